@@ -0,0 +1,92 @@
+// Random numbers and latency histograms for disk_rand and fs_bench
+// (see bench.h).
+
+#include <math.h>
+
+#include "bench.h"
+
+// ---------------------------------------------------------------------
+// random numbers
+
+uint64_t rng_next(uint64_t *st) {
+    uint64_t x = *st;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *st = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+double rng_unit(uint64_t *st) {
+    return (double)(rng_next(st) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+uint64_t rng_below(uint64_t *st, uint64_t n) {
+    return rng_next(st) % n;
+}
+
+// ---------------------------------------------------------------------
+// histograms
+
+static int hist_bucket(uint64_t v) {
+    if (v < SUB_COUNT) {
+        return (int)v;
+    }
+    int msb = 63 - __builtin_clzll(v);          // >= SUB_BITS
+    int shift = msb - SUB_BITS;
+    int sub = (int)((v >> shift) & (SUB_COUNT - 1));
+    return (shift + 1) * SUB_COUNT + sub;
+}
+
+// smallest value that falls in bucket b
+static uint64_t hist_bucket_low(int b) {
+    if (b < SUB_COUNT) {
+        return (uint64_t)b;
+    }
+    int shift = b / SUB_COUNT - 1;
+    uint64_t sub = (uint64_t)(b % SUB_COUNT);
+    return (SUB_COUNT + sub) << shift;
+}
+
+void hist_record(hist_t *h, uint64_t ns) {
+    h->counts[hist_bucket(ns)]++;
+    h->total++;
+    h->sum_ns += (double)ns;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->errors += src->errors;
+    dst->bytes += src->bytes;
+    dst->sum_ns += src->sum_ns;
+    if (src->max_ns > dst->max_ns) {
+        dst->max_ns = src->max_ns;
+    }
+}
+
+uint64_t hist_quantile(const hist_t *h, double q) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)ceil(q * (double)h->total);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank) {
+            uint64_t lo = hist_bucket_low(b);
+            uint64_t hi = b + 1 < HIST_BUCKETS ? hist_bucket_low(b + 1) : lo;
+            uint64_t mid = lo + (hi - lo) / 2;
+            return mid < h->max_ns ? mid : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
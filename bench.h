@@ -0,0 +1,41 @@
+// Random numbers and latency histograms shared by the benchmark clients
+// disk_rand and fs_bench.
+//
+// rng_*: xorshift64*, one state per thread (rand() is neither
+// thread-safe nor fast).  A state must not be 0.
+//
+// hist_*: log-linear histograms of nanosecond latencies, like
+// HdrHistogram.  Values below 2^SUB_BITS are exact; above that, each
+// power of two is split into 2^SUB_BITS equal buckets, which keeps the
+// relative error under 1/32.  Each thread records into its own
+// histograms and they are merged at the end, so recording costs no
+// locks.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+#define SUB_BITS 5
+#define SUB_COUNT (1 << SUB_BITS)
+#define HIST_BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t errors;      // kept by the caller; summed by hist_merge
+    uint64_t bytes;       // payload moved, kept by the caller; summed by hist_merge
+    double   sum_ns;
+    uint64_t max_ns;
+} hist_t;
+
+uint64_t rng_next(uint64_t *st);
+double   rng_unit(uint64_t *st);                   // uniform in [0, 1)
+uint64_t rng_below(uint64_t *st, uint64_t n);      // uniform in [0, n), n > 0
+
+void     hist_record(hist_t *h, uint64_t ns);
+void     hist_merge(hist_t *dst, const hist_t *src);
+// value at quantile q (0..1), reported as the middle of its bucket
+uint64_t hist_quantile(const hist_t *h, double q);
+
+#endif
@@ -1,225 +1,510 @@
 // Problem 3: Random workload generator for the disk server.
 //
 // This client connects to disk_server, queries the disk size using
-// the "I" command, and then issues N random operations.  Each operation
-// is randomly chosen to be either a read (R) or a write (W).  Cylinder
-// and sector numbers are picked uniformly from the valid ranges.
-// All writes send 128 bytes of random data.
+// the "I" command, and then issues a stream of reads (R) and writes
+// (W).  All writes send 128 bytes of random data.
 //
-// The client prints a single character per request (e.g., 'r' for read,
-// 'w' for write) so you can see progress but not be overwhelmed by data.
+// Usage:
+//
+//   ./disk_rand [options] <host> <port> <N> <seed>
+//
+// With no options it behaves like the original tool: one connection,
+// N requests, half reads and half writes, sectors picked uniformly.
+// The options turn it into a small benchmark:
+//
+//   -t threads    number of client threads, one connection each (default 1)
+//   -r ops/s      paced ("open loop"): requests fall due at this total rate,
+//                 split over the threads, and latency is measured from the
+//                 due time; 0 (the default) is closed loop, each thread
+//                 sends as soon as it has a reply. Each thread still waits
+//                 for one reply before its next request, so a reply that
+//                 comes late delays the requests behind it; they go out at
+//                 once, and the wait counts in their latency. Use -t for
+//                 more requests in flight
+//   -w percent    share of writes, 0..100 (default 50)
+//   -p pattern    seq        each thread walks the disk sector by sector
+//                 uniform    every sector equally likely (default)
+//                 zipf[:s]   sector i has weight 1/(i+1)^s (default s=0.99)
+//                 hot[:c,o]  o% of requests go to a band of c% of the
+//                            cylinders in the middle of the disk (default 10,90)
+//   -W seconds    warmup: requests in the first seconds are not recorded
+//   -d seconds    run for this long (after warmup) instead of N requests;
+//                 N may then be 0
+//   -o format     report as text (default), csv or json
+//   -v            print one character per request ('r' / 'w'), as before
+//
+// The report has one row per op type (read, write, all) with the count,
+// errors, throughput and the mean, p50, p90, p99, p999 and max latency
+// in microseconds, from per-thread log-linear histograms (bench.h).
 
-#include <arpa/inet.h>
+#define _GNU_SOURCE
 #include <errno.h>
-#include <netinet/in.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
 
-#define BLKSZ   128
-#define MAXLINE 256
-
-// write exactly n bytes from buf to fd, handling partial writes and EINTR
-static ssize_t write_all(int fd, const void *buf, size_t n) {
-    size_t off = 0;
-    while (off < n) {
-        ssize_t w = send(fd, (const char *)buf + off, n - off, 0);
-        if (w < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            return -1;
-        }
-        off += (size_t)w;
+#include "bench.h"
+#include "libdisk.h"
+
+#define BLKSZ   DC_BLKSZ
+
+enum { OP_READ = 0, OP_WRITE = 1, OP_ALL = 2 };
+enum { PAT_SEQ, PAT_UNIFORM, PAT_ZIPF, PAT_HOT };
+
+// settings shared by all threads (read-only once the threads start)
+typedef struct {
+    const char *host;
+    int port;
+    long cyl, sec;
+    int threads;
+    double rate;          // total ops/s, 0 = closed loop
+    int write_pct;
+    int pattern;
+    double zipf_s;
+    int hot_cyl_pct, hot_op_pct;
+    double warmup_s, duration_s;
+    long nreq;            // total requests when duration_s == 0
+    unsigned int seed;
+    bool verbose;
+    double *zipf_cdf;     // cumulative weights for PAT_ZIPF, one per sector
+} config_t;
+
+typedef struct {
+    const config_t *cfg;
+    int id;
+    long nreq;            // this thread's share of nreq
+    struct timespec start;
+    hist_t hist[2];       // OP_READ, OP_WRITE
+    int failed;           // connection-level failure
+} worker_t;
+
+// ---------------------------------------------------------------------
+// access patterns
+
+// zipf: cumulative weights over all sectors, searched with bisection
+static double *zipf_build(long n, double s) {
+    double *cdf = malloc((size_t)n * sizeof(double));
+    if (!cdf) {
+        return NULL;
     }
-    return (ssize_t)off;
+    double acc = 0.0;
+    for (long i = 0; i < n; i++) {
+        acc += 1.0 / pow((double)(i + 1), s);
+        cdf[i] = acc;
+    }
+    for (long i = 0; i < n; i++) {
+        cdf[i] /= acc;
+    }
+    return cdf;
 }
 
-// read exactly n bytes from fd into buf, handling EINTR and partial reads
-// returns n on success, 0 on clean EOF, or -1 on error
-static ssize_t read_exact(int fd, void *buf, size_t n) {
-    size_t off = 0;
-    while (off < n) {
-        ssize_t r = recv(fd, (char *)buf + off, n - off, 0);
-        if (r == 0) {
-            return 0;
-        }
-        if (r < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            return -1;
+static long zipf_pick(const double *cdf, long n, double u) {
+    long lo = 0, hi = n - 1;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        off += (size_t)r;
     }
-    return (ssize_t)off;
+    return lo;
 }
 
-// read a '\n'-terminated line from fd into out (up to max bytes)
-// returns bytes stored (excluding NUL) on success, 0 on EOF, or -1 on error
-static ssize_t readline(int fd, char *out, size_t max) {
-    size_t off = 0;
-    while (off + 1 < max) {
-        char c;
-        ssize_t r = recv(fd, &c, 1, 0);
-        if (r == 0) {
-            break;
-        }
-        if (r < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            return -1;
+// pick the next (cylinder, sector) for a thread
+static void next_target(const config_t *cfg, uint64_t *rng, long *seq_pos, long *c, long *s) {
+    long nsec = cfg->cyl * cfg->sec;
+    long idx = 0;
+
+    switch (cfg->pattern) {
+    case PAT_SEQ:
+        idx = *seq_pos;
+        *seq_pos = (*seq_pos + 1) % nsec;
+        break;
+    case PAT_ZIPF:
+        idx = zipf_pick(cfg->zipf_cdf, nsec, rng_unit(rng));
+        break;
+    case PAT_HOT: {
+        long band = cfg->cyl * cfg->hot_cyl_pct / 100;
+        if (band < 1) {
+            band = 1;
         }
-        out[off++] = c;
-        if (c == '\n') {
-            break;
+        long first = (cfg->cyl - band) / 2;
+        long cy;
+        if ((int)rng_below(rng, 100) < cfg->hot_op_pct) {
+            cy = first + (long)rng_below(rng, (uint64_t)band);
+        } else {
+            cy = (long)rng_below(rng, (uint64_t)cfg->cyl);
         }
+        *c = cy;
+        *s = (long)rng_below(rng, (uint64_t)cfg->sec);
+        return;
     }
-    out[off] = '\0';
-    return (ssize_t)off;
-}
-
-int main(int argc, char **argv) {
-    // usage: ./disk_rand <host> <port> <N> <seed>
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <host> <port> <N> <seed>\n", argv[0]);
-        return 1;
+    default:
+        idx = (long)rng_below(rng, (uint64_t)nsec);
+        break;
     }
+    *c = idx / cfg->sec;
+    *s = idx % cfg->sec;
+}
 
-    const char *host = argv[1];
-    int port = atoi(argv[2]);
-    long N = strtol(argv[3], NULL, 10);
-    unsigned int seed = (unsigned int)strtoul(argv[4], NULL, 10);
+// ---------------------------------------------------------------------
+// time helpers
 
-    if (port <= 0 || N <= 0) {
-        fprintf(stderr, "Invalid port or N\n");
-        return 1;
-    }
+static double ts_diff(const struct timespec *a, const struct timespec *b) {
+    return (double)(b->tv_sec - a->tv_sec) + (double)(b->tv_nsec - a->tv_nsec) / 1e9;
+}
 
-    srand(seed);
+static uint64_t ts_ns(const struct timespec *t) {
+    return (uint64_t)t->tv_sec * 1000000000ULL + (uint64_t)t->tv_nsec;
+}
 
-    // create TCP socket
-    int s = socket(AF_INET, SOCK_STREAM, 0);
-    if (s < 0) {
-        perror("socket");
-        return 1;
-    }
+static void ns_ts(uint64_t ns, struct timespec *t) {
+    t->tv_sec = (time_t)(ns / 1000000000ULL);
+    t->tv_nsec = (long)(ns % 1000000000ULL);
+}
 
-    struct sockaddr_in sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sin_family = AF_INET;
-    sa.sin_port   = htons((uint16_t)port);
+// ---------------------------------------------------------------------
+// one request on the ASCII protocol; returns 1 on success, 0 if the
+// disk rejected it, -1 if the connection failed
 
-    if (inet_pton(AF_INET, host, &sa.sin_addr) <= 0) {
-        perror("inet_pton");
-        close(s);
-        return 1;
+static int do_read(dc_conn_t *d, long c, long sc, unsigned char *buf) {
+    int rc = dc_read(d, c, sc, buf);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to read R reply\n");
     }
+    return rc;
+}
 
-    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
-        perror("connect");
-        close(s);
-        return 1;
+static int do_write(dc_conn_t *d, long c, long sc, const unsigned char *buf) {
+    // "W c s 128\n" and the data go out in one send
+    int rc = dc_write(d, c, sc, BLKSZ, buf);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to read W reply\n");
     }
+    return rc;
+}
 
-    // first query the disk geometry via the "I" command
-    const char *Iq = "I\n";
-    if (write_all(s, Iq, strlen(Iq)) < 0) {
-        perror("send(I)");
-        close(s);
-        return 1;
-    }
+// ---------------------------------------------------------------------
+// worker thread: one connection, its own RNG, its own histograms
 
-    char line[MAXLINE];
-    if (readline(s, line, sizeof(line)) <= 0) {
-        fprintf(stderr, "Failed to read geometry\n");
-        close(s);
-        return 1;
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    const config_t *cfg = w->cfg;
+
+    dc_conn_t *d = malloc(sizeof(*d));
+    if (d == NULL || dc_open(d, cfg->host, cfg->port, 0) < 0) {
+        free(d);
+        w->failed = 1;
+        return NULL;
     }
 
-    long cyl = 0, sec = 0;
-    if (sscanf(line, "%ld %ld", &cyl, &sec) != 2 || cyl <= 0 || sec <= 0) {
-        fprintf(stderr, "Bad geometry: %s\n", line);
-        close(s);
-        return 1;
+    uint64_t rng = ((uint64_t)cfg->seed << 16) ^ (0x9E3779B97F4A7C15ULL * (uint64_t)(w->id + 1));
+    if (rng == 0) {
+        rng = 1;
     }
+    long nsec = cfg->cyl * cfg->sec;
+    long seq_pos = nsec / cfg->threads * w->id;
 
-    fprintf(stderr, "[disk_rand] geometry: %ld cylinders x %ld sectors\n", cyl, sec);
+    // paced: this thread's requests are due every interval_ns; one that
+    // falls due while the previous reply is outstanding is sent as soon
+    // as that reply arrives
+    double thread_rate = cfg->rate / cfg->threads;
+    uint64_t interval_ns = thread_rate > 0 ? (uint64_t)(1e9 / thread_rate) : 0;
+    uint64_t t0 = ts_ns(&w->start);
+    uint64_t warm_end = t0 + (uint64_t)(cfg->warmup_s * 1e9);
+    uint64_t stop = cfg->duration_s > 0 ? warm_end + (uint64_t)(cfg->duration_s * 1e9) : UINT64_MAX;
+    uint64_t due = t0;
 
     unsigned char buf[BLKSZ];
+    for (long i = 0; cfg->duration_s > 0 || i < w->nreq; i++) {
+        struct timespec now;
+        if (interval_ns > 0) {
+            struct timespec at;
+            ns_ts(due, &at);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR) {
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t begin = ts_ns(&now);
+        if (begin >= stop) {
+            break;
+        }
+        // latency counts from when the request was due, so a stalled
+        // server cannot hide the queueing it causes
+        uint64_t from = interval_ns > 0 ? due : begin;
+        due += interval_ns;
 
-    // generate N random requests
-    for (long i = 0; i < N; i++) {
-        long c = rand() % cyl;
-        long sc = rand() % sec;
-        int is_write = rand() & 1;
+        long c = 0, sc = 0;
+        next_target(cfg, &rng, &seq_pos, &c, &sc);
+        int op = (int)rng_below(&rng, 100) < cfg->write_pct ? OP_WRITE : OP_READ;
 
-        if (is_write) {
+        int rc;
+        if (op == OP_WRITE) {
             // prepare random data
-            for (int j = 0; j < BLKSZ; j++) {
-                buf[j] = (unsigned char)(rand() & 0xff);
+            for (int j = 0; j < BLKSZ; j += 8) {
+                uint64_t r = rng_next(&rng);
+                memcpy(buf + j, &r, 8);
             }
+            rc = do_write(d, c, sc, buf);
+        } else {
+            rc = do_read(d, c, sc, buf);
+        }
+        if (rc < 0) {
+            w->failed = 1;
+            break;
+        }
 
-            // build and send "W c s 128\n"
-            char hdr[64];
-            int n = snprintf(hdr, sizeof(hdr), "W %ld %ld 128\n", c, sc);
-            if (n < 0 || write_all(s, hdr, (size_t)n) < 0) {
-                perror("send(W hdr)");
-                break;
-            }
-            if (write_all(s, buf, BLKSZ) < 0) {
-                perror("send(W data)");
-                break;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (from >= warm_end) {
+            hist_record(&w->hist[op], ts_ns(&now) - from);
+            if (rc == 0) {
+                w->hist[op].errors++;
             }
+        }
 
-            char code;
-            if (read_exact(s, &code, 1) != 1) {
-                fprintf(stderr, "Failed to read W reply\n");
-                break;
+        if (cfg->verbose) {
+            // show progress: 'r' for reads, 'w' for writes, a newline
+            // every 64 requests; stdout is line buffered, so no fflush
+            putchar(op == OP_WRITE ? 'w' : 'r');
+            if ((i + 1) % 64 == 0) {
+                putchar('\n');
             }
+        }
+    }
+
+    dc_close(d);
+    free(d);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------
+// report
+
+static void report(const char *fmt, hist_t *h, double secs) {
+    static const char *names[3] = { "read", "write", "all" };
+    bool json = strcmp(fmt, "json") == 0;
+    bool csv = strcmp(fmt, "csv") == 0;
+
+    if (csv) {
+        printf("op,count,errors,ops_per_sec,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    } else if (json) {
+        printf("{\"seconds\": %.3f, \"ops\": [", secs);
+    } else {
+        printf("%-6s %10s %8s %12s %10s %10s %10s %10s %10s %10s\n", "op", "count", "errors", "ops/s",
+               "mean_us", "p50_us", "p90_us", "p99_us", "p999_us", "max_us");
+    }
 
-            // show progress: write 'w' for writes
-            putchar('w');
+    for (int op = 0; op < 3; op++) {
+        const hist_t *x = &h[op];
+        double mean = x->total ? x->sum_ns / (double)x->total / 1e3 : 0.0;
+        double tput = secs > 0 ? (double)x->total / secs : 0.0;
+        double p50 = hist_quantile(x, 0.50) / 1e3, p90 = hist_quantile(x, 0.90) / 1e3;
+        double p99 = hist_quantile(x, 0.99) / 1e3, p999 = hist_quantile(x, 0.999) / 1e3;
+        double mx = x->max_ns / 1e3;
+        if (csv) {
+            printf("%s,%llu,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", names[op], (unsigned long long)x->total,
+                   (unsigned long long)x->errors, tput, mean, p50, p90, p99, p999, mx);
+        } else if (json) {
+            printf("%s{\"op\": \"%s\", \"count\": %llu, \"errors\": %llu, \"ops_per_sec\": %.1f, "
+                   "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+                   "\"p999_us\": %.1f, \"max_us\": %.1f}",
+                   op ? ", " : "", names[op], (unsigned long long)x->total, (unsigned long long)x->errors, tput,
+                   mean, p50, p90, p99, p999, mx);
         } else {
-            // build and send "R c s\n"
-            char hdr[64];
-            int n = snprintf(hdr, sizeof(hdr), "R %ld %ld\n", c, sc);
-            if (n < 0 || write_all(s, hdr, (size_t)n) < 0) {
-                perror("send(R)");
-                break;
-            }
+            printf("%-6s %10llu %8llu %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[op],
+                   (unsigned long long)x->total, (unsigned long long)x->errors, tput, mean, p50, p90, p99, p999, mx);
+        }
+    }
+    if (json) {
+        printf("]}\n");
+    }
+}
 
-            char code;
-            if (read_exact(s, &code, 1) != 1) {
-                fprintf(stderr, "Failed to read R reply\n");
-                break;
-            }
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-r ops_per_sec] [-w write_pct] [-p seq|uniform|zipf[:s]|hot[:cyl_pct,op_pct]]\n"
+            "       [-W warmup_s] [-d duration_s] [-o text|csv|json] [-v] <host> <port> <N> <seed>\n",
+            prog);
+}
 
-            if (code == '1') {
-                // read and discard the 128-byte block
-                if (read_exact(s, buf, BLKSZ) != BLKSZ) {
-                    fprintf(stderr, "Failed to read R data\n");
-                    break;
+int main(int argc, char **argv) {
+    config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.threads = 1;
+    cfg.write_pct = 50;
+    cfg.pattern = PAT_UNIFORM;
+    cfg.zipf_s = 0.99;
+    cfg.hot_cyl_pct = 10;
+    cfg.hot_op_pct = 90;
+    const char *fmt = "text";
+    bool legacy = true;   // no options: keep the old progress output
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:r:w:p:W:d:o:v")) != -1) {
+        if (opt != 'v') {
+            legacy = false;
+        }
+        switch (opt) {
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'r':
+            cfg.rate = atof(optarg);
+            break;
+        case 'w':
+            cfg.write_pct = atoi(optarg);
+            break;
+        case 'p':
+            if (strcmp(optarg, "seq") == 0) {
+                cfg.pattern = PAT_SEQ;
+            } else if (strcmp(optarg, "uniform") == 0) {
+                cfg.pattern = PAT_UNIFORM;
+            } else if (strncmp(optarg, "zipf", 4) == 0) {
+                cfg.pattern = PAT_ZIPF;
+                if (optarg[4] == ':') {
+                    cfg.zipf_s = atof(optarg + 5);
+                }
+            } else if (strncmp(optarg, "hot", 3) == 0) {
+                cfg.pattern = PAT_HOT;
+                if (optarg[3] == ':' &&
+                    sscanf(optarg + 4, "%d,%d", &cfg.hot_cyl_pct, &cfg.hot_op_pct) != 2) {
+                    usage(argv[0]);
+                    return 1;
                 }
+            } else {
+                usage(argv[0]);
+                return 1;
             }
+            break;
+        case 'W':
+            cfg.warmup_s = atof(optarg);
+            break;
+        case 'd':
+            cfg.duration_s = atof(optarg);
+            break;
+        case 'o':
+            fmt = optarg;
+            break;
+        case 'v':
+            cfg.verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (legacy) {
+        cfg.verbose = true;
+    }
+
+    if (argc - optind != 4) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    cfg.host = argv[optind];
+    cfg.port = atoi(argv[optind + 1]);
+    cfg.nreq = strtol(argv[optind + 2], NULL, 10);
+    cfg.seed = (unsigned int)strtoul(argv[optind + 3], NULL, 10);
+
+    if (cfg.port <= 0 || cfg.nreq < 0 || (cfg.nreq == 0 && cfg.duration_s <= 0)) {
+        fprintf(stderr, "Invalid port or N\n");
+        return 1;
+    }
+    if (cfg.threads < 1 || cfg.rate < 0 || cfg.write_pct < 0 || cfg.write_pct > 100 || cfg.warmup_s < 0 ||
+        cfg.duration_s < 0 || cfg.zipf_s <= 0 || cfg.hot_cyl_pct < 1 || cfg.hot_cyl_pct > 100 ||
+        cfg.hot_op_pct < 0 || cfg.hot_op_pct > 100 ||
+        (strcmp(fmt, "text") != 0 && strcmp(fmt, "csv") != 0 && strcmp(fmt, "json") != 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // first query the disk geometry via the "I" command
+    dc_conn_t *d = malloc(sizeof(*d));
+    if (d == NULL || dc_open(d, cfg.host, cfg.port, 0) < 0) {
+        return 1;
+    }
+    cfg.cyl = d->cyl;
+    cfg.sec = d->sec;
+    dc_close(d);
+    free(d);
+
+    if (cfg.cyl <= 0 || cfg.sec <= 0) {
+        fprintf(stderr, "Bad geometry: %ld %ld\n", cfg.cyl, cfg.sec);
+        return 1;
+    }
 
-            // show progress: 'r' for reads
-            putchar('r');
+    fprintf(stderr, "[disk_rand] geometry: %ld cylinders x %ld sectors\n", cfg.cyl, cfg.sec);
+
+    if (cfg.pattern == PAT_ZIPF) {
+        cfg.zipf_cdf = zipf_build(cfg.cyl * cfg.sec, cfg.zipf_s);
+        if (!cfg.zipf_cdf) {
+            perror("malloc");
+            return 1;
+        }
+    }
+
+    worker_t *ws = calloc((size_t)cfg.threads, sizeof(worker_t));
+    pthread_t *tids = calloc((size_t)cfg.threads, sizeof(pthread_t));
+    if (!ws || !tids) {
+        perror("calloc");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < cfg.threads; i++) {
+        ws[i].cfg = &cfg;
+        ws[i].id = i;
+        ws[i].nreq = cfg.nreq / cfg.threads + (i < cfg.nreq % cfg.threads ? 1 : 0);
+        ws[i].start = start;
+        if (pthread_create(&tids[i], NULL, worker_main, &ws[i]) != 0) {
+            perror("pthread_create");
+            return 1;
         }
+    }
 
-        // newline every 64 operations to keep the terminal tidy
-        if ((i + 1) % 64 == 0) {
+    hist_t *total = calloc(3, sizeof(hist_t));
+    if (!total) {
+        perror("calloc");
+        return 1;
+    }
+    int failed = 0;
+    for (int i = 0; i < cfg.threads; i++) {
+        pthread_join(tids[i], NULL);
+        hist_merge(&total[OP_READ], &ws[i].hist[OP_READ]);
+        hist_merge(&total[OP_WRITE], &ws[i].hist[OP_WRITE]);
+        failed |= ws[i].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    hist_merge(&total[OP_ALL], &total[OP_READ]);
+    hist_merge(&total[OP_ALL], &total[OP_WRITE]);
+
+    if (legacy) {
+        // the old tool printed only progress characters
+        putchar('\n');
+    } else {
+        // throughput over the measured part of the run
+        double secs = ts_diff(&start, &end) - cfg.warmup_s;
+        if (secs <= 0) {
+            secs = ts_diff(&start, &end);
+        }
+        if (cfg.verbose) {
             putchar('\n');
         }
-        fflush(stdout);
+        report(fmt, total, secs);
     }
 
-    putchar('\n');
-    close(s);
-    return 0;
+    free(total);
+    free(ws);
+    free(tids);
+    free(cfg.zipf_cdf);
+    return failed ? 1 : 0;
 }
-
@@ -3,7 +3,7 @@
 // This program implements a TCP server that behaves like a very simple
 // block device.  The "disk" is organized by cylinder and sector, with
 // a fixed block size of 128 bytes.  All disk data is stored in a real
-// backing file using mmap(2), so the contents persist across runs.
+// backing file, so the contents persist across runs.
 //
 // Protocol (all numbers are ASCII decimal separated by spaces):
 //
@@ -21,35 +21,153 @@
 //        the remaining bytes with zeros.
 //        otherwise: disk replies with '0'
 //
+//   RV n c1 s1 c2 s2 ... cn sn
+//     -> vectored read of n sectors (1 <= n <= MAX_VEC).  If every
+//        (c,s) pair is valid: disk replies with '1' followed by n*128
+//        bytes, the sectors in the order they were named.
+//        otherwise: disk replies with '0'
+//
+//   WV n c1 s1 c2 s2 ... cn sn <n*128 raw bytes>
+//     -> vectored write of n full sectors.  The payload is always
+//        consumed so the stream stays in sync; the disk replies '1'
+//        if every pair was valid and all sectors were written,
+//        otherwise '0' (and nothing is written).
+//
+// A vectored request queues all of its sectors under a single
+// acquisition of each arm mutex it needs and answers with a single
+// reply, so clients can fetch a whole FAT chain in one round trip.
+//
+//   S
+//     -> disk replies with its runtime statistics, one "name value"
+//        pair per line, followed by an empty line: uptime, per-command
+//        counts, bytes read and written, seek distance and simulated
+//        seek time, storage backend, sync policy and sync count,
+//        scheduler queue depth, time spent waiting for vs.
+//        holding the arm mutexes, each arm's zone, head position,
+//        sectors, seek distance and queue depth, open connections,
+//        and the count, mean
+//        and p50/p90/p99/p999 latency of reads (R, RV) and writes
+//        (W, WV) in microseconds
+//
+//   B
+//     -> disk replies with '1' and the connection switches to the
+//        binary framed protocol for the rest of its lifetime.
+//
+// Binary protocol (all integers little-endian):
+//
+//   request:  op[1] flags[1] count[2] id[4] cyl[4] sec[4] len[4]
+//             followed by len payload bytes
+//   reply:    op[1] status[1] count[2] id[4] len[4]
+//             followed by len payload bytes
+//
+//   op 1 (I)   no payload; reply payload is cyl[4] sec[4]
+//   op 2 (R)   reads (cyl,sec); reply payload is 128 bytes
+//   op 3 (W)   payload is up to 128 bytes for (cyl,sec), zero-filled
+//   op 4 (RV)  payload is count (cyl[4],sec[4]) pairs; reply payload
+//              is count*128 bytes
+//   op 5 (WV)  payload is count pairs followed by count*128 bytes
+//   op 6 (S)   no payload; reply payload is the "S" text below
+//
+// The reply echoes op and id so a client can pipeline requests.
+// status is 1 on success and 0 on an invalid sector, just like the
+// '1'/'0' codes of the ASCII protocol.  A malformed frame closes the
+// connection.
+//
 // The server simulates track-to-track seek time using nanosleep().
 // The number of cylinders, sectors, track time (microseconds) and
 // the backing file name are all command-line arguments.
 //
-// One thread is created per client connection.  All threads share a
-// single "disk arm" position protected by a mutex so that seeks are
-// serialized across clients.
+// By default one thread is created per client connection.  With
+// -e <workers> a single epoll event loop serves every connection over
+// non-blocking sockets and hands complete commands to a fixed pool of
+// worker threads instead.  Either way, connection handlers never move
+// the disk arm themselves: each sector transfer is queued for the
+// scheduler thread that owns the arm, which picks the next transfer
+// according to the policy chosen with -p:
+//
+//   fcfs   arrival order (default)
+//   sstf   shortest seek from the current head position
+//   scan   elevator that sweeps to the edge of the disk before turning
+//   look   elevator that turns at the last pending request
+//   clook  one-way elevator that jumps back to the lowest request
+//
+// With -k <arms> the disk has that many independent arms (up to
+// ARMS_MAX).  The cylinders are split into equal contiguous zones, one
+// per arm, and each arm has its own head position, queue, mutex and
+// scheduler thread, so transfers in different zones seek and complete
+// in parallel (like several spindles, or the channels of an SSD).
+// Each arm applies the -p policy within its zone; SCAN sweeps to the
+// zone's edges.  A vectored command may span zones: every arm involved
+// gets its share, and the command completes when all of them have.
+//
+// On SIGINT/SIGTERM the server prints total seek distance and the
+// mean/p50/p99 latency of commands as seen by the scheduler.
+//
+// The scheduler moves sectors to and from the backing file through a
+// storage backend chosen with -b:
+//
+//   mmap    map the file MAP_SHARED and memcpy (default); ",populate"
+//           prefaults the whole image at startup so no page fault
+//           stalls the scheduler later, ",huge" asks for huge pages
+//   pio     pread(2)/pwrite(2) of each sector
+//   direct  pread/pwrite with O_DIRECT: sectors are moved through an
+//           aligned bounce buffer of DIO_ALIGN bytes (read-modify-write
+//           for writes), bypassing the page cache
+//   uring   io_uring: transfers on the same cylinder are queued and
+//           submitted together, and complete while the arm seeks on
+//
+// and -s picks when written data is forced to stable storage (msync
+// for mmap, fdatasync otherwise): "never" leaves it to the kernel
+// (default), "always" syncs before acknowledging each W or WV, and a
+// number of milliseconds syncs that often from a background thread.
+// The data is always synced once more on shutdown.
+//
+// With -m <port> the statistics of the "S" command are also served
+// over HTTP at /metrics in the Prometheus text format, with the read
+// and write latencies as histograms (buckets from 1us to ~16.8 s).
 
 #define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
 #define BLKSZ      128        // bytes per sector
-#define MAX_LINE   1024       // max command line length from client
+#define MAX_LINE   4096       // max command line length from client
+#define MAX_VEC    64         // max sectors in one RV/WV request
 #define BACKLOG    16         // listen() backlog
 
+// binary protocol framing (see the protocol description above)
+#define BIN_REQ_HDR 20        // request header bytes
+#define BIN_RSP_HDR 12        // reply header bytes
+#define BIN_OP_I    1
+#define BIN_OP_R    2
+#define BIN_OP_W    3
+#define BIN_OP_RV   4
+#define BIN_OP_WV   5
+#define BIN_OP_S    6
+
+#define STATS_BUFSZ 4096      // "S" reply; fits in one binary reply frame
+#define PROM_BUFSZ  16384     // /metrics body
+
 // -------- global state describing the simulated disk --------
 
 // disk geometry (set from command line)
@@ -57,13 +175,78 @@ static long g_cyl       = 0;   // number of cylinders
 static long g_sec       = 0;   // number of sectors per cylinder
 static long g_track_us  = 0;   // track-to-track seek time in microseconds
 
-// backing file and mmap'ed region
-static int   g_fd       = -1;  // backing file descriptor
-static unsigned char *g_base = NULL; // base of mmap()'d disk image
+// ------------- request scheduler state -------------
+
+// arm scheduling policies selectable with -p
+typedef enum {
+    POL_FCFS,                  // arrival order
+    POL_SSTF,                  // shortest seek time first
+    POL_SCAN,                  // elevator, sweeping to the disk edge
+    POL_LOOK,                  // elevator, reversing at the last request
+    POL_CLOOK                  // one-way elevator, jumping back to the lowest
+} sched_policy_t;
+
+static const char *const g_policy_names[] = {
+    "fcfs", "sstf", "scan", "look", "clook"
+};
+
+// a group of sector transfers submitted together by one command
+typedef struct {
+    long left;                 // transfers not yet serviced
+    struct timespec t_submit;  // when the command was queued
+    pthread_cond_t done;       // signalled when left reaches 0
+    int failed;                // set if the backing store failed a transfer
+} io_batch_t;
+
+// one pending sector transfer waiting for the disk arm
+typedef struct io_req {
+    long c, s;
+    int  is_write;
+    unsigned char *buf;        // destination (read) or source (write)
+    int  err;                  // set by the backend if the transfer failed
+    io_batch_t *batch;
+    struct io_req *next;
+} io_req_t;
+
+// latency histogram: 16 linear sub-buckets per power of two (in us)
+#define HIST_SUB     16
+#define HIST_BUCKETS (HIST_SUB * 40)
+
+typedef struct {
+    unsigned long count;
+    unsigned long long sum_us;
+    unsigned long b[HIST_BUCKETS];
+} hist_t;
+
+// one simulated disk arm.  It owns the cylinders lo .. hi-1 (its zone)
+// and never leaves them; with -k the disk is split into that many equal
+// zones, each served by its own arm and scheduler thread, so transfers
+// in different zones seek and run in parallel.  The pending queue
+// (arrival order) and the statistics are protected by the arm's mtx.
+#define ARMS_MAX 16
 
-// simulated disk arm position and mutex to protect it
-static long g_head_cyl = 0;    // current cylinder
-static pthread_mutex_t g_arm_mtx = PTHREAD_MUTEX_INITIALIZER;
+typedef struct {
+    int  id;
+    long lo, hi;                        // zone: cylinders [lo, hi)
+    pthread_mutex_t mtx;
+    pthread_cond_t  cv;                 // signalled when work is queued
+    io_req_t *q_head, *q_tail;
+    long head_cyl;                      // only the arm's scheduler moves it
+    int  scan_dir;                      // +1 toward higher cylinders
+    unsigned long long seek_tracks;
+    unsigned long sectors_done;
+    hist_t lat;                         // per-command service latency
+
+    // mutex accounting, updated by whichever thread holds mtx
+    unsigned long long wait_ns;         // blocked in arm_lock()
+    unsigned long long hold_ns;         // between lock and unlock
+    unsigned long long acquires;
+    struct timespec locked_at;          // when the holder got it
+} arm_t;
+
+static arm_t g_arms[ARMS_MAX];
+static int g_narms = 1;                 // -k
+static sched_policy_t g_policy = POL_FCFS;
 
 // flag used to request termination from SIGINT
 static volatile sig_atomic_t g_stop = 0;
@@ -73,71 +256,188 @@ typedef struct {
     int client_fd;
 } client_arg_t;
 
+// per-connection state: the socket, which protocol it speaks, and a
+// receive buffer so command lines are not read one recv() per byte.
+// IN_BUFSZ holds the largest complete command (a full WV line plus its
+// payload), which the event loop relies on.
+//
+// Replies are collected in out[] (read sectors are transferred straight
+// into it) and sent in one go when the client has no further command
+// buffered, so a pipelining client gets its replies coalesced; past
+// OUT_FLUSH bytes they are sent anyway.
+#define IN_BUFSZ  16384
+#define OUT_FLUSH 16384
+typedef struct conn {
+    int    fd;
+    int    binary;            // set once the client negotiated with "B"
+    size_t in_pos;            // next unread byte in in[]
+    size_t in_len;            // number of valid bytes in in[]
+    unsigned char in[IN_BUFSZ];
+
+    unsigned char *out;
+    size_t out_len, out_cap, out_sent;
+
+    // event-loop mode only (-e): out[] is flushed by the loop, which
+    // owns the non-blocking socket
+    int    evented;
+    int    peer_eof;          // client closed its side; drain, then close
+    int    closing;           // close once out[] is flushed
+    struct conn *next;        // worker / completion queue link
+} conn_t;
+
 // ------------- helper functions for I/O on sockets -------------
 
-// read exactly n bytes from fd into buf, unless EOF or error
-// returns n on success, 0 on clean EOF, or -1 on error
-static ssize_t read_exact(int fd, void *buf, size_t n) {
+// write exactly n bytes from buf to fd
+// returns n on success, or -1 on error
+static ssize_t write_all(int fd, const void *buf, size_t n) {
     size_t off = 0;
     while (off < n) {
-        ssize_t r = recv(fd, (char *)buf + off, n - off, 0);
-        if (r == 0) {
-            // peer closed connection.
-            return 0;
-        }
-        if (r < 0) {
+        ssize_t w = send(fd, (const char *)buf + off, n - off, 0);
+        if (w < 0) {
             if (errno == EINTR) {
                 continue; // interrupted by signal, retry
             }
-            return -1;    // real error
+            return -1;
         }
-        off += (size_t)r;
+        off += (size_t)w;
     }
     return (ssize_t)off;
 }
 
-// write exactly n bytes from buf to fd
-// returns n on success, or -1 on error
-static ssize_t write_all(int fd, const void *buf, size_t n) {
+// append n bytes to the connection's output buffer without filling
+// them in; returns where they go (valid until the next append), or
+// NULL if out of memory
+static unsigned char *conn_reserve(conn_t *cn, size_t n) {
+    if (cn->out_len + n > cn->out_cap) {
+        size_t cap = cn->out_cap ? cn->out_cap : 1024;
+        while (cap < cn->out_len + n) {
+            cap *= 2;
+        }
+        unsigned char *p = realloc(cn->out, cap);
+        if (!p) {
+            return NULL;
+        }
+        cn->out = p;
+        cn->out_cap = cap;
+    }
+    unsigned char *p = cn->out + cn->out_len;
+    cn->out_len += n;
+    return p;
+}
+
+// queue reply bytes for sending
+// returns 0 on success, or -1 on error
+static int conn_send(conn_t *cn, const void *buf, size_t n) {
+    unsigned char *p = conn_reserve(cn, n);
+    if (!p) {
+        return -1;
+    }
+    memcpy(p, buf, n);
+    return 0;
+}
+
+// threaded mode: send everything queued in out[] with one write
+// returns 0 on success, or -1 on error
+static int conn_flush(conn_t *cn) {
+    if (cn->evented || cn->out_len == 0) {
+        return 0;
+    }
+    size_t n = cn->out_len;
+    cn->out_len = 0;
+    return (write_all(cn->fd, cn->out, n) == (ssize_t)n) ? 0 : -1;
+}
+
+// refill the connection's receive buffer with a single recv(); queued
+// replies are sent first, since the client may be waiting for them
+// returns bytes now buffered, 0 on EOF, or -1 on error
+static ssize_t conn_fill(conn_t *cn) {
+    if (conn_flush(cn) < 0) {
+        return -1;
+    }
+    for (;;) {
+        ssize_t r = recv(cn->fd, cn->in, IN_BUFSZ, 0);
+        if (r < 0 && errno == EINTR) {
+            continue; // interrupted by signal, retry
+        }
+        if (r <= 0) {
+            return r;
+        }
+        cn->in_pos = 0;
+        cn->in_len = (size_t)r;
+        return r;
+    }
+}
+
+// read exactly n bytes from the connection into buf, unless EOF or error
+// buffered bytes are used first; large remainders bypass the buffer
+// returns n on success, 0 on clean EOF, or -1 on error
+static ssize_t read_exact(conn_t *cn, void *buf, size_t n) {
     size_t off = 0;
     while (off < n) {
-        ssize_t w = send(fd, (const char *)buf + off, n - off, 0);
-        if (w < 0) {
-            if (errno == EINTR) {
-                continue; // interrupted by signal, retry
+        size_t avail = cn->in_len - cn->in_pos;
+        if (avail > 0) {
+            size_t take = (n - off < avail) ? n - off : avail;
+            memcpy((char *)buf + off, cn->in + cn->in_pos, take);
+            cn->in_pos += take;
+            off += take;
+            continue;
+        }
+        if (n - off >= IN_BUFSZ) {
+            // big payload: receive straight into the destination
+            if (conn_flush(cn) < 0) {
+                return -1;
             }
-            return -1;
+            ssize_t r = recv(cn->fd, (char *)buf + off, n - off, 0);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                return r;
+            }
+            off += (size_t)r;
+            continue;
+        }
+        ssize_t r = conn_fill(cn);
+        if (r <= 0) {
+            return r;
         }
-        off += (size_t)w;
     }
     return (ssize_t)off;
 }
 
-// read a single '\n'-terminated line from fd into out
+// read a single '\n'-terminated line from the connection into out
 // out is always NUL-terminated as long as MAX_LINE > 0
 //
 // returns number of bytes stored (excluding NUL) on success,
 // 0 on EOF, or -1 on error
-static ssize_t readline(int fd, char *out) {
+static ssize_t readline(conn_t *cn, char *out) {
     size_t off = 0;
 
     while (off + 1 < MAX_LINE) {
-        char c;
-        ssize_t r = recv(fd, &c, 1, 0);
-        if (r == 0) {
-            // EOF with no more data
-            break;
-        }
-        if (r < 0) {
-            if (errno == EINTR) {
-                continue; // retry on signal
+        if (cn->in_pos == cn->in_len) {
+            ssize_t r = conn_fill(cn);
+            if (r == 0) {
+                break;        // EOF with no more data
+            }
+            if (r < 0) {
+                return -1;
             }
-            return -1;
         }
 
-        out[off++] = c;
-        if (c == '\n') {
-            break;        // end of line
+        // copy up to the next newline out of the buffer in one go
+        unsigned char *start = cn->in + cn->in_pos;
+        size_t avail = cn->in_len - cn->in_pos;
+        size_t room  = MAX_LINE - 1 - off;
+        size_t take  = (avail < room) ? avail : room;
+        unsigned char *nl = memchr(start, '\n', take);
+        if (nl) {
+            take = (size_t)(nl - start) + 1;
+        }
+        memcpy(out + off, start, take);
+        cn->in_pos += take;
+        off += take;
+        if (nl) {
+            break;            // end of line
         }
     }
 
@@ -145,13 +445,35 @@ static ssize_t readline(int fd, char *out) {
     return (ssize_t)off;
 }
 
+// little-endian field access for the binary protocol
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get_le16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void put_le16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
 // ------------- disk geometry / timing helpers -------------
 
-// compute a pointer to the start of the block at cylinder c, sector s
-static unsigned char *blk_ptr(long c, long s) {
+// byte offset of the block at cylinder c, sector s in the disk image
+static off_t blk_off(long c, long s) {
     // index of sector in the linear disk image
     size_t idx = (size_t)c * (size_t)g_sec + (size_t)s;
-    return g_base + idx * BLKSZ;
+    return (off_t)(idx * BLKSZ);
 }
 
 // validate that cylinder c and sector s are within the disk geometry
@@ -177,228 +499,2067 @@ static void sleep_tracks(long from, long to) {
     nanosleep(&ts, NULL);
 }
 
-// ------------- command handlers for the disk protocol -------------
+// ------------- latency histogram -------------
 
-// handle the "I" command: return "<cyl> <sec>\n"
-static int handle_I(int fd) {
-    char buf[64];
-    int n = snprintf(buf, sizeof(buf), "%ld %ld\n", g_cyl, g_sec);
-    if (n < 0) {
-        return -1;
+static int hist_index(unsigned long long us) {
+    if (us < HIST_SUB) {
+        return (int)us;
     }
-    return (write_all(fd, buf, (size_t)n) == n) ? 0 : -1;
+    int e = 63 - __builtin_clzll(us);            // us in [2^e, 2^(e+1))
+    int idx = (e - 3) * HIST_SUB + (int)((us >> (e - 4)) & (HIST_SUB - 1));
+    return (idx < HIST_BUCKETS) ? idx : HIST_BUCKETS - 1;
 }
 
-// handle "R c s": read a 128-byte sector
-//
-// on invalid (c,s): send '0'
-// on valid (c,s): simulate seek, then send '1' followed by 128 bytes
-static int handle_R(int fd, long c, long s) {
-    if (!validate_cs(c, s)) {
-        char z = '0';
-        return (write_all(fd, &z, 1) == 1) ? 0 : -1;
+// smallest value that falls in bucket idx
+static unsigned long long hist_value(int idx) {
+    if (idx < HIST_SUB) {
+        return (unsigned long long)idx;
     }
+    int e = idx / HIST_SUB + 3;
+    return (1ULL << e) | ((unsigned long long)(idx % HIST_SUB) << (e - 4));
+}
 
-    // serialize access to the disk arm and sector
-    pthread_mutex_lock(&g_arm_mtx);
-
-    long from = g_head_cyl;
-    sleep_tracks(from, c);     // simulate seek time
-    g_head_cyl = c;
-
-    unsigned char *p = blk_ptr(c, s);
-    char ok = '1';
-    int rv = 0;
+static void hist_add(hist_t *h, unsigned long long us) {
+    h->count++;
+    h->sum_us += us;
+    h->b[hist_index(us)]++;
+}
 
-    if (write_all(fd, &ok, 1) != 1) {
-        rv = -1;
-    } else if (write_all(fd, p, BLKSZ) != BLKSZ) {
-        rv = -1;
+// value at quantile q (0..1), accurate to the bucket width
+static unsigned long long hist_quantile(const hist_t *h, double q) {
+    if (h->count == 0) {
+        return 0;
     }
+    unsigned long want = (unsigned long)(q * (double)h->count);
+    if (want >= h->count) {
+        want = h->count - 1;
+    }
+    unsigned long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->b[i];
+        if (seen > want) {
+            return hist_value(i);
+        }
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
 
-    pthread_mutex_unlock(&g_arm_mtx);
-    return rv;
+static unsigned long long elapsed_us(const struct timespec *from) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long us = (now.tv_sec - from->tv_sec) * 1000000LL +
+                   (now.tv_nsec - from->tv_nsec) / 1000;
+    return (us > 0) ? (unsigned long long)us : 0;
 }
 
-// handle "W c s l" followed by l raw bytes
+static unsigned long long ts_diff_ns(const struct timespec *a, const struct timespec *b) {
+    long long ns = (b->tv_sec - a->tv_sec) * 1000000000LL + (b->tv_nsec - a->tv_nsec);
+    return (ns > 0) ? (unsigned long long)ns : 0;
+}
+
+// ------------- runtime statistics -------------
 //
-//    - on invalid cylinder/sector or bad length, send '0'
-//    - on success, write the data into the mapped disk sector
-//      (zero-filling any remaining bytes) and send '1'
-static int handle_W(int fd, long c, long s, long l) {
-    unsigned char buf[BLKSZ];
+// Reported by the "S" command and, with -m <port>, as Prometheus text
+// on a small HTTP endpoint.  Command counters, bytes moved, connection
+// counts and the R/W latency histograms are guarded by g_stats_mtx, so
+// collecting them never adds work under an arm mutex.  The arm mutex
+// accounting (time spent waiting for an arm's mtx vs. holding it) is
+// updated by whichever thread holds that mtx, see arm_lock() below.
+
+typedef enum { ST_I, ST_R, ST_W, ST_RV, ST_WV, ST_B, ST_S, ST_NOPS } stat_op_t;
+static const char *const g_stat_op_names[] = { "I", "R", "W", "RV", "WV", "B", "S" };
+
+static pthread_mutex_t g_stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long g_op_count[ST_NOPS];
+static unsigned long long g_bytes_read = 0;
+static unsigned long long g_bytes_written = 0;
+static hist_t g_read_lat;               // R and RV, per command
+static hist_t g_write_lat;              // W and WV, per command
+static long g_conns_active = 0;
+static unsigned long long g_conns_total = 0;
+static struct timespec g_start_time;
+
+// count one command of type op
+static void stats_op(stat_op_t op) {
+    pthread_mutex_lock(&g_stats_mtx);
+    g_op_count[op]++;
+    pthread_mutex_unlock(&g_stats_mtx);
+}
 
-    if (!validate_cs(c, s) || l < 0 || l > BLKSZ) {
-        char z = '0';
-        return (write_all(fd, &z, 1) == 1) ? 0 : -1;
+// account n sectors moved by one command that started at t0
+static void stats_io(int is_write, long n, const struct timespec *t0) {
+    unsigned long long us = elapsed_us(t0);
+    pthread_mutex_lock(&g_stats_mtx);
+    if (is_write) {
+        g_bytes_written += (unsigned long long)n * BLKSZ;
+        hist_add(&g_write_lat, us);
+    } else {
+        g_bytes_read += (unsigned long long)n * BLKSZ;
+        hist_add(&g_read_lat, us);
     }
+    pthread_mutex_unlock(&g_stats_mtx);
+}
 
-    // read exactly l bytes of raw data from the client
-    if (l > 0) {
-        if (read_exact(fd, buf, (size_t)l) != l) {
-            return -1;
-        }
+// a connection opened (+1) or closed (-1)
+static void stats_conn(int delta) {
+    pthread_mutex_lock(&g_stats_mtx);
+    g_conns_active += delta;
+    if (delta > 0) {
+        g_conns_total++;
     }
+    pthread_mutex_unlock(&g_stats_mtx);
+}
 
-    // zero-fill the remaining bytes in the sector
-    if (l < BLKSZ) {
-        memset(buf + l, 0, (size_t)(BLKSZ - l));
-    }
+// ------------- arm mutex with wait/hold accounting -------------
 
-    pthread_mutex_lock(&g_arm_mtx);
+static void arm_lock(arm_t *a) {
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_mutex_lock(&a->mtx);
+    clock_gettime(CLOCK_MONOTONIC, &a->locked_at);
+    a->wait_ns += ts_diff_ns(&t0, &a->locked_at);
+    a->acquires++;
+}
 
-    long from = g_head_cyl;
-    sleep_tracks(from, c); // simulate seek into position
-    g_head_cyl = c;
+static void arm_unlock(arm_t *a) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    a->hold_ns += ts_diff_ns(&a->locked_at, &now);
+    pthread_mutex_unlock(&a->mtx);
+}
 
-    // copy the new sector contents into the mapped disk
-    memcpy(blk_ptr(c, s), buf, BLKSZ);
+// pthread_cond_wait on a->mtx: the mutex is not held while asleep,
+// so close the current hold interval and start a new one on wakeup
+// (the time spent sleeping is not counted as waiting for the mutex)
+static void arm_wait(arm_t *a, pthread_cond_t *cv) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    a->hold_ns += ts_diff_ns(&a->locked_at, &now);
+    pthread_cond_wait(cv, &a->mtx);
+    clock_gettime(CLOCK_MONOTONIC, &a->locked_at);
+    a->acquires++;
+}
 
-    pthread_mutex_unlock(&g_arm_mtx);
+// split the disk into g_narms zones of (nearly) equal size
+static void arms_init(void) {
+    for (int i = 0; i < g_narms; i++) {
+        arm_t *a = &g_arms[i];
+        a->id = i;
+        a->lo = (long)((long long)g_cyl * i / g_narms);
+        a->hi = (long)((long long)g_cyl * (i + 1) / g_narms);
+        pthread_mutex_init(&a->mtx, NULL);
+        pthread_cond_init(&a->cv, NULL);
+        a->head_cyl = a->lo;
+        a->scan_dir = 1;
+    }
+}
 
-    char ok = '1';
-    return (write_all(fd, &ok, 1) == 1) ? 0 : -1;
+// the arm whose zone holds cylinder c (c must be valid)
+static arm_t *arm_of(long c) {
+    int i = 0;
+    while (i + 1 < g_narms && c >= g_arms[i + 1].lo) {
+        i++;
+    }
+    return &g_arms[i];
 }
 
-// ------------- per-client worker thread -------------
+// ------------- storage backends -------------
+
+// A backend moves sectors between the backing file and request buffers.
+// It is driven by the scheduler threads, one per arm, each passing its
+// arm number: start() begins the transfer of one request and returns 1
+// if it is already done or 0 if it completes later, kick() hands the
+// arm's queued transfers to the kernel (called before the arm sleeps),
+// and reap() returns the arm's transfers finished since the last call
+// as a list linked through ->next, waiting for at least one if asked
+// to.  Arms never share a sector, but they do run concurrently.  sync()
+// forces written data to stable storage and may also be called from
+// the -s flusher thread.
+typedef struct {
+    const char *name;
+    int  (*open)(const char *path, size_t bytes);
+    int  (*start)(int arm, io_req_t *r);
+    void (*kick)(int arm);              // NULL: nothing is ever queued
+    io_req_t *(*reap)(int arm, int wait); // NULL: start() always finishes
+    int  (*sync)(void);
+    void (*close)(void);
+} backend_t;
+
+#define BE_POPULATE 1                   // mmap: prefault the image
+#define BE_HUGE     2                   // mmap: MADV_HUGEPAGE
+#define DIO_ALIGN   4096                // O_DIRECT offset/length/buffer alignment
+#define URING_DEPTH MAX_VEC             // io_uring submission queue entries
+
+static int    g_fd    = -1;             // backing file descriptor
+static size_t g_bytes = 0;              // size of the disk image
+static int    g_be_flags = 0;           // BE_* options given with -b
+
+// open (or create) the backing file and make it the right size; with
+// O_DIRECT the size is rounded up so the last chunk can be read whole
+static int open_image(const char *path, size_t bytes, int oflags) {
+    g_fd = open(path, O_RDWR | O_CREAT | oflags, 0644);
+    if (g_fd < 0) {
+        perror("open");
+        return -1;
+    }
+    off_t size = (off_t)bytes;
+    if (oflags & O_DIRECT) {
+        size = (size + DIO_ALIGN - 1) & ~(off_t)(DIO_ALIGN - 1);
+    }
+    if (ftruncate(g_fd, size) < 0) {
+        perror("ftruncate");
+        return -1;
+    }
+    g_bytes = bytes;
+    return 0;
+}
 
-static void *client_main(void *arg) {
-    client_arg_t *carg = (client_arg_t *)arg;
-    int fd = carg->client_fd;
-    free(carg);
+static int fd_sync(void) {
+    return fdatasync(g_fd);
+}
 
-    char line[MAX_LINE];
+static void fd_close(void) {
+    close(g_fd);
+}
 
-    for (;;) {
-        // read a single command line from the client
-        ssize_t n = readline(fd, line);
-        if (n <= 0) {
-            // EOF or error: terminate this connection
-            break;
-        }
+// --- mmap: sectors are just pointer arithmetic into a shared mapping ---
 
-        // ignore pure blank lines
-        if (line[0] == '\n' || line[0] == '\0') {
-            continue;
-        }
+static unsigned char *g_base = NULL;    // base of mmap()'d disk image
 
-        if (line[0] == 'I') {
-            if (handle_I(fd) < 0) {
-                break;
-            }
-        } else if (line[0] == 'R') {
-            long c, s;
-            if (sscanf(line, "R %ld %ld", &c, &s) != 2) {
-                // malformed command: close connection
-                break;
-            }
-            if (handle_R(fd, c, s) < 0) {
-                break;
-            }
-        } else if (line[0] == 'W') {
-            long c, s, l;
-            if (sscanf(line, "W %ld %ld %ld", &c, &s, &l) != 3) {
-                break;
-            }
-            if (handle_W(fd, c, s, l) < 0) {
-                break;
-            }
-        } else {
-            // unknown command; stop talking to this client
-            break;
-        }
+static int mmap_open(const char *path, size_t bytes) {
+    if (open_image(path, bytes, 0) < 0) {
+        return -1;
     }
+    int flags = MAP_SHARED | ((g_be_flags & BE_POPULATE) ? MAP_POPULATE : 0);
+    g_base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, g_fd, 0);
+    if (g_base == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    // sector-sized accesses at random: readahead would only evict pages
+    madvise(g_base, bytes, MADV_RANDOM);
+    if ((g_be_flags & BE_HUGE) && madvise(g_base, bytes, MADV_HUGEPAGE) < 0) {
+        perror("madvise(MADV_HUGEPAGE)"); // only a hint; carry on without
+    }
+    return 0;
+}
 
-    close(fd);
-    return NULL;
+static int mmap_start(int arm, io_req_t *r) {
+    (void)arm;
+    unsigned char *p = g_base + blk_off(r->c, r->s);
+    if (r->is_write) {
+        memcpy(p, r->buf, BLKSZ);
+    } else {
+        memcpy(r->buf, p, BLKSZ);
+    }
+    return 1;
 }
 
-// ------------- signal handler and main program -------------
+static int mmap_sync(void) {
+    return msync(g_base, g_bytes, MS_SYNC);
+}
 
-// SIGINT handler: set a flag to tell the accept loop to exit
-static void on_sigint(int signo) {
-    (void)signo;
-    g_stop = 1;
+static void mmap_close(void) {
+    munmap(g_base, g_bytes);
+    close(g_fd);
 }
 
-int main(int argc, char **argv) {
-    // usage: ./disk_server <port> <cylinders> <sectors> <track_us> <backing_file>
-    if (argc != 6) {
-        fprintf(stderr,
-                "Usage: %s <port> <cylinders> <sectors> <track_us> <backing_file>\n",
-                argv[0]);
-        return 2;
-    }
+// --- pio: one pread/pwrite per sector ---
 
-    int  port = atoi(argv[1]);
-    g_cyl      = strtol(argv[2], NULL, 10);
-    g_sec      = strtol(argv[3], NULL, 10);
-    g_track_us = strtol(argv[4], NULL, 10);
-    const char *path = argv[5];
+static int pio_open(const char *path, size_t bytes) {
+    return open_image(path, bytes, 0);
+}
 
-    if (g_cyl <= 0 || g_sec <= 0) {
-        fprintf(stderr, "cylinders and sectors must both be > 0\n");
-        return 2;
-    }
+static int pio_start(int arm, io_req_t *r) {
+    (void)arm;
+    off_t off = blk_off(r->c, r->s);
+    ssize_t n = r->is_write ? pwrite(g_fd, r->buf, BLKSZ, off)
+                            : pread(g_fd, r->buf, BLKSZ, off);
+    r->err = (n != BLKSZ);
+    return 1;
+}
 
-    size_t total_bytes = (size_t)g_cyl * (size_t)g_sec * BLKSZ;
+// --- direct: pread/pwrite with O_DIRECT through an aligned chunk ---
 
-    // open (or create) the backing file for the simulated disk
-    g_fd = open(path, O_RDWR | O_CREAT, 0644);
-    if (g_fd < 0) {
-        perror("open");
-        return 1;
-    }
+static unsigned char *g_dio_buf = NULL; // DIO_ALIGN bytes, DIO_ALIGN-aligned
+static off_t g_dio_off = -1;            // chunk held in g_dio_buf, -1 if none
+static pthread_mutex_t g_dio_mtx = PTHREAD_MUTEX_INITIALIZER; // guards both
 
-    // ensure the file is the right size
-    if (ftruncate(g_fd, (off_t)total_bytes) < 0) {
-        perror("ftruncate");
-        return 1;
+static int direct_open(const char *path, size_t bytes) {
+    if (open_image(path, bytes, O_DIRECT) < 0) {
+        return -1;
     }
-
-    // map the file into memory so sectors are just pointer arithmetic
-    g_base = mmap(NULL, total_bytes,
-                  PROT_READ | PROT_WRITE, MAP_SHARED,
-                  g_fd, 0);
-    if (g_base == MAP_FAILED) {
-        perror("mmap");
-        return 1;
+    if (posix_memalign((void **)&g_dio_buf, DIO_ALIGN, DIO_ALIGN) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
     }
+    return 0;
+}
 
-    // create listening socket
-    int srv = socket(AF_INET, SOCK_STREAM, 0);
-    if (srv < 0) {
-        perror("socket");
-        return 1;
+// the chunk around a sector is read once and then kept: only this
+// backend writes the file, so it stays current, and neighbouring
+// sectors (a FAT, a file's blocks) are served without another read.
+// A chunk may straddle two zones, so with -k the arms take turns here
+// (their seeks still overlap)
+static int direct_start(int arm, io_req_t *r) {
+    (void)arm;
+    off_t off = blk_off(r->c, r->s);
+    off_t chunk = off & ~(off_t)(DIO_ALIGN - 1);
+    pthread_mutex_lock(&g_dio_mtx);
+    if (chunk != g_dio_off) {
+        g_dio_off = -1;
+        if (pread(g_fd, g_dio_buf, DIO_ALIGN, chunk) != DIO_ALIGN) {
+            r->err = 1;
+            pthread_mutex_unlock(&g_dio_mtx);
+            return 1;
+        }
+        g_dio_off = chunk;
+    }
+    unsigned char *p = g_dio_buf + (off - chunk);
+    if (!r->is_write) {
+        memcpy(r->buf, p, BLKSZ);
+    } else {
+        memcpy(p, r->buf, BLKSZ);
+        if (pwrite(g_fd, g_dio_buf, DIO_ALIGN, chunk) != DIO_ALIGN) {
+            g_dio_off = -1; // the file may hold either version now
+            r->err = 1;
+        }
     }
+    pthread_mutex_unlock(&g_dio_mtx);
+    return 1;
+}
 
-    int opt = 1;
-    setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+static void direct_close(void) {
+    close(g_fd);
+    free(g_dio_buf);
+}
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family      = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port        = htons((uint16_t)port);
+// --- uring: io_uring read/write, submitted in batches ---
 
-    if (bind(srv, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        return 1;
+// the rings are set up with raw system calls (no liburing needed); each
+// arm has a ring of its own, so no locking is needed
+typedef struct {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+    unsigned queued;                    // SQEs not submitted yet
+    io_req_t *live[URING_DEPTH];        // queued or in flight
+    unsigned nlive;
+    io_req_t *done;                     // reaped, not yet returned
+} uring_t;
+
+static uring_t g_ur[ARMS_MAX];
+
+static int uring_setup(uring_t *u) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = (int)syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (u->fd < 0) {
+        perror("io_uring_setup");
+        return -1;
     }
-    if (listen(srv, BACKLOG) < 0) {
-        perror("listen");
-        return 1;
+    u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_sz > u->sq_ring_sz) {
+            u->sq_ring_sz = u->cq_ring_sz;
+        }
+        u->cq_ring_sz = u->sq_ring_sz;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->cq_ring = u->sq_ring;
+    if (u->sq_ring != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
     }
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        perror("mmap io_uring");
+        return -1;
+    }
+    unsigned char *sq = u->sq_ring, *cq = u->cq_ring;
+    u->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
 
-    // arrange to stop on Ctrl-C
-    signal(SIGINT, on_sigint);
+static int uring_open(const char *path, size_t bytes) {
+    if (open_image(path, bytes, 0) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < g_narms; i++) {
+        if (uring_setup(&g_ur[i]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    fprintf(stderr,
-            "[disk_server] port=%d geom=%ldx%ld track=%ldus file=%s\n",
-            port, g_cyl, g_sec, g_track_us, path);
+// move completions from the CQ ring to u->done
+static void uring_harvest(uring_t *u) {
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        io_req_t *r = (io_req_t *)(uintptr_t)cqe->user_data;
+        r->err = (cqe->res != BLKSZ);
+        for (unsigned i = 0; i < u->nlive; i++) {
+            if (u->live[i] == r) {
+                u->live[i] = u->live[--u->nlive];
+                break;
+            }
+        }
+        r->next = u->done;
+        u->done = r;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// submit what is queued and, if wait is set, block for one completion;
+// the ring never holds more than it has room to complete, so the only
+// errors left are fatal ones
+static void uring_enter(uring_t *u, unsigned wait) {
+    for (;;) {
+        long rc = syscall(__NR_io_uring_enter, u->fd, u->queued, wait,
+                          wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc >= 0) {
+            u->queued -= (unsigned)rc;
+            break;
+        }
+        if (errno != EINTR) {
+            perror("io_uring_enter");
+            exit(1);
+        }
+    }
+    uring_harvest(u);
+}
+
+// queue r; the kernel may run queued transfers in any order, so first
+// wait out any that touch the same sector (or a full ring)
+static int uring_start(int arm, io_req_t *r) {
+    uring_t *u = &g_ur[arm];
+    for (;;) {
+        int clash = (u->nlive == URING_DEPTH);
+        for (unsigned i = 0; i < u->nlive && !clash; i++) {
+            io_req_t *q = u->live[i];
+            clash = q->c == r->c && q->s == r->s && (q->is_write || r->is_write);
+        }
+        if (!clash) {
+            break;
+        }
+        uring_enter(u, 1);
+    }
+
+    unsigned tail = *u->sq_tail;
+    unsigned i = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = r->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = g_fd;
+    sqe->off = (uint64_t)blk_off(r->c, r->s);
+    sqe->addr = (uint64_t)(uintptr_t)r->buf;
+    sqe->len = BLKSZ;
+    sqe->user_data = (uint64_t)(uintptr_t)r;
+    u->sq_array[i] = i;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->queued++;
+    u->live[u->nlive++] = r;
+    return 0;
+}
+
+static void uring_kick(int arm) {
+    uring_t *u = &g_ur[arm];
+    if (u->queued > 0) {
+        uring_enter(u, 0);
+    }
+}
+
+static io_req_t *uring_reap(int arm, int wait) {
+    uring_t *u = &g_ur[arm];
+    uring_harvest(u);
+    if (u->done == NULL && wait && u->nlive > 0) {
+        uring_enter(u, 1);
+    }
+    io_req_t *done = u->done;
+    u->done = NULL;
+    return done;
+}
+
+static void uring_close(void) {
+    for (int i = 0; i < g_narms; i++) {
+        uring_t *u = &g_ur[i];
+        munmap(u->sqes, u->sqes_sz);
+        if (u->cq_ring != u->sq_ring) {
+            munmap(u->cq_ring, u->cq_ring_sz);
+        }
+        munmap(u->sq_ring, u->sq_ring_sz);
+        close(u->fd);
+    }
+    close(g_fd);
+}
+
+// selectable with -b; the first one is the default
+static const backend_t g_backends[] = {
+    { "mmap",   mmap_open,   mmap_start,   NULL,       NULL,       mmap_sync, mmap_close   },
+    { "pio",    pio_open,    pio_start,    NULL,       NULL,       fd_sync,   fd_close     },
+    { "direct", direct_open, direct_start, NULL,       NULL,       fd_sync,   direct_close },
+    { "uring",  uring_open,  uring_start,  uring_kick, uring_reap, fd_sync,   uring_close  },
+};
+static const backend_t *g_be = &g_backends[0];
+
+// -s: 0 never syncs, SYNC_ALWAYS syncs before acknowledging each write
+// command, anything else is the period of the flusher thread in ms
+#define SYNC_ALWAYS (-1L)
+static long g_sync_ms = 0;
+static unsigned long long g_syncs = 0;  // sync() calls, updated atomically
+
+// the -s policy as given: "never", "always" or the period in ms
+static const char *sync_desc(char *buf, size_t cap) {
+    if (g_sync_ms == 0) {
+        return "never";
+    }
+    if (g_sync_ms == SYNC_ALWAYS) {
+        return "always";
+    }
+    snprintf(buf, cap, "%ld", g_sync_ms);
+    return buf;
+}
+
+static int be_sync(void) {
+    __atomic_fetch_add(&g_syncs, 1, __ATOMIC_RELAXED);
+    return g_be->sync();
+}
+
+// -s <ms>: sync the image every g_sync_ms milliseconds
+static void *syncer_main(void *arg) {
+    (void)arg;
+    struct timespec ts = { g_sync_ms / 1000, (g_sync_ms % 1000) * 1000000L };
+    for (;;) {
+        nanosleep(&ts, NULL);
+        if (be_sync() < 0) {
+            perror("sync");
+        }
+    }
+    return NULL;
+}
+
+// ------------- disk arm scheduler -------------
+
+// choose the next request for arm a to service according to g_policy
+// a->mtx must be held and its queue must not be empty; returns the
+// link that points at the chosen request so it can be unlinked.
+//
+// SCAN may instead decide to finish its sweep at the zone edge first:
+// then NULL is returned and *sweep_to is set to the edge cylinder.
+static io_req_t **pick_next(arm_t *a, long *sweep_to) {
+    io_req_t **best = NULL;
+    long best_key = 0;
+
+    if (g_policy == POL_FCFS) {
+        return &a->q_head;
+    }
+
+    for (int pass = 0; pass < 2 && best == NULL; pass++) {
+        for (io_req_t **pp = &a->q_head; *pp; pp = &(*pp)->next) {
+            long c = (*pp)->c;
+            long key;
+
+            if (g_policy == POL_SSTF) {
+                key = labs(c - a->head_cyl);
+            } else if (g_policy == POL_CLOOK) {
+                // pass 0: at or above the head; pass 1: wrap to the lowest
+                if (pass == 0 && c < a->head_cyl) {
+                    continue;
+                }
+                key = (pass == 0) ? c - a->head_cyl : c;
+            } else {
+                // SCAN/LOOK: only requests in the current direction
+                long d = (c - a->head_cyl) * a->scan_dir;
+                if (d < 0) {
+                    continue;
+                }
+                key = d;
+            }
+
+            // strict '<' keeps arrival order among equal keys
+            if (best == NULL || key < best_key) {
+                best = pp;
+                best_key = key;
+            }
+        }
+
+        if (best == NULL && (g_policy == POL_SCAN || g_policy == POL_LOOK)) {
+            // nothing left ahead of the arm: reverse the sweep
+            a->scan_dir = -a->scan_dir;
+            long edge = (a->scan_dir > 0) ? a->lo : a->hi - 1;
+            if (g_policy == POL_SCAN && a->head_cyl != edge) {
+                // SCAN travels all the way to the edge before turning
+                *sweep_to = edge;
+                return NULL;
+            }
+        }
+    }
+    return best;
+}
+
+// with -s always: does the list of finished transfers complete a
+// write command?  Only the arm's scheduler changes batch->left, so it
+// can read it without the lock
+static int completes_write(io_req_t *list) {
+    for (io_req_t *r = list; r; r = r->next) {
+        if (!r->is_write) {
+            continue;
+        }
+        long k = 0;
+        for (io_req_t *q = list; q; q = q->next) {
+            k += (q->batch == r->batch);
+        }
+        if (k == r->batch->left) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// the transfers the backend has finished for arm a (none for
+// synchronous ones), synced first if that is what their commands wait for
+static io_req_t *collect_done(arm_t *a, io_req_t *done, int wait) {
+    if (g_be->reap) {
+        io_req_t *more = g_be->reap(a->id, wait);
+        while (more) {
+            io_req_t *next = more->next;
+            more->next = done;
+            done = more;
+            more = next;
+        }
+    }
+    if (g_sync_ms == SYNC_ALWAYS && completes_write(done) && be_sync() < 0) {
+        for (io_req_t *r = done; r; r = r->next) {
+            r->err |= r->is_write; // not known to be on disk
+        }
+    }
+    return done;
+}
+
+// account for finished transfers and wake the commands they complete;
+// a->mtx must be held.  Returns how many there were.
+static long finish_done(arm_t *a, io_req_t *r) {
+    long n = 0;
+    while (r) {
+        io_req_t *next = r->next;
+        io_batch_t *b = r->batch;
+        a->sectors_done++;
+        n++;
+        if (r->err) {
+            b->failed = 1;
+        }
+        if (--b->left == 0) {
+            hist_add(&a->lat, elapsed_us(&b->t_submit));
+            pthread_cond_signal(&b->done);
+        }
+        r = next;
+    }
+    return n;
+}
+
+// scheduler thread of arm a: repeatedly pick a pending transfer in
+// its zone, seek, and hand it to the backend
+static void *sched_main(void *arg) {
+    arm_t *a = arg;
+    long inflight = 0;          // started but not finished
+    arm_lock(a);
+    for (;;) {
+        if (a->q_head == NULL && inflight > 0) {
+            // nothing new to start: wait for what is in flight
+            arm_unlock(a);
+            io_req_t *done = collect_done(a, NULL, 1);
+            arm_lock(a);
+            inflight -= finish_done(a, done);
+            continue;
+        }
+        while (a->q_head == NULL) {
+            arm_wait(a, &a->cv);
+        }
+
+        long sweep_to = -1;
+        io_req_t **pp = pick_next(a, &sweep_to);
+        if (pp == NULL) {
+            // finish the SCAN sweep, then choose again
+            long from = a->head_cyl;
+            a->head_cyl = sweep_to;
+            a->seek_tracks += (unsigned long long)labs(sweep_to - from);
+            arm_unlock(a);
+            if (g_be->kick) {
+                g_be->kick(a->id);
+            }
+            sleep_tracks(from, sweep_to);
+            arm_lock(a);
+            continue;
+        }
+        io_req_t *r = *pp;
+        *pp = r->next;
+        if (a->q_tail == r) {
+            // recompute the tail after unlinking the last element
+            a->q_tail = NULL;
+            for (io_req_t *q = a->q_head; q; q = q->next) {
+                a->q_tail = q;
+            }
+        }
+
+        long from = a->head_cyl;
+        a->head_cyl = r->c;
+        a->seek_tracks += (unsigned long long)labs(r->c - from);
+
+        // seek without the lock so new requests can queue meanwhile;
+        // this thread is the only one that touches the arm or its
+        // zone's sectors.  Transfers queued on the old cylinder run
+        // during the seek.
+        arm_unlock(a);
+        if (from != r->c && g_be->kick) {
+            g_be->kick(a->id);
+        }
+        sleep_tracks(from, r->c);
+        r->err = 0;
+        r->next = NULL;
+        inflight++;
+        io_req_t *done = collect_done(a, g_be->start(a->id, r) ? r : NULL, 0);
+        arm_lock(a);
+        inflight -= finish_done(a, done);
+    }
+    return NULL;
+}
+
+// queue n transfers for the arms of their zones and wait until all are
+// done.  Each arm gets its share as one batch, and every batch is
+// queued before waiting on any, so the arms work on them in parallel.
+// returns 0, or -1 if the backend failed any of them
+static int submit_and_wait(io_req_t *reqs, long n) {
+    io_batch_t b[ARMS_MAX];
+    io_req_t *head[ARMS_MAX], *tail[ARMS_MAX];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int k = 0; k < g_narms; k++) {
+        b[k].left = 0;
+        head[k] = tail[k] = NULL;
+    }
+
+    // split the transfers by arm, keeping their order
+    for (long i = 0; i < n; i++) {
+        int k = arm_of(reqs[i].c)->id;
+        reqs[i].batch = &b[k];
+        reqs[i].next = NULL;
+        if (tail[k]) {
+            tail[k]->next = &reqs[i];
+        } else {
+            head[k] = &reqs[i];
+        }
+        tail[k] = &reqs[i];
+        b[k].left++;
+    }
+
+    for (int k = 0; k < g_narms; k++) {
+        if (b[k].left == 0) {
+            continue;
+        }
+        arm_t *a = &g_arms[k];
+        b[k].failed = 0;
+        b[k].t_submit = now;
+        pthread_cond_init(&b[k].done, NULL);
+        arm_lock(a);
+        if (a->q_tail) {
+            a->q_tail->next = head[k];
+        } else {
+            a->q_head = head[k];
+        }
+        a->q_tail = tail[k];
+        pthread_cond_signal(&a->cv);
+        arm_unlock(a);
+    }
+
+    int failed = 0;
+    for (int k = 0; k < g_narms; k++) {
+        if (head[k] == NULL) {
+            continue;
+        }
+        arm_t *a = &g_arms[k];
+        arm_lock(a);
+        while (b[k].left > 0) {
+            arm_wait(a, &b[k].done);
+        }
+        arm_unlock(a);
+        failed |= b[k].failed;
+        pthread_cond_destroy(&b[k].done);
+    }
+    return failed ? -1 : 0;
+}
+
+static void hist_merge(hist_t *dst, const hist_t *src) {
+    dst->count += src->count;
+    dst->sum_us += src->sum_us;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->b[i] += src->b[i];
+    }
+}
+
+// print the scheduler statistics collected so far; with several arms a
+// command that spans zones counts once per arm it used
+static void report_stats(void) {
+    hist_t lat;
+    unsigned long sectors = 0;
+    unsigned long long seek_tracks = 0;
+    memset(&lat, 0, sizeof(lat));
+    for (int k = 0; k < g_narms; k++) {
+        arm_t *a = &g_arms[k];
+        arm_lock(a);
+        hist_merge(&lat, &a->lat);
+        sectors += a->sectors_done;
+        seek_tracks += a->seek_tracks;
+        if (g_narms > 1) {
+            fprintf(stderr,
+                    "[disk_server] arm %d cylinders=%ld-%ld commands=%lu sectors=%lu "
+                    "seek_tracks=%llu\n",
+                    k, a->lo, a->hi - 1, a->lat.count, a->sectors_done, a->seek_tracks);
+        }
+        arm_unlock(a);
+    }
+    double mean = lat.count ? (double)lat.sum_us / (double)lat.count : 0.0;
+    fprintf(stderr,
+            "[disk_server] policy=%s arms=%d commands=%lu sectors=%lu "
+            "seek_tracks=%llu mean=%.1fus p50=%lluus p99=%lluus\n",
+            g_policy_names[g_policy], g_narms, lat.count, sectors,
+            seek_tracks, mean, hist_quantile(&lat, 0.50),
+            hist_quantile(&lat, 0.99));
+}
+
+// a copy of every statistic, taken under the stats mutex and then each
+// arm's mutex in turn
+typedef struct {
+    double uptime_s;
+    unsigned long long ops[ST_NOPS];
+    unsigned long long bytes_read, bytes_written;
+    hist_t read_lat, write_lat;
+    long conns_active;
+    unsigned long long conns_total;
+    unsigned long long seek_tracks;
+    unsigned long sectors;
+    unsigned long long arm_wait_ns, arm_hold_ns, arm_acquires;
+    long queue_depth;
+    struct {
+        long head_cyl;
+        unsigned long long seek_tracks;
+        unsigned long sectors;
+        long queue_depth;
+    } arm[ARMS_MAX];
+} stats_snap_t;
+
+static void stats_snapshot(stats_snap_t *st) {
+    pthread_mutex_lock(&g_stats_mtx);
+    memcpy(st->ops, g_op_count, sizeof(st->ops));
+    st->bytes_read = g_bytes_read;
+    st->bytes_written = g_bytes_written;
+    st->read_lat = g_read_lat;
+    st->write_lat = g_write_lat;
+    st->conns_active = g_conns_active;
+    st->conns_total = g_conns_total;
+    pthread_mutex_unlock(&g_stats_mtx);
+
+    st->seek_tracks = 0;
+    st->sectors = 0;
+    st->arm_wait_ns = st->arm_hold_ns = st->arm_acquires = 0;
+    st->queue_depth = 0;
+    for (int k = 0; k < g_narms; k++) {
+        arm_t *a = &g_arms[k];
+        arm_lock(a);
+        st->arm[k].head_cyl = a->head_cyl;
+        st->arm[k].seek_tracks = a->seek_tracks;
+        st->arm[k].sectors = a->sectors_done;
+        st->arm[k].queue_depth = 0;
+        for (io_req_t *q = a->q_head; q; q = q->next) {
+            st->arm[k].queue_depth++;
+        }
+        st->arm_wait_ns += a->wait_ns;
+        st->arm_acquires += a->acquires;
+        st->arm_hold_ns += a->hold_ns;
+        arm_unlock(a);
+        st->seek_tracks += st->arm[k].seek_tracks;
+        st->sectors += st->arm[k].sectors;
+        st->queue_depth += st->arm[k].queue_depth;
+    }
+
+    st->uptime_s = (double)elapsed_us(&g_start_time) / 1e6;
+}
+
+// append printf-style text to buf at *len (truncating at cap)
+static void appendf(char *buf, size_t cap, size_t *len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+static void appendf(char *buf, size_t cap, size_t *len, const char *fmt, ...) {
+    if (*len >= cap) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, cap - *len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        *len += (size_t)n;
+        if (*len > cap) {
+            *len = cap;
+        }
+    }
+}
+
+// latency summary lines for the "S" reply
+static void append_lat(char *buf, size_t cap, size_t *len, const char *name, const hist_t *h) {
+    double mean = h->count ? (double)h->sum_us / (double)h->count : 0.0;
+    appendf(buf, cap, len,
+            "%s_count %lu\n%s_mean_us %.1f\n%s_p50_us %llu\n%s_p90_us %llu\n"
+            "%s_p99_us %llu\n%s_p999_us %llu\n",
+            name, h->count, name, mean, name, hist_quantile(h, 0.50),
+            name, hist_quantile(h, 0.90), name, hist_quantile(h, 0.99),
+            name, hist_quantile(h, 0.999));
+}
+
+// "S" reply: one "name value" pair per line, ended by an empty line
+static size_t format_stats(char *buf, size_t cap) {
+    stats_snap_t st;
+    stats_snapshot(&st);
+
+    size_t len = 0;
+    appendf(buf, cap, &len, "uptime_s %.3f\npolicy %s\ntrack_us %ld\n",
+            st.uptime_s, g_policy_names[g_policy], g_track_us);
+    char sd[24];
+    appendf(buf, cap, &len, "backend %s\nsync %s\nsyncs %llu\n", g_be->name,
+            sync_desc(sd, sizeof(sd)), __atomic_load_n(&g_syncs, __ATOMIC_RELAXED));
+    appendf(buf, cap, &len, "connections_active %ld\nconnections_total %llu\n",
+            st.conns_active, st.conns_total);
+    for (int i = 0; i < ST_NOPS; i++) {
+        appendf(buf, cap, &len, "op_%s %llu\n", g_stat_op_names[i], st.ops[i]);
+    }
+    appendf(buf, cap, &len,
+            "bytes_read %llu\nbytes_written %llu\nsectors %lu\n"
+            "seek_tracks %llu\nseek_us %llu\nqueue_depth %ld\n",
+            st.bytes_read, st.bytes_written, st.sectors, st.seek_tracks,
+            st.seek_tracks * (unsigned long long)g_track_us, st.queue_depth);
+    appendf(buf, cap, &len, "arm_acquires %llu\narm_wait_us %llu\narm_hold_us %llu\n",
+            st.arm_acquires, st.arm_wait_ns / 1000, st.arm_hold_ns / 1000);
+    appendf(buf, cap, &len, "arms %d\n", g_narms);
+    for (int k = 0; k < g_narms; k++) {
+        appendf(buf, cap, &len,
+                "arm%d_cylinders %ld-%ld\narm%d_head %ld\narm%d_sectors %lu\n"
+                "arm%d_seek_tracks %llu\narm%d_queue_depth %ld\n",
+                k, g_arms[k].lo, g_arms[k].hi - 1, k, st.arm[k].head_cyl,
+                k, st.arm[k].sectors, k, st.arm[k].seek_tracks, k, st.arm[k].queue_depth);
+    }
+    append_lat(buf, cap, &len, "read_lat", &st.read_lat);
+    append_lat(buf, cap, &len, "write_lat", &st.write_lat);
+    appendf(buf, cap, &len, "\n");
+    return len;
+}
+
+// Prometheus histogram: cumulative buckets at powers of two from 1us
+// to 2^24us (~16.8 s), in seconds; a bucket counts only histogram cells
+// that lie entirely at or below its bound
+static void append_prom_hist(char *buf, size_t cap, size_t *len, const char *op, const hist_t *h) {
+    unsigned long cum = 0;
+    int i = 0;
+    for (int k = 0; k <= 24; k++) {
+        unsigned long long le = 1ULL << k;
+        while (i < HIST_BUCKETS - 1 && hist_value(i + 1) - 1 <= le) {
+            cum += h->b[i++];
+        }
+        appendf(buf, cap, len, "disk_request_duration_seconds_bucket{op=\"%s\",le=\"%g\"} %lu\n",
+                op, (double)le / 1e6, cum);
+    }
+    appendf(buf, cap, len, "disk_request_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %lu\n", op, h->count);
+    appendf(buf, cap, len, "disk_request_duration_seconds_sum{op=\"%s\"} %g\n", op, (double)h->sum_us / 1e6);
+    appendf(buf, cap, len, "disk_request_duration_seconds_count{op=\"%s\"} %lu\n", op, h->count);
+}
+
+// the same statistics in the Prometheus text exposition format
+static size_t format_prometheus(char *buf, size_t cap) {
+    stats_snap_t st;
+    stats_snapshot(&st);
+
+    size_t len = 0;
+    appendf(buf, cap, &len,
+            "# HELP disk_uptime_seconds Time since the server started.\n"
+            "# TYPE disk_uptime_seconds gauge\n"
+            "disk_uptime_seconds %.3f\n", st.uptime_s);
+    appendf(buf, cap, &len,
+            "# HELP disk_connections Client connections currently open.\n"
+            "# TYPE disk_connections gauge\n"
+            "disk_connections %ld\n"
+            "# HELP disk_connections_total Client connections accepted.\n"
+            "# TYPE disk_connections_total counter\n"
+            "disk_connections_total %llu\n", st.conns_active, st.conns_total);
+    appendf(buf, cap, &len,
+            "# HELP disk_ops_total Commands served, by command.\n"
+            "# TYPE disk_ops_total counter\n");
+    for (int i = 0; i < ST_NOPS; i++) {
+        appendf(buf, cap, &len, "disk_ops_total{op=\"%s\"} %llu\n", g_stat_op_names[i], st.ops[i]);
+    }
+    appendf(buf, cap, &len,
+            "# HELP disk_bytes_total Sector bytes moved.\n"
+            "# TYPE disk_bytes_total counter\n"
+            "disk_bytes_total{dir=\"read\"} %llu\n"
+            "disk_bytes_total{dir=\"write\"} %llu\n"
+            "# HELP disk_sectors_total Sector transfers serviced by the scheduler.\n"
+            "# TYPE disk_sectors_total counter\n"
+            "disk_sectors_total %lu\n",
+            st.bytes_read, st.bytes_written, st.sectors);
+    appendf(buf, cap, &len,
+            "# HELP disk_seek_tracks_total Tracks travelled by the arm.\n"
+            "# TYPE disk_seek_tracks_total counter\n"
+            "disk_seek_tracks_total %llu\n"
+            "# HELP disk_seek_seconds_total Simulated seek time slept.\n"
+            "# TYPE disk_seek_seconds_total counter\n"
+            "disk_seek_seconds_total %g\n"
+            "# HELP disk_queue_depth Sector transfers waiting for the arm.\n"
+            "# TYPE disk_queue_depth gauge\n"
+            "disk_queue_depth %ld\n",
+            st.seek_tracks, (double)st.seek_tracks * (double)g_track_us / 1e6, st.queue_depth);
+    appendf(buf, cap, &len,
+            "# HELP disk_arm_mutex_acquisitions_total Acquisitions of the arm mutex.\n"
+            "# TYPE disk_arm_mutex_acquisitions_total counter\n"
+            "disk_arm_mutex_acquisitions_total %llu\n"
+            "# HELP disk_arm_mutex_wait_seconds_total Time spent blocked acquiring the arm mutex.\n"
+            "# TYPE disk_arm_mutex_wait_seconds_total counter\n"
+            "disk_arm_mutex_wait_seconds_total %g\n"
+            "# HELP disk_arm_mutex_hold_seconds_total Time the arm mutex was held.\n"
+            "# TYPE disk_arm_mutex_hold_seconds_total counter\n"
+            "disk_arm_mutex_hold_seconds_total %g\n",
+            st.arm_acquires, (double)st.arm_wait_ns / 1e9, (double)st.arm_hold_ns / 1e9);
+    appendf(buf, cap, &len,
+            "# HELP disk_arm_seek_tracks_total Tracks travelled, by arm.\n"
+            "# TYPE disk_arm_seek_tracks_total counter\n");
+    for (int k = 0; k < g_narms; k++) {
+        appendf(buf, cap, &len, "disk_arm_seek_tracks_total{arm=\"%d\"} %llu\n",
+                k, st.arm[k].seek_tracks);
+    }
+    appendf(buf, cap, &len,
+            "# HELP disk_arm_queue_depth Sector transfers waiting, by arm.\n"
+            "# TYPE disk_arm_queue_depth gauge\n");
+    for (int k = 0; k < g_narms; k++) {
+        appendf(buf, cap, &len, "disk_arm_queue_depth{arm=\"%d\"} %ld\n",
+                k, st.arm[k].queue_depth);
+    }
+    appendf(buf, cap, &len,
+            "# HELP disk_request_duration_seconds Read (R, RV) and write (W, WV) service time.\n"
+            "# TYPE disk_request_duration_seconds histogram\n");
+    append_prom_hist(buf, cap, &len, "read", &st.read_lat);
+    append_prom_hist(buf, cap, &len, "write", &st.write_lat);
+    return len;
+}
+
+// ------------- sector access through the scheduler -------------
+
+// read the n sectors named by the (c,s) pairs in cs[] into out
+// the transfers are queued together and serviced by the scheduler
+// returns 0 on success, or -1 (reading nothing) if any pair is invalid
+// or if the backing store failed
+static int read_sectors(long n, const long *cs, unsigned char *out) {
+    io_req_t reqs[MAX_VEC];
+
+    for (long i = 0; i < n; i++) {
+        if (!validate_cs(cs[2 * i], cs[2 * i + 1])) {
+            return -1;
+        }
+        reqs[i].c = cs[2 * i];
+        reqs[i].s = cs[2 * i + 1];
+        reqs[i].is_write = 0;
+        reqs[i].buf = out + i * BLKSZ;
+    }
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = submit_and_wait(reqs, n);
+    stats_io(0, n, &t0);
+    return rc;
+}
+
+// write n full sectors from data to the (c,s) pairs in cs[]
+// returns 0 on success, -1 (writing nothing) if any pair is invalid, or
+// -1 if the backing store failed (some sectors may have been written)
+static int write_sectors(long n, const long *cs, const unsigned char *data) {
+    io_req_t reqs[MAX_VEC];
+
+    for (long i = 0; i < n; i++) {
+        if (!validate_cs(cs[2 * i], cs[2 * i + 1])) {
+            return -1;
+        }
+        reqs[i].c = cs[2 * i];
+        reqs[i].s = cs[2 * i + 1];
+        reqs[i].is_write = 1;
+        reqs[i].buf = (unsigned char *)data + i * BLKSZ;
+    }
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = submit_and_wait(reqs, n);
+    stats_io(1, n, &t0);
+    return rc;
+}
+
+// ------------- command handlers for the ASCII disk protocol -------------
+
+// send a single status character ('0' or '1')
+static int reply_code(conn_t *cn, char code) {
+    return conn_send(cn, &code, 1);
+}
+
+// handle the "I" command: return "<cyl> <sec>\n"
+static int handle_I(conn_t *cn) {
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "%ld %ld\n", g_cyl, g_sec);
+    if (n < 0) {
+        return -1;
+    }
+    return conn_send(cn, buf, (size_t)n);
+}
+
+// handle "RV n c1 s1 ... cn sn" (and "R c s", which is RV with n = 1)
+//
+// on any invalid (c,s): send '0'
+// otherwise: seek to each sector in turn, then send '1' followed by
+// the n sectors back to back.  The sectors are read straight into the
+// output buffer, behind the status byte.
+static int handle_RV(conn_t *cn, long n, const long *cs) {
+    size_t len = (size_t)n * BLKSZ;
+    unsigned char *reply = conn_reserve(cn, 1 + len);
+    if (!reply) {
+        return -1;
+    }
+    if (read_sectors(n, cs, reply + 1) < 0) {
+        cn->out_len -= len;
+        reply[0] = '0';
+        return 0;
+    }
+    reply[0] = '1';
+    return 0;
+}
+
+// handle "W c s l" followed by l raw bytes
+//
+//    - on invalid cylinder/sector or bad length, send '0'
+//    - on success, write the data into the mapped disk sector
+//      (zero-filling any remaining bytes) and send '1'
+static int handle_W(conn_t *cn, long c, long s, long l) {
+    unsigned char buf[BLKSZ];
+
+    if (!validate_cs(c, s) || l < 0 || l > BLKSZ) {
+        return reply_code(cn, '0');
+    }
+
+    // read exactly l bytes of raw data from the client
+    if (l > 0) {
+        if (read_exact(cn, buf, (size_t)l) != l) {
+            return -1;
+        }
+    }
+
+    // zero-fill the remaining bytes in the sector
+    if (l < BLKSZ) {
+        memset(buf + l, 0, (size_t)(BLKSZ - l));
+    }
+
+    long cs[2] = { c, s };
+    return reply_code(cn, write_sectors(1, cs, buf) == 0 ? '1' : '0');
+}
+
+// handle "WV n c1 s1 ... cn sn" followed by n*128 raw bytes
+//
+//    - the payload is always read so the next command parses cleanly
+//    - if any (c,s) is invalid nothing is written and '0' is sent
+//    - otherwise all sectors are written in order and '1' is sent
+static int handle_WV(conn_t *cn, long n, const long *cs) {
+    unsigned char data[MAX_VEC * BLKSZ];
+    size_t len = (size_t)n * BLKSZ;
+
+    if (read_exact(cn, data, len) != (ssize_t)len) {
+        return -1;
+    }
+    return reply_code(cn, write_sectors(n, cs, data) == 0 ? '1' : '0');
+}
+
+// handle the "S" command: statistics as "name value" lines, ending
+// with an empty line
+static int handle_S(conn_t *cn) {
+    char buf[STATS_BUFSZ];
+    size_t n = format_stats(buf, sizeof(buf));
+    return conn_send(cn, buf, n);
+}
+
+// parse the "n c1 s1 ... cn sn" tail of an RV/WV command line
+//
+// p points just past the command name.  on success fills cs[] with
+// 2*n values and returns n; returns -1 if the line is malformed.
+static long parse_vec(const char *p, long cs[2 * MAX_VEC]) {
+    char *end;
+    long n = strtol(p, &end, 10);
+    if (end == p || n < 1 || n > MAX_VEC) {
+        return -1;
+    }
+    p = end;
+    for (long i = 0; i < 2 * n; i++) {
+        cs[i] = strtol(p, &end, 10);
+        if (end == p) {
+            return -1;
+        }
+        p = end;
+    }
+    return n;
+}
+
+// execute one ASCII command line
+// returns 0 to keep the connection open, -1 to close it
+static int handle_line(conn_t *cn, const char *line) {
+    long cs[2 * MAX_VEC];
+
+    if (line[0] == 'I') {
+        stats_op(ST_I);
+        return handle_I(cn);
+    } else if (line[0] == 'S') {
+        stats_op(ST_S);
+        return handle_S(cn);
+    } else if (line[0] == 'B') {
+        // switch this connection to the binary framed protocol
+        stats_op(ST_B);
+        cn->binary = 1;
+        return reply_code(cn, '1');
+    } else if (line[0] == 'R' && line[1] == 'V') {
+        long cnt = parse_vec(line + 2, cs);
+        if (cnt < 0) {
+            return -1;
+        }
+        stats_op(ST_RV);
+        return handle_RV(cn, cnt, cs);
+    } else if (line[0] == 'W' && line[1] == 'V') {
+        long cnt = parse_vec(line + 2, cs);
+        if (cnt < 0) {
+            return -1;
+        }
+        stats_op(ST_WV);
+        return handle_WV(cn, cnt, cs);
+    } else if (line[0] == 'R') {
+        if (sscanf(line, "R %ld %ld", &cs[0], &cs[1]) != 2) {
+            return -1; // malformed command: close connection
+        }
+        stats_op(ST_R);
+        return handle_RV(cn, 1, cs);
+    } else if (line[0] == 'W') {
+        long c, s, l;
+        if (sscanf(line, "W %ld %ld %ld", &c, &s, &l) != 3) {
+            return -1;
+        }
+        stats_op(ST_W);
+        return handle_W(cn, c, s, l);
+    }
+
+    // unknown command; stop talking to this client
+    return -1;
+}
+
+// ------------- binary framed protocol -------------
+
+// fill in a reply frame header
+static void bin_header(unsigned char *out, const unsigned char *req, int ok,
+                       uint16_t count, uint32_t len) {
+    out[0] = req[0];                      // echo opcode
+    out[1] = ok ? 1 : 0;
+    put_le16(out + 2, count);
+    memcpy(out + 4, req + 4, 4);          // echo request id
+    put_le32(out + 8, ok ? len : 0);
+}
+
+// send a reply frame header followed by len payload bytes
+static int bin_reply(conn_t *cn, const unsigned char *req, int ok,
+                     uint16_t count, const unsigned char *payload,
+                     uint32_t len) {
+    size_t n = BIN_RSP_HDR + ((ok && len > 0) ? len : 0);
+    unsigned char *out = conn_reserve(cn, n);
+    if (!out) {
+        return -1;
+    }
+    bin_header(out, req, ok, count, len);
+    if (n > BIN_RSP_HDR) {
+        memcpy(out + BIN_RSP_HDR, payload, len);
+    }
+    return 0;
+}
+
+// reply to R/RV: the sectors are read straight into the output buffer,
+// behind the frame header
+static int bin_read_reply(conn_t *cn, const unsigned char *req, long n, const long *cs) {
+    uint32_t len = (uint32_t)n * BLKSZ;
+    unsigned char *out = conn_reserve(cn, BIN_RSP_HDR + len);
+    if (!out) {
+        return -1;
+    }
+    int ok = read_sectors(n, cs, out + BIN_RSP_HDR) == 0;
+    if (!ok) {
+        cn->out_len -= len;
+    }
+    bin_header(out, req, ok, (uint16_t)n, len);
+    return 0;
+}
+
+// execute one binary request frame whose header is in hdr
+// returns 0 to keep the connection open, -1 to close it
+static int handle_frame(conn_t *cn, const unsigned char *hdr) {
+    unsigned char payload[MAX_VEC * 8 + MAX_VEC * BLKSZ];
+    unsigned char data[BLKSZ];
+    long cs[2 * MAX_VEC];
+
+    uint8_t  op    = hdr[0];
+    uint16_t count = get_le16(hdr + 2);
+    uint32_t len   = get_le32(hdr + 16);
+
+    if (len > sizeof(payload)) {
+        return -1;            // oversized frame: framing is lost
+    }
+    if (len > 0 && read_exact(cn, payload, len) != (ssize_t)len) {
+        return -1;
+    }
+
+    switch (op) {
+    case BIN_OP_I: {
+        stats_op(ST_I);
+        unsigned char geo[8];
+        put_le32(geo, (uint32_t)g_cyl);
+        put_le32(geo + 4, (uint32_t)g_sec);
+        return bin_reply(cn, hdr, 1, 1, geo, sizeof(geo));
+    }
+    case BIN_OP_R:
+        stats_op(ST_R);
+        cs[0] = get_le32(hdr + 8);
+        cs[1] = get_le32(hdr + 12);
+        return bin_read_reply(cn, hdr, 1, cs);
+    case BIN_OP_W:
+        stats_op(ST_W);
+        if (len > BLKSZ) {
+            return bin_reply(cn, hdr, 0, 1, NULL, 0);
+        }
+        cs[0] = get_le32(hdr + 8);
+        cs[1] = get_le32(hdr + 12);
+        memcpy(data, payload, len);
+        memset(data + len, 0, BLKSZ - len);
+        return bin_reply(cn, hdr, write_sectors(1, cs, data) == 0, 1,
+                         NULL, 0);
+    case BIN_OP_RV:
+    case BIN_OP_WV: {
+        size_t want = (size_t)count * 8;
+        if (op == BIN_OP_WV) {
+            want += (size_t)count * BLKSZ;
+        }
+        if (count < 1 || count > MAX_VEC || len != want) {
+            return -1;
+        }
+        for (long i = 0; i < 2L * count; i++) {
+            cs[i] = get_le32(payload + i * 4);
+        }
+        stats_op(op == BIN_OP_RV ? ST_RV : ST_WV);
+        if (op == BIN_OP_RV) {
+            return bin_read_reply(cn, hdr, count, cs);
+        }
+        int ok = write_sectors(count, cs, payload + (size_t)count * 8) == 0;
+        return bin_reply(cn, hdr, ok, count, NULL, 0);
+    }
+    case BIN_OP_S: {
+        stats_op(ST_S);
+        char text[STATS_BUFSZ];
+        size_t n = format_stats(text, sizeof(text));
+        return bin_reply(cn, hdr, 1, 1, (const unsigned char *)text, (uint32_t)n);
+    }
+    default:
+        return -1;            // unknown opcode
+    }
+}
+
+// read and execute the next command on the connection
+// returns 1 to continue, 0 on EOF, or -1 to close the connection
+static int exec_one(conn_t *cn) {
+    if (cn->binary) {
+        // fixed-size frame header, then its payload
+        unsigned char hdr[BIN_REQ_HDR];
+        ssize_t r = read_exact(cn, hdr, sizeof(hdr));
+        if (r != (ssize_t)sizeof(hdr)) {
+            return (r == 0) ? 0 : -1;
+        }
+        return (handle_frame(cn, hdr) < 0) ? -1 : 1;
+    }
+
+    // read a single command line from the client
+    char line[MAX_LINE];
+    ssize_t n = readline(cn, line);
+    if (n <= 0) {
+        return (n == 0) ? 0 : -1;
+    }
+
+    // ignore pure blank lines
+    if (line[0] == '\n' || line[0] == '\0') {
+        return 1;
+    }
+    return (handle_line(cn, line) < 0) ? -1 : 1;
+}
+
+// ------------- per-client worker thread -------------
 
-    // accept loop: spawn a detached thread per client
+static void *client_main(void *arg) {
+    client_arg_t *carg = (client_arg_t *)arg;
+    int fd = carg->client_fd;
+    free(carg);
+
+    conn_t *cn = calloc(1, sizeof(*cn));
+    if (!cn) {
+        close(fd);
+        return NULL;
+    }
+    cn->fd = fd;
+    stats_conn(+1);
+
+    // EOF or error terminates this connection; replies go out whenever
+    // the next command has to be waited for (see conn_fill)
+    while (exec_one(cn) > 0) {
+        if (cn->out_len >= OUT_FLUSH && conn_flush(cn) < 0) {
+            break;
+        }
+    }
+    conn_flush(cn);
+
+    stats_conn(-1);
+    close(fd);
+    free(cn->out);
+    free(cn);
+    return NULL;
+}
+
+static int spawn_detached(void *(*fn)(void *), void *arg);
+
+// ------------- event-loop front end (-e) -------------
+//
+// One thread runs epoll over non-blocking sockets.  It buffers input
+// until a complete command is present, then hands the connection to a
+// small fixed pool of workers, which execute the command (waiting on
+// the scheduler like any client thread would) and append the reply to
+// the connection's output buffer, along with the replies of any further
+// complete commands already buffered, so pipelined replies go out in
+// one send.  A connection has at most one command executing at a time,
+// so replies stay in order.
+
+static int g_epfd = -1;                 // epoll instance
+static int g_wake_fd = -1;              // eventfd: workers -> loop
+
+static pthread_mutex_t g_work_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_work_cv  = PTHREAD_COND_INITIALIZER;
+static conn_t *g_work_head = NULL, *g_work_tail = NULL;  // to workers
+static conn_t *g_done_head = NULL;                       // to the loop
+
+// length of the complete command at the front of cn->in
+// returns the byte count, 0 if more input is needed, or -1 if the
+// input can never form a valid command
+static long cmd_length(const conn_t *cn) {
+    const unsigned char *p = cn->in + cn->in_pos;
+    size_t avail = cn->in_len - cn->in_pos;
+
+    if (cn->binary) {
+        if (avail < BIN_REQ_HDR) {
+            return 0;
+        }
+        size_t len = get_le32(p + 16);
+        if (len > MAX_VEC * (8 + BLKSZ)) {
+            return -1;
+        }
+        return (avail >= BIN_REQ_HDR + len) ? (long)(BIN_REQ_HDR + len) : 0;
+    }
+
+    const unsigned char *nl = memchr(p, '\n', avail);
+    if (!nl) {
+        return (avail >= MAX_LINE - 1) ? -1 : 0;
+    }
+    size_t line_len = (size_t)(nl - p) + 1;
+    if (line_len >= MAX_LINE) {
+        return -1;
+    }
+
+    // W and WV carry raw bytes after the line; mirror what the
+    // handlers will consume so the command is present in full
+    char line[MAX_LINE];
+    memcpy(line, p, line_len);
+    line[line_len] = '\0';
+    size_t payload = 0;
+    if (line[0] == 'W' && line[1] == 'V') {
+        long cs[2 * MAX_VEC];
+        long cnt = parse_vec(line + 2, cs);
+        payload = (cnt > 0) ? (size_t)cnt * BLKSZ : 0;
+    } else if (line[0] == 'W') {
+        long c, s, l;
+        if (sscanf(line, "W %ld %ld %ld", &c, &s, &l) == 3 &&
+            validate_cs(c, s) && l > 0 && l <= BLKSZ) {
+            payload = (size_t)l;
+        }
+    }
+    return (avail >= line_len + payload) ? (long)(line_len + payload) : 0;
+}
+
+// re-arm cn for the given events; connections are registered
+// EPOLLONESHOT, so one that is with a worker gets no events at all
+static void ev_watch(conn_t *cn, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = cn;
+    epoll_ctl(g_epfd, EPOLL_CTL_MOD, cn->fd, &ev);
+}
+
+static void ev_close(conn_t *cn) {
+    stats_conn(-1);
+    epoll_ctl(g_epfd, EPOLL_CTL_DEL, cn->fd, NULL);
+    close(cn->fd);
+    free(cn->out);
+    free(cn);
+}
+
+// flush as much buffered output as the socket accepts
+// returns 1 when everything is sent, 0 if the socket is full, -1 on error
+static int ev_flush(conn_t *cn) {
+    while (cn->out_sent < cn->out_len) {
+        ssize_t w = send(cn->fd, cn->out + cn->out_sent,
+                         cn->out_len - cn->out_sent, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        cn->out_sent += (size_t)w;
+    }
+    cn->out_len = cn->out_sent = 0;
+    return 1;
+}
+
+// advance an idle connection: flush output, then either dispatch the
+// next buffered command or go back to waiting for input
+static void ev_progress(conn_t *cn) {
+    int f = ev_flush(cn);
+    if (f < 0) {
+        ev_close(cn);
+        return;
+    }
+    if (f == 0) {
+        ev_watch(cn, EPOLLOUT);       // resume when the socket drains
+        return;
+    }
+    if (cn->closing) {
+        ev_close(cn);
+        return;
+    }
+
+    long need = cmd_length(cn);
+    if (need < 0 || (need == 0 && cn->peer_eof)) {
+        ev_close(cn);
+        return;
+    }
+    if (need == 0) {
+        // keep unread bytes at the front so a full command always fits
+        if (cn->in_pos > 0) {
+            memmove(cn->in, cn->in + cn->in_pos, cn->in_len - cn->in_pos);
+            cn->in_len -= cn->in_pos;
+            cn->in_pos = 0;
+        }
+        ev_watch(cn, EPOLLIN | EPOLLRDHUP);
+        return;
+    }
+
+    // hand the connection to a worker; it stays disarmed meanwhile
+    pthread_mutex_lock(&g_work_mtx);
+    cn->next = NULL;
+    if (g_work_tail) {
+        g_work_tail->next = cn;
+    } else {
+        g_work_head = cn;
+    }
+    g_work_tail = cn;
+    pthread_cond_signal(&g_work_cv);
+    pthread_mutex_unlock(&g_work_mtx);
+}
+
+// read everything the socket has into cn->in
+static void ev_read(conn_t *cn) {
+    for (;;) {
+        if (cn->in_len == IN_BUFSZ) {
+            if (cn->in_pos == 0) {
+                break;                // full: ev_progress will parse
+            }
+            memmove(cn->in, cn->in + cn->in_pos, cn->in_len - cn->in_pos);
+            cn->in_len -= cn->in_pos;
+            cn->in_pos = 0;
+        }
+        ssize_t r = recv(cn->fd, cn->in + cn->in_len, IN_BUFSZ - cn->in_len, 0);
+        if (r > 0) {
+            cn->in_len += (size_t)r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // EOF or error: finish whatever is complete, then close
+        cn->peer_eof = 1;
+        break;
+    }
+    ev_progress(cn);
+}
+
+// worker thread: execute one command per dequeued connection
+static void *ev_worker_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_work_mtx);
+        while (g_work_head == NULL) {
+            pthread_cond_wait(&g_work_cv, &g_work_mtx);
+        }
+        conn_t *cn = g_work_head;
+        g_work_head = cn->next;
+        if (g_work_head == NULL) {
+            g_work_tail = NULL;
+        }
+        pthread_mutex_unlock(&g_work_mtx);
+
+        // the whole command is buffered, so this never blocks on input;
+        // run the ones after it too while they are complete
+        do {
+            if (exec_one(cn) < 0) {
+                cn->closing = 1;
+            }
+        } while (!cn->closing && cn->out_len < OUT_FLUSH && cmd_length(cn) > 0);
+
+        pthread_mutex_lock(&g_work_mtx);
+        cn->next = g_done_head;
+        g_done_head = cn;
+        pthread_mutex_unlock(&g_work_mtx);
+        uint64_t one = 1;
+        if (write(g_wake_fd, &one, sizeof(one)) < 0) {
+            perror("eventfd write");
+        }
+    }
+    return NULL;
+}
+
+// run the event loop on the listening socket srv until g_stop is set
+static int run_event_loop(int srv, int nworkers) {
+    g_epfd = epoll_create1(0);
+    g_wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (g_epfd < 0 || g_wake_fd < 0) {
+        perror("epoll/eventfd");
+        return -1;
+    }
+
+    // NULL data.ptr marks the listener; &g_wake_fd marks the eventfd
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, srv, &ev);
+    ev.data.ptr = &g_wake_fd;
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, g_wake_fd, &ev);
+    fcntl(srv, F_SETFL, fcntl(srv, F_GETFL) | O_NONBLOCK);
+
+    for (int i = 0; i < nworkers; i++) {
+        if (spawn_detached(ev_worker_main, NULL) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+
+    struct epoll_event evs[64];
     while (!g_stop) {
+        int n = epoll_wait(g_epfd, evs, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;             // g_stop is re-checked
+            }
+            perror("epoll_wait");
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data.ptr == NULL) {
+                // accept every pending connection
+                for (;;) {
+                    int cfd = accept4(srv, NULL, NULL, SOCK_NONBLOCK);
+                    if (cfd < 0) {
+                        break;
+                    }
+                    conn_t *cn = calloc(1, sizeof(*cn));
+                    if (!cn) {
+                        close(cfd);
+                        continue;
+                    }
+                    int one = 1;
+                    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    cn->fd = cfd;
+                    cn->evented = 1;
+                    stats_conn(+1);
+                    struct epoll_event cev;
+                    memset(&cev, 0, sizeof(cev));
+                    cev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                    cev.data.ptr = cn;
+                    epoll_ctl(g_epfd, EPOLL_CTL_ADD, cfd, &cev);
+                }
+            } else if (evs[i].data.ptr == &g_wake_fd) {
+                // pick up connections whose command finished
+                uint64_t cnt;
+                if (read(g_wake_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+                    perror("eventfd read");
+                }
+                pthread_mutex_lock(&g_work_mtx);
+                conn_t *done = g_done_head;
+                g_done_head = NULL;
+                pthread_mutex_unlock(&g_work_mtx);
+                while (done) {
+                    conn_t *next = done->next;
+                    ev_progress(done);
+                    done = next;
+                }
+            } else {
+                conn_t *cn = evs[i].data.ptr;
+                if (evs[i].events & EPOLLOUT) {
+                    ev_progress(cn);
+                } else {
+                    ev_read(cn);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// ------------- Prometheus metrics endpoint (-m) -------------
+//
+// A single thread answers HTTP/1.0 scrapes one at a time: "GET /metrics"
+// gets the statistics in the Prometheus text format, anything else a
+// 404.  Scrapes are rare, so there is no need for more than this.
+
+// answer one HTTP request on cfd
+static void metrics_serve(int cfd) {
+    // a slow or silent scraper must not hold up the next one
+    struct timeval tv = { 1, 0 };
+    setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // the request line is all we need; read until the end of the headers
+    char req[1024];
+    size_t got = 0;
+    while (got < sizeof(req) - 1) {
+        ssize_t r = recv(cfd, req + got, sizeof(req) - 1 - got, 0);
+        if (r <= 0) {
+            break;
+        }
+        got += (size_t)r;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) {
+            break;
+        }
+    }
+    req[got] = '\0';
+
+    int ok = strncmp(req, "GET /metrics", 12) == 0 &&
+             (req[12] == ' ' || req[12] == '?' || req[12] == '\r' || req[12] == '\n');
+
+    static char body[PROM_BUFSZ];       // only this thread uses it
+    size_t blen;
+    if (ok) {
+        blen = format_prometheus(body, sizeof(body));
+    } else {
+        blen = (size_t)snprintf(body, sizeof(body), "not found\n");
+    }
+
+    char head[256];
+    int hlen = snprintf(head, sizeof(head),
+                        "HTTP/1.0 %s\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: close\r\n\r\n",
+                        ok ? "200 OK" : "404 Not Found",
+                        ok ? "text/plain; version=0.0.4" : "text/plain",
+                        blen);
+    if (send(cfd, head, (size_t)hlen, MSG_NOSIGNAL) == hlen) {
+        send(cfd, body, blen, MSG_NOSIGNAL);
+    }
+}
+
+static void *metrics_main(void *arg) {
+    int msrv = *(int *)arg;
+    free(arg);
+
+    for (;;) {
+        int cfd = accept(msrv, NULL, NULL);
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("metrics accept");
+            return NULL;
+        }
+        metrics_serve(cfd);
+        close(cfd);
+    }
+}
+
+// listen on port and start the metrics thread; returns 0 on success
+static int start_metrics(int port) {
+    int msrv = socket(AF_INET, SOCK_STREAM, 0);
+    if (msrv < 0) {
+        perror("metrics socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(msrv, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+    if (bind(msrv, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(msrv, BACKLOG) < 0) {
+        perror("metrics bind/listen");
+        close(msrv);
+        return -1;
+    }
+
+    int *arg = malloc(sizeof(*arg));
+    if (!arg) {
+        close(msrv);
+        return -1;
+    }
+    *arg = msrv;
+    if (spawn_detached(metrics_main, arg) != 0) {
+        perror("pthread_create");
+        free(arg);
+        close(msrv);
+        return -1;
+    }
+    return 0;
+}
+
+// ------------- signal handler and main program -------------
+
+// SIGINT handler: set a flag to tell the accept loop to exit
+static void on_sigint(int signo) {
+    (void)signo;
+    g_stop = 1;
+}
+
+// pick a scheduling policy by name; returns 0 on success
+static int parse_policy(const char *name) {
+    for (int i = 0; i <= POL_CLOOK; i++) {
+        if (strcmp(name, g_policy_names[i]) == 0) {
+            g_policy = (sched_policy_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// pick a storage backend by name, optionally followed by ",populate"
+// and/or ",huge" for mmap; returns 0 on success
+static int parse_backend(const char *spec) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char *save = NULL;
+    char *name = strtok_r(buf, ",", &save);
+    if (name == NULL) {
+        return -1;
+    }
+    g_be = NULL;
+    for (size_t i = 0; i < sizeof(g_backends) / sizeof(g_backends[0]); i++) {
+        if (strcmp(name, g_backends[i].name) == 0) {
+            g_be = &g_backends[i];
+        }
+    }
+    for (char *f; g_be && (f = strtok_r(NULL, ",", &save)) != NULL; ) {
+        if (g_be != &g_backends[0]) {
+            return -1;
+        } else if (strcmp(f, "populate") == 0) {
+            g_be_flags |= BE_POPULATE;
+        } else if (strcmp(f, "huge") == 0) {
+            g_be_flags |= BE_HUGE;
+        } else {
+            return -1;
+        }
+    }
+    return g_be ? 0 : -1;
+}
+
+// "never", "always" or a period in milliseconds; returns 0 on success
+static int parse_sync(const char *arg) {
+    char *end;
+    if (strcmp(arg, "never") == 0) {
+        g_sync_ms = 0;
+    } else if (strcmp(arg, "always") == 0) {
+        g_sync_ms = SYNC_ALWAYS;
+    } else if ((g_sync_ms = strtol(arg, &end, 10)) <= 0 || *end) {
+        return -1;
+    }
+    return 0;
+}
+
+// start fn in a detached thread with SIGINT/SIGTERM blocked, so those
+// signals are always delivered to the main thread's accept()
+static int spawn_detached(void *(*fn)(void *), void *arg) {
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    pthread_t tid;
+    int rc = pthread_create(&tid, NULL, fn, arg);
+    if (rc == 0) {
+        pthread_detach(tid);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    // usage: ./disk_server [-p policy] [-e workers] [-m metrics_port] [-b backend] [-s sync] [-k arms] <port> <cylinders> <sectors> <track_us> <backing_file>
+    int opt;
+    int ev_workers = 0;        // 0: thread per connection
+    int metrics_port = 0;      // 0: no metrics endpoint
+    while ((opt = getopt(argc, argv, "p:e:m:b:s:k:")) != -1) {
+        if (opt == 'p' && parse_policy(optarg) == 0) {
+            continue;
+        }
+        if (opt == 'e' && (ev_workers = atoi(optarg)) > 0) {
+            continue;
+        }
+        if (opt == 'm' && (metrics_port = atoi(optarg)) > 0) {
+            continue;
+        }
+        if (opt == 'b' && parse_backend(optarg) == 0) {
+            continue;
+        }
+        if (opt == 's' && parse_sync(optarg) == 0) {
+            continue;
+        }
+        if (opt == 'k' && (g_narms = atoi(optarg)) > 0 && g_narms <= ARMS_MAX) {
+            continue;
+        }
+        argc = 0; // force the usage message
+        break;
+    }
+
+    if (argc - optind != 5) {
+        fprintf(stderr,
+                "Usage: %s [-p fcfs|sstf|scan|look|clook] [-e workers] [-m metrics_port] "
+                "[-b mmap[,populate][,huge]|pio|direct|uring] [-s never|always|ms] [-k arms] <port> <cylinders> <sectors> <track_us> <backing_file>\n",
+                argv[0]);
+        return 2;
+    }
+    argv += optind - 1;
+
+    int  port = atoi(argv[1]);
+    g_cyl      = strtol(argv[2], NULL, 10);
+    g_sec      = strtol(argv[3], NULL, 10);
+    g_track_us = strtol(argv[4], NULL, 10);
+    const char *path = argv[5];
+
+    if (g_cyl <= 0 || g_sec <= 0) {
+        fprintf(stderr, "cylinders and sectors must both be > 0\n");
+        return 2;
+    }
+    if (g_narms > g_cyl) {
+        fprintf(stderr, "cannot have more arms than cylinders\n");
+        return 2;
+    }
+    arms_init();
+
+    size_t total_bytes = (size_t)g_cyl * (size_t)g_sec * BLKSZ;
+
+    // open (or create) the backing file for the simulated disk
+    if (g_be->open(path, total_bytes) < 0) {
+        return 1;
+    }
+
+    // create listening socket
+    int srv = socket(AF_INET, SOCK_STREAM, 0);
+    if (srv < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    opt = 1;
+    setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port        = htons((uint16_t)port);
+
+    if (bind(srv, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    if (listen(srv, BACKLOG) < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    // arrange to stop on Ctrl-C or kill; no SA_RESTART so accept()
+    // returns EINTR and the loop can notice g_stop
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigint;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &g_start_time);
+
+    // each arm is owned by a scheduler thread of its own
+    for (int k = 0; k < g_narms; k++) {
+        if (spawn_detached(sched_main, &g_arms[k]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    if (g_sync_ms > 0 && spawn_detached(syncer_main, NULL) != 0) {
+        perror("pthread_create");
+        return 1;
+    }
+
+    if (metrics_port > 0 && start_metrics(metrics_port) < 0) {
+        return 1;
+    }
+
+    char sd[24];
+    fprintf(stderr,
+            "[disk_server] port=%d geom=%ldx%ld track=%ldus file=%s policy=%s mode=%s "
+            "backend=%s sync=%s arms=%d\n",
+            port, g_cyl, g_sec, g_track_us, path, g_policy_names[g_policy],
+            ev_workers ? "epoll" : "threads", g_be->name, sync_desc(sd, sizeof(sd)), g_narms);
+
+    if (ev_workers > 0 && run_event_loop(srv, ev_workers) < 0) {
+        return 1;
+    }
+
+    // accept loop: spawn a detached thread per client
+    while (!g_stop && ev_workers == 0) {
         struct sockaddr_in cli;
         socklen_t cl = sizeof(cli);
 
@@ -422,22 +2583,26 @@ int main(int argc, char **argv) {
             close(cfd);
             continue;
         }
+        // replies are coalesced in out[], so Nagle would only delay them
+        int one = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
         arg->client_fd = cfd;
 
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, client_main, arg) == 0) {
-            pthread_detach(tid);
-        } else {
+        if (spawn_detached(client_main, arg) != 0) {
             perror("pthread_create");
             close(cfd);
             free(arg);
         }
     }
 
+    report_stats();
+
     // clean up global resources
     close(srv);
-    munmap(g_base, total_bytes);
-    close(g_fd);
+    if (be_sync() < 0) {
+        perror("sync");
+    }
+    g_be->close();
 
     return 0;
 }
@@ -0,0 +1,633 @@
+// Problem 4: Load generator for the filesystem server.
+//
+// fs_bench opens many connections to fs_server and runs a weighted mix
+// of C / W / R / D / L (plus RR and A) on each, closed loop: every
+// connection sends its next command as soon as the previous reply is in.
+//
+// Usage:
+//
+//   ./fs_bench [options] <host> <port>
+//
+//   -c conns      concurrent connections, one thread each (default 8)
+//   -m mix        op weights, e.g. "C=5,W=30,R=50,D=5,L=2,RR=5,A=3"
+//                 (default C=10,W=30,R=50,D=10; unnamed ops get 0)
+//   -s sizes      W/A/RR sizes in bytes: "n", "lo-hi" (log-uniform, so
+//                 small and large files both show up) or a list "a,b,c"
+//                 (default 128-65536)
+//   -f files      files per connection (default 4); they all go in the
+//                 root directory, whose size is set when it is formatted
+//                 ("F cs n", n entries, 64 by default, which is also what
+//                 -F gives), so keep conns * files below that
+//   -d seconds    measured run time (default 5)
+//   -W seconds    warmup before measuring (default 0)
+//   -F            format the filesystem first (destroys its contents)
+//   -k            keep the files at the end instead of deleting them
+//   -D host:port  also probe disk_server directly: one R of sector
+//                 (0,0) every 20 ms on its own connection, reported as
+//                 the "disk_R" row, so a slow run can be pinned on the
+//                 filesystem or on the disk underneath it
+//   -S seed       random seed (default 1)
+//   -o format     report as text (default), csv or json
+//
+// Each connection works on its own files (fb<conn>_<i>) and tracks their
+// lengths, so every reply can be checked: a wrong code or length counts
+// as an error for that op.  L has no end marker in the protocol; libfs's
+// fc_list() sends "R" of a name that never exists right behind it and
+// takes its "1 0 " reply as the end of the listing, so L latency
+// includes that R.
+//
+// The report has one row per op type with the count, errors, ops/s,
+// MB/s of file data moved and the mean, p50, p90, p99, p999 and max
+// latency in microseconds, from per-thread log-linear histograms (bench.h).
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "libdisk.h"
+#include "libfs.h"
+
+#define MAXLINE 4096
+#define MAXSIZES 32
+
+enum { OP_C, OP_W, OP_R, OP_D, OP_L, OP_RR, OP_A, OP_DISK, NOPS };
+static const char *op_names[NOPS] = { "C", "W", "R", "D", "L", "RR", "A", "disk_R" };
+
+typedef struct {
+    const char *host;
+    int port;
+    int conns;
+    int weight[OP_DISK];
+    int weight_sum;
+    uint32_t sizes[MAXSIZES];
+    int nsizes;
+    bool size_range;      // sizes[0]..sizes[1], log-uniform
+    int files;
+    double duration_s, warmup_s;
+    bool keep;
+    unsigned int seed;
+    char disk_host[64];
+    int disk_port;        // 0: no disk probe
+    uint64_t warm_end_ns, stop_ns;
+} config_t;
+
+typedef struct {
+    const config_t *cfg;
+    int id;
+    hist_t hist[NOPS];
+    int failed;
+} worker_t;
+
+// ---------------------------------------------------------------------
+// time helpers
+
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+// ---------------------------------------------------------------------
+// sizes
+
+static uint32_t pick_size(const config_t *cfg, uint64_t *rng) {
+    if (cfg->size_range) {
+        // log-uniform: pick a power of two band, then a point inside it
+        uint32_t lo = cfg->sizes[0], hi = cfg->sizes[1];
+        uint32_t lo1 = lo ? lo : 1;
+        int blo = 31 - __builtin_clz(lo1), bhi = 31 - __builtin_clz(hi ? hi : 1);
+        int b = blo + (int)rng_below(rng, (uint64_t)(bhi - blo + 1));
+        uint64_t from = (uint64_t)1 << b, to = ((uint64_t)1 << (b + 1)) - 1;
+        if (from < lo) {
+            from = lo;
+        }
+        if (to > hi) {
+            to = hi;
+        }
+        return (uint32_t)(from + rng_below(rng, to - from + 1));
+    }
+    return cfg->sizes[rng_below(rng, (uint64_t)cfg->nsizes)];
+}
+
+// ---------------------------------------------------------------------
+// FS commands; each returns 1 if the reply matched what the tracked file
+// state predicts, 0 if not, -1 if the connection failed
+
+static int fs_simple(fc_conn_t *fc, const char *cmd, char want) {
+    char line[MAXLINE];
+    if (fc_cmd(fc, cmd, NULL, 0, line, sizeof(line)) == -1) {
+        return -1;
+    }
+    return line[0] == want && line[1] == '\0';
+}
+
+// W/A/WR: header then payload, sent together
+static int fs_write(fc_conn_t *fc, const char *hdr, const unsigned char *data, uint32_t len) {
+    char line[MAXLINE];
+    if (fc_cmd(fc, hdr, data, len, line, sizeof(line)) == -1) {
+        return -1;
+    }
+    return strcmp(line, "0") == 0;
+}
+
+// R/RR: "code len data\n"; *got is set to len
+static int fs_read(fc_conn_t *fc, const char *cmd, int want_code, long want_len, long *got) {
+    size_t len = 0;
+    int code = fc_read(fc, cmd, NULL, 0, &len);
+    if (code < 0) {
+        return -1;
+    }
+    *got = (long)len;
+    return code == want_code && (want_len < 0 || (long)len == want_len);
+}
+
+// L: a listing of an unformatted filesystem is "(unformatted)" alone
+static void list_line(const char *line, void *arg) {
+    if (strcmp(line, "(unformatted)") == 0) {
+        *(int *)arg = 1;
+    }
+}
+
+static int fs_list(fc_conn_t *fc, int brief) {
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "L %d\n", brief);
+    int unformatted = 0;
+    if (fc_list(fc, cmd, list_line, &unformatted) < 0) {
+        return -1;
+    }
+    return !unformatted;
+}
+
+// ---------------------------------------------------------------------
+// worker thread
+
+static int pick_op(const config_t *cfg, uint64_t *rng) {
+    int r = (int)rng_below(rng, (uint64_t)cfg->weight_sum);
+    for (int op = 0; op < OP_DISK; op++) {
+        if (r < cfg->weight[op]) {
+            return op;
+        }
+        r -= cfg->weight[op];
+    }
+    return OP_R;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    const config_t *cfg = w->cfg;
+
+    fc_conn_t *fc = malloc(sizeof(*fc));
+    if (fc == NULL || fc_open(fc, cfg->host, cfg->port) < 0) {
+        free(fc);
+        w->failed = 1;
+        return NULL;
+    }
+    long *len = calloc((size_t)cfg->files, sizeof(long));   // -1: file absent
+    uint32_t maxsz = 0;
+    for (int i = 0; i < cfg->nsizes; i++) {
+        if (cfg->sizes[i] > maxsz) {
+            maxsz = cfg->sizes[i];
+        }
+    }
+    unsigned char *data = malloc((size_t)maxsz + 1);
+    if (!len || !data) {
+        perror("malloc");
+        w->failed = 1;
+        goto out;
+    }
+    memset(data, 'a' + w->id % 26, (size_t)maxsz + 1);
+
+    uint64_t rng = ((uint64_t)cfg->seed << 20) ^ (0x9E3779B97F4A7C15ULL * (uint64_t)(w->id + 1));
+    if (rng == 0) {
+        rng = 1;
+    }
+
+    // start from a known state: none of this connection's files exist
+    char cmd[128];
+    for (int i = 0; i < cfg->files; i++) {
+        snprintf(cmd, sizeof(cmd), "D fb%d_%d\n", w->id, i);
+        if (fs_simple(fc, cmd, '0') < 0) {
+            w->failed = 1;
+            goto out;
+        }
+        len[i] = -1;
+    }
+
+    for (;;) {
+        uint64_t begin = now_ns();
+        if (begin >= cfg->stop_ns) {
+            break;
+        }
+        int op = pick_op(cfg, &rng);
+        int f = (int)rng_below(&rng, (uint64_t)cfg->files);
+        if (op != OP_C && op != OP_L && len[f] < 0) {
+            op = OP_C; // everything else needs the file to exist
+        }
+
+        char name[48];
+        snprintf(name, sizeof(name), "fb%d_%d", w->id, f);
+        int rc = 0;
+        uint64_t bytes = 0;
+        long got = 0;
+        switch (op) {
+        case OP_C:
+            snprintf(cmd, sizeof(cmd), "C %s\n", name);
+            rc = fs_simple(fc, cmd, len[f] < 0 ? '0' : '1');
+            if (rc > 0 && len[f] < 0) {
+                len[f] = 0;
+            }
+            break;
+        case OP_D:
+            snprintf(cmd, sizeof(cmd), "D %s\n", name);
+            rc = fs_simple(fc, cmd, '0');
+            if (rc > 0) {
+                len[f] = -1;
+            }
+            break;
+        case OP_W: {
+            uint32_t n = pick_size(cfg, &rng);
+            snprintf(cmd, sizeof(cmd), "W %s %u\n", name, n);
+            rc = fs_write(fc, cmd, data, n);
+            if (rc > 0) {
+                len[f] = n;
+            }
+            bytes = n;
+            break;
+        }
+        case OP_A: {
+            uint32_t n = pick_size(cfg, &rng);
+            snprintf(cmd, sizeof(cmd), "A %s %u\n", name, n);
+            rc = fs_write(fc, cmd, data, n);
+            if (rc > 0) {
+                len[f] += n;
+            }
+            bytes = n;
+            break;
+        }
+        case OP_R:
+            snprintf(cmd, sizeof(cmd), "R %s\n", name);
+            rc = fs_read(fc, cmd, 0, len[f], &got);
+            bytes = (uint64_t)got;
+            break;
+        case OP_RR: {
+            uint32_t n = pick_size(cfg, &rng);
+            uint32_t off = len[f] > 0 ? (uint32_t)rng_below(&rng, (uint64_t)len[f]) : 0;
+            long want = len[f] - (long)off < (long)n ? len[f] - (long)off : (long)n;
+            snprintf(cmd, sizeof(cmd), "RR %s %u %u\n", name, off, n);
+            rc = fs_read(fc, cmd, 0, want, &got);
+            bytes = (uint64_t)got;
+            break;
+        }
+        case OP_L:
+            rc = fs_list(fc, (int)rng_below(&rng, 2));
+            break;
+        }
+        if (rc < 0) {
+            fprintf(stderr, "[fs_bench] connection %d: %s failed\n", w->id, op_names[op]);
+            w->failed = 1;
+            break;
+        }
+        // a failed W leaves the length unknown; forget the file
+        if (rc == 0 && (op == OP_W || op == OP_A)) {
+            snprintf(cmd, sizeof(cmd), "D %s\n", name);
+            if (fs_simple(fc, cmd, '0') < 0) {
+                w->failed = 1;
+                break;
+            }
+            len[f] = -1;
+        }
+
+        uint64_t end = now_ns();
+        if (begin >= cfg->warm_end_ns) {
+            hist_record(&w->hist[op], end - begin);
+            w->hist[op].bytes += bytes;
+            if (rc == 0) {
+                w->hist[op].errors++;
+            }
+        }
+    }
+
+    if (!cfg->keep && !w->failed) {
+        for (int i = 0; i < cfg->files; i++) {
+            if (len[i] >= 0) {
+                snprintf(cmd, sizeof(cmd), "D fb%d_%d\n", w->id, i);
+                if (fs_simple(fc, cmd, '0') < 0) {
+                    break;
+                }
+            }
+        }
+    }
+
+out:
+    free(len);
+    free(data);
+    fc_close(fc);
+    free(fc);
+    return NULL;
+}
+
+// disk probe: one ASCII "R 0 0" every 20 ms, straight to disk_server
+static void *probe_main(void *arg) {
+    worker_t *w = arg;
+    const config_t *cfg = w->cfg;
+
+    dc_conn_t *d = malloc(sizeof(*d));
+    if (d == NULL || dc_open(d, cfg->disk_host, cfg->disk_port, 0) < 0) {
+        free(d);
+        w->failed = 1;
+        return NULL;
+    }
+    unsigned char buf[DC_BLKSZ];
+    while (now_ns() < cfg->stop_ns) {
+        uint64_t begin = now_ns();
+        int rc = dc_read(d, 0, 0, buf);
+        if (rc < 0) {
+            w->failed = 1;
+            break;
+        }
+        uint64_t end = now_ns();
+        if (begin >= cfg->warm_end_ns) {
+            hist_record(&w->hist[OP_DISK], end - begin);
+            if (rc != 1) {
+                w->hist[OP_DISK].errors++;
+            }
+        }
+        struct timespec nap = { 0, 20 * 1000000L };
+        nanosleep(&nap, NULL);
+    }
+    dc_close(d);
+    free(d);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------
+// report
+
+static void report(const char *fmt, const hist_t *h, double secs) {
+    bool json = strcmp(fmt, "json") == 0;
+    bool csv = strcmp(fmt, "csv") == 0;
+    bool first = true;
+
+    if (csv) {
+        printf("op,count,errors,ops_per_sec,mb_per_sec,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    } else if (json) {
+        printf("{\"seconds\": %.3f, \"ops\": [", secs);
+    } else {
+        printf("%-6s %9s %7s %10s %8s %9s %9s %9s %9s %9s %9s\n", "op", "count", "errors", "ops/s", "MB/s",
+               "mean_us", "p50_us", "p90_us", "p99_us", "p999_us", "max_us");
+    }
+
+    for (int op = 0; op < NOPS + 1; op++) {
+        // the last row sums the FS ops (not the disk probe)
+        hist_t all;
+        const hist_t *x = &h[op < NOPS ? op : 0];
+        const char *name = op < NOPS ? op_names[op] : "all";
+        if (op == NOPS) {
+            memset(&all, 0, sizeof(all));
+            for (int i = 0; i < OP_DISK; i++) {
+                hist_merge(&all, &h[i]);
+            }
+            x = &all;
+        }
+        if (x->total == 0) {
+            continue;
+        }
+        double mean = x->sum_ns / (double)x->total / 1e3;
+        double tput = secs > 0 ? (double)x->total / secs : 0.0;
+        double mbs = secs > 0 ? (double)x->bytes / secs / 1e6 : 0.0;
+        double p50 = hist_quantile(x, 0.50) / 1e3, p90 = hist_quantile(x, 0.90) / 1e3;
+        double p99 = hist_quantile(x, 0.99) / 1e3, p999 = hist_quantile(x, 0.999) / 1e3;
+        double mx = x->max_ns / 1e3;
+        if (csv) {
+            printf("%s,%llu,%llu,%.1f,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", name, (unsigned long long)x->total,
+                   (unsigned long long)x->errors, tput, mbs, mean, p50, p90, p99, p999, mx);
+        } else if (json) {
+            printf("%s{\"op\": \"%s\", \"count\": %llu, \"errors\": %llu, \"ops_per_sec\": %.1f, "
+                   "\"mb_per_sec\": %.3f, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+                   "\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+                   first ? "" : ", ", name, (unsigned long long)x->total, (unsigned long long)x->errors, tput, mbs,
+                   mean, p50, p90, p99, p999, mx);
+        } else {
+            printf("%-6s %9llu %7llu %10.1f %8.3f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+                   (unsigned long long)x->total, (unsigned long long)x->errors, tput, mbs, mean, p50, p90, p99,
+                   p999, mx);
+        }
+        first = false;
+    }
+    if (json) {
+        printf("]}\n");
+    }
+}
+
+// ---------------------------------------------------------------------
+// option parsing
+
+static int parse_mix(config_t *cfg, const char *spec) {
+    memset(cfg->weight, 0, sizeof(cfg->weight));
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s", spec);
+    for (char *tok = strtok(tmp, ","); tok; tok = strtok(NULL, ",")) {
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            return -1;
+        }
+        *eq = '\0';
+        int op = -1;
+        for (int i = 0; i < OP_DISK; i++) {
+            if (strcmp(tok, op_names[i]) == 0) {
+                op = i;
+            }
+        }
+        int v = atoi(eq + 1);
+        if (op < 0 || v < 0) {
+            return -1;
+        }
+        cfg->weight[op] = v;
+    }
+    cfg->weight_sum = 0;
+    for (int i = 0; i < OP_DISK; i++) {
+        cfg->weight_sum += cfg->weight[i];
+    }
+    return cfg->weight_sum > 0 ? 0 : -1;
+}
+
+static int parse_sizes(config_t *cfg, const char *spec) {
+    cfg->nsizes = 0;
+    cfg->size_range = false;
+    unsigned long lo, hi;
+    char dash;
+    if (sscanf(spec, "%lu%c%lu", &lo, &dash, &hi) == 3 && dash == '-') {
+        if (lo > hi || hi > (1UL << 30)) {
+            return -1;
+        }
+        cfg->size_range = true;
+        cfg->sizes[0] = (uint32_t)lo;
+        cfg->sizes[1] = (uint32_t)hi;
+        cfg->nsizes = 2;
+        return 0;
+    }
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s", spec);
+    for (char *tok = strtok(tmp, ","); tok; tok = strtok(NULL, ",")) {
+        char *end;
+        unsigned long v = strtoul(tok, &end, 10);
+        if (*end != '\0' || v > (1UL << 30) || cfg->nsizes == MAXSIZES) {
+            return -1;
+        }
+        cfg->sizes[cfg->nsizes++] = (uint32_t)v;
+    }
+    return cfg->nsizes > 0 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-c conns] [-m C=10,W=30,R=50,D=10,L=0,RR=0,A=0] [-s lo-hi|a,b,c] [-f files]\n"
+            "       [-d seconds] [-W warmup_s] [-F] [-k] [-D disk_host:port] [-S seed] [-o text|csv|json]\n"
+            "       <host> <port>\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    config_t cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.conns = 8;
+    cfg.files = 4;
+    cfg.duration_s = 5;
+    cfg.seed = 1;
+    parse_mix(&cfg, "C=10,W=30,R=50,D=10");
+    parse_sizes(&cfg, "128-65536");
+    const char *fmt = "text";
+    bool format = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:m:s:f:d:W:FkD:S:o:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cfg.conns = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_mix(&cfg, optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            if (parse_sizes(&cfg, optarg) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            cfg.files = atoi(optarg);
+            break;
+        case 'd':
+            cfg.duration_s = atof(optarg);
+            break;
+        case 'W':
+            cfg.warmup_s = atof(optarg);
+            break;
+        case 'F':
+            format = true;
+            break;
+        case 'k':
+            cfg.keep = true;
+            break;
+        case 'D': {
+            char *colon = strrchr(optarg, ':');
+            if (!colon || (size_t)(colon - optarg) >= sizeof(cfg.disk_host)) {
+                usage(argv[0]);
+                return 1;
+            }
+            memcpy(cfg.disk_host, optarg, (size_t)(colon - optarg));
+            cfg.disk_port = atoi(colon + 1);
+            break;
+        }
+        case 'S':
+            cfg.seed = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            fmt = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg.host = argv[optind];
+    cfg.port = atoi(argv[optind + 1]);
+    if (cfg.port <= 0 || cfg.conns < 1 || cfg.files < 1 || cfg.duration_s <= 0 || cfg.warmup_s < 0 ||
+        (strcmp(fmt, "text") != 0 && strcmp(fmt, "csv") != 0 && strcmp(fmt, "json") != 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (format) {
+        fc_conn_t *fc = malloc(sizeof(*fc));
+        if (fc == NULL || fc_open(fc, cfg.host, cfg.port) < 0) {
+            return 1;
+        }
+        int rc = fs_simple(fc, "F\n", '0');
+        fc_close(fc);
+        free(fc);
+        if (rc != 1) {
+            fprintf(stderr, "[fs_bench] format failed\n");
+            return 1;
+        }
+    }
+
+    int nthreads = cfg.conns + (cfg.disk_port > 0 ? 1 : 0);
+    worker_t *ws = calloc((size_t)nthreads, sizeof(worker_t));
+    pthread_t *tids = calloc((size_t)nthreads, sizeof(pthread_t));
+    if (!ws || !tids) {
+        perror("calloc");
+        return 1;
+    }
+
+    uint64_t t0 = now_ns();
+    cfg.warm_end_ns = t0 + (uint64_t)(cfg.warmup_s * 1e9);
+    cfg.stop_ns = cfg.warm_end_ns + (uint64_t)(cfg.duration_s * 1e9);
+    for (int i = 0; i < nthreads; i++) {
+        ws[i].cfg = &cfg;
+        ws[i].id = i;
+        void *(*fn)(void *) = i < cfg.conns ? worker_main : probe_main;
+        if (pthread_create(&tids[i], NULL, fn, &ws[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    hist_t *total = calloc(NOPS, sizeof(hist_t));
+    if (!total) {
+        perror("calloc");
+        return 1;
+    }
+    int failed = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        for (int op = 0; op < NOPS; op++) {
+            hist_merge(&total[op], &ws[i].hist[op]);
+        }
+        failed |= ws[i].failed;
+    }
+
+    if (!failed || total[OP_C].total + total[OP_R].total + total[OP_W].total > 0) {
+        report(fmt, total, cfg.duration_s);
+    }
+
+    free(total);
+    free(ws);
+    free(tids);
+    return failed ? 1 : 0;
+}
@@ -1,61 +1,59 @@
 // problem 4 
 // Filesystem client that sends filesystem commands to fs_server and prints status codes and data.
 
-#include <arpa/inet.h>
-#include <errno.h>
-#include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <unistd.h>
+
+#include "libfs.h"
 
 #define MAXLINE 4096
 
-static ssize_t write_all(int fd, const void* buf, size_t n) { size_t o = 0; while (o < n) { ssize_t w = send(fd, (const char*)buf + o, n - o, 0); if (w < 0) { if (errno == EINTR)continue; return -1; }o += (size_t)w; }return (ssize_t)o; }
-static ssize_t read_exact(int fd, void* buf, size_t n) { size_t o = 0; while (o < n) { ssize_t r = recv(fd, (char*)buf + o, n - o, 0); if (r == 0)return o; if (r < 0) { if (errno == EINTR)continue; return -1; }o += (size_t)r; }return (ssize_t)o; }
+static void print_line(const char* text, void* arg) { (void)arg; puts(text); }
 
 int main(int argc, char** argv) {
     if (argc != 3) { fprintf(stderr, "Usage: %s <host> <port>\n", argv[0]); return 2; }
     const char* host = argv[1]; int port = atoi(argv[2]);
 
-    int s = socket(AF_INET, SOCK_STREAM, 0); if (s < 0) { perror("socket"); return 1; }
-    struct sockaddr_in a = { 0 }; a.sin_family = AF_INET; a.sin_port = htons((uint16_t)port);
-    if (inet_pton(AF_INET, host, &a.sin_addr) != 1) { perror("inet_pton"); return 1; }
-    if (connect(s, (struct sockaddr*)&a, sizeof(a)) < 0) { perror("connect"); return 1; }
+    fc_conn_t* fc = (fc_conn_t*)malloc(sizeof(*fc)); if (!fc) { perror("malloc"); return 1; }
+    if (fc_open(fc, host, port) < 0) return 1;
 
-    fprintf(stderr, "Enter: F | C f | D f | L b | R f | W f l <newline> <raw data>\n");
+    fprintf(stderr, "Enter: F [cs [n [j [i]]]] | C f | D f | L b [d] | R f | RR f off len | W f l | WR f off l | A f l | MD d | RD d | CD d | S f... | T  (W/WR/A: <newline> <raw data>)\n");
     char line[MAXLINE];
     while (fgets(line, sizeof(line), stdin)) {
-        if (line[0] == 'W') {
+        if (line[0] == 'W' || line[0] == 'A') {
             // Send header line as-is, then read l bytes from stdin and forward
-            char fname[1024] = { 0 }; unsigned l = 0;
-            if (sscanf(line, " W %1023s %u", fname, &l) != 2) { fputs("bad W\n", stderr); continue; }
-            if (write_all(s, line, strlen(line)) < 0) break;
+            char fname[1024] = { 0 }; unsigned l = 0, off = 0;
+            int ok = line[1] == 'R' ? sscanf(line, " WR %1023s %u %u", fname, &off, &l) == 3
+                   : line[0] == 'A' ? sscanf(line, " A %1023s %u", fname, &l) == 2
+                   : sscanf(line, " W %1023s %u", fname, &l) == 2;
+            if (!ok) { fputs(line[0] == 'A' ? "bad A\n" : "bad W\n", stderr); continue; }
             unsigned char* tmp = (unsigned char*)malloc(l ? l : 1); if (!tmp) { fputs("oom\n", stderr); break; }
             for (unsigned i = 0; i < l; i++) { int ch = fgetc(stdin); if (ch == EOF) { fputs("stdin ended early\n", stderr); free(tmp); goto done; } tmp[i] = (unsigned char)ch; }
-            if (write_all(s, tmp, l) < 0) { free(tmp); break; }
+            // header line as typed, then the payload, in one send; the reply is a code line
+            char resp[64]; int rc = fc_cmd(fc, line, tmp, l, resp, sizeof(resp));
             free(tmp);
-            // read small response code line (e.g., "0\n" or "2\n")
-            char resp[32]; int n = recv(s, resp, sizeof(resp) - 1, 0); if (n <= 0) break; resp[n] = 0; fputs(resp, stdout);
+            if (rc == -1) break;
+            printf("%s\n", resp);
+        }
+        else if ((line[0] == 'R' && (line[1] == ' ' || line[1] == 'R')) || (line[0] == 'T' && (line[1] == '\n' || line[1] == ' '))) {
+            // R, RR, T: "<code> <len> <data>\n", printed as it came
+            unsigned char* data = (unsigned char*)malloc(1 << 20); if (!data) { fputs("oom\n", stderr); break; }
+            size_t len = 0; int code = fc_read(fc, line, data, 1 << 20, &len);
+            if (code < 0) { free(data); break; }
+            printf("%d %zu ", code, len); fwrite(data, 1, len < (1 << 20) ? len : (1 << 20), stdout); putchar('\n');
+            free(data);
         }
-        else if (line[0] == 'R') {
-            if (write_all(s, line, strlen(line)) < 0) break;
-            // Expect: "<code> <len> <data>\n"
-            char hdr[64]; int pos = 0;
-            // read until we get space after len
-            // For simplicity, read a chunk, print as it comes:
-            int n = recv(s, hdr, sizeof(hdr) - 1, 0); if (n <= 0) break; hdr[n] = 0;
-            // Print whatever server sent (it includes data and trailing newline)
-            fputs(hdr, stdout);
-            // If the server sent "0 <len> " followed by raw data then '\n', the above prints it.
-            // For larger files, a proper buffered loop would be better; this is enough for tests.
+        else if (line[0] == 'L' && (line[1] == ' ' || line[1] == '\n')) {
+            // L: unframed, one line per entry; fc_list finds where it ends
+            if (fc_list(fc, line, print_line, NULL) < 0) break;
         }
         else {
-            if (write_all(s, line, strlen(line)) < 0) break;
-            char resp[2048]; int n = recv(s, resp, sizeof(resp) - 1, 0); if (n <= 0) break; resp[n] = 0; fputs(resp, stdout);
+            // other replies are a line, or several (S): print what arrives
+            if (net_put(&fc->net, line, strlen(line)) < 0) break;
+            char resp[2048]; ssize_t n = fc_some(fc, resp, sizeof(resp) - 1); if (n <= 0) break; resp[n] = 0; fputs(resp, stdout);
         }
     }
 done:
-    close(s); return 0;
+    fc_close(fc); free(fc); return 0;
 }
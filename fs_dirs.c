@@ -1,119 +1,47 @@
 /*
  * fs_dirs.c  --  Problem 5: directory structure client
  *
- * This program adds a simple directory structure on top of the flat
- * filesystem implemented in Problem 4 (fs_server / disk_server).
+ * This program is a shell for the directory tree of the filesystem
+ * implemented in Problem 4 (fs_server / disk_server). Directories are
+ * real entry tables in fs_server: mkdir, rmdir and cd map to its MD, RD
+ * and CD commands, which resolve paths (relative, absolute, "." and
+ * "..") against the connection's working directory on the server.
  */
 
-#include <arpa/inet.h>
-#include <errno.h>
-#include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <unistd.h>
+
+#include "libfs.h"
 
 #define MAXLINE 4096
 #define PATHBUF 1024
 
 /* ------------------------------------------------------------------ */
-/* Utility: write_all
+/* Utility: send a one-line directory command and parse its status code.
  *
- * Write exactly n bytes to a socket, handling partial writes and EINTR.
- * Returns n on success, -1 on error (and sets errno).
+ * The server resolves the path against this connection's working
+ * directory, so arg is passed through as typed. Returns the code, or -2
+ * if the reply was not a number. Exits if the connection fails.
  */
-static ssize_t write_all(int fd, const void *buf, size_t n) {
-    size_t off = 0;
-    while (off < n) {
-        ssize_t w = send(fd, (const char *)buf + off, n - off, 0);
-        if (w < 0) {
-            if (errno == EINTR) {
-                continue;   /* interrupted by signal, retry */
-            }
-            return -1;
-        }
-        off += (size_t)w;
-    }
-    return (ssize_t)off;
-}
-
-/* ------------------------------------------------------------------ */
-/* Utility: simple command to fs_server
- *
- * Send a single-line command (cmd must include the trailing '\n')
- * and read a response into respbuf, terminated with '\0'.
- *
- * This function is designed for small protocol responses like:
- *   "0\n" or "1\n" or "0 18 Hello, filesystem!\n"
- *
- * Returns number of bytes read (>=0) on success, -1 on error.
- */
-static ssize_t fs_simple_cmd(int sock, const char *cmd,
-                             char *respbuf, size_t respbuf_sz) {
-    size_t len = strlen(cmd);
-    if (write_all(sock, cmd, len) < 0) {
-        return -1;
-    }
-
-    ssize_t r = recv(sock, respbuf, respbuf_sz - 1, 0);
-    if (r < 0) {
-        return -1;
-    }
-    respbuf[r] = '\0';
-    return r;
-}
-
-/* ------------------------------------------------------------------ */
-/* Path helpers
- *
- * CWD is always a canonical path starting with '/', with no trailing
- * slash, except root "/" itself.
- */
-
-/* Join cwd and a relative name into a canonical path. */
-static void join_path(const char *cwd,
-                      const char *name,
-                      char *out,
-                      size_t out_sz) {
-    if (name[0] == '/') {
-        /* Absolute path: name already includes leading '/'. */
-        snprintf(out, out_sz, "%s", name);
-    } else {
-        if (strcmp(cwd, "/") == 0) {
-            snprintf(out, out_sz, "/%s", name);
-        } else {
-            snprintf(out, out_sz, "%s/%s", cwd, name);
-        }
-    }
-
-    /* Remove trailing slashes except for root itself. */
-    size_t len = strlen(out);
-    while (len > 1 && out[len - 1] == '/') {
-        out[len - 1] = '\0';
-        len--;
+static int fs_dir_cmd(fc_conn_t *fc, const char *op, const char *arg,
+                      char *resp, size_t resp_sz) {
+    char cmd[MAXLINE];
+    snprintf(cmd, sizeof(cmd), "%s %s\n", op, arg);
+    int code = fc_cmd(fc, cmd, NULL, 0, resp, resp_sz);
+    if (code == -1) {
+        fprintf(stderr, "%s: connection to fs_server lost\n", op);
+        exit(1);
     }
-}
-
-/* Convert canonical path like "/a/b" to filesystem name "a/b/". */
-static void path_to_fsname(const char *canon_path,
-                           char *fsname,
-                           size_t fsname_sz) {
-    if (strcmp(canon_path, "/") == 0) {
-        /* Root directory is implicit; we never create a marker for it. */
-        fsname[0] = '\0';
-        return;
+    if (code == -2) {
+        fprintf(stderr, "%s: unexpected response: %s\n", op, resp);
     }
-    /* Skip leading '/', append trailing '/'. */
-    snprintf(fsname, fsname_sz, "%s/", canon_path + 1);
+    return code;
 }
 
 /* ------------------------------------------------------------------ */
-/* mkdir implementation: create directory marker file. */
-static void cmd_mkdir(int sock, char *cwd, const char *arg) {
-    char path[PATHBUF];
-    char fsname[PATHBUF];
-    char cmd[MAXLINE];
+/* mkdir implementation: MD creates the directory in the server's tree. */
+static void cmd_mkdir(fc_conn_t *fc, const char *arg) {
     char resp[MAXLINE];
 
     if (arg == NULL || arg[0] == '\0') {
@@ -121,46 +49,21 @@ static void cmd_mkdir(int sock, char *cwd, const char *arg) {
         return;
     }
 
-    join_path(cwd, arg, path, sizeof(path));
-    if (strcmp(path, "/") == 0) {
-        fprintf(stderr, "mkdir: cannot create root directory\n");
-        return;
-    }
-
-    path_to_fsname(path, fsname, sizeof(fsname));
-    if (fsname[0] == '\0') {
-        fprintf(stderr, "mkdir: internal error (empty fsname)\n");
-        return;
-    }
-
-    snprintf(cmd, sizeof(cmd), "C %s\n", fsname);
-    if (fs_simple_cmd(sock, cmd, resp, sizeof(resp)) < 0) {
-        perror("mkdir: send/recv");
-        exit(1);
-    }
-
-    int code = -1;
-    if (sscanf(resp, "%d", &code) != 1) {
-        fprintf(stderr, "mkdir: unexpected response: %s", resp);
-        return;
-    }
-
-    if (code == 0) {
-        /* success */
+    int code = fs_dir_cmd(fc, "MD", arg, resp, sizeof(resp));
+    if (code == 0 || code == -2) {
         return;
     } else if (code == 1) {
-        fprintf(stderr, "mkdir: '%s' already exists\n", path);
+        fprintf(stderr, "mkdir: '%s' already exists\n", arg);
     } else {
-        fprintf(stderr, "mkdir: failed with code %d\n", code);
+        fprintf(stderr, "mkdir: cannot create '%s' (missing parent, bad name or no space)\n", arg);
     }
 }
 
 /* ------------------------------------------------------------------ */
-/* cd implementation: change cwd if directory marker exists. */
-static void cmd_cd(int sock, char *cwd, const char *arg) {
-    char path[PATHBUF];
-    char fsname[PATHBUF];
-    char cmd[MAXLINE];
+/* cd implementation: CD changes the server's working directory for this
+ * connection and replies with its canonical path, which becomes cwd here.
+ */
+static void cmd_cd(fc_conn_t *fc, char *cwd, const char *arg) {
     char resp[MAXLINE];
 
     if (arg == NULL || arg[0] == '\0') {
@@ -168,41 +71,16 @@ static void cmd_cd(int sock, char *cwd, const char *arg) {
         return;
     }
 
-    join_path(cwd, arg, path, sizeof(path));
-
-    /* Root always exists. */
-    if (strcmp(path, "/") == 0) {
-        strcpy(cwd, "/");
-        return;
-    }
-
-    path_to_fsname(path, fsname, sizeof(fsname));
-    if (fsname[0] == '\0') {
-        fprintf(stderr, "cd: internal error (empty fsname)\n");
-        return;
-    }
-
-    /* Use R to check for existence. We only care about the status code. */
-    snprintf(cmd, sizeof(cmd), "R %s\n", fsname);
-    if (fs_simple_cmd(sock, cmd, resp, sizeof(resp)) < 0) {
-        perror("cd: send/recv");
-        exit(1);
-    }
-
-    int code = -1;
-    if (sscanf(resp, "%d", &code) != 1) {
-        fprintf(stderr, "cd: unexpected response: %s", resp);
-        return;
-    }
-
+    int code = fs_dir_cmd(fc, "CD", arg, resp, sizeof(resp));
     if (code == 0) {
-        /* Directory marker exists. Update cwd. */
-        strncpy(cwd, path, PATHBUF - 1);
-        cwd[PATHBUF - 1] = '\0';
+        char path[PATHBUF];
+        if (sscanf(resp, "%*d %1023s", path) == 1) {
+            strcpy(cwd, path);
+        }
     } else if (code == 1) {
-        fprintf(stderr, "cd: '%s' does not exist\n", path);
-    } else {
-        fprintf(stderr, "cd: error code %d while accessing '%s'\n", code, path);
+        fprintf(stderr, "cd: '%s' does not exist\n", arg);
+    } else if (code != -2) {
+        fprintf(stderr, "cd: error code %d while accessing '%s'\n", code, arg);
     }
 }
 
@@ -213,92 +91,106 @@ static void cmd_pwd(const char *cwd) {
 }
 
 /* ------------------------------------------------------------------ */
-/* rmdir implementation:
- *   - ensures directory exists
- *   - checks for emptiness by scanning listing from L 0
- *   - then deletes the directory marker
+/* rmdir implementation: RD removes the directory if it is empty. The
+ * server checks emptiness from the directory's own entry count.
  */
-static void cmd_rmdir(int sock, char *cwd, const char *arg) {
-    char path[PATHBUF];
-    char fsname[PATHBUF];
-    char cmd[MAXLINE];
-    char resp[8192];  /* large buffer for directory listing */
+static void cmd_rmdir(fc_conn_t *fc, const char *arg) {
+    char resp[MAXLINE];
 
     if (arg == NULL || arg[0] == '\0') {
         fprintf(stderr, "rmdir: missing directory name\n");
         return;
     }
 
-    join_path(cwd, arg, path, sizeof(path));
-    if (strcmp(path, "/") == 0) {
-        fprintf(stderr, "rmdir: cannot remove root directory\n");
+    int code = fs_dir_cmd(fc, "RD", arg, resp, sizeof(resp));
+    if (code == 0 || code == -2) {
         return;
+    } else if (code == 1) {
+        fprintf(stderr, "rmdir: '%s' does not exist\n", arg);
+    } else if (code == 3) {
+        fprintf(stderr, "rmdir: directory '%s' is not empty\n", arg);
+    } else {
+        fprintf(stderr, "rmdir: cannot remove '%s' (not a directory, or the root)\n", arg);
     }
+}
 
-    path_to_fsname(path, fsname, sizeof(fsname));
-    if (fsname[0] == '\0') {
-        fprintf(stderr, "rmdir: internal error (empty fsname)\n");
-        return;
-    }
+/* ------------------------------------------------------------------ */
+/* ls implementation: print the names in a directory (default: cwd);
+ * subdirectories end in '/'.
+ */
+static void print_line(const char *text, void *arg) {
+    (void)arg;
+    puts(text);
+}
+
+static void cmd_ls(fc_conn_t *fc, const char *arg) {
+    char cmd[MAXLINE];
 
-    /* First check that the directory marker exists. */
-    snprintf(cmd, sizeof(cmd), "R %s\n", fsname);
-    if (fs_simple_cmd(sock, cmd, resp, sizeof(resp)) < 0) {
-        perror("rmdir: send/recv");
+    snprintf(cmd, sizeof(cmd), "L 0 %s\n", arg ? arg : "");
+    if (fc_list(fc, cmd, print_line, NULL) < 0) {
+        fprintf(stderr, "ls: connection to fs_server lost\n");
         exit(1);
     }
-    int code = -1;
-    if (sscanf(resp, "%d", &code) != 1) {
-        fprintf(stderr, "rmdir: unexpected response: %s", resp);
+}
+
+/* ------------------------------------------------------------------ */
+/* stat implementation: report every component of a path ("a", "a/b",
+ * "a/b/c") from one batched S command, so a missing component shows up
+ * without a round trip per level.
+ */
+static void cmd_stat(fc_conn_t *fc, const char *arg) {
+    char cmd[MAXLINE];
+
+    if (arg == NULL || arg[0] == '\0') {
+        fprintf(stderr, "stat: missing name\n");
         return;
     }
-    if (code == 1) {
-        fprintf(stderr, "rmdir: '%s' does not exist\n", path);
-        return;
+
+    /* "S a a/b a/b/c": each prefix ending before a '/' plus the whole path. */
+    size_t len = strlen(arg);
+    size_t off = (size_t)snprintf(cmd, sizeof(cmd), "S");
+    int nnames = 0;
+    for (size_t i = 1; i <= len && off < sizeof(cmd); i++) {
+        if (i == len || (arg[i] == '/' && arg[i - 1] != '/')) {
+            off += (size_t)snprintf(cmd + off, sizeof(cmd) - off, " %.*s", (int)i, arg);
+            nnames++;
+        }
     }
-    if (code != 0) {
-        fprintf(stderr, "rmdir: error code %d while accessing '%s'\n", code, path);
+    if (off + 1 >= sizeof(cmd)) {
+        fprintf(stderr, "stat: path too long\n");
         return;
     }
+    strcat(cmd, "\n");
 
-    /* Now check emptiness: no other entry name should start with fsname. */
-    snprintf(cmd, sizeof(cmd), "L 0\n");
-    if (fs_simple_cmd(sock, cmd, resp, sizeof(resp)) < 0) {
-        perror("rmdir: send/recv");
+    /* One reply line per name. */
+    fc_req_t req = { 0 };
+    if (fc_submit_lines(fc, &req, cmd, nnames) < 0 || fc_wait(fc, &req) < 0) {
+        fprintf(stderr, "stat: connection to fs_server lost\n");
         exit(1);
     }
+    char *resp = req.text;
 
-    /* resp now contains listing; each line is a filename. */
-    size_t fsname_len = strlen(fsname);
-    char *line = strtok(resp, "\n");
-    while (line != NULL) {
-        if (strncmp(line, fsname, fsname_len) == 0 &&
-            strcmp(line, fsname) != 0) {
-            fprintf(stderr, "rmdir: directory '%s' is not empty\n", path);
-            return;
+    /* Print each component with its entry. */
+    char *saveptr = NULL;
+    char *line = strtok_r(resp, "\n", &saveptr);
+    size_t i = 1;
+    for (int k = 0; k < nnames && line != NULL; k++) {
+        while (i < len && !(arg[i] == '/' && arg[i - 1] != '/')) {
+            i++;
         }
-        line = strtok(NULL, "\n");
-    }
-
-    /* Safe to delete the directory marker itself. */
-    snprintf(cmd, sizeof(cmd), "D %s\n", fsname);
-    if (fs_simple_cmd(sock, cmd, resp, sizeof(resp)) < 0) {
-        perror("rmdir: send/recv");
-        exit(1);
-    }
-    code = -1;
-    if (sscanf(resp, "%d", &code) != 1) {
-        fprintf(stderr, "rmdir: unexpected response: %s", resp);
-        return;
-    }
-
-    if (code == 0) {
-        /* success */
-        return;
-    } else if (code == 1) {
-        fprintf(stderr, "rmdir: '%s' does not exist (race)\n", path);
-    } else {
-        fprintf(stderr, "rmdir: failed with code %d\n", code);
+        unsigned length = 0;
+        int first = 0;
+        char type = '?';
+        if (sscanf(line, "0 %u %d %c", &length, &first, &type) == 3) {
+            printf("%.*s: %s, %u bytes\n", (int)i, arg,
+                   type == 'd' ? "directory" : "file", length);
+        } else if (line[0] == '1') {
+            printf("%.*s: does not exist\n", (int)i, arg);
+        } else {
+            printf("%.*s: error %s\n", (int)i, arg, line);
+        }
+        i++;
+        line = strtok_r(NULL, "\n", &saveptr);
     }
 }
 
@@ -310,6 +202,8 @@ static void cmd_help(void) {
     printf("  cd <dirname>      - change current directory\n");
     printf("  pwd               - print current directory\n");
     printf("  rmdir <dirname>   - remove a directory (must be empty)\n");
+    printf("  ls [dirname]      - list a directory\n");
+    printf("  stat <path>       - show each component of a path\n");
     printf("  help              - show this help\n");
     printf("  quit / exit       - exit the program\n");
 }
@@ -328,27 +222,14 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    /* Create socket and connect to fs_server. */
-    int s = socket(AF_INET, SOCK_STREAM, 0);
-    if (s < 0) {
-        perror("socket");
-        return 1;
-    }
-
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port   = htons((uint16_t)port);
-
-    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
-        perror("inet_pton");
-        close(s);
+    /* Connect to fs_server. */
+    fc_conn_t *fc = malloc(sizeof(*fc));
+    if (fc == NULL) {
+        perror("malloc");
         return 1;
     }
-
-    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("connect");
-        close(s);
+    if (fc_open(fc, host, port) < 0) {
+        free(fc);
         return 1;
     }
 
@@ -391,13 +272,17 @@ int main(int argc, char **argv) {
         }
 
         if (strcmp(cmd, "mkdir") == 0) {
-            cmd_mkdir(s, cwd, (arg[0] ? arg : NULL));
+            cmd_mkdir(fc, (arg[0] ? arg : NULL));
         } else if (strcmp(cmd, "cd") == 0) {
-            cmd_cd(s, cwd, (arg[0] ? arg : NULL));
+            cmd_cd(fc, cwd, (arg[0] ? arg : NULL));
         } else if (strcmp(cmd, "pwd") == 0) {
             cmd_pwd(cwd);
         } else if (strcmp(cmd, "rmdir") == 0) {
-            cmd_rmdir(s, cwd, (arg[0] ? arg : NULL));
+            cmd_rmdir(fc, (arg[0] ? arg : NULL));
+        } else if (strcmp(cmd, "ls") == 0) {
+            cmd_ls(fc, (arg[0] ? arg : NULL));
+        } else if (strcmp(cmd, "stat") == 0) {
+            cmd_stat(fc, (arg[0] ? arg : NULL));
         } else if (strcmp(cmd, "help") == 0) {
             cmd_help();
         } else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) {
@@ -407,7 +292,8 @@ int main(int argc, char **argv) {
         }
     }
 
-    close(s);
+    fc_close(fc);
+    free(fc);
     return 0;
 }
 
@@ -1,9 +1,57 @@
 // Filesystem server (Problem 4).
 // Speaks the FS protocol to clients and uses the disk server protocol underneath.
-// FS protocol per handout: F, C f, D f, L b, R f, W f l data.  (flat directory).
+// FS protocol per handout: F, C f, D f, L b, R f, W f l data.
+// Extensions:
+//   S f [f ...]     stat each name from its directory entry, no data read: one
+//                   "0 length first type" line per name (1 if it does not exist).
+//                   S alone reports the cache counters, framed like an R reply.
+//   MD d, RD d      make / remove a directory; RD replies 3 if d is not empty.
+//   CD d            change this connection's directory; replies "0 /canonical/path".
+//   L b d           list directory d instead of the current one.
+//   F cs n j i      format with cs-sector clusters, an n-entry root directory, a
+//                   j-sector metadata journal and files of up to i bytes kept
+//                   inline. Plain F is F 1 64 with the default journal and no
+//                   inline data.
+//   RR f off len    ranged read, replied like R.
+//   WR f off len    in-place write of [off, off+len), followed by the data; may
+//                   grow the file.
+//   A f len         append len bytes, followed by the data.
+//   T               tracing timers as a table framed like an R reply: count,
+//                   total, mean and max time of each command, disk round trip,
+//                   lock wait, FAT/directory operation and client socket I/O.
 //
 // Build/run example:
-//   ./fs_server <listen_port> <disk_host> <disk_port>
+//   ./fs_server [-a] [-P pool_size] [-G ms[,n]] [-c n[,lru|arc][,wb]]
+//               [-T trace.json] [-R copies]
+//               <listen_port> <disk_host> <disk_port> [<disk_host> <disk_port> ...]
+//
+//   With several disk servers the blocks are striped over all of them (RAID-0),
+//   and a multi-block R/W moves its share of blocks on every node in parallel.
+//
+//   -a  use the ASCII disk protocol; by default fs_server negotiates the
+//       binary framed protocol with "B" and falls back to ASCII if refused.
+//   -P  number of persistent disk connections shared by all clients (default 8).
+//       Each FS command checks one out, so short-lived fs_cli sessions do not
+//       pay a TCP connect and geometry handshake to the disk server. W, WR and A
+//       hold one only once their payload has arrived (W one ring of blocks at a
+//       time), so slow writers cannot tie up the pool. If the disk server cannot
+//       be reached the command gets 2.
+//   -G  group commit: C/D/W leave their FAT and directory sectors dirty in memory
+//       and are acknowledged once a committer thread flushes them, every ms
+//       milliseconds or as soon as n commands are waiting (default 8).
+//       Without -G each command flushes its own dirty FAT sectors. Either way, on a
+//       filesystem formatted with a journal the flush goes through the journal.
+//   -c  sector cache for file data: n blocks (default 2048, 0 disables it), LRU or
+//       ARC replacement, write-through unless "wb" is given, in which case a
+//       flusher thread writes dirty blocks back in sorted batches. SIGINT/SIGTERM
+//       flush the cache and print its hit/miss counters before exiting.
+//   -R  keep copies of every block on that many disk servers (the number of servers
+//       must be a multiple of it): writes go to each copy, reads to the least-loaded.
+//       The stripe layout is recorded by F; a filesystem is not mounted over a
+//       different number of servers or copies.
+//   -T  also record every timed span (see T) and write them to the file as a Chrome
+//       trace (JSON), viewable in chrome://tracing or Perfetto; the file is completed
+//       on SIGINT/SIGTERM.
 //
 // Example:
 //   ./fs_server 5555 127.0.0.1 4443
@@ -11,11 +59,39 @@
 // Then, from another terminal, use fs_cli to send commands.
 //
 // Notes:
-//  - Disk block size = 128 bytes, one sector per block (from Problem 3).
-//  - We implement a simple on-disk layout with a superblock, FAT, and fixed-size directory.
-//  - FAT entry: 32-bit little-endian. 0 = FREE, 0xFFFFFFFF = EOF, 0xFFFFFFFE = RESERVED/META.
-//  - Directory entry: fixed 64 bytes (name[32], length[4], first[4], used[1], pad[23]); two per sector.
+//  - Disk block size = 128 bytes, one sector per block (from Problem 3). Block numbers
+//    are logical: with striping, block b is block b / groups on the node(s) of group
+//    b % groups.
+//  - We implement a simple on-disk layout with a superblock, FAT, and fixed-size root
+//    directory, both sized by F and recorded in the superblock. Subdirectories are
+//    entry tables stored in FAT chains like files, growing a cluster at a time.
+//  - Metadata journal (physical redo log) after the root directory: every commit of
+//    dirty FAT/directory sectors is appended to it as one checksummed transaction in a
+//    single vectored write, and the sectors reach their home locations only when the
+//    journal fills up (checkpoint). Mount replays the valid transactions, so a crash
+//    leaves all of a commit or none of it. F ... 0 formats without one.
+//  - Names are paths resolved against the connection's working directory (CD, default
+//    "/"), with "." and ".."; plain names therefore still mean files in the root.
+//  - FAT entry: 32-bit little-endian, one per cluster of 1..256 sectors (files take whole
+//    clusters). 0 = FREE, 0xFFFFFFFF = EOF, 0xFFFFFFFE = RESERVED/META.
+//  - Directory entry: fixed 64 bytes (name[32], length[4], first[4], used[1], type[1],
+//    pad[22]; type 1 = directory, whose first is its table's cluster); two per sector.
+//    A filesystem formatted with inline data (F ... i) uses 128-byte entries, one per
+//    sector, with data[84] at offset 44: a file of at most i bytes is stored there
+//    (first = EOF, length > 0), so its R and W move no data blocks and leave the FAT
+//    alone. A write that takes it past i moves it to blocks.
 //  - "F" formats the disk (writes metadata tables). Other ops require a formatted disk.
+//  - The FAT and every directory table are cached in memory (all loaded at mount); each
+//    directory has a hashed name index and a free-slot stack, and each update writes
+//    back only its sector.
+//  - Blocks are allocated next-fit from an in-memory free bitmap, preferring one
+//    contiguous extent per file.
+//  - Locking: an rwlock over the FAT/directory caches plus striped per-file rwlocks
+//    keyed by directory and slot (file lock first, then metadata). R of different files
+//    runs in parallel and holds only its shared file lock while streaming.
+//  - R/RR keep several vectored disk reads of the chain in flight. An RR that picks
+//    up where the previous RR on the connection ended also reads ahead into the
+//    sector cache, with a window that doubles while the pattern stays sequential.
 //
 // Spec refs: FS server commands & responses; flat filesystem design with FAT & directory table. 
 //   - Commands list & return codes. (F, C, D, L, R, W). 
@@ -25,7 +101,9 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -35,72 +113,528 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "libdisk.h"
+
 #define BLKSZ 128
 #define MAX_LINE 4096
 #define MAX_NAME 32
 
-// === disk protocol helpers ===
-// open a *separate* disk connection per client thread for simplicity
+// === tracing ===
+// Every thread keeps its own timers (count, total and worst time) for commands,
+// disk round trips, lock waits, FAT/directory work and client socket I/O, so the
+// hot path only reads the clock and stores to thread-local counters. "T" sums
+// them over all threads. With -T file each timed span is also buffered per
+// thread and written as a Chrome trace (JSON array of "X" events, which
+// chrome://tracing and Perfetto load). Lock waits try the lock first: an
+// uncontended acquisition is counted but takes no time and leaves no event.
+typedef enum {
+    TR_CMD_F, TR_CMD_C, TR_CMD_D, TR_CMD_L, TR_CMD_R, TR_CMD_W, TR_CMD_A, TR_CMD_RR, TR_CMD_WR, TR_CMD_MD, TR_CMD_RD, TR_CMD_CD, TR_CMD_S, TR_CMD_T,
+    TR_DISK_RV, TR_DISK_WV, TR_DISK_REPLY,
+    TR_WAIT_POOL, TR_WAIT_META, TR_WAIT_FILE, TR_WAIT_COMMIT,
+    TR_FAT_LOAD, TR_FAT_FLUSH, TR_DIR_LOAD, TR_DIR_WRITE, TR_ALLOC, TR_FREE_CHAIN, TR_BIDX,
+    TR_GROUP_FLUSH, TR_JR_COMMIT, TR_JR_CKPT, TR_CACHE_FLUSH,
+    TR_CLIENT_RECV, TR_CLIENT_SEND,
+    TR_NKINDS
+} tr_kind;
+static const char* const tr_names[TR_NKINDS] = {
+    "cmd_F", "cmd_C", "cmd_D", "cmd_L", "cmd_R", "cmd_W", "cmd_A", "cmd_RR", "cmd_WR", "cmd_MD", "cmd_RD", "cmd_CD", "cmd_S", "cmd_T",
+    "disk_RV", "disk_WV", "disk_reply",
+    "wait_pool", "wait_meta", "wait_file", "wait_commit",
+    "fat_load", "fat_flush", "dir_load", "dir_write", "alloc", "free_chain", "bidx_get",
+    "group_flush", "jr_commit", "jr_ckpt", "cache_flush",
+    "client_recv", "client_send",
+};
+static const char* tr_cat(int k) {
+    return k <= TR_CMD_T ? "cmd" : k <= TR_DISK_REPLY ? "disk" : k <= TR_WAIT_COMMIT ? "lock" : k <= TR_CACHE_FLUSH ? "meta" : "client";
+}
+#define TR_EV_BUF 4096 // events buffered per thread before they are written out
+typedef struct { uint64_t n, ns, max_ns; } tr_stat_t;
+typedef struct { uint32_t kind; uint64_t t0, dur; } tr_ev_t;
+typedef struct tr_thread {
+    struct tr_thread *prev, *next;
+    uint32_t tid;
+    tr_stat_t st[TR_NKINDS]; // written only by the owner, read by "T"
+    tr_ev_t* ev; uint32_t nev; // NULL unless -T
+} tr_thread_t;
+static struct {
+    pthread_mutex_t mtx; // guards the thread list, retired, and the trace file
+    tr_thread_t* live;
+    tr_stat_t retired[TR_NKINDS]; // totals of threads that have exited
+    uint32_t next_tid;
+    FILE* out; bool any_ev; // trace file, and whether an event was written yet
+    uint64_t t0;
+} g_tr = { .mtx = PTHREAD_MUTEX_INITIALIZER };
+static __thread tr_thread_t* tr_self;
+static __thread int tr_cfd = -1; // client socket of the command being run; its I/O is timed
+// single writer per counter: relaxed stores keep "T" from reading torn values
+#define TR_SET(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define TR_GET(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static inline uint64_t tr_now(void) {
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+// write n buffered events of thread tid; g_tr.mtx held
+static void tr_write_events(uint32_t tid, const tr_ev_t* ev, uint32_t n) {
+    if (!g_tr.out) return;
+    for (uint32_t i = 0; i < n; i++) {
+        fprintf(g_tr.out, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                g_tr.any_ev ? ",\n" : "", tr_names[ev[i].kind], tr_cat((int)ev[i].kind),
+                (double)(ev[i].t0 - g_tr.t0) / 1e3, (double)ev[i].dur / 1e3, tid);
+        g_tr.any_ev = true;
+    }
+}
+// register the calling thread under role (shown as the thread name in the trace)
+static tr_thread_t* tr_attach(const char* role) {
+    tr_thread_t* me = (tr_thread_t*)calloc(1, sizeof(*me));
+    if (!me) { perror("calloc trace"); exit(1); }
+    pthread_mutex_lock(&g_tr.mtx);
+    me->tid = ++g_tr.next_tid;
+    if (g_tr.out) {
+        me->ev = (tr_ev_t*)malloc(TR_EV_BUF * sizeof(tr_ev_t));
+        fprintf(g_tr.out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+                g_tr.any_ev ? ",\n" : "", me->tid, role, me->tid);
+        g_tr.any_ev = true;
+    }
+    me->next = g_tr.live; if (g_tr.live) g_tr.live->prev = me; g_tr.live = me;
+    pthread_mutex_unlock(&g_tr.mtx);
+    return tr_self = me;
+}
+// an exiting thread folds its counters into the retired totals and writes its events
+static void tr_detach(void) {
+    tr_thread_t* me = tr_self;
+    if (!me) return;
+    pthread_mutex_lock(&g_tr.mtx);
+    for (int k = 0; k < TR_NKINDS; k++) {
+        tr_stat_t* r = &g_tr.retired[k];
+        r->n += me->st[k].n; r->ns += me->st[k].ns;
+        if (me->st[k].max_ns > r->max_ns) r->max_ns = me->st[k].max_ns;
+    }
+    if (me->ev) tr_write_events(me->tid, me->ev, me->nev);
+    if (me->prev) me->prev->next = me->next; else g_tr.live = me->next;
+    if (me->next) me->next->prev = me->prev;
+    pthread_mutex_unlock(&g_tr.mtx);
+    free(me->ev); free(me); tr_self = NULL;
+}
+static inline tr_thread_t* tr_me(void) { return tr_self ? tr_self : tr_attach("thread"); }
+// count one uncontended lock acquisition
+static inline void tr_count(int kind) { tr_stat_t* s = &tr_me()->st[kind]; TR_SET(s->n, s->n + 1); }
+// close a span of the given kind that started at t0
+static void tr_end(int kind, uint64_t t0) {
+    tr_thread_t* me = tr_me();
+    uint64_t d = tr_now() - t0;
+    tr_stat_t* s = &me->st[kind];
+    TR_SET(s->n, s->n + 1); TR_SET(s->ns, s->ns + d);
+    if (d > s->max_ns) TR_SET(s->max_ns, d);
+    if (!me->ev) return;
+    if (me->nev == TR_EV_BUF) {
+        pthread_mutex_lock(&g_tr.mtx);
+        tr_write_events(me->tid, me->ev, me->nev);
+        __atomic_store_n(&me->nev, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&g_tr.mtx);
+    }
+    me->ev[me->nev] = (tr_ev_t){ (uint32_t)kind, t0, d };
+    __atomic_store_n(&me->nev, me->nev + 1, __ATOMIC_RELEASE);
+}
+// TR_SCOPE(kind) times the rest of the enclosing block
+typedef struct { int kind; uint64_t t0; } tr_scope_t;
+static inline void tr_scope_end(tr_scope_t* sc) { tr_end(sc->kind, sc->t0); }
+#define TR_SCOPE(kind) tr_scope_t tr_scope_ __attribute__((cleanup(tr_scope_end))) = { (kind), tr_now() }
+// rwlock acquisition that times (and traces) only the contended case
+static void tr_rwlock(pthread_rwlock_t* l, bool excl, int kind) {
+    if ((excl ? pthread_rwlock_trywrlock(l) : pthread_rwlock_tryrdlock(l)) == 0) { tr_count(kind); return; }
+    uint64_t t0 = tr_now();
+    if (excl) pthread_rwlock_wrlock(l); else pthread_rwlock_rdlock(l);
+    tr_end(kind, t0);
+}
+// -T: start the trace file; called before any other thread exists
+static int tr_open(const char* path) {
+    g_tr.out = fopen(path, "w");
+    if (!g_tr.out) { perror(path); return -1; }
+    g_tr.t0 = tr_now();
+    fputs("[\n", g_tr.out);
+    return 0;
+}
+// at exit: write what every thread still buffers and end the JSON array
+static void tr_close(void) {
+    pthread_mutex_lock(&g_tr.mtx);
+    if (g_tr.out) {
+        for (tr_thread_t* t = g_tr.live; t; t = t->next)
+            if (t->ev) tr_write_events(t->tid, t->ev, __atomic_load_n(&t->nev, __ATOMIC_ACQUIRE));
+        fputs("\n]\n", g_tr.out); fclose(g_tr.out); g_tr.out = NULL;
+    }
+    pthread_mutex_unlock(&g_tr.mtx);
+}
+// "T" report: one line per timer, summed over live and exited threads
+static size_t tr_report(char* out, size_t cap) {
+    tr_stat_t sum[TR_NKINDS];
+    pthread_mutex_lock(&g_tr.mtx);
+    memcpy(sum, g_tr.retired, sizeof(sum));
+    for (tr_thread_t* t = g_tr.live; t; t = t->next)
+        for (int k = 0; k < TR_NKINDS; k++) {
+            sum[k].n += TR_GET(t->st[k].n); sum[k].ns += TR_GET(t->st[k].ns);
+            uint64_t m = TR_GET(t->st[k].max_ns); if (m > sum[k].max_ns) sum[k].max_ns = m;
+        }
+    pthread_mutex_unlock(&g_tr.mtx);
+    size_t n = (size_t)snprintf(out, cap, "%-12s %10s %12s %10s %10s\n", "timer", "count", "total_ms", "mean_us", "max_us");
+    for (int k = 0; k < TR_NKINDS && n < cap; k++)
+        n += (size_t)snprintf(out + n, cap - n, "%-12s %10llu %12.3f %10.1f %10.1f\n", tr_names[k], (unsigned long long)sum[k].n,
+                              (double)sum[k].ns / 1e6, sum[k].n ? (double)sum[k].ns / (double)sum[k].n / 1e3 : 0.0, (double)sum[k].max_ns / 1e3);
+    return n < cap ? n : cap - 1;
+}
+
+// === buffered socket input ===
+// commands, replies and payloads are pulled out of a per-socket buffer
+// instead of one recv() per byte
+#define RBUF_SZ 8192
 typedef struct {
     int fd;
-    long cyl, sec;
-} disk_t;
+    size_t pos, len;          // unread bytes are buf[pos .. len)
+    unsigned char buf[RBUF_SZ];
+} rbuf_t;
+
+static void rbuf_init(rbuf_t* rb, int fd) { rb->fd = fd; rb->pos = rb->len = 0; }
+static ssize_t rbuf_fill(rbuf_t* rb) {
+    uint64_t t0 = rb->fd == tr_cfd ? tr_now() : 0;
+    for (;;) {
+        ssize_t r = recv(rb->fd, rb->buf, RBUF_SZ, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r > 0) { rb->pos = 0; rb->len = (size_t)r; }
+        if (t0) tr_end(TR_CLIENT_RECV, t0);
+        return r;
+    }
+}
 
 // robust I/O
 static ssize_t write_all(int fd, const void* buf, size_t n) {
+    uint64_t t0 = fd == tr_cfd ? tr_now() : 0;
     size_t off = 0; while (off < n) {
         ssize_t w = send(fd, (const char*)buf + off, n - off, 0);
         if (w < 0) { if (errno == EINTR) continue; return -1; } off += (size_t)w;
-    } return (ssize_t)off;
+    }
+    if (t0) tr_end(TR_CLIENT_SEND, t0);
+    return (ssize_t)off;
 }
-static ssize_t read_exact(int fd, void* buf, size_t n) {
+static ssize_t read_exact(rbuf_t* rb, void* buf, size_t n) {
     size_t off = 0; while (off < n) {
-        ssize_t r = recv(fd, (char*)buf + off, n - off, 0);
-        if (r == 0) return off; if (r < 0) { if (errno == EINTR) continue; return -1; } off += (size_t)r;
+        size_t avail = rb->len - rb->pos;
+        if (avail > 0) {
+            size_t take = n - off < avail ? n - off : avail;
+            memcpy((char*)buf + off, rb->buf + rb->pos, take); rb->pos += take; off += take; continue;
+        }
+        ssize_t r;
+        if (n - off >= RBUF_SZ) { // large payloads skip the buffer
+            uint64_t t0 = rb->fd == tr_cfd ? tr_now() : 0;
+            r = recv(rb->fd, (char*)buf + off, n - off, 0);
+            if (t0) tr_end(TR_CLIENT_RECV, t0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r > 0) { off += (size_t)r; continue; }
+        } else {
+            r = rbuf_fill(rb);
+            if (r > 0) continue;
+        }
+        if (r == 0) return (ssize_t)off;
+        return -1;
     } return (ssize_t)off;
 }
-static ssize_t readline(int fd, char* out) {
+static ssize_t readline(rbuf_t* rb, char* out) {
     size_t off = 0; while (off + 1 < MAX_LINE) {
-        char c; ssize_t r = recv(fd, &c, 1, 0);
-        if (r == 0) break; if (r < 0) { if (errno == EINTR) continue; return -1; } out[off++] = c; if (c == '\n') break;
+        if (rb->pos == rb->len) { ssize_t r = rbuf_fill(rb); if (r == 0) break; if (r < 0) return -1; }
+        unsigned char* start = rb->buf + rb->pos;
+        size_t take = rb->len - rb->pos; if (take > MAX_LINE - 1 - off) take = MAX_LINE - 1 - off;
+        unsigned char* nl = memchr(start, '\n', take); if (nl) take = (size_t)(nl - start) + 1;
+        memcpy(out + off, start, take); rb->pos += take; off += take;
+        if (nl) break;
     }
     out[off] = 0; return (ssize_t)off;
 }
 
-static int disk_connect(disk_t* d, const char* host, int port) {
-    d->fd = socket(AF_INET, SOCK_STREAM, 0); if (d->fd < 0) { perror("socket"); return -1; }
-    struct sockaddr_in a = { 0 }; a.sin_family = AF_INET; a.sin_port = htons((uint16_t)port);
-    if (inet_pton(AF_INET, host, &a.sin_addr) != 1) { perror("inet_pton"); close(d->fd); return -1; }
-    if (connect(d->fd, (struct sockaddr*)&a, sizeof(a)) < 0) { perror("connect disk"); close(d->fd); return -1; }
-    // Query geometry with I
-    const char* I = "I\n"; if (write_all(d->fd, I, 2) < 0) { perror("send I"); close(d->fd); return -1; }
-    char buf[64]; int n = recv(d->fd, buf, sizeof(buf) - 1, 0); if (n <= 0) { fprintf(stderr, "disk: no geom\n"); close(d->fd); return -1; }
-    buf[n] = 0; if (sscanf(buf, "%ld %ld", &d->cyl, &d->sec) != 2) { fprintf(stderr, "disk: bad geom %s\n", buf); close(d->fd); return -1; }
+// === disk protocol helpers ===
+// fs_server sees one logical disk (disk_t) striped over one or more disk servers,
+// RAID-0 style: logical block b lives on node b % N, as block b / N there. With
+// -R copies the N nodes form N / copies mirror groups instead: b lives in group
+// b % groups, as block b / groups on each of that group's nodes. Writes go to
+// every copy; a read goes to the copy with the fewest sectors outstanding over
+// all connections. Each request is split into one sub-request per node, all sent
+// before any reply is awaited, so the nodes seek and transfer in parallel.
+// Logical connections live in a shared pool (see disk_pool_t) and are checked out per command.
+#define DISK_NODES_MAX 16
+typedef struct { char host[64]; int port; } disk_node_t;
+static struct {
+    disk_node_t node[DISK_NODES_MAX];
+    int n;                         // disk servers
+    int copies;                    // copies of each block (-R); divides n
+    bool binary;                   // negotiate the binary disk protocol (-a turns it off)
+    uint32_t load[DISK_NODES_MAX]; // sectors requested from each node and not yet answered (atomic)
+} g_vol = { .copies = 1, .binary = true };
+static inline uint32_t vol_groups(void) { return (uint32_t)(g_vol.n / g_vol.copies); }
+
+// one connection to one disk server: libdisk's dc_conn_t, which buffers the
+// requests of every sub-request until the first reply is awaited
+typedef dc_conn_t disk_link_t;
+
+// vectored sector I/O: move n sectors in as few RV/WV round trips as possible.
+// the disk server accepts at most DISK_VEC_MAX sectors per request, so
+// longer transfers are split and up to DISK_PIPE_DEPTH requests are kept
+// in flight on the connection; replies come back in request order.
+#define DISK_VEC_MAX 64
+#define DISK_PIPE_DEPTH 4
+
+// a request waiting for its replies: how many of its sectors went to each node
+// and, for reads, which node each one comes back from
+typedef struct {
+    uint32_t k;
+    uint16_t cnt[DISK_NODES_MAX];
+    uint8_t node[DISK_VEC_MAX];
+    dc_req_t req[DISK_NODES_MAX]; // the sub-request in flight on each node
+} disk_pend_t;
+
+typedef struct {
+    bool up;           // every link connected
+    long cyl, sec;     // logical geometry: the smallest node's, times the groups
+    bool broken;       // an I/O error left a link in an unknown state
+    disk_link_t* link; // g_vol.n of them, allocated on first connect
+    disk_pend_t pend[DISK_PIPE_DEPTH]; // outstanding requests, oldest first
+    uint32_t pend_head, npend;
+} disk_t;
+
+#define BIN_OP_RV DC_OP_RV
+#define BIN_OP_WV DC_OP_WV
+
+// connect and, if want_bin, switch to the binary protocol (see dc_open)
+static int link_connect(disk_link_t* l, const disk_node_t* nd, bool want_bin) {
+    return dc_open(l, nd->host, nd->port, want_bin);
+}
+static void link_close(disk_link_t* l) { dc_close(l); }
+
+static inline void idx_to_cs(const disk_link_t* l, uint32_t idx, long* c, long* s) {
+    *c = idx / (uint32_t)l->sec; *s = idx % (uint32_t)l->sec;
+}
+
+// queue one RV (op BIN_OP_RV) or WV request of k sectors as r; data is the WV
+// payload. It goes out with the link's next flush
+static int link_send_vec(disk_link_t* l, dc_req_t* r, uint8_t op, const uint32_t* idx, uint32_t k, const unsigned char* data) {
+    long cs[2 * DISK_VEC_MAX];
+    for (uint32_t i = 0; i < k; i++) idx_to_cs(l, idx[i], &cs[2 * i], &cs[2 * i + 1]);
+    r->cb = NULL;
+    return op == BIN_OP_WV ? dc_submit_write(l, r, k, cs, data) : dc_submit_read(l, r, k, cs, NULL);
+}
+// collect the reply to r, the oldest request on the link; out receives RV data.
+// -1 if the disk refused it, -2 if the stream is out of sync
+static int link_recv_vec(disk_link_t* l, dc_req_t* r, unsigned char* out) {
+    r->out = out;
+    int st = dc_wait(l, r);
+    return st == 1 ? 0 : st == 0 ? -1 : -2;
+}
+
+// forget the outstanding requests (their replies are lost with a broken link),
+// and the load they put on each node
+static void disk_forget(disk_t* d) {
+    // closing the links fails whatever is still queued on them, so no pend slot
+    // is reused while a link holds its request
+    if (d->broken && d->up) for (int n = 0; n < g_vol.n; n++) link_close(&d->link[n]);
+    for (; d->npend > 0; d->npend--, d->pend_head = (d->pend_head + 1) % DISK_PIPE_DEPTH)
+        for (int n = 0; n < g_vol.n; n++) __atomic_fetch_sub(&g_vol.load[n], d->pend[d->pend_head].cnt[n], __ATOMIC_RELAXED);
+}
+static int disk_connect(disk_t* d) {
+    if (!d->link && !(d->link = (disk_link_t*)calloc((size_t)g_vol.n, sizeof(disk_link_t)))) return -1;
+    long cyl = 0, sec = 0;
+    for (int i = 0; i < g_vol.n; i++) {
+        if (link_connect(&d->link[i], &g_vol.node[i], g_vol.binary) < 0) {
+            while (i-- > 0) link_close(&d->link[i]);
+            return -1;
+        }
+        if (i == 0 || d->link[i].cyl < cyl) cyl = d->link[i].cyl;
+        if (i == 0 || d->link[i].sec < sec) sec = d->link[i].sec;
+    }
+    d->cyl = cyl * (long)vol_groups(); d->sec = sec;
+    d->up = true; d->broken = false; d->pend_head = d->npend = 0;
     return 0;
 }
-static void disk_close(disk_t* d) { if (d->fd >= 0) close(d->fd); d->fd = -1; }
+static void disk_close(disk_t* d) {
+    if (d->up) for (int i = 0; i < g_vol.n; i++) link_close(&d->link[i]);
+    disk_forget(d);
+    d->up = false;
+}
 
 static inline uint32_t total_blocks(const disk_t* d) { return (uint32_t)(d->cyl * d->sec); }
-static inline void idx_to_cs(const disk_t* d, uint32_t idx, long* c, long* s) {
-    *c = idx / (uint32_t)d->sec; *s = idx % (uint32_t)d->sec;
-}
 
-// read sector by absolute index
-static int disk_read_idx(disk_t* d, uint32_t idx, unsigned char out[BLKSZ]) {
-    long c, s; idx_to_cs(d, idx, &c, &s);
-    char hdr[64]; int m = snprintf(hdr, sizeof(hdr), "R %ld %ld\n", c, s);
-    if (write_all(d->fd, hdr, (size_t)m) < 0) return -1;
-    char code; if (read_exact(d->fd, &code, 1) != 1) return -1;
-    if (code != '1') return -1;
-    return (read_exact(d->fd, out, BLKSZ) == BLKSZ) ? 0 : -1;
+// send one logical RV or WV request of k sectors as a sub-request to each node
+// that holds some of them; data is the WV payload
+static int disk_send_vec(disk_t* d, uint8_t op, const uint32_t* idx, uint32_t k, const unsigned char* data) {
+    if (d->npend == DISK_PIPE_DEPTH) { d->broken = true; disk_forget(d); return -1; }
+    disk_pend_t* p = &d->pend[(d->pend_head + d->npend) % DISK_PIPE_DEPTH];
+    uint32_t groups = vol_groups(), copies = (uint32_t)g_vol.copies;
+    uint32_t pidx[DISK_NODES_MAX][DISK_VEC_MAX], picked[DISK_NODES_MAX] = { 0 };
+    memset(p->cnt, 0, sizeof(p->cnt)); p->k = k;
+    for (uint32_t i = 0; i < k; i++) {
+        uint32_t first = idx[i] % groups * copies, at = idx[i] / groups;
+        if (op == BIN_OP_WV) { for (uint32_t r = 0; r < copies; r++) pidx[first + r][p->cnt[first + r]++] = at; continue; }
+        // the least-loaded copy, counting what this request already picked
+        uint32_t best = first + at % copies, best_load = UINT32_MAX;
+        for (uint32_t r = 0; r < copies; r++) {
+            uint32_t n = first + (at + r) % copies;
+            uint32_t load = __atomic_load_n(&g_vol.load[n], __ATOMIC_RELAXED) + picked[n];
+            if (load < best_load) { best = n; best_load = load; }
+        }
+        picked[best]++;
+        p->node[i] = (uint8_t)best;
+        pidx[best][p->cnt[best]++] = at;
+    }
+    unsigned char buf[DISK_VEC_MAX * BLKSZ];
+    for (int n = 0; n < g_vol.n; n++) {
+        if (p->cnt[n] == 0) continue;
+        const unsigned char* src = data;
+        if (op == BIN_OP_WV && p->cnt[n] != k) { // gather this node's sectors
+            uint32_t m = 0;
+            for (uint32_t i = 0; i < k; i++)
+                if (idx[i] % groups == (uint32_t)n / copies) memcpy(buf + (size_t)m++ * BLKSZ, data + (size_t)i * BLKSZ, BLKSZ);
+            src = buf;
+        }
+        __atomic_fetch_add(&g_vol.load[n], p->cnt[n], __ATOMIC_RELAXED);
+        if (link_send_vec(&d->link[n], &p->req[n], op, pidx[n], p->cnt[n], src) < 0) {
+            for (int m = 0; m <= n; m++) __atomic_fetch_sub(&g_vol.load[m], p->cnt[m], __ATOMIC_RELAXED);
+            d->broken = true; disk_forget(d);
+            return -1;
+        }
+    }
+    d->npend++;
+    return 0;
+}
+// collect the replies to the oldest outstanding request from every node it went
+// to and put read sectors back in request order; out receives RV data
+static int disk_recv_vec(disk_t* d, uint8_t op, uint32_t k, unsigned char* out) {
+    TR_SCOPE(TR_DISK_REPLY);
+    if (d->npend == 0 || d->pend[d->pend_head].k != k) { d->broken = true; disk_forget(d); return -1; }
+    disk_pend_t* p = &d->pend[d->pend_head];
+    d->pend_head = (d->pend_head + 1) % DISK_PIPE_DEPTH; d->npend--;
+    // everything queued goes out, on every link, before any reply is awaited
+    for (int n = 0; n < g_vol.n; n++) dc_flush(&d->link[n]);
+    unsigned char buf[DISK_VEC_MAX * BLKSZ];
+    uint32_t at[DISK_NODES_MAX], m = 0;
+    bool split = op == BIN_OP_RV;
+    int rv = 0;
+    for (int n = 0; n < g_vol.n; n++) {
+        if (p->cnt[n] == 0) continue;
+        if (p->cnt[n] == k) split = false; // all from one node: straight into out
+        unsigned char* dst = op != BIN_OP_RV ? NULL : split ? buf + (size_t)m * BLKSZ : out;
+        at[n] = m; m += p->cnt[n];
+        // after a broken link only the load is given back; the whole disk_t is redialed
+        int r = d->broken ? -2 : link_recv_vec(&d->link[n], &p->req[n], dst);
+        __atomic_fetch_sub(&g_vol.load[n], p->cnt[n], __ATOMIC_RELAXED);
+        if (r == -2) d->broken = true;
+        if (r < 0) rv = -1;
+    }
+    if (d->broken) { disk_forget(d); return -1; }
+    if (rv == 0 && split)
+        for (uint32_t i = 0; i < k; i++) memcpy(out + (size_t)i * BLKSZ, buf + (size_t)at[p->node[i]]++ * BLKSZ, BLKSZ);
+    return rv;
+}
+// pipelined driver shared by reads and writes; buf is the destination or source
+static int disk_xfer_vec(disk_t* d, uint8_t op, const uint32_t* idx, uint32_t n, unsigned char* buf) {
+    TR_SCOPE(op == BIN_OP_RV ? TR_DISK_RV : TR_DISK_WV);
+    uint32_t ks[DISK_PIPE_DEPTH]; // sizes of in-flight requests, oldest first
+    uint32_t head = 0, inflight = 0, sent = 0, recvd = 0;
+    int rv = 0;
+    while (recvd < n) {
+        while (sent < n && inflight < DISK_PIPE_DEPTH && rv == 0) {
+            uint32_t k = n - sent < DISK_VEC_MAX ? n - sent : DISK_VEC_MAX;
+            if (disk_send_vec(d, op, idx + sent, k, buf + (size_t)sent * BLKSZ) < 0) return -1;
+            ks[(head + inflight++) % DISK_PIPE_DEPTH] = k; sent += k;
+        }
+        if (inflight == 0) break;
+        uint32_t k = ks[head]; head = (head + 1) % DISK_PIPE_DEPTH; inflight--;
+        // keep draining after a refused request so the stream stays in sync
+        if (disk_recv_vec(d, op, k, buf + (size_t)recvd * BLKSZ) < 0) { rv = -1; if (d->broken) return -1; }
+        recvd += k;
+    }
+    return rv;
+}
+static int disk_read_vec(disk_t* d, const uint32_t* idx, uint32_t n, unsigned char* out) {
+    return disk_xfer_vec(d, BIN_OP_RV, idx, n, out);
 }
+static int disk_write_vec(disk_t* d, const uint32_t* idx, uint32_t n, const unsigned char* in) {
+    return disk_xfer_vec(d, BIN_OP_WV, idx, n, (unsigned char*)in);
+}
+// read sector by absolute index
+static int disk_read_idx(disk_t* d, uint32_t idx, unsigned char out[BLKSZ]) { return disk_read_vec(d, &idx, 1, out); }
 // write sector by absolute index, always write 128 bytes
-static int disk_write_idx(disk_t* d, uint32_t idx, const unsigned char in[BLKSZ]) {
-    long c, s; idx_to_cs(d, idx, &c, &s);
-    char hdr[64]; int m = snprintf(hdr, sizeof(hdr), "W %ld %ld %d\n", c, s, BLKSZ);
-    if (write_all(d->fd, hdr, (size_t)m) < 0) return -1;
-    if (write_all(d->fd, in, BLKSZ) < 0) return -1;
-    char code; return (read_exact(d->fd, &code, 1) == 1 && code == '1') ? 0 : -1;
+static int disk_write_idx(disk_t* d, uint32_t idx, const unsigned char in[BLKSZ]) { return disk_write_vec(d, &idx, 1, in); }
+// contiguous run [first, first+n) -- used for FAT and directory regions
+static int disk_read_run(disk_t* d, uint32_t first, uint32_t n, unsigned char* out) {
+    uint32_t idx[DISK_VEC_MAX];
+    for (uint32_t done = 0; done < n; ) {
+        uint32_t k = n - done < DISK_VEC_MAX ? n - done : DISK_VEC_MAX;
+        for (uint32_t i = 0; i < k; i++) idx[i] = first + done + i;
+        if (disk_read_vec(d, idx, k, out + (size_t)done * BLKSZ) < 0) return -1;
+        done += k;
+    }
+    return 0;
+}
+static int disk_write_run(disk_t* d, uint32_t first, uint32_t n, const unsigned char* in) {
+    uint32_t idx[DISK_VEC_MAX];
+    for (uint32_t done = 0; done < n; ) {
+        uint32_t k = n - done < DISK_VEC_MAX ? n - done : DISK_VEC_MAX;
+        for (uint32_t i = 0; i < k; i++) idx[i] = first + done + i;
+        if (disk_write_vec(d, idx, k, in + (size_t)done * BLKSZ) < 0) return -1;
+        done += k;
+    }
+    return 0;
+}
+
+// === disk connection pool ===
+// a bounded set of persistent, already-handshaked disk connections shared by
+// all client threads
+typedef struct {
+    disk_t* conns;
+    int* free_stack;   // indices of idle conns
+    int nfree, size;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+} disk_pool_t;
+static void pool_init(disk_pool_t* p, int size) {
+    p->conns = (disk_t*)calloc((size_t)size, sizeof(disk_t));
+    p->free_stack = (int*)calloc((size_t)size, sizeof(int));
+    if (!p->conns || !p->free_stack) { perror("calloc pool"); exit(1); }
+    p->size = p->nfree = size;
+    for (int i = 0; i < size; i++) p->free_stack[i] = i;
+    pthread_mutex_init(&p->mtx, NULL); pthread_cond_init(&p->cv, NULL);
+}
+// return a connection to the pool; broken ones are dropped and redialed on next use
+static void pool_put(disk_pool_t* p, disk_t* d) {
+    if (d->broken) disk_close(d);
+    pthread_mutex_lock(&p->mtx);
+    p->free_stack[p->nfree++] = (int)(d - p->conns);
+    pthread_cond_signal(&p->cv);
+    pthread_mutex_unlock(&p->mtx);
+}
+// check out a connected disk_t, waiting while all are in use; NULL if the disk is unreachable
+static disk_t* pool_get(disk_pool_t* p) {
+    pthread_mutex_lock(&p->mtx);
+    if (p->nfree == 0) {
+        uint64_t t0 = tr_now();
+        while (p->nfree == 0) pthread_cond_wait(&p->cv, &p->mtx);
+        tr_end(TR_WAIT_POOL, t0);
+    } else tr_count(TR_WAIT_POOL);
+    disk_t* d = &p->conns[p->free_stack[--p->nfree]];
+    pthread_mutex_unlock(&p->mtx);
+    if (!d->up && disk_connect(d) < 0) {
+        d->broken = false; pool_put(p, d); return NULL;
+    }
+    return d;
+}
+// a pool connection checked out on first use and held until lease_put. Commands
+// that receive a payload use it to hold a connection only while they work on the
+// disk. Never taken while holding meta_lock or a file lock: the threads holding
+// every connection could be waiting for that lock.
+typedef struct { disk_pool_t* pool; disk_t* d; } disk_lease_t;
+static disk_t* lease_get(disk_lease_t* ls) {
+    if (!ls->d) ls->d = pool_get(ls->pool);
+    return ls->d;
+}
+static void lease_put(disk_lease_t* ls) {
+    if (ls->d) pool_put(ls->pool, ls->d);
+    ls->d = NULL;
 }
 
 // === on-disk layout ===
@@ -116,30 +650,52 @@ typedef struct {
     uint32_t dir_start;    // sector index
     uint32_t dir_sectors;  // number of sectors used by directory
     uint32_t dir_entries;  // total directory entries
+    uint32_t cluster_secs; // sectors per FAT entry (cluster)
+    uint32_t clusters;     // FAT entries: cluster c covers sectors [c * cluster_secs, (c + 1) * cluster_secs)
+    uint32_t journal_start;   // sector index of the metadata journal
+    uint32_t journal_sectors; // 0: no journal, metadata is written in place
+    uint32_t stripe_nodes;    // disk servers the blocks are striped over
+    uint32_t stripe_copies;   // copies of each block (-R)
+    uint32_t dirent_size;     // DIRENT_SIZE, or DIRENT_SIZE_INLINE with inline data
+    uint32_t inline_max;      // largest file kept in its entry; 0: none
 } layout_t;
 
-// directory entry (64 bytes) — manual packing to avoid padding
+// directory entry (64 or 128 bytes) — manual packing to avoid padding
+#define FT_FILE 0
+#define FT_DIR 1
+#define DIRENT_SIZE 64
+#define DIRENT_SIZE_INLINE 128
+#define DIRENT_DATA_OFF 44
+#define DIRENT_INLINE_MAX (DIRENT_SIZE_INLINE - DIRENT_DATA_OFF) // 84
 typedef struct {
     char     name[MAX_NAME]; // 32
-    uint32_t length;         // bytes
-    uint32_t first;          // first data block index, or FAT_EOF if empty
+    uint32_t length;         // bytes (0 for a directory)
+    uint32_t first;          // first data cluster, or FAT_EOF if empty or inline; a directory's table
     uint8_t  used;           // 0/1
-    uint8_t  pad[23];        // 64 - (32+4+4+1) = 23
+    uint8_t  type;           // FT_FILE or FT_DIR
+    uint8_t  data[DIRENT_INLINE_MAX]; // an inline file's bytes (128-byte entries only)
 } dirent_fs;
 
-static void dirent_pack(const dirent_fs* e, unsigned char* dst) {
-    memset(dst, 0, 64);
+// the file's bytes are in data[] rather than in blocks
+static inline bool dirent_inline(const dirent_fs* e) { return e->type == FT_FILE && e->first == FAT_EOF && e->length > 0; }
+
+static void dirent_pack(const dirent_fs* e, unsigned char* dst, uint32_t esize) {
+    memset(dst, 0, esize);
     memcpy(dst, e->name, MAX_NAME);
     memcpy(dst + 32, &e->length, 4);
     memcpy(dst + 36, &e->first, 4);
     dst[40] = e->used;
+    dst[41] = e->type;
+    if (esize == DIRENT_SIZE_INLINE && dirent_inline(e)) memcpy(dst + DIRENT_DATA_OFF, e->data, e->length);
 }
-static void dirent_unpack(dirent_fs* e, const unsigned char* src) {
+static void dirent_unpack(dirent_fs* e, const unsigned char* src, uint32_t esize) {
     memset(e, 0, sizeof(*e));
     memcpy(e->name, src, MAX_NAME); e->name[MAX_NAME - 1] = '\0';
     memcpy(&e->length, src + 32, 4);
     memcpy(&e->first, src + 36, 4);
     e->used = src[40];
+    e->type = src[41];
+    if (esize == DIRENT_SIZE_INLINE) memcpy(e->data, src + DIRENT_DATA_OFF, DIRENT_INLINE_MAX);
 }
 
 // superblock (sector 0): ASCII tag + fields; manual pack to 128B
@@ -155,6 +711,14 @@ static void super_pack(unsigned char* blk, const disk_t* d, const layout_t* L) {
     memcpy(blk + 52, &L->dir_start, 4);
     memcpy(blk + 56, &L->dir_sectors, 4);
     memcpy(blk + 60, &L->dir_entries, 4);
+    memcpy(blk + 64, &L->cluster_secs, 4);
+    memcpy(blk + 68, &L->clusters, 4);
+    memcpy(blk + 72, &L->journal_start, 4);
+    memcpy(blk + 76, &L->journal_sectors, 4);
+    memcpy(blk + 80, &L->stripe_nodes, 4);
+    memcpy(blk + 84, &L->stripe_copies, 4);
+    memcpy(blk + 88, &L->dirent_size, 4);
+    memcpy(blk + 92, &L->inline_max, 4);
 }
 static int super_load(const unsigned char* blk, disk_t* d, layout_t* L) {
     if (memcmp(blk, "CSFS1", 5) != 0) return -1;
@@ -166,226 +730,1340 @@ static int super_load(const unsigned char* blk, disk_t* d, layout_t* L) {
     memcpy(&L->dir_start, blk + 52, 4);
     memcpy(&L->dir_sectors, blk + 56, 4);
     memcpy(&L->dir_entries, blk + 60, 4);
+    memcpy(&L->cluster_secs, blk + 64, 4);
+    memcpy(&L->clusters, blk + 68, 4);
+    memcpy(&L->journal_start, blk + 72, 4); // zero on images formatted before the journal
+    memcpy(&L->journal_sectors, blk + 76, 4);
+    memcpy(&L->stripe_nodes, blk + 80, 4);
+    memcpy(&L->stripe_copies, blk + 84, 4);
+    memcpy(&L->dirent_size, blk + 88, 4);
+    memcpy(&L->inline_max, blk + 92, 4);
+    if (L->dirent_size == 0) L->dirent_size = DIRENT_SIZE; // formatted before inline data
+    if (L->dirent_size != DIRENT_SIZE && L->dirent_size != DIRENT_SIZE_INLINE) return -1;
+    if (L->inline_max > (L->dirent_size == DIRENT_SIZE ? 0 : DIRENT_INLINE_MAX)) return -1;
+    if (L->stripe_nodes == 0) L->stripe_nodes = L->stripe_copies = 1; // formatted before striping
+    if (L->cluster_secs == 0) { L->cluster_secs = 1; L->clusters = L->total_blocks; } // formatted before clusters
     return 0;
 }
 
+// === dirty sector tracking ===
+// FAT and directory caches mark the sectors they change in a bitmap; flushes
+// gather just those sectors into one vectored write
+static inline void bm_set(uint64_t* bm, uint32_t i) { bm[i >> 6] |= 1ull << (i & 63); }
+static inline void bm_clr(uint64_t* bm, uint32_t i) { bm[i >> 6] &= ~(1ull << (i & 63)); }
+static inline bool bm_test(const uint64_t* bm, uint32_t i) { return (bm[i >> 6] >> (i & 63)) & 1; }
+static inline size_t bm_words(uint32_t nbits) { return ((size_t)nbits + 63) / 64; }
+// first bit >= from that is set (want_set) or clear, a word at a time; nbits if none
+static uint32_t bm_next(const uint64_t* bm, uint32_t from, uint32_t nbits, bool want_set) {
+    if (from >= nbits) return nbits;
+    size_t w = from >> 6;
+    uint64_t m = (want_set ? bm[w] : ~bm[w]) & (~0ull << (from & 63));
+    while (!m) {
+        if (++w >= bm_words(nbits)) return nbits;
+        m = want_set ? bm[w] : ~bm[w];
+    }
+    uint32_t i = (uint32_t)(w * 64 + (size_t)__builtin_ctzll(m));
+    return i < nbits ? i : nbits;
+}
+
+typedef struct {
+    uint32_t* idx;       // absolute sector numbers
+    unsigned char* data; // n * BLKSZ
+    uint32_t n;
+} sec_batch_t;
+
+// copy the dirty sectors of img (nsec sectors starting at disk sector base, or at
+// the disk sectors listed in map) into b; with clear, their dirty bits are reset as they are taken
+static int batch_gather(sec_batch_t* b, uint32_t base, const uint32_t* map, const unsigned char* img, uint64_t* dirty, uint32_t nsec, bool clear) {
+    size_t words = bm_words(nsec);
+    uint32_t cnt = 0;
+    for (size_t w = 0; w < words; w++) cnt += (uint32_t)__builtin_popcountll(dirty[w]);
+    if (cnt == 0) return 0;
+    uint32_t* idx = (uint32_t*)realloc(b->idx, (size_t)(b->n + cnt) * sizeof(uint32_t));
+    if (idx) b->idx = idx;
+    unsigned char* data = (unsigned char*)realloc(b->data, (size_t)(b->n + cnt) * BLKSZ);
+    if (data) b->data = data;
+    if (!idx || !data) return -1;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t m = dirty[w];
+        if (clear) dirty[w] = 0;
+        while (m) {
+            uint32_t sec = (uint32_t)(w * 64 + (size_t)__builtin_ctzll(m)); m &= m - 1;
+            b->idx[b->n] = map ? map[sec] : base + sec;
+            memcpy(b->data + (size_t)b->n * BLKSZ, img + (size_t)sec * BLKSZ, BLKSZ);
+            b->n++;
+        }
+    }
+    return 0;
+}
+// put back the dirty bits of batch entries [from, to) after a failed write
+static void batch_redirty(const sec_batch_t* b, uint32_t from, uint32_t to, uint32_t base, uint64_t* dirty) {
+    for (uint32_t k = from; k < to; k++) bm_set(dirty, b->idx[k] - base);
+}
+static void batch_free(sec_batch_t* b) { free(b->idx); free(b->data); b->idx = NULL; b->data = NULL; b->n = 0; }
+
 // === FAT cache ===
-// load/save the whole FAT into memory (uint32_t per block)
+// load/save the whole FAT into memory (uint32_t per cluster). Chains, the free
+// map and allocation count clusters; file data is addressed by sector (see sec_next).
+#define FAT_PER_SEC (BLKSZ / 4)
 typedef struct {
-    uint32_t* v;   // size = total_blocks
+    uint32_t* v;   // size = clusters
+    uint64_t* dirty; // one bit per FAT sector changed since the last flush
+    uint64_t* freemap; // one bit per cluster, set while its FAT entry is FAT_FREE
+    uint32_t nblocks;  // bits in freemap (clusters)
+    uint32_t nfree;    // set bits in freemap
+    uint32_t csize;    // sectors per cluster
+    uint32_t cursor;   // next-fit allocation start
     bool loaded;
     pthread_mutex_t mtx;
 } fat_cache_t;
 
-static void fat_init(fat_cache_t* fc) { fc->v = NULL; fc->loaded = false; pthread_mutex_init(&fc->mtx, NULL); }
-static void fat_free(fat_cache_t* fc) { free(fc->v); fc->v = NULL; fc->loaded = false; }
+static void fat_init(fat_cache_t* fc) {
+    fc->v = NULL; fc->dirty = NULL; fc->freemap = NULL; fc->nblocks = fc->nfree = fc->cursor = 0; fc->csize = 1;
+    fc->loaded = false; pthread_mutex_init(&fc->mtx, NULL);
+}
+static void fat_free(fat_cache_t* fc) {
+    free(fc->v); free(fc->dirty); free(fc->freemap);
+    fc->v = NULL; fc->dirty = NULL; fc->freemap = NULL; fc->nblocks = fc->nfree = 0; fc->loaded = false;
+}
 
 static int fat_load(disk_t* d, const layout_t* L, fat_cache_t* fc) {
+    TR_SCOPE(TR_FAT_LOAD);
     pthread_mutex_lock(&fc->mtx);
     if (fc->loaded) { pthread_mutex_unlock(&fc->mtx); return 0; }
-    fc->v = (uint32_t*)calloc(L->total_blocks, sizeof(uint32_t));
-    if (!fc->v) { pthread_mutex_unlock(&fc->mtx); return -1; }
-    unsigned char blk[BLKSZ];
-    uint32_t entries_per_sector = BLKSZ / 4; // 32
-    uint32_t idx = 0;
-    for (uint32_t s = 0; s < L->fat_sectors; s++) {
-        if (disk_read_idx(d, L->fat_start + s, blk) < 0) { pthread_mutex_unlock(&fc->mtx); return -1; }
-        for (uint32_t i = 0; i < entries_per_sector && idx < L->total_blocks; i++, idx++) {
-            memcpy(&fc->v[idx], blk + i * 4, 4);
-        }
+    // FAT sectors are contiguous on disk: size the cache to whole sectors and read them straight in
+    fc->v = (uint32_t*)calloc((size_t)L->fat_sectors * FAT_PER_SEC + 1, sizeof(uint32_t));
+    fc->dirty = (uint64_t*)calloc(bm_words(L->fat_sectors) + 1, sizeof(uint64_t));
+    fc->freemap = (uint64_t*)calloc(bm_words(L->clusters) + 1, sizeof(uint64_t));
+    if (!fc->v || !fc->dirty || !fc->freemap) { fat_free(fc); pthread_mutex_unlock(&fc->mtx); return -1; }
+    if (disk_read_run(d, L->fat_start, L->fat_sectors, (unsigned char*)fc->v) < 0) {
+        fat_free(fc); pthread_mutex_unlock(&fc->mtx); return -1;
     }
+    fc->nblocks = L->clusters;
+    fc->csize = L->cluster_secs;
+    for (uint32_t i = 0; i < fc->nblocks; i++) if (fc->v[i] == FAT_FREE) { bm_set(fc->freemap, i); fc->nfree++; }
+    fc->cursor = 0;
     fc->loaded = true;
     pthread_mutex_unlock(&fc->mtx);
     return 0;
 }
+// write back only the FAT sectors touched since the last flush
 static int fat_flush(disk_t* d, const layout_t* L, fat_cache_t* fc) {
+    TR_SCOPE(TR_FAT_FLUSH);
     pthread_mutex_lock(&fc->mtx);
     if (!fc->loaded) { pthread_mutex_unlock(&fc->mtx); return 0; }
-    unsigned char blk[BLKSZ];
-    uint32_t entries_per_sector = BLKSZ / 4;
-    uint32_t idx = 0;
-    for (uint32_t s = 0; s < L->fat_sectors; s++) {
-        memset(blk, 0, BLKSZ);
-        for (uint32_t i = 0; i < entries_per_sector && idx < L->total_blocks; i++, idx++) {
-            memcpy(blk + i * 4, &fc->v[idx], 4);
-        }
-        if (disk_write_idx(d, L->fat_start + s, blk) < 0) { pthread_mutex_unlock(&fc->mtx); return -1; }
-    }
+    sec_batch_t b = { 0 };
+    int rv = batch_gather(&b, L->fat_start, NULL, (const unsigned char*)fc->v, fc->dirty, L->fat_sectors, false);
+    if (rv == 0 && b.n > 0) rv = disk_write_vec(d, b.idx, b.n, b.data);
+    if (rv == 0) memset(fc->dirty, 0, bm_words(L->fat_sectors) * sizeof(uint64_t));
+    batch_free(&b);
     pthread_mutex_unlock(&fc->mtx);
-    return 0;
+    return rv;
 }
 static uint32_t fat_get(fat_cache_t* fc, uint32_t i) { return fc->v[i]; }
-static void     fat_set(fat_cache_t* fc, uint32_t i, uint32_t v) { fc->v[i] = v; }
-
-// === directory helpers ===
-static int dir_read_entry(disk_t* d, const layout_t* L, uint32_t slot, dirent_fs* out) {
-    uint32_t per_sector = BLKSZ / 64; // 2
-    uint32_t sec = L->dir_start + (slot / per_sector);
-    uint32_t offs = (slot % per_sector) * 64;
-    unsigned char blk[BLKSZ]; if (disk_read_idx(d, sec, blk) < 0) return -1;
-    dirent_unpack(out, blk + offs);
+// the sector after sector s in its chain: the rest of s's cluster, then the next cluster's first
+static uint32_t sec_next(fat_cache_t* fc, uint32_t s) {
+    if ((s + 1) % fc->csize != 0) return s + 1;
+    uint32_t c = fat_get(fc, s / fc->csize);
+    return c == FAT_EOF ? FAT_EOF : c * fc->csize;
+}
+// sector numbers of the first n sectors of a list of clusters
+static void clusters_to_secs(const fat_cache_t* fc, const uint32_t* clu, uint32_t n, uint32_t* out) {
+    for (uint32_t i = 0; i < n; i++) out[i] = clu[i / fc->csize] * fc->csize + i % fc->csize;
+}
+static void     fat_set(fat_cache_t* fc, uint32_t i, uint32_t v) {
+    bool was_free = fc->v[i] == FAT_FREE, is_free = v == FAT_FREE;
+    fc->v[i] = v; bm_set(fc->dirty, i / FAT_PER_SEC);
+    if (was_free != is_free && i < fc->nblocks) {
+        if (is_free) { bm_set(fc->freemap, i); fc->nfree++; }
+        else { bm_clr(fc->freemap, i); fc->nfree--; }
+    }
+}
+
+// === directory cache ===
+// every directory table lives in memory, like the FAT: a packed image of its
+// sectors (so one entry can be written back without re-reading its sector), the
+// unpacked entries, a chained hash from name to slot, and a stack of free slots.
+// The root table is the fixed region after the FAT; a subdirectory's table is a
+// chain of clusters (secs maps its image to disk sectors) that grows a cluster
+// at a time. Callers hold meta_lock (exclusive for changes).
+#define DIR_NIL 0xffffffffu
+typedef struct dir_cache {
+    uint32_t id;        // first cluster of the table's chain; 0 for the root
+    unsigned char* raw; // nsec * BLKSZ, on-disk image
+    uint32_t nsec, nents; // BLKSZ / esize entries per sector
+    uint32_t esize;     // entry size, from the layout
+    uint32_t* secs;     // disk sector of each image sector
+    dirent_fs* ents;    // nents
+    uint32_t* bucket;   // nbuckets heads into next[]
+    uint32_t* next;     // per-slot hash chain
+    uint32_t nbuckets;  // power of two
+    uint32_t* free_slots; // stack, lowest slot on top after load
+    uint32_t nfree, nused;
+    uint64_t* dirty;    // sectors awaiting a group commit (write_back only)
+    bool write_back;    // defer sector writes to the group committer
+    bool loaded;
+    struct dir_cache* hnext; // subdirectory registry chain
+} dir_cache_t;
+
+static void dir_init(dir_cache_t* dc) { bool wb = dc->write_back; memset(dc, 0, sizeof(*dc)); dc->write_back = wb; }
+static void dir_free(dir_cache_t* dc) {
+    free(dc->raw); free(dc->secs); free(dc->ents); free(dc->bucket); free(dc->next); free(dc->free_slots); free(dc->dirty);
+    dir_init(dc);
+}
+static uint32_t dir_hash(const char* name) { // FNV-1a
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < MAX_NAME && name[i]; i++) { h ^= (unsigned char)name[i]; h *= 16777619u; }
+    return h;
+}
+static void dir_index_add(dir_cache_t* dc, uint32_t slot) {
+    uint32_t b = dir_hash(dc->ents[slot].name) & (dc->nbuckets - 1);
+    dc->next[slot] = dc->bucket[b]; dc->bucket[b] = slot;
+}
+static void dir_index_del(dir_cache_t* dc, uint32_t slot) {
+    uint32_t* pp = &dc->bucket[dir_hash(dc->ents[slot].name) & (dc->nbuckets - 1)];
+    while (*pp != DIR_NIL && *pp != slot) pp = &dc->next[*pp];
+    if (*pp == slot) *pp = dc->next[slot];
+}
+// index dc->raw[0 .. nsec): entries, name hash and free stack. Also used when a
+// table grows (raw and secs already enlarged), keeping its pending dirty bits; on
+// failure the cache is left describing its old size.
+static int dir_build(dir_cache_t* dc, uint32_t nsec) {
+    uint32_t n = nsec * (BLKSZ / dc->esize), nb = 1;
+    while (nb < n) nb <<= 1;
+    dirent_fs* ents = (dirent_fs*)calloc(n ? n : 1, sizeof(dirent_fs));
+    uint32_t* next = (uint32_t*)malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t* fslots = (uint32_t*)malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t* bucket = (uint32_t*)malloc(nb * sizeof(uint32_t));
+    uint64_t* dirty = (uint64_t*)calloc(bm_words(nsec) + 1, sizeof(uint64_t));
+    if (!ents || !next || !fslots || !bucket || !dirty) { free(ents); free(next); free(fslots); free(bucket); free(dirty); return -1; }
+    if (dc->dirty) memcpy(dirty, dc->dirty, bm_words(dc->nsec) * sizeof(uint64_t));
+    free(dc->ents); free(dc->next); free(dc->free_slots); free(dc->bucket); free(dc->dirty);
+    dc->ents = ents; dc->next = next; dc->free_slots = fslots; dc->bucket = bucket; dc->dirty = dirty;
+    dc->nsec = nsec; dc->nents = n; dc->nbuckets = nb;
+    memset(dc->bucket, 0xff, nb * sizeof(uint32_t));
+    dc->nfree = dc->nused = 0;
+    for (uint32_t i = n; i-- > 0;) { // descending, so pops hand out the lowest slot first
+        dirent_unpack(&dc->ents[i], dc->raw + (size_t)i * dc->esize, dc->esize);
+        if (dc->ents[i].used) { dir_index_add(dc, i); dc->nused++; }
+        else dc->free_slots[dc->nfree++] = i;
+    }
+    dc->loaded = true;
     return 0;
 }
-static int dir_write_entry(disk_t* d, const layout_t* L, uint32_t slot, const dirent_fs* in) {
-    uint32_t per_sector = BLKSZ / 64;
-    uint32_t sec = L->dir_start + (slot / per_sector);
-    uint32_t offs = (slot % per_sector) * 64;
-    unsigned char blk[BLKSZ]; if (disk_read_idx(d, sec, blk) < 0) return -1;
-    dirent_pack(in, blk + offs);
-    if (disk_write_idx(d, sec, blk) < 0) return -1;
+// read the root directory table with one vectored request
+static int dir_load(disk_t* d, const layout_t* L, dir_cache_t* dc) {
+    TR_SCOPE(TR_DIR_LOAD);
+    if (dc->loaded) return 0;
+    unsigned char* raw = (unsigned char*)malloc((size_t)L->dir_sectors * BLKSZ);
+    uint32_t* secs = (uint32_t*)malloc((size_t)L->dir_sectors * sizeof(uint32_t));
+    if (!raw || !secs || disk_read_run(d, L->dir_start, L->dir_sectors, raw) < 0) { free(raw); free(secs); return -1; }
+    for (uint32_t i = 0; i < L->dir_sectors; i++) secs[i] = L->dir_start + i;
+    dc->raw = raw; dc->secs = secs; dc->esize = L->dirent_size;
+    if (dir_build(dc, L->dir_sectors) < 0) { dir_free(dc); return -1; }
+    return 0;
+}
+// update one slot in the cache and write through its sector only; the cache is
+// left unchanged if the disk write fails. In write_back mode the sector is only
+// marked dirty for the group committer.
+static int dir_write_entry(disk_t* d, dir_cache_t* dc, uint32_t slot, const dirent_fs* in) {
+    TR_SCOPE(TR_DIR_WRITE);
+    uint32_t per_sector = BLKSZ / dc->esize;
+    uint32_t sec = slot / per_sector;
+    unsigned char* at = dc->raw + (size_t)slot * dc->esize;
+    unsigned char old[DIRENT_SIZE_INLINE]; memcpy(old, at, dc->esize);
+    dirent_pack(in, at, dc->esize);
+    if (dc->write_back) bm_set(dc->dirty, sec);
+    else if (disk_write_idx(d, dc->secs[sec], dc->raw + (size_t)sec * BLKSZ) < 0) { memcpy(at, old, dc->esize); return -1; }
+    dirent_fs* e = &dc->ents[slot];
+    bool was_used = e->used, rename = was_used && in->used && strncmp(e->name, in->name, MAX_NAME) != 0;
+    if (was_used && (!in->used || rename)) dir_index_del(dc, slot);
+    dirent_unpack(e, at, dc->esize);
+    if (in->used && (!was_used || rename)) dir_index_add(dc, slot);
+    if (was_used && !in->used) { dc->free_slots[dc->nfree++] = slot; dc->nused--; }
+    if (!was_used && in->used) { // normally the top of the stack (from dir_find_free)
+        uint32_t k = dc->nfree;
+        while (k > 0 && dc->free_slots[k - 1] != slot) k--;
+        if (k > 0) { memmove(&dc->free_slots[k - 1], &dc->free_slots[k], (dc->nfree - k) * sizeof(uint32_t)); dc->nfree--; }
+        dc->nused++;
+    }
     return 0;
 }
-static int dir_find_by_name(disk_t* d, const layout_t* L, const char* name, uint32_t* slot, dirent_fs* ent) {
-    for (uint32_t i = 0; i < L->dir_entries; i++) {
-        if (dir_read_entry(d, L, i, ent) < 0) return -1;
-        if (ent->used && strncmp(ent->name, name, MAX_NAME) == 0) { *slot = i; return 0; }
+static int dir_find_by_name(dir_cache_t* dc, const char* name, uint32_t* slot, dirent_fs* ent) {
+    if (!dc->loaded) return 1; // a failed F dropped the cache
+    for (uint32_t i = dc->bucket[dir_hash(name) & (dc->nbuckets - 1)]; i != DIR_NIL; i = dc->next[i]) {
+        if (strncmp(dc->ents[i].name, name, MAX_NAME) == 0) { *slot = i; *ent = dc->ents[i]; return 0; }
     }
     return 1; // not found
 }
-static int dir_find_free(disk_t* d, const layout_t* L, uint32_t* slot) {
-    dirent_fs e;
-    for (uint32_t i = 0; i < L->dir_entries; i++) {
-        if (dir_read_entry(d, L, i, &e) < 0) return -1;
-        if (!e.used) { *slot = i; return 0; }
+// peek at the next free slot; dir_write_entry takes it off the stack once it is used
+static int dir_find_free(dir_cache_t* dc, uint32_t* slot) {
+    if (!dc->loaded || dc->nfree == 0) return 1; // none
+    *slot = dc->free_slots[dc->nfree - 1];
+    return 0;
+}
+
+// === block-index cache ===
+// per-file arrays of sector numbers, so finding block #n of a file is an array
+// lookup instead of a walk over the FAT. Entries are keyed by the chain's head block,
+// built lazily as far as lookups reach, dropped by free_chain (a new chain always
+// gets a fresh head) and cleared by F. Total cached block numbers are capped at
+// BIDX_CAP_BLOCKS, evicting the least recently used files; past the cap a
+// lookup falls back to walking the FAT from the last cached block.
+// Callers hold the file's lock, so the chain itself cannot change underneath.
+#define BIDX_CAP_BLOCKS (1u << 18) // 1 MB of block numbers
+#define BIDX_BUCKETS 256
+typedef struct bidx_ent {
+    uint32_t head;
+    uint32_t n, cap;        // blk[0 .. n) are valid
+    uint32_t* blk;
+    struct bidx_ent *hnext, *prev, *next; // hash chain; LRU list (most recent at front)
+} bidx_ent_t;
+typedef struct {
+    bidx_ent_t* bucket[BIDX_BUCKETS];
+    bidx_ent_t *lru_head, *lru_tail;
+    size_t total;           // sum of cap over entries
+    uint64_t hits, misses;
+    pthread_mutex_t mtx;
+} bidx_cache_t;
+static bidx_cache_t g_bidx = { .mtx = PTHREAD_MUTEX_INITIALIZER };
+
+static void bidx_unlink_lru(bidx_cache_t* bc, bidx_ent_t* e) {
+    if (e->prev) e->prev->next = e->next; else bc->lru_head = e->next;
+    if (e->next) e->next->prev = e->prev; else bc->lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+static void bidx_push_front(bidx_cache_t* bc, bidx_ent_t* e) {
+    e->prev = NULL; e->next = bc->lru_head;
+    if (bc->lru_head) bc->lru_head->prev = e; else bc->lru_tail = e;
+    bc->lru_head = e;
+}
+static void bidx_remove(bidx_cache_t* bc, bidx_ent_t* e) {
+    bidx_ent_t** pp = &bc->bucket[e->head % BIDX_BUCKETS];
+    while (*pp != e) pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    bidx_unlink_lru(bc, e);
+    bc->total -= e->cap;
+    free(e->blk); free(e);
+}
+// forget the index of the chain starting at head (called as the chain is freed)
+static void bidx_drop(uint32_t head) {
+    pthread_mutex_lock(&g_bidx.mtx);
+    for (bidx_ent_t* e = g_bidx.bucket[head % BIDX_BUCKETS]; e; e = e->hnext)
+        if (e->head == head) { bidx_remove(&g_bidx, e); break; }
+    pthread_mutex_unlock(&g_bidx.mtx);
+}
+static void bidx_clear(void) {
+    pthread_mutex_lock(&g_bidx.mtx);
+    while (g_bidx.lru_head) bidx_remove(&g_bidx, g_bidx.lru_head);
+    pthread_mutex_unlock(&g_bidx.mtx);
+}
+// copy the sector numbers of blocks [from, from+n) of the chain at head (a cluster)
+// into out. Returns the count copied, short only if the chain ends first; the
+// chain includes the unused sectors at the end of its last cluster.
+static uint32_t bidx_get(fat_cache_t* fc, uint32_t head, uint32_t from, uint32_t n, uint32_t* out) {
+    TR_SCOPE(TR_BIDX);
+    if (head == FAT_EOF || n == 0) return 0;
+    pthread_mutex_lock(&g_bidx.mtx);
+    bidx_ent_t* e = g_bidx.bucket[head % BIDX_BUCKETS];
+    while (e && e->head != head) e = e->hnext;
+    if (!e && (e = (bidx_ent_t*)calloc(1, sizeof(*e))) != NULL) {
+        e->head = head;
+        e->hnext = g_bidx.bucket[head % BIDX_BUCKETS]; g_bidx.bucket[head % BIDX_BUCKETS] = e;
+        bidx_push_front(&g_bidx, e);
+    } else if (e) { bidx_unlink_lru(&g_bidx, e); bidx_push_front(&g_bidx, e); }
+    uint32_t want = from + n;
+    if (e && e->n >= want) g_bidx.hits++; else g_bidx.misses++;
+    // extend the cached prefix toward want, within the memory cap
+    if (e && e->n < want) {
+        if (e->cap < want) {
+            uint32_t ncap = e->cap ? e->cap : 64;
+            while (ncap < want) ncap *= 2;
+            while (g_bidx.total + (ncap - e->cap) > BIDX_CAP_BLOCKS && g_bidx.lru_tail && g_bidx.lru_tail != e)
+                bidx_remove(&g_bidx, g_bidx.lru_tail);
+            if (g_bidx.total + (ncap - e->cap) <= BIDX_CAP_BLOCKS) {
+                uint32_t* nb = (uint32_t*)realloc(e->blk, (size_t)ncap * sizeof(uint32_t));
+                if (nb) { e->blk = nb; g_bidx.total += ncap - e->cap; e->cap = ncap; }
+            }
+        }
+        uint32_t cur = e->n ? sec_next(fc, e->blk[e->n - 1]) : head * fc->csize;
+        while (e->n < want && e->n < e->cap && cur != FAT_EOF) { e->blk[e->n++] = cur; cur = sec_next(fc, cur); }
+    }
+    // copy what is cached, walk the rest
+    uint32_t got = 0, cur = FAT_EOF;
+    if (e && from < e->n) {
+        got = e->n - from < n ? e->n - from : n;
+        memcpy(out, e->blk + from, (size_t)got * sizeof(uint32_t));
+        cur = sec_next(fc, out[got - 1]);
+    } else {
+        cur = (e && e->n) ? sec_next(fc, e->blk[e->n - 1]) : head * fc->csize;
+        for (uint32_t i = e ? e->n : 0; i < from && cur != FAT_EOF; i++) cur = sec_next(fc, cur);
     }
-    return 1; // none
+    pthread_mutex_unlock(&g_bidx.mtx);
+    while (got < n && cur != FAT_EOF) { out[got++] = cur; cur = sec_next(fc, cur); }
+    return got;
 }
 
 // === allocation ===
-static int find_free_block(const layout_t* L, fat_cache_t* fc, uint32_t start_idx, uint32_t* out) {
-    for (uint32_t i = start_idx; i < L->total_blocks; i++) {
-        if (fc->v[i] == FAT_FREE) { *out = i; return 0; }
+// pick n free clusters into out[], next-fit from the rotating cursor. A single free
+// extent of n blocks is preferred; otherwise runs are taken in cursor order.
+// Clusters holding metadata are RESERVED in the FAT, so they never show up as free.
+// The blocks are only chosen here; the caller links them with fat_set.
+static int alloc_blocks(fat_cache_t* fc, uint32_t n, uint32_t* out) {
+    TR_SCOPE(TR_ALLOC);
+    if (n > fc->nfree) return 1; // no space
+    uint32_t nb = fc->nblocks, start = fc->cursor < nb ? fc->cursor : 0;
+    // pass 1: first extent of length >= n at or after the cursor, wrapping once
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t i = pass ? 0 : start, end = pass ? start : nb;
+        while ((i = bm_next(fc->freemap, i, end, true)) < end) {
+            uint32_t j = bm_next(fc->freemap, i, nb, false);
+            if (j - i >= n) {
+                for (uint32_t k = 0; k < n; k++) out[k] = i + k;
+                fc->cursor = i + n;
+                return 0;
+            }
+            i = j;
+        }
+    }
+    // pass 2: fragmented; take runs in order from the cursor
+    uint32_t got = 0, i = start;
+    while (got < n) {
+        i = bm_next(fc->freemap, i, nb, true);
+        if (i >= nb) { i = 0; continue; }
+        while (got < n && i < nb && bm_test(fc->freemap, i)) out[got++] = i++;
     }
-    return 1;
+    fc->cursor = i;
+    return 0;
+}
+// W and growing WR/A allocate before streaming the data in without meta_lock, but
+// link the clusters into the FAT only when they publish: meanwhile they are just
+// out of the free map, so a commit in between never records a chain that no entry
+// points to (or a file longer than its length says).
+static void fat_reserve(fat_cache_t* fc, const uint32_t* c, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) { bm_clr(fc->freemap, c[i]); fc->nfree--; }
+}
+static void fat_unreserve(fat_cache_t* fc, const uint32_t* c, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) { bm_set(fc->freemap, c[i]); fc->nfree++; }
+}
+// chain reserved clusters in order, ending in FAT_EOF
+static void fat_link_reserved(fat_cache_t* fc, const uint32_t* c, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) { fc->v[c[i]] = i + 1 < n ? c[i + 1] : FAT_EOF; bm_set(fc->dirty, c[i] / FAT_PER_SEC); }
 }
 static int free_chain(disk_t* d, const layout_t* L, fat_cache_t* fc, uint32_t head) {
+    TR_SCOPE(TR_FREE_CHAIN);
     (void)d; (void)L; // local only; flushed at end
+    bidx_drop(head);
     uint32_t cur = head;
     while (cur != FAT_EOF) {
-        uint32_t nxt = fc->v[cur];
-        fc->v[cur] = FAT_FREE;
+        uint32_t nxt = fat_get(fc, cur);
+        fat_set(fc, cur, FAT_FREE);
         if (nxt == FAT_EOF) break;
         cur = nxt;
     }
     return 0;
 }
 
+// === metadata journal ===
+// With a journal (on by default, see F) FAT and directory sectors are not written
+// in place when a command commits. The commit -- one command, or a whole -G batch --
+// is appended to the journal region as one transaction in a single vectored
+// write: a descriptor (magic, sequence number, sector count, CRC of the rest),
+// the target sector numbers, then the sector images. It is durable once that
+// write is acknowledged. The images are kept in memory too and only written in
+// place, the last one per sector, when the journal is full (a checkpoint), which
+// then resets the header sector to say where the next transaction goes. Mounting
+// after a crash reads just the journal region and replays the transactions that
+// follow the header and check out, so the FAT and directories come back exactly as
+// of the last acknowledged commit: no chain is leaked or cross-linked halfway.
+#define JR_HDR_MAGIC "CSJH"
+#define JR_TXN_MAGIC "CSJT"
+#define JR_PER_LIST (BLKSZ / 4) // target sector numbers per list sector
+typedef struct {
+    uint32_t start, nsec;   // region; nsec is 0 without a journal
+    uint32_t head;          // offset of the next transaction (sector 0 is the header)
+    uint64_t seq;           // sequence number of the next transaction
+    sec_batch_t pend;       // images journaled since the last checkpoint, oldest first
+    // subdirectory clusters freed by RD: older transactions may still rewrite them
+    // at a checkpoint or a replay, so they are kept from reuse until the
+    // transaction freeing them has been checkpointed
+    uint32_t* q; uint32_t nq, qcap;
+    uint32_t q_gathered;    // q[0 .. q_gathered) are freed in a commit being written,
+    uint32_t q_journaled;   // in a journaled one,
+    uint32_t q_released;    // in a checkpointed one: free to reuse
+} journal_t;
+static journal_t g_jr;
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char* p, size_t n) {
+    crc = ~crc;
+    while (n--) { crc ^= *p++; for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1))); }
+    return ~crc;
+}
+static uint32_t jr_crc(uint64_t seq, uint32_t n, const unsigned char* body, size_t len) {
+    unsigned char h[12]; memcpy(h, &seq, 8); memcpy(h + 8, &n, 4);
+    return crc32_update(crc32_update(0, h, sizeof(h)), body, len);
+}
+// sectors taken by a transaction of n images
+static uint32_t jr_txn_len(uint32_t n) { return 1 + (n + JR_PER_LIST - 1) / JR_PER_LIST + n; }
+static void jr_header_pack(unsigned char* blk, uint64_t seq, uint32_t head) {
+    memset(blk, 0, BLKSZ);
+    memcpy(blk, JR_HDR_MAGIC, 4);
+    memcpy(blk + 8, &seq, 8);
+    memcpy(blk + 16, &head, 4);
+}
+static void jr_reset(const layout_t* L, uint64_t seq) {
+    batch_free(&g_jr.pend); free(g_jr.q);
+    memset(&g_jr, 0, sizeof(g_jr));
+    g_jr.start = L->journal_start; g_jr.nsec = L->journal_sectors;
+    g_jr.head = 1; g_jr.seq = seq;
+}
+// F: zero the whole region, so nothing there from before can pass for a transaction
+static int jr_format(disk_t* d, const layout_t* L) {
+    unsigned char* z = (unsigned char*)calloc(L->journal_sectors, BLKSZ);
+    if (!z) return -1;
+    jr_header_pack(z, 1, 1);
+    int rv = disk_write_run(d, L->journal_start, L->journal_sectors, z);
+    free(z);
+    return rv;
+}
+static int cmp_u64(const void* a, const void* b) { uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b; return x < y ? -1 : x > y; }
+// write images to their home sectors, in sector order, the last one of each sector only
+static int jr_write_home(disk_t* d, const sec_batch_t* b) {
+    if (b->n == 0) return 0;
+    uint64_t* key = (uint64_t*)malloc((size_t)b->n * sizeof(uint64_t));
+    uint32_t* idx = (uint32_t*)malloc((size_t)b->n * sizeof(uint32_t));
+    unsigned char* data = (unsigned char*)malloc((size_t)b->n * BLKSZ);
+    int rv = -1;
+    if (key && idx && data) {
+        for (uint32_t i = 0; i < b->n; i++) key[i] = (uint64_t)b->idx[i] << 32 | i;
+        qsort(key, b->n, sizeof(uint64_t), cmp_u64);
+        uint32_t m = 0;
+        for (uint32_t i = 0; i < b->n; i++) {
+            if (i + 1 < b->n && key[i + 1] >> 32 == key[i] >> 32) continue; // superseded
+            idx[m] = (uint32_t)(key[i] >> 32);
+            memcpy(data + (size_t)m * BLKSZ, b->data + (size_t)(uint32_t)key[i] * BLKSZ, BLKSZ);
+            m++;
+        }
+        rv = disk_write_vec(d, idx, m, data);
+    }
+    free(key); free(idx); free(data);
+    return rv;
+}
+// write what has been journaled in place, then start the journal over
+static int jr_checkpoint(disk_t* d) {
+    if (g_jr.head == 1) return 0;
+    TR_SCOPE(TR_JR_CKPT);
+    unsigned char blk[BLKSZ]; jr_header_pack(blk, g_jr.seq, 1);
+    if (jr_write_home(d, &g_jr.pend) < 0 || disk_write_idx(d, g_jr.start, blk) < 0) return -1;
+    batch_free(&g_jr.pend);
+    g_jr.head = 1;
+    g_jr.q_released = g_jr.q_journaled;
+    return 0;
+}
+// append the dirty sectors in b as one transaction, checkpointing first if it does
+// not fit. A batch too big for the whole journal goes in place after a
+// checkpoint instead, without the all-or-nothing guarantee.
+static int jr_commit(disk_t* d, const sec_batch_t* b) {
+    if (b->n == 0) return 0;
+    TR_SCOPE(TR_JR_COMMIT);
+    uint32_t len = jr_txn_len(b->n), nlist = len - 1 - b->n;
+    if (len > g_jr.nsec - 1) {
+        if (jr_checkpoint(d) < 0 || disk_write_vec(d, b->idx, b->n, b->data) < 0) return -1;
+        g_jr.q_released = g_jr.q_journaled = g_jr.q_gathered;
+        return 0;
+    }
+    if (g_jr.head + len > g_jr.nsec && jr_checkpoint(d) < 0) return -1;
+    // room in pend first, so a journaled transaction is always checkpointed later
+    uint32_t* pidx = (uint32_t*)realloc(g_jr.pend.idx, (size_t)(g_jr.pend.n + b->n) * sizeof(uint32_t));
+    if (pidx) g_jr.pend.idx = pidx;
+    unsigned char* pdata = (unsigned char*)realloc(g_jr.pend.data, (size_t)(g_jr.pend.n + b->n) * BLKSZ);
+    if (pdata) g_jr.pend.data = pdata;
+    unsigned char* buf = (unsigned char*)calloc(len, BLKSZ);
+    uint32_t* idx = (uint32_t*)malloc((size_t)len * sizeof(uint32_t));
+    int rv = -1;
+    if (pidx && pdata && buf && idx) {
+        memcpy(buf + BLKSZ, b->idx, (size_t)b->n * sizeof(uint32_t)); // the list sectors, packed
+        memcpy(buf + (size_t)(1 + nlist) * BLKSZ, b->data, (size_t)b->n * BLKSZ);
+        uint32_t crc = jr_crc(g_jr.seq, b->n, buf + BLKSZ, (size_t)(len - 1) * BLKSZ);
+        memcpy(buf, JR_TXN_MAGIC, 4);
+        memcpy(buf + 8, &g_jr.seq, 8);
+        memcpy(buf + 16, &b->n, 4);
+        memcpy(buf + 20, &crc, 4);
+        for (uint32_t k = 0; k < len; k++) idx[k] = g_jr.start + g_jr.head + k;
+        rv = disk_write_vec(d, idx, len, buf);
+    }
+    if (rv == 0) {
+        memcpy(g_jr.pend.idx + g_jr.pend.n, b->idx, (size_t)b->n * sizeof(uint32_t));
+        memcpy(g_jr.pend.data + (size_t)g_jr.pend.n * BLKSZ, b->data, (size_t)b->n * BLKSZ);
+        g_jr.pend.n += b->n;
+        g_jr.head += len; g_jr.seq++;
+        g_jr.q_journaled = g_jr.q_gathered;
+    }
+    free(buf); free(idx);
+    return rv;
+}
+// when the filesystem is first used: apply the transactions after the header in
+// order, then start the journal empty. Only the journal region is read.
+static int jr_replay(disk_t* d, const layout_t* L) {
+    jr_reset(L, 1);
+    uint32_t J = L->journal_sectors;
+    if (J == 0) return 0;
+    unsigned char* r = (unsigned char*)malloc((size_t)J * BLKSZ);
+    if (!r || disk_read_run(d, L->journal_start, J, r) < 0 || memcmp(r, JR_HDR_MAGIC, 4) != 0) { free(r); return -1; }
+    uint64_t seq; uint32_t off;
+    memcpy(&seq, r + 8, 8); memcpy(&off, r + 16, 4);
+    sec_batch_t b = { 0 };
+    uint32_t ntx = 0;
+    int rv = 0;
+    while (rv == 0 && off >= 1 && off < J) {
+        const unsigned char* t = r + (size_t)off * BLKSZ;
+        uint64_t ts; uint32_t n, crc;
+        memcpy(&ts, t + 8, 8); memcpy(&n, t + 16, 4); memcpy(&crc, t + 20, 4);
+        if (memcmp(t, JR_TXN_MAGIC, 4) != 0 || ts != seq || n == 0 || n >= J) break; // end of the log
+        uint32_t len = jr_txn_len(n), nlist = len - 1 - n;
+        if (len > J - off || jr_crc(ts, n, t + BLKSZ, (size_t)(len - 1) * BLKSZ) != crc) break; // torn write
+        uint32_t* idx = (uint32_t*)realloc(b.idx, (size_t)(b.n + n) * sizeof(uint32_t));
+        if (idx) b.idx = idx;
+        unsigned char* data = (unsigned char*)realloc(b.data, (size_t)(b.n + n) * BLKSZ);
+        if (data) b.data = data;
+        if (!idx || !data) { rv = -1; break; }
+        memcpy(b.idx + b.n, t + BLKSZ, (size_t)n * sizeof(uint32_t));
+        memcpy(b.data + (size_t)b.n * BLKSZ, t + (size_t)(1 + nlist) * BLKSZ, (size_t)n * BLKSZ);
+        for (uint32_t k = b.n; k < b.n + n; k++) // only ever FAT or directory sectors
+            if (b.idx[k] == 0 || b.idx[k] >= L->total_blocks || (b.idx[k] >= L->journal_start && b.idx[k] < L->journal_start + J)) rv = -1;
+        b.n += n; off += len; seq++; ntx++;
+    }
+    if (rv == 0 && ntx > 0) {
+        unsigned char blk[BLKSZ]; jr_header_pack(blk, seq, 1);
+        if (jr_write_home(d, &b) < 0 || disk_write_idx(d, L->journal_start, blk) < 0) rv = -1;
+        else fprintf(stderr, "[fs_server] journal: replayed %u transactions (%u sectors)\n", ntx, b.n);
+    }
+    batch_free(&b); free(r);
+    if (rv == 0) g_jr.seq = seq;
+    return rv;
+}
+// RD with a journal: free a table's chain in the FAT but keep its clusters out of
+// the free map until jr_release. If the list cannot grow they stay allocated until F.
+static void jr_quarantine(fat_cache_t* fc, uint32_t head) {
+    uint32_t n = 0;
+    for (uint32_t c = head; c != FAT_EOF && n <= fc->nblocks; c = fat_get(fc, c)) n++;
+    if (g_jr.nq + n > g_jr.qcap) {
+        uint32_t cap = g_jr.qcap ? g_jr.qcap : 16;
+        while (cap < g_jr.nq + n) cap *= 2;
+        uint32_t* q = (uint32_t*)realloc(g_jr.q, (size_t)cap * sizeof(uint32_t));
+        if (!q) return;
+        g_jr.q = q; g_jr.qcap = cap;
+    }
+    bidx_drop(head);
+    for (uint32_t c = head; c != FAT_EOF && n-- > 0; ) {
+        uint32_t nxt = fat_get(fc, c);
+        fat_set(fc, c, FAT_FREE);
+        bm_clr(fc->freemap, c); fc->nfree--;
+        g_jr.q[g_jr.nq++] = c;
+        c = nxt;
+    }
+}
+// return the quarantined clusters that are safe to reuse; meta_lock held exclusively
+static void jr_release(fat_cache_t* fc) {
+    uint32_t k = g_jr.q_released;
+    if (k == 0) return;
+    for (uint32_t i = 0; i < k; i++) {
+        uint32_t c = g_jr.q[i];
+        if (fc->v[c] == FAT_FREE && !bm_test(fc->freemap, c)) { bm_set(fc->freemap, c); fc->nfree++; }
+    }
+    memmove(g_jr.q, g_jr.q + k, (size_t)(g_jr.nq - k) * sizeof(uint32_t));
+    g_jr.nq -= k; g_jr.q_gathered -= k; g_jr.q_journaled -= k; g_jr.q_released = 0;
+}
+
 // === formatting ===
-static int compute_layout(const disk_t* disk, layout_t* L) {
+// "F [cluster_secs [dir_entries [journal_sectors [inline_max]]]]"
+#define FMT_CLUSTER_DEFAULT 1
+#define FMT_CLUSTER_MAX 256
+#define FMT_DIR_DEFAULT 64
+#define FMT_DIR_MAX (1u << 20)
+#define FMT_JOURNAL_AUTO UINT32_MAX // FMT_JOURNAL_DEFAULT, or 1/16 of a small disk
+#define FMT_JOURNAL_DEFAULT 128
+#define FMT_JOURNAL_MIN 8
+#define FMT_JOURNAL_MAX (1u << 16)
+typedef struct { uint32_t cluster_secs, dir_entries, journal_sectors, inline_max; } fmt_opts_t;
+
+// sector 0 superblock, then the FAT (one entry per cluster), the root directory
+// (two entries per sector, one with inline data) and the journal. Fails if the metadata
+// would leave no data cluster.
+static int compute_layout(const disk_t* disk, const fmt_opts_t* o, layout_t* L) {
+    if (o->cluster_secs < 1 || o->cluster_secs > FMT_CLUSTER_MAX || o->dir_entries < 1 || o->dir_entries > FMT_DIR_MAX) return -1;
+    if (o->inline_max > DIRENT_INLINE_MAX) return -1;
     L->total_blocks = total_blocks(disk);
+    L->cluster_secs = o->cluster_secs;
+    L->clusters = L->total_blocks / L->cluster_secs; // a partial cluster at the end goes unused
     // FAT: 4 bytes per entry. entries_per_sector = 128/4 = 32
-    uint32_t fat_bytes = L->total_blocks * 4;
-    uint32_t fat_secs = (fat_bytes + BLKSZ - 1) / BLKSZ;
-    // Directory: choose 64 entries (2 per sector -> 32 sectors)
-    L->dir_entries = 64;
-    L->dir_sectors = 32;
-
-    L->fat_start = 1;                 // superblock at sector 0
-    L->fat_sectors = fat_secs;
+    L->fat_start = 1;
+    L->fat_sectors = (L->clusters + FAT_PER_SEC - 1) / FAT_PER_SEC;
+    L->inline_max = o->inline_max;
+    L->dirent_size = o->inline_max > 0 ? DIRENT_SIZE_INLINE : DIRENT_SIZE;
+    uint32_t per_sector = BLKSZ / L->dirent_size;
+    L->dir_sectors = (o->dir_entries + per_sector - 1) / per_sector;
+    L->dir_entries = L->dir_sectors * per_sector; // fill the last sector
     L->dir_start = L->fat_start + L->fat_sectors;
-    L->dir_sectors = L->dir_sectors;
-    return 0;
+    uint32_t j = o->journal_sectors;
+    if (j == FMT_JOURNAL_AUTO) {
+        j = L->total_blocks / 16 < FMT_JOURNAL_DEFAULT ? L->total_blocks / 16 : FMT_JOURNAL_DEFAULT;
+        if (j < FMT_JOURNAL_MIN) j = 0; // too small a disk to spare it
+    } else if (j != 0 && (j < FMT_JOURNAL_MIN || j > FMT_JOURNAL_MAX)) return -1;
+    L->journal_start = L->dir_start + L->dir_sectors;
+    L->journal_sectors = j;
+    L->stripe_nodes = (uint32_t)g_vol.n; L->stripe_copies = (uint32_t)g_vol.copies;
+    uint64_t meta_end = (uint64_t)L->journal_start + L->journal_sectors; // first sector after the metadata
+    return meta_end / L->cluster_secs < L->clusters ? 0 : -1;
 }
-static int format_fs(disk_t* d, layout_t* L, fat_cache_t* fc) {
-    if (compute_layout(d, L) < 0) return -1;
-
+static int format_fs(disk_t* d, layout_t* L, fat_cache_t* fc, dir_cache_t* dc) {
     // write superblock
     unsigned char blk[BLKSZ]; super_pack(blk, d, L);
     if (disk_write_idx(d, 0, blk) < 0) return -1;
 
-    // init FAT on disk: mark everything FREE, then mark [0 .. meta_end] as RESERVED
-    unsigned char z[BLKSZ]; memset(z, 0, BLKSZ);
-    for (uint32_t s = 0; s < L->fat_sectors; s++) {
-        if (disk_write_idx(d, L->fat_start + s, z) < 0) return -1;
-    }
+    // init FAT on disk: mark everything FREE, then the clusters of sectors [0 .. meta_end] as RESERVED
+    uint32_t meta_secs = L->fat_sectors > L->dir_sectors ? L->fat_sectors : L->dir_sectors;
+    unsigned char* z = (unsigned char*)calloc(meta_secs, BLKSZ); if (!z) return -1;
+    if (disk_write_run(d, L->fat_start, L->fat_sectors, z) < 0) { free(z); return -1; }
     // load to cache, then set reservations and flush
-    if (fat_load(d, L, fc) < 0) return -1;
+    if (fat_load(d, L, fc) < 0) { free(z); return -1; }
 
-    uint32_t meta_end = L->dir_start + L->dir_sectors - 1;
-    for (uint32_t i = 0; i <= meta_end && i < L->total_blocks; i++) {
-        fc->v[i] = FAT_RESERVED;
+    uint32_t meta_end = L->journal_start + L->journal_sectors - 1;
+    for (uint32_t i = 0; i <= meta_end / L->cluster_secs && i < L->clusters; i++) {
+        fat_set(fc, i, FAT_RESERVED);
     }
-    if (fat_flush(d, L, fc) < 0) return -1;
+    if (fat_flush(d, L, fc) < 0) { free(z); return -1; }
 
-    // clear directory sectors
-    memset(z, 0, BLKSZ);
-    for (uint32_t s = 0; s < L->dir_sectors; s++) {
-        if (disk_write_idx(d, L->dir_start + s, z) < 0) return -1;
+    // an empty journal, so nothing left in the region from before is replayed
+    if (L->journal_sectors > 0 && jr_format(d, L) < 0) { free(z); return -1; }
+    // clear directory sectors; the zeroed image becomes the directory cache
+    if (disk_write_run(d, L->dir_start, L->dir_sectors, z) < 0) { free(z); return -1; }
+    if (L->dir_sectors < L->fat_sectors) {
+        unsigned char* shrunk = (unsigned char*)realloc(z, (size_t)L->dir_sectors * BLKSZ);
+        if (shrunk) z = shrunk;
     }
+    dc->raw = z; dc->esize = L->dirent_size;
+    dc->secs = (uint32_t*)malloc((size_t)L->dir_sectors * sizeof(uint32_t));
+    if (!dc->secs) { dir_free(dc); return -1; }
+    for (uint32_t i = 0; i < L->dir_sectors; i++) dc->secs[i] = L->dir_start + i;
+    if (dir_build(dc, L->dir_sectors) < 0) { dir_free(dc); return -1; }
     return 0;
 }
 
-// === reading/writing files ===
-static int read_whole_file(disk_t* d, const layout_t* L, fat_cache_t* fc, const dirent_fs* ent, unsigned char** out, uint32_t* outlen) {
-    *outlen = ent->length;
-    *out = (unsigned char*)malloc(ent->length ? ent->length : 1);
-    if (!*out) return -1;
-    uint32_t left = ent->length, pos = 0;
-    uint32_t cur = ent->first;
-    unsigned char blk[BLKSZ];
-    while (left > 0 && cur != FAT_EOF) {
-        if (disk_read_idx(d, cur, blk) < 0) { free(*out); return -1; }
-        uint32_t take = left < BLKSZ ? left : BLKSZ;
-        memcpy(*out + pos, blk, take);
-        pos += take; left -= take;
-        cur = fat_get(fc, cur);
+// === sector cache ===
+// data blocks, keyed by sector index, with LRU or ARC replacement. FAT and
+// directory sectors have their own caches above, so only file data comes here.
+// Write-through by default; in write-back mode (-c n,wb) file writes only dirty
+// the cache and a flusher thread writes them out in sorted batches. Dirty
+// blocks are never evicted: when no clean victim exists an insert is refused
+// and the caller goes to the disk directly.
+typedef enum { BC_NONE, BC_T1, BC_T2, BC_B1, BC_B2 } bc_list_id;
+typedef struct bc_ent {
+    uint32_t idx;
+    int32_t data;            // slot in bc.data, -1 for ARC ghosts
+    uint8_t list;            // bc_list_id
+    bool dirty;
+    bool ahead;              // brought in by read-ahead and not yet read
+    uint32_t ver;            // bumped on every write, so a flush can tell it went stale
+    struct bc_ent *prev, *next, *hnext;
+} bc_ent_t;
+typedef struct { bc_ent_t *mru, *lru; uint32_t n; } bc_list_t;
+typedef struct {
+    uint32_t cap;            // data blocks held (c)
+    bool arc, write_back;
+    bc_ent_t* ents;          // cap (LRU) or 2*cap (ARC: resident + ghosts)
+    bc_ent_t* spare;         // unused entries
+    bc_ent_t** bucket; uint32_t nbuckets;
+    unsigned char* data;     // cap * BLKSZ
+    int32_t* free_data; uint32_t nfree_data;
+    bc_list_t t1, t2, b1, b2; // LRU uses t1 only
+    uint32_t p;              // ARC target size of t1
+    uint32_t ndirty;
+    uint64_t hits, misses, inserts, evictions, refused, writebacks;
+    uint64_t ra_blocks, ra_hits; // blocks read ahead, and how many of them were then read
+    pthread_mutex_t mtx;
+    pthread_cond_t flush_kick;
+} bcache_t;
+static bcache_t g_bc = { .mtx = PTHREAD_MUTEX_INITIALIZER, .flush_kick = PTHREAD_COND_INITIALIZER };
+
+static bc_list_t* bc_list(bcache_t* bc, uint8_t id) {
+    return id == BC_T1 ? &bc->t1 : id == BC_T2 ? &bc->t2 : id == BC_B1 ? &bc->b1 : &bc->b2;
+}
+static void bc_unlink(bcache_t* bc, bc_ent_t* e) {
+    bc_list_t* l = bc_list(bc, e->list);
+    if (e->prev) e->prev->next = e->next; else l->mru = e->next;
+    if (e->next) e->next->prev = e->prev; else l->lru = e->prev;
+    e->prev = e->next = NULL; l->n--; e->list = BC_NONE;
+}
+static void bc_push_mru(bcache_t* bc, bc_ent_t* e, uint8_t id) {
+    bc_list_t* l = bc_list(bc, id);
+    e->list = id; e->prev = NULL; e->next = l->mru;
+    if (l->mru) l->mru->prev = e; else l->lru = e;
+    l->mru = e; l->n++;
+}
+static bc_ent_t* bc_find(bcache_t* bc, uint32_t idx) {
+    bc_ent_t* e = bc->bucket[idx & (bc->nbuckets - 1)];
+    while (e && e->idx != idx) e = e->hnext;
+    return e;
+}
+static void bc_unhash(bcache_t* bc, bc_ent_t* e) {
+    bc_ent_t** pp = &bc->bucket[e->idx & (bc->nbuckets - 1)];
+    while (*pp != e) pp = &(*pp)->hnext;
+    *pp = e->hnext;
+}
+// drop an entry entirely (ghost or resident), returning its data slot
+static void bc_discard(bcache_t* bc, bc_ent_t* e) {
+    bc_unlink(bc, e); bc_unhash(bc, e);
+    if (e->dirty) { e->dirty = false; bc->ndirty--; }
+    if (e->data >= 0) bc->free_data[bc->nfree_data++] = e->data;
+    e->data = -1; e->next = bc->spare; bc->spare = e;
+}
+// least recently used clean entry of a resident list, or NULL
+static bc_ent_t* bc_clean_lru(bc_list_t* l) {
+    bc_ent_t* e = l->lru;
+    while (e && e->dirty) e = e->prev;
+    return e;
+}
+// free one data slot by demoting a clean resident block (to a ghost list under ARC)
+static bool bc_evict(bcache_t* bc, bool from_b2) {
+    bc_ent_t* v = NULL; bool t1 = false;
+    if (!bc->arc) { v = bc_clean_lru(&bc->t1); t1 = true; }
+    else {
+        // ARC REPLACE: prefer t1 while it is over its target size p
+        bool pick_t1 = bc->t1.n > 0 && ((from_b2 && bc->t1.n == bc->p) || bc->t1.n > bc->p);
+        v = pick_t1 ? bc_clean_lru(&bc->t1) : bc_clean_lru(&bc->t2);
+        t1 = pick_t1;
+        if (!v) { v = pick_t1 ? bc_clean_lru(&bc->t2) : bc_clean_lru(&bc->t1); t1 = !pick_t1; }
     }
-    return 0;
+    if (!v) return false;
+    bc->evictions++;
+    if (!bc->arc) { bc_discard(bc, v); return true; }
+    bc_unlink(bc, v);
+    bc->free_data[bc->nfree_data++] = v->data; v->data = -1;
+    bc_push_mru(bc, v, t1 ? BC_B1 : BC_B2);
+    return true;
 }
-
-static int write_whole_file(disk_t* d, const layout_t* L, fat_cache_t* fc, dirent_fs* ent, const unsigned char* data, uint32_t len) {
-    // free current chain if any
-    if (ent->used && ent->first != FAT_EOF) {
-        if (free_chain(d, L, fc, ent->first) < 0) return -1;
+static void bc_init(bcache_t* bc, uint32_t cap, bool arc, bool write_back) {
+    bc->cap = cap; bc->arc = arc; bc->write_back = write_back && cap > 0;
+    if (cap == 0) return;
+    uint32_t nents = arc ? 2 * cap : cap;
+    bc->nbuckets = 1; while (bc->nbuckets < nents) bc->nbuckets <<= 1;
+    bc->ents = (bc_ent_t*)calloc(nents, sizeof(bc_ent_t));
+    bc->bucket = (bc_ent_t**)calloc(bc->nbuckets, sizeof(bc_ent_t*));
+    bc->data = (unsigned char*)malloc((size_t)cap * BLKSZ);
+    bc->free_data = (int32_t*)malloc((size_t)cap * sizeof(int32_t));
+    if (!bc->ents || !bc->bucket || !bc->data || !bc->free_data) { perror("malloc cache"); exit(1); }
+    for (uint32_t i = 0; i < nents; i++) { bc->ents[i].data = -1; bc->ents[i].next = bc->spare; bc->spare = &bc->ents[i]; }
+    for (uint32_t i = 0; i < cap; i++) bc->free_data[i] = (int32_t)i;
+    bc->nfree_data = cap;
+}
+// copy a cached block into out; false (and a miss) if it is not resident
+static bool bc_get(bcache_t* bc, uint32_t idx, unsigned char* out) {
+    if (bc->cap == 0) return false;
+    pthread_mutex_lock(&bc->mtx);
+    bc_ent_t* e = bc_find(bc, idx);
+    bool hit = e && e->data >= 0;
+    if (hit) {
+        memcpy(out, bc->data + (size_t)e->data * BLKSZ, BLKSZ);
+        bc_unlink(bc, e); bc_push_mru(bc, e, bc->arc ? BC_T2 : BC_T1); // ARC case 1: promote to t2
+        bc->hits++;
+        if (e->ahead) { e->ahead = false; bc->ra_hits++; }
+    } else bc->misses++;
+    pthread_mutex_unlock(&bc->mtx);
+    return hit;
+}
+// insert or update a block. With dirty it must stay cached until flushed; returns
+// false if no clean victim could be found (the caller writes it through instead).
+// fill marks data just read from the disk, which never replaces a resident copy;
+// ahead marks such a fill as read-ahead.
+static bool bc_put(bcache_t* bc, uint32_t idx, const unsigned char* in, bool dirty, bool fill, bool ahead) {
+    if (bc->cap == 0) return false;
+    pthread_mutex_lock(&bc->mtx);
+    bc_ent_t* e = bc_find(bc, idx);
+    if (e && e->data >= 0) { // resident: update in place
+        if (fill) { pthread_mutex_unlock(&bc->mtx); return true; }
+        if (!bc->arc) { bc_unlink(bc, e); bc_push_mru(bc, e, BC_T1); }
+    } else {
+        bool ghost2 = e && e->list == BC_B2;
+        if (e && bc->arc) {
+            // ARC cases 2/3: a ghost hit moves the target p toward the list it came from
+            uint32_t b1 = bc->b1.n ? bc->b1.n : 1, b2 = bc->b2.n ? bc->b2.n : 1;
+            if (e->list == BC_B1) { uint32_t d = bc->b2.n / b1; bc->p += d ? d : 1; if (bc->p > bc->cap) bc->p = bc->cap; }
+            else { uint32_t d = bc->b1.n / b2; d = d ? d : 1; bc->p = bc->p > d ? bc->p - d : 0; }
+        } else if (bc->arc) {
+            // ARC case 4: keep t1+b1 <= c and the whole directory <= 2c
+            if (bc->t1.n + bc->b1.n >= bc->cap && bc->b1.n > 0) bc_discard(bc, bc->b1.lru);
+            else if (bc->t1.n + bc->t2.n + bc->b1.n + bc->b2.n >= 2 * bc->cap && bc->b2.n > 0) bc_discard(bc, bc->b2.lru);
+        }
+        if (bc->nfree_data == 0 && !bc_evict(bc, ghost2)) { bc->refused++; pthread_mutex_unlock(&bc->mtx); return false; }
+        if (!e) {
+            if (!bc->spare) { // every entry is a ghost or resident; recycle the oldest ghost
+                bc_list_t* g = bc->b1.n ? &bc->b1 : &bc->b2;
+                if (!g->lru) { bc->refused++; pthread_mutex_unlock(&bc->mtx); return false; }
+                bc_discard(bc, g->lru);
+            }
+            e = bc->spare; bc->spare = e->next;
+            e->idx = idx; e->dirty = false; e->ver = 0; e->prev = e->next = NULL; e->list = BC_NONE;
+            e->hnext = bc->bucket[idx & (bc->nbuckets - 1)]; bc->bucket[idx & (bc->nbuckets - 1)] = e;
+            bc_push_mru(bc, e, BC_T1);
+        } else {
+            bc_unlink(bc, e); bc_push_mru(bc, e, BC_T2); // ghost hit: seen twice
+        }
+        e->data = bc->free_data[--bc->nfree_data];
+        bc->inserts++;
+        if (ahead) bc->ra_blocks++;
     }
-    ent->first = FAT_EOF;
-    ent->length = len;
-
-    if (len == 0) { return 0; }
+    e->ahead = ahead;
+    memcpy(bc->data + (size_t)e->data * BLKSZ, in, BLKSZ);
+    e->ver++;
+    if (dirty && !e->dirty) { e->dirty = true; bc->ndirty++; }
+    if (bc->ndirty > bc->cap / 2) pthread_cond_signal(&bc->flush_kick);
+    pthread_mutex_unlock(&bc->mtx);
+    return true;
+}
+// drop everything, dirty blocks included (F makes old file data meaningless)
+static void bc_clear(bcache_t* bc) {
+    if (bc->cap == 0) return;
+    pthread_mutex_lock(&bc->mtx);
+    bc_list_t* ls[4] = { &bc->t1, &bc->t2, &bc->b1, &bc->b2 };
+    for (int i = 0; i < 4; i++) while (ls[i]->lru) bc_discard(bc, ls[i]->lru);
+    bc->p = 0;
+    pthread_mutex_unlock(&bc->mtx);
+}
+// drop one block whatever its state: before its sector is reused for a directory table
+// (whose writes bypass the cache), or after a write-through of it failed
+static void bc_forget(bcache_t* bc, uint32_t idx) {
+    if (bc->cap == 0) return;
+    pthread_mutex_lock(&bc->mtx);
+    bc_ent_t* e = bc_find(bc, idx);
+    if (e) bc_discard(bc, e);
+    pthread_mutex_unlock(&bc->mtx);
+}
+static int cmp_u32(const void* a, const void* b) { uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b; return x < y ? -1 : x > y; }
+// write up to max dirty blocks, in sector order, over d. Returns blocks written or -1.
+static int bc_flush_some(bcache_t* bc, disk_t* d, uint32_t max) {
+    TR_SCOPE(TR_CACHE_FLUSH);
+    uint32_t* idx = (uint32_t*)malloc((size_t)max * sizeof(uint32_t));
+    uint32_t* ver = (uint32_t*)malloc((size_t)max * sizeof(uint32_t));
+    unsigned char* buf = (unsigned char*)malloc((size_t)max * BLKSZ);
+    if (!idx || !ver || !buf) { free(idx); free(ver); free(buf); return -1; }
+    pthread_mutex_lock(&bc->mtx);
+    uint32_t n = 0, nents = bc->arc ? 2 * bc->cap : bc->cap;
+    for (uint32_t i = 0; i < nents && n < max; i++) if (bc->ents[i].dirty) idx[n++] = bc->ents[i].idx;
+    qsort(idx, n, sizeof(uint32_t), cmp_u32);
+    for (uint32_t i = 0; i < n; i++) {
+        bc_ent_t* e = bc_find(bc, idx[i]);
+        ver[i] = e->ver; memcpy(buf + (size_t)i * BLKSZ, bc->data + (size_t)e->data * BLKSZ, BLKSZ);
+    }
+    pthread_mutex_unlock(&bc->mtx);
+    int rv = n > 0 ? disk_write_vec(d, idx, n, buf) : 0;
+    if (rv == 0 && n > 0) {
+        pthread_mutex_lock(&bc->mtx);
+        for (uint32_t i = 0; i < n; i++) {
+            bc_ent_t* e = bc_find(bc, idx[i]);
+            if (e && e->dirty && e->ver == ver[i]) { e->dirty = false; bc->ndirty--; } // unchanged since the copy
+        }
+        bc->writebacks += n;
+        pthread_mutex_unlock(&bc->mtx);
+    }
+    free(idx); free(ver); free(buf);
+    return rv < 0 ? -1 : (int)n;
+}
+// is the block resident? (no effect on the counters or the replacement order)
+static bool bc_has(bcache_t* bc, uint32_t idx) {
+    if (bc->cap == 0) return false;
+    pthread_mutex_lock(&bc->mtx);
+    bc_ent_t* e = bc_find(bc, idx);
+    bool hit = e && e->data >= 0;
+    pthread_mutex_unlock(&bc->mtx);
+    return hit;
+}
+// read one block through the cache
+static int bc_read_idx(disk_t* d, uint32_t idx, unsigned char out[BLKSZ]) {
+    if (bc_get(&g_bc, idx, out)) return 0;
+    if (disk_read_idx(d, idx, out) < 0) return -1;
+    bc_put(&g_bc, idx, out, false, true, false);
+    return 0;
+}
 
-    // allocate needed blocks
-    uint32_t blocks = (len + BLKSZ - 1) / BLKSZ;
-    uint32_t data_start = L->dir_start + L->dir_sectors; // first usable data block
-    uint32_t head = FAT_EOF, prev = FAT_EOF;
+// === streaming file I/O ===
+// R and W move file data through a small ring of block buffers instead of a
+// whole-file malloc: each slot carries one RV/WV request of up to STREAM_CHUNK
+// blocks, and up to STREAM_RING of them are in flight on the disk connection.
+// R sends each slot to the client while the later ones are still being read; W
+// fills the whole ring from the client first and then writes it, so it holds a
+// disk connection only while the disk works.
+#define STREAM_CHUNK DISK_VEC_MAX
+#define STREAM_RING DISK_PIPE_DEPTH
 
-    for (uint32_t k = 0; k < blocks; k++) {
-        uint32_t b;
-        if (find_free_block(L, fc, data_start, &b) != 0) return -2; // no space
-        fat_set(fc, b, FAT_EOF);
-        if (prev != FAT_EOF) fat_set(fc, prev, b);
-        else head = b;
-        prev = b;
+// R/RR: send "0 len <data>\n" with len bytes of the chain at head chain, starting skip
+// bytes into its block #bno, then read up to ahead further chain blocks into the
+// sector cache; those are issued behind the range so the disk works on them while
+// the last chunks go out. Returns 0 on success, -1 if the disk failed before anything was sent
+// (the caller can still reply "2 0 "), and -2 if the reply was cut short (the
+// client connection must be dropped).
+static int stream_range_out(disk_t* d, fat_cache_t* fc, uint32_t chain, uint32_t bno, uint32_t skip, uint32_t len,
+                            uint32_t ahead, int cfd) {
+    uint32_t blocks = (skip + len + BLKSZ - 1) / BLKSZ;
+    char hdr[64]; int m = snprintf(hdr, sizeof(hdr), "0 %u ", len);
+    if (len == 0) { hdr[m++] = '\n'; return write_all(cfd, hdr, (size_t)m) < 0 ? -2 : 0; }
+    if (ahead > g_bc.cap / 4) ahead = g_bc.cap / 4; // never crowd out what was just read
+    uint32_t total = blocks + ahead;
+    // the header rides with the first chunk and the newline with the last, so a
+    // small file goes out in a single send
+    unsigned char* ring = (unsigned char*)malloc((size_t)STREAM_RING * STREAM_CHUNK * BLKSZ + sizeof(hdr) + STREAM_CHUNK * BLKSZ + 1);
+    if (!ring) return -1;
+    unsigned char* obuf = ring + (size_t)STREAM_RING * STREAM_CHUNK * BLKSZ;
+    // per slot: blocks in the chunk, and which of them missed the sector cache
+    // (only those go to the disk; hits are copied in when the chunk is issued)
+    uint32_t idx[STREAM_CHUNK], ks[STREAM_RING], nmiss[STREAM_RING];
+    uint32_t miss_idx[STREAM_RING][STREAM_CHUNK]; uint8_t miss_at[STREAM_RING][STREAM_CHUNK];
+    bool is_ahead[STREAM_RING];
+    uint32_t head = 0, inflight = 0, issued = 0, sent = 0;
+    int rv = 0; bool started = false;
+    while (issued < total || inflight > 0) {
+        while (issued < total && inflight < STREAM_RING && rv == 0) {
+            // read-ahead chunks never straddle the end of the range
+            uint32_t lim = issued < blocks ? blocks : total;
+            uint32_t k = lim - issued < STREAM_CHUNK ? lim - issued : STREAM_CHUNK;
+            k = bidx_get(fc, chain, bno + issued, k, idx);
+            if (k == 0 && issued >= blocks) { total = issued; break; } // read-ahead ran off the chain
+            if (k == 0) { rv = -1; break; } // short chain
+            uint32_t s = (head + inflight) % STREAM_RING, nm = 0;
+            unsigned char* sbuf = ring + (size_t)s * STREAM_CHUNK * BLKSZ;
+            for (uint32_t i = 0; i < k; i++) {
+                bool have = issued >= blocks ? bc_has(&g_bc, idx[i]) : bc_get(&g_bc, idx[i], sbuf + (size_t)i * BLKSZ);
+                if (!have) { miss_at[s][nm] = (uint8_t)i; miss_idx[s][nm++] = idx[i]; }
+            }
+            if (nm > 0 && disk_send_vec(d, BIN_OP_RV, miss_idx[s], nm, NULL) < 0) { rv = -1; break; } // dead link
+            ks[s] = k; nmiss[s] = nm; is_ahead[s] = issued >= blocks; inflight++; issued += k;
+        }
+        if (inflight == 0) break;
+        uint32_t slot = head, k = ks[slot], nm = nmiss[slot]; head = (head + 1) % STREAM_RING; inflight--;
+        unsigned char* buf = ring + (size_t)slot * STREAM_CHUNK * BLKSZ;
+        // keep collecting replies after an error so the disk connection stays in sync
+        if (nm > 0) {
+            if (disk_recv_vec(d, BIN_OP_RV, nm, obuf) < 0) {
+                if (!is_ahead[slot]) rv = -1; // a failed read-ahead is only a lost hint
+                if (d->broken) break;
+                continue;
+            }
+            // misses arrive packed (in the output buffer, free until this chunk is sent); put them in place
+            for (uint32_t i = nm; i-- > 0;) {
+                unsigned char* at = buf + (size_t)miss_at[slot][i] * BLKSZ;
+                memcpy(at, obuf + (size_t)i * BLKSZ, BLKSZ);
+                bc_put(&g_bc, miss_idx[slot][i], at, false, true, is_ahead[slot]);
+            }
+        }
+        if (rv != 0 || is_ahead[slot]) continue;
+        uint32_t off = sent == 0 ? skip : 0; // only the first block starts mid-way
+        uint32_t n = len - sent < k * BLKSZ - off ? len - sent : k * BLKSZ - off;
+        size_t o = 0;
+        if (!started) { memcpy(obuf, hdr, (size_t)m); o = (size_t)m; started = true; }
+        memcpy(obuf + o, buf + off, n); o += n;
+        sent += n;
+        if (sent == len) obuf[o++] = '\n';
+        if (write_all(cfd, obuf, o) < 0) { rv = -2; continue; }
     }
+    free(ring);
+    if (rv == 0 && sent != len) rv = -1; // chain shorter than the file
+    return (rv == -1 && started) ? -2 : rv;
+}
+// R/RR of an inline file: bytes [off, off + len) straight from its entry, no disk I/O
+static int inline_out(const dirent_fs* ent, uint32_t off, uint32_t len, int cfd) {
+    char out[32 + DIRENT_INLINE_MAX];
+    int m = snprintf(out, sizeof(out), "0 %u ", len);
+    if (len > 0) memcpy(out + m, ent->data + off, len);
+    out[m + len] = '\n';
+    return write_all(cfd, out, (size_t)m + len + 1) < 0 ? -2 : 0;
+}
+static int stream_file_out(disk_t* d, fat_cache_t* fc, const dirent_fs* ent, int cfd) {
+    if (dirent_inline(ent)) return inline_out(ent, 0, ent->length, cfd);
+    return stream_range_out(d, fc, ent->first, 0, 0, ent->length, 0, cfd);
+}
 
-    // write blocks
-    ent->first = head;
-    uint32_t cur = head;
-    uint32_t left = len, pos = 0;
-    unsigned char blk[BLKSZ];
-    while (cur != FAT_EOF) {
-        memset(blk, 0, BLKSZ);
-        uint32_t take = left < BLKSZ ? left : BLKSZ;
-        memcpy(blk, data + pos, take);
-        if (disk_write_idx(d, cur, blk) < 0) return -1;
-        pos += take; if (left > take) left -= take; else left = 0;
-        uint32_t nxt = fat_get(fc, cur);
-        cur = (nxt == FAT_EOF || pos >= len) ? FAT_EOF : nxt;
+// discard n payload bytes so the command stream stays in sync after an early error
+static int rbuf_skip(rbuf_t* cin, uint32_t n) {
+    unsigned char tmp[1024];
+    while (n > 0) {
+        uint32_t k = n < sizeof(tmp) ? n : (uint32_t)sizeof(tmp);
+        if (read_exact(cin, tmp, k) != (ssize_t)k) return -1;
+        n -= k;
     }
     return 0;
 }
+// W/WR/A: receive len payload bytes from the client into blk[], starting skip bytes
+// into blk[0], or take them from src if the payload was already read. head/tail,
+// when given, hold the current contents of the first and last block so the bytes
+// around the range survive; otherwise they are zeroed. The payload comes in a ring
+// of chunks at a time, and only then is a disk connection leased (unless the
+// caller already holds one) to write the ring as pipelined WV requests, so a slow
+// sender never keeps a pooled connection waiting. The whole payload is always
+// consumed unless the client goes away. Returns 0, -1 on a disk error, -2 if the
+// client connection failed.
+static int stream_range_in(disk_lease_t* ls, rbuf_t* cin, const unsigned char* src, const uint32_t* blk, uint32_t skip, uint32_t len,
+                           const unsigned char* head_blk, const unsigned char* tail_blk) {
+    uint32_t blocks = (skip + len + BLKSZ - 1) / BLKSZ, end = skip + len;
+    unsigned char* ring = (unsigned char*)malloc((size_t)STREAM_RING * STREAM_CHUNK * BLKSZ);
+    if (!ring) return src || rbuf_skip(cin, len) == 0 ? -1 : -2;
+    bool own = ls->d == NULL;
+    uint32_t pos = 0;
+    int rv = 0;
+    while (pos < blocks && rv != -2) {
+        // fill the ring: chunk n covers blocks ps[n] .. ps[n] + ks[n]
+        uint32_t ks[STREAM_RING], ps[STREAM_RING], n = 0;
+        while (pos < blocks && n < STREAM_RING) {
+            unsigned char* buf = ring + (size_t)n * STREAM_CHUNK * BLKSZ;
+            uint32_t k = blocks - pos < STREAM_CHUNK ? blocks - pos : STREAM_CHUNK;
+            uint32_t lo = pos * BLKSZ, hi = (pos + k) * BLKSZ; // window bytes covered by this chunk
+            memset(buf, 0, (size_t)k * BLKSZ);
+            if (pos + k == blocks && tail_blk) memcpy(buf + (size_t)(k - 1) * BLKSZ, tail_blk, BLKSZ);
+            if (pos == 0 && head_blk) memcpy(buf, head_blk, BLKSZ);
+            uint32_t from = lo > skip ? lo : skip, to = hi < end ? hi : end;
+            if (src) memcpy(buf + (from - lo), src + (from - skip), to - from);
+            else if (read_exact(cin, buf + (from - lo), to - from) != (ssize_t)(to - from)) { rv = -2; break; }
+            pos += k;
+            if (rv != 0) continue; // after a disk error the rest is only drained
+            if (g_bc.write_back) {
+                // write-back: the chunk only goes to the disk now if the cache could not hold all of it
+                bool held = true;
+                for (uint32_t i = 0; i < k; i++)
+                    if (!bc_put(&g_bc, blk[pos - k + i], buf + (size_t)i * BLKSZ, true, false, false)) held = false;
+                if (held) continue;
+            }
+            ks[n] = k; ps[n] = pos - k; n++;
+        }
+        if (n == 0 || rv != 0) continue;
+        // send every chunk before awaiting the first reply
+        disk_t* d = lease_get(ls);
+        uint32_t sent = 0;
+        while (d && sent < n && !d->broken && disk_send_vec(d, BIN_OP_WV, blk + ps[sent], ks[sent], ring + (size_t)sent * STREAM_CHUNK * BLKSZ) == 0) sent++;
+        if (sent < n) rv = -1;
+        for (uint32_t c = 0; c < sent; c++) {
+            bool ok = disk_recv_vec(d, BIN_OP_WV, ks[c], NULL) == 0;
+            if (!ok) rv = -1;
+            // write-through: the cache gets the blocks only once they are on the disk, and
+            // forgets older copies of blocks whose write failed (the disk may hold either)
+            if (!g_bc.write_back) {
+                const unsigned char* wbuf = ring + (size_t)c * STREAM_CHUNK * BLKSZ;
+                for (uint32_t i = 0; i < ks[c]; i++) {
+                    if (ok) bc_put(&g_bc, blk[ps[c] + i], wbuf + (size_t)i * BLKSZ, false, false, false);
+                    else bc_forget(&g_bc, blk[ps[c] + i]);
+                }
+            }
+        }
+        if (own) lease_put(ls);
+    }
+    free(ring);
+    return rv;
+}
+static int stream_file_in(disk_lease_t* ls, rbuf_t* cin, const unsigned char* src, const uint32_t* blk, uint32_t len) {
+    return stream_range_in(ls, cin, src, blk, 0, len, NULL, NULL);
+}
 
 // === server state per process ===
+#define FILE_LOCK_STRIPES 64
 typedef struct {
-    char disk_host[64];
-    int  disk_port;
     layout_t L;
     fat_cache_t fat;
+    dir_cache_t dir;
     bool formatted; // superblock present
-    pthread_mutex_t meta_mtx; // protects FAT & directory updates
+    bool super_checked; // superblock probed once after the first disk connection
+    // locking: a command that names a file takes that file's stripe lock first,
+    // then meta_lock; R holds only its file lock (shared) while streaming
+    pthread_rwlock_t meta_lock; // FAT, directory and layout: shared to look up, exclusive to change
+    pthread_rwlock_t file_locks[FILE_LOCK_STRIPES]; // per-file, keyed by directory slot
+    disk_pool_t pool; // shared disk connections
+    // group commit (-G): metadata changes are acknowledged once a committer
+    // thread has flushed them, batching concurrent writers into one flush
+    bool group;
+    int group_ms, group_max;   // flush interval, and waiters that force an early flush
+    uint64_t meta_seq;        // bumped by each metadata change
+    uint64_t durable_seq;     // changes <= this are on disk
+    uint64_t failed_seq;      // changes in (durable_seq, failed_seq] failed to flush
+    int commit_waiters;
+    uint64_t fs_gen;          // bumped by F, so in-flight writes notice a reformat
+    bool commit_busy;         // a flush is being written outside meta_lock
+    bool commit_hold;         // F is waiting: start no new batch
+    pthread_mutex_t commit_mtx; // guards the group commit fields above
+    pthread_cond_t commit_kick, commit_done;
+    disk_t commit_disk;       // committer's own connection, so it never waits on the pool
 } server_state_t;
 
 static server_state_t G;
 
+// === directory tree ===
+// subdirectory tables by id (first cluster of their chain). All of them are loaded
+// with the root when the filesystem is first used, so resolving a path is one
+// hash lookup per component and never touches the disk. Paths reaching the
+// commands are canonical: absolute, without "." or ".." (see path_canon).
+#define DIR_REG_BUCKETS 256
+static struct {
+    dir_cache_t* bucket[DIR_REG_BUCKETS];
+    // chains of directories removed under -G: a batch gathered before the rmdir may
+    // still be writing their sectors, so they are freed once that write is over
+    uint32_t* zombies;
+    uint32_t nzombies, zcap;
+} g_dirs;
+
+static dir_cache_t* dir_by_id(uint32_t id) {
+    if (id == 0) return &G.dir;
+    dir_cache_t* dc = g_dirs.bucket[id % DIR_REG_BUCKETS];
+    while (dc && dc->id != id) dc = dc->hnext;
+    return dc;
+}
+static void dir_register(dir_cache_t* dc) {
+    dc->hnext = g_dirs.bucket[dc->id % DIR_REG_BUCKETS]; g_dirs.bucket[dc->id % DIR_REG_BUCKETS] = dc;
+}
+static void dir_unregister(dir_cache_t* dc) {
+    dir_cache_t** pp = &g_dirs.bucket[dc->id % DIR_REG_BUCKETS];
+    while (*pp && *pp != dc) pp = &(*pp)->hnext;
+    if (*pp) *pp = dc->hnext;
+}
+// drop every directory cache, the root included
+static void dirs_free(void) {
+    for (uint32_t h = 0; h < DIR_REG_BUCKETS; h++) {
+        while (g_dirs.bucket[h]) { dir_cache_t* dc = g_dirs.bucket[h]; g_dirs.bucket[h] = dc->hnext; dir_free(dc); free(dc); }
+    }
+    dir_free(&G.dir);
+}
+// read the table of the subdirectory whose chain starts at id
+static dir_cache_t* dir_load_sub(disk_t* d, uint32_t id) {
+    TR_SCOPE(TR_DIR_LOAD);
+    uint32_t cs = G.fat.csize, n = 0;
+    for (uint32_t c = id; c != FAT_EOF; c = fat_get(&G.fat, c))
+        if (c >= G.fat.nblocks || ++n > G.fat.nblocks) return NULL; // out of range or a loop: corrupt
+    dir_cache_t* dc = (dir_cache_t*)calloc(1, sizeof(*dc));
+    if (!dc) return NULL;
+    dc->id = id; dc->write_back = G.dir.write_back; dc->esize = G.dir.esize;
+    dc->secs = (uint32_t*)malloc((size_t)n * cs * sizeof(uint32_t));
+    dc->raw = (unsigned char*)malloc((size_t)n * cs * BLKSZ);
+    uint32_t k = 0;
+    if (dc->secs) for (uint32_t c = id; c != FAT_EOF; c = fat_get(&G.fat, c)) for (uint32_t j = 0; j < cs; j++) dc->secs[k++] = c * cs + j;
+    if (!dc->secs || !dc->raw || disk_read_vec(d, dc->secs, n * cs, dc->raw) < 0 || dir_build(dc, n * cs) < 0) { dir_free(dc); free(dc); return NULL; }
+    return dc;
+}
+// load the root and, breadth first, every directory below it
+static int dirs_load(disk_t* d) {
+    if (dir_load(d, &G.L, &G.dir) < 0) return -1;
+    dir_cache_t** todo = NULL; size_t n = 0, cap = 0;
+    dir_cache_t* dc = &G.dir;
+    for (;;) {
+        for (uint32_t i = 0; i < dc->nents; i++) {
+            const dirent_fs* e = &dc->ents[i];
+            if (!e->used || e->type != FT_DIR) continue;
+            dir_cache_t* sub = dir_by_id(e->first) ? NULL : dir_load_sub(d, e->first); // shared chains are corrupt
+            if (!sub) { free(todo); dirs_free(); return -1; }
+            dir_register(sub);
+            if (n == cap) {
+                dir_cache_t** nt = (dir_cache_t**)realloc(todo, (cap = cap ? cap * 2 : 16) * sizeof(*nt));
+                if (!nt) { free(todo); dirs_free(); return -1; }
+                todo = nt;
+            }
+            todo[n++] = sub;
+        }
+        if (n == 0) break;
+        dc = todo[--n];
+    }
+    free(todo);
+    return 0;
+}
+// mark a table's image sectors dirty (write_back), or write them through
+static int dir_write_secs(disk_t* d, dir_cache_t* dc, uint32_t from, uint32_t n) {
+    if (dc->write_back) { for (uint32_t i = from; i < from + n; i++) bm_set(dc->dirty, i); return 0; }
+    return disk_write_vec(d, dc->secs + from, n, dc->raw + (size_t)from * BLKSZ);
+}
+// a new, empty subdirectory table of one cluster; the cluster is linked in the FAT
+// (flushed by the caller's meta_commit) and the table registered
+static dir_cache_t* dir_create_table(disk_t* d) {
+    uint32_t cs = G.fat.csize, c;
+    if (alloc_blocks(&G.fat, 1, &c) != 0) return NULL;
+    dir_cache_t* dc = (dir_cache_t*)calloc(1, sizeof(*dc));
+    if (!dc) return NULL;
+    dc->id = c; dc->write_back = G.dir.write_back; dc->esize = G.dir.esize;
+    dc->secs = (uint32_t*)malloc((size_t)cs * sizeof(uint32_t));
+    dc->raw = (unsigned char*)calloc(cs, BLKSZ);
+    if (dc->secs) for (uint32_t j = 0; j < cs; j++) { dc->secs[j] = c * cs + j; bc_forget(&g_bc, c * cs + j); }
+    if (!dc->secs || !dc->raw || dir_build(dc, cs) < 0 || dir_write_secs(d, dc, 0, cs) < 0) { dir_free(dc); free(dc); return NULL; }
+    fat_set(&G.fat, c, FAT_EOF);
+    dir_register(dc);
+    return dc;
+}
+// add a cluster to a full subdirectory table (the root has a fixed size)
+static int dir_grow(disk_t* d, dir_cache_t* dc) {
+    uint32_t cs = G.fat.csize, c, n = dc->nsec;
+    if (dc->id == 0 || alloc_blocks(&G.fat, 1, &c) != 0) return -1;
+    unsigned char* raw = (unsigned char*)realloc(dc->raw, (size_t)(n + cs) * BLKSZ);
+    if (raw) dc->raw = raw;
+    uint32_t* secs = (uint32_t*)realloc(dc->secs, (size_t)(n + cs) * sizeof(uint32_t));
+    if (secs) dc->secs = secs;
+    if (!raw || !secs) return -1;
+    memset(dc->raw + (size_t)n * BLKSZ, 0, (size_t)cs * BLKSZ);
+    for (uint32_t j = 0; j < cs; j++) { dc->secs[n + j] = c * cs + j; bc_forget(&g_bc, c * cs + j); }
+    if (dir_build(dc, n + cs) < 0) return -1;
+    if (dir_write_secs(d, dc, n, cs) < 0) { dir_build(dc, n); return -1; } // the tail stays as it was
+    fat_set(&G.fat, c, FAT_EOF);
+    fat_set(&G.fat, dc->secs[n - 1] / cs, c);
+    return 0;
+}
+// find a free slot in dc, growing a subdirectory table if it is full
+static int dir_take_free(disk_t* d, dir_cache_t* dc, uint32_t* slot) {
+    if (dir_find_free(dc, slot) == 0) return 0;
+    return dir_grow(d, dc) == 0 ? dir_find_free(dc, slot) : 1;
+}
+// resolve every component of path but the last; returns the directory holding it
+// (with *leaf pointing at its name, "" for the root itself), or NULL if a
+// component is missing or not a directory
+static dir_cache_t* dir_walk(const char* path, const char** leaf) {
+    dir_cache_t* dc = &G.dir;
+    if (path[0] != '/') return NULL; // path_canon failed
+    const char* p = path + 1;
+    for (;;) {
+        const char* slash = strchr(p, '/');
+        if (!slash) { *leaf = p; return dc; }
+        char name[MAX_NAME]; uint32_t slot; dirent_fs e;
+        if ((size_t)(slash - p) >= MAX_NAME) return NULL;
+        memcpy(name, p, (size_t)(slash - p)); name[slash - p] = '\0';
+        if (dir_find_by_name(dc, name, &slot, &e) != 0 || e.type != FT_DIR || !(dc = dir_by_id(e.first))) return NULL;
+        p = slash + 1;
+    }
+}
+// the directory named by path, or NULL
+static dir_cache_t* dir_lookup(const char* path) {
+    const char* leaf; uint32_t slot; dirent_fs e;
+    dir_cache_t* dc = dir_walk(path, &leaf);
+    if (!dc || !*leaf) return dc;
+    if (dir_find_by_name(dc, leaf, &slot, &e) != 0 || e.type != FT_DIR) return NULL;
+    return dir_by_id(e.first);
+}
+// join arg to the connection's cwd and fold "." and ".." into a canonical absolute
+// path ("/" or "/a/b"); -1 if it does not fit in out
+static int path_canon(const char* cwd, const char* arg, char* out, size_t cap) {
+    size_t n = 0;
+    if (cap < 2) return -1;
+    out[n++] = '/';
+    for (int pass = arg[0] == '/' ? 1 : 0; pass < 2; pass++) {
+        const char* p = pass == 0 ? cwd : arg;
+        while (*p) {
+            while (*p == '/') p++;
+            const char* q = p; while (*q && *q != '/') q++;
+            size_t len = (size_t)(q - p);
+            if (len == 0 || (len == 1 && p[0] == '.')) { p = q; continue; }
+            if (len == 2 && p[0] == '.' && p[1] == '.') { // up one level; the root is its own parent
+                while (n > 1 && out[n - 1] != '/') n--;
+                if (n > 1) n--;
+                p = q; continue;
+            }
+            if (n > 1) { if (n + 1 >= cap) return -1; out[n++] = '/'; }
+            if (n + len >= cap) return -1;
+            memcpy(out + n, p, len); n += len;
+            p = q;
+        }
+    }
+    out[n] = '\0';
+    return 0;
+}
+
 typedef struct { int cfd; } client_arg_t;
 
 // utility: load superblock if present
@@ -394,172 +2072,922 @@ static int try_load_super(disk_t* d, layout_t* L) {
     if (disk_read_idx(d, 0, blk) < 0) return -1;
     return super_load(blk, d, L);
 }
+// detect an existing FS once, instead of on every client connection
+static void adopt_super(disk_t* d) {
+    tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+    if (!G.super_checked) {
+        layout_t tmpL;
+        bool found = try_load_super(d, &tmpL) == 0;
+        if (found && (tmpL.stripe_nodes != (uint32_t)g_vol.n || tmpL.stripe_copies != (uint32_t)g_vol.copies))
+            // block b would be looked for on the wrong node: leave it alone until F
+            fprintf(stderr, "[fs_server] filesystem was formatted for %u disk server(s) and %u copies; not mounting it\n",
+                    tmpL.stripe_nodes, tmpL.stripe_copies);
+        else if (found) { G.L = tmpL; G.formatted = true; } // lazy adoption
+        G.super_checked = !d->broken;
+    }
+    pthread_rwlock_unlock(&G.meta_lock);
+}
+// make sure the FAT and directory caches are loaded. 0 ready, 1 unformatted, -1 disk error.
+// Once loaded they stay loaded (F rebuilds them under the exclusive lock).
+static int meta_ready(disk_t* disk) {
+    tr_rwlock(&G.meta_lock, false, TR_WAIT_META);
+    int rv = !G.formatted ? 1 : (G.fat.loaded && G.dir.loaded) ? 0 : -2;
+    pthread_rwlock_unlock(&G.meta_lock);
+    if (rv != -2) return rv;
+    tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+    if (!G.formatted) rv = 1;
+    else {
+        G.dir.write_back = G.group || G.L.journal_sectors > 0; // a journal commits directories like the FAT
+        rv = (jr_replay(disk, &G.L) < 0 || fat_load(disk, &G.L, &G.fat) < 0 || dirs_load(disk) < 0) ? -1 : 0;
+    }
+    pthread_rwlock_unlock(&G.meta_lock);
+    return rv;
+}
+static pthread_rwlock_t* file_lock(uint32_t dir_id, uint32_t slot) {
+    return &G.file_locks[(dir_id * 2654435761u + slot) % FILE_LOCK_STRIPES];
+}
+// find the file at path and lock it: its file stripe (shared or exclusive), then
+// meta_lock. The slot is looked up first and re-checked once both locks are held,
+// since the file may have been deleted or recreated elsewhere in between. A held
+// file lock also pins its directory, which cannot be removed while not empty.
+// Returns 0 with both locks held, 1 if not found, 2 if path is a directory (no locks held).
+static int lock_file(const char* path, bool excl_file, bool excl_meta, dir_cache_t** dcp, uint32_t* slot, dirent_fs* e) {
+    for (;;) {
+        tr_rwlock(&G.meta_lock, false, TR_WAIT_META);
+        const char* leaf; dir_cache_t* dc = dir_walk(path, &leaf);
+        int fnd = !dc || !*leaf ? (dc ? 2 : 1) : dir_find_by_name(dc, leaf, slot, e);
+        if (fnd == 0 && e->type != FT_FILE) fnd = 2;
+        uint32_t id = dc ? dc->id : 0;
+        pthread_rwlock_unlock(&G.meta_lock);
+        if (fnd != 0) return fnd;
+        pthread_rwlock_t* fl = file_lock(id, *slot);
+        tr_rwlock(fl, excl_file, TR_WAIT_FILE);
+        tr_rwlock(&G.meta_lock, excl_meta, TR_WAIT_META);
+        dc = dir_walk(path, &leaf);
+        const dirent_fs* cur = dc && dc->id == id ? &dc->ents[*slot] : NULL;
+        if (cur && cur->used && cur->type == FT_FILE && strncmp(cur->name, leaf, MAX_NAME) == 0) { *e = *cur; *dcp = dc; return 0; }
+        pthread_rwlock_unlock(&G.meta_lock); pthread_rwlock_unlock(fl);
+    }
+}
+
+// === metadata commit ===
+// copy every dirty FAT and directory sector into b, FAT first, clearing their bits;
+// the FAT sectors end at *nfat, the root's at *nroot. meta_lock held exclusively.
+static int meta_gather(sec_batch_t* b, uint32_t* nfat, uint32_t* nroot) {
+    int rv = 0;
+    if (G.fat.loaded) rv = batch_gather(b, G.L.fat_start, NULL, (const unsigned char*)G.fat.v, G.fat.dirty, G.L.fat_sectors, true);
+    *nfat = b->n;
+    if (rv == 0 && G.dir.loaded) rv = batch_gather(b, G.L.dir_start, NULL, G.dir.raw, G.dir.dirty, G.L.dir_sectors, true);
+    *nroot = b->n;
+    for (uint32_t h = 0; h < DIR_REG_BUCKETS; h++)
+        for (dir_cache_t* dc = g_dirs.bucket[h]; dc && rv == 0; dc = dc->hnext)
+            rv = batch_gather(b, 0, dc->secs, dc->raw, dc->dirty, dc->nsec, true);
+    g_jr.q_gathered = g_jr.nq;
+    return rv;
+}
+// after a failed write of b: keep its sectors dirty for a later commit (F cannot
+// run meanwhile); subdirectory tables are simply rewritten whole
+static void meta_redirty(const sec_batch_t* b, uint32_t nfat, uint32_t nroot) {
+    if (G.fat.loaded) batch_redirty(b, 0, nfat, G.L.fat_start, G.fat.dirty);
+    if (G.dir.loaded) batch_redirty(b, nfat, nroot, G.L.dir_start, G.dir.dirty);
+    for (uint32_t h = 0; h < DIR_REG_BUCKETS; h++)
+        for (dir_cache_t* dc = g_dirs.bucket[h]; dc; dc = dc->hnext) dir_write_secs(NULL, dc, 0, dc->nsec);
+}
+// called with meta_lock held exclusively after a command changed the FAT and/or
+// directory. Synchronous mode writes the change now and returns 0: as one journal
+// transaction, or without a journal by flushing the dirty FAT sectors (directory
+// entries were already written through). Group mode returns a ticket for commit_wait.
+static int meta_commit(disk_t* disk, uint64_t* ticket) {
+    *ticket = 0;
+    if (!G.group && g_jr.nsec == 0) return fat_flush(disk, &G.L, &G.fat);
+    if (!G.group) {
+        sec_batch_t b = { 0 };
+        uint32_t nfat, nroot;
+        int rv = meta_gather(&b, &nfat, &nroot);
+        if (rv == 0) rv = jr_commit(disk, &b);
+        if (rv != 0) meta_redirty(&b, nfat, nroot);
+        jr_release(&G.fat);
+        batch_free(&b);
+        return rv;
+    }
+    pthread_mutex_lock(&G.commit_mtx);
+    *ticket = ++G.meta_seq;
+    if (++G.commit_waiters >= G.group_max) pthread_cond_signal(&G.commit_kick);
+    pthread_mutex_unlock(&G.commit_mtx);
+    return 0;
+}
+// wait (without meta_lock held) until the change behind ticket is durable; -1 if its flush failed
+static int commit_wait(uint64_t ticket) {
+    if (ticket == 0) return 0;
+    TR_SCOPE(TR_WAIT_COMMIT);
+    pthread_mutex_lock(&G.commit_mtx);
+    while (G.durable_seq < ticket && G.failed_seq < ticket) pthread_cond_wait(&G.commit_done, &G.commit_mtx);
+    int rv = (G.durable_seq >= ticket) ? 0 : -1;
+    pthread_mutex_unlock(&G.commit_mtx);
+    return rv;
+}
+// point slot at e and commit that together with the FAT changes already made.
+// Without a journal the FAT goes out first, so a crash in between can only leak
+// clusters; with one, both are in the same transaction.
+static int meta_publish(disk_t* disk, dir_cache_t* dc, uint32_t slot, const dirent_fs* e, uint64_t* ticket) {
+    if (g_jr.nsec == 0) return meta_commit(disk, ticket) < 0 || dir_write_entry(disk, dc, slot, e) < 0 ? -1 : 0;
+    *ticket = 0;
+    return dir_write_entry(disk, dc, slot, e) < 0 || meta_commit(disk, ticket) < 0 ? -1 : 0;
+}
+// group committer: every group_ms (or sooner once group_max commands wait) copy the
+// dirty FAT and directory sectors under meta_lock, then write them FAT-first without it
+static void* committer_main(void* vp) {
+    (void)vp;
+    tr_attach("committer");
+    for (;;) {
+        pthread_mutex_lock(&G.commit_mtx);
+        if (G.commit_waiters < G.group_max) {
+            struct timespec ts; clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += (long)G.group_ms * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L; ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&G.commit_kick, &G.commit_mtx, &ts);
+        }
+        bool pending = G.meta_seq != G.durable_seq && !G.commit_hold;
+        pthread_mutex_unlock(&G.commit_mtx);
+        if (!pending) continue;
+
+        tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+        pthread_mutex_lock(&G.commit_mtx);
+        if (G.commit_hold || !G.formatted) { pthread_mutex_unlock(&G.commit_mtx); pthread_rwlock_unlock(&G.meta_lock); continue; }
+        uint64_t hi = G.meta_seq;
+        G.commit_waiters = 0;
+        G.commit_busy = true;
+        pthread_mutex_unlock(&G.commit_mtx);
+        sec_batch_t b = { 0 };
+        uint32_t nfat, nroot;
+        int rv = meta_gather(&b, &nfat, &nroot);
+        pthread_rwlock_unlock(&G.meta_lock);
+        uint64_t t0 = tr_now();
+
+        // only this thread touches the journal state while a batch is being written
+        disk_t* d = &G.commit_disk;
+        if (rv == 0 && !d->up && disk_connect(d) < 0) rv = -1;
+        if (rv == 0 && g_jr.nsec > 0) rv = jr_commit(d, &b);
+        else if (rv == 0 && nfat > 0) rv = disk_write_vec(d, b.idx, nfat, b.data);
+        if (rv == 0 && g_jr.nsec == 0 && b.n > nfat) rv = disk_write_vec(d, b.idx + nfat, b.n - nfat, b.data + (size_t)nfat * BLKSZ);
+        if (d->broken) disk_close(d);
+        tr_end(TR_GROUP_FLUSH, t0);
+
+        bool zombies = __atomic_load_n(&g_dirs.nzombies, __ATOMIC_RELAXED) > 0;
+        if (rv != 0 || zombies || g_jr.q_released > 0) {
+            tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+            if (rv != 0) meta_redirty(&b, nfat, nroot);
+            jr_release(&G.fat);
+            // no batch is writing now, so the removed tables' clusters can be reused
+            for (uint32_t i = 0; i < g_dirs.nzombies; i++) free_chain(NULL, &G.L, &G.fat, g_dirs.zombies[i]);
+            zombies = g_dirs.nzombies > 0;
+            g_dirs.nzombies = 0;
+            pthread_rwlock_unlock(&G.meta_lock);
+        }
+        batch_free(&b);
+        pthread_mutex_lock(&G.commit_mtx);
+        G.commit_busy = false;
+        if (rv == 0) G.durable_seq = hi; else G.failed_seq = hi; // a failed batch fails its waiters
+        if (zombies) G.meta_seq++; // the FAT sectors just freed go out with the next batch
+        pthread_cond_broadcast(&G.commit_done);
+        pthread_mutex_unlock(&G.commit_mtx);
+    }
+    return NULL;
+}
+
+// === sector cache write-back ===
+#define FLUSH_MS 100
+#define FLUSH_BATCH 256
+// flusher (-c n,wb): write dirty cache blocks every FLUSH_MS, or as soon as half
+// the cache is dirty, over its own disk connection
+static void* flusher_main(void* vp) {
+    (void)vp;
+    tr_attach("flusher");
+    disk_t d = { 0 };
+    for (;;) {
+        pthread_mutex_lock(&g_bc.mtx);
+        if (g_bc.ndirty <= g_bc.cap / 2) {
+            struct timespec ts; clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += FLUSH_MS * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L; ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&g_bc.flush_kick, &g_bc.mtx, &ts);
+        }
+        uint32_t nd = g_bc.ndirty;
+        pthread_mutex_unlock(&g_bc.mtx);
+        if (nd == 0) continue;
+        if (!d.up && disk_connect(&d) < 0) continue;
+        while (bc_flush_some(&g_bc, &d, FLUSH_BATCH) == FLUSH_BATCH) {}
+        if (d.broken) disk_close(&d);
+    }
+    return NULL;
+}
+// SIGINT/SIGTERM: write back what the cache still holds, report, and exit
+static void* shutdown_main(void* vp) {
+    sigset_t* set = (sigset_t*)vp;
+    int sig = 0;
+    sigwait(set, &sig);
+    if (g_bc.write_back) {
+        disk_t d = { 0 };
+        int n = 0;
+        if (disk_connect(&d) == 0)
+            while ((n = bc_flush_some(&g_bc, &d, FLUSH_BATCH)) > 0) {}
+        if (n < 0 || g_bc.ndirty > 0) fprintf(stderr, "[fs_server] %u dirty blocks could not be written back\n", g_bc.ndirty);
+        disk_close(&d);
+    }
+    pthread_mutex_lock(&g_bc.mtx);
+    fprintf(stderr, "[fs_server] sector cache: hits=%llu misses=%llu evictions=%llu refused=%llu writebacks=%llu\n",
+            (unsigned long long)g_bc.hits, (unsigned long long)g_bc.misses, (unsigned long long)g_bc.evictions,
+            (unsigned long long)g_bc.refused, (unsigned long long)g_bc.writebacks);
+    pthread_mutex_unlock(&g_bc.mtx);
+    pthread_mutex_lock(&g_bidx.mtx);
+    fprintf(stderr, "[fs_server] block-index cache: hits=%llu misses=%llu\n",
+            (unsigned long long)g_bidx.hits, (unsigned long long)g_bidx.misses);
+    pthread_mutex_unlock(&g_bidx.mtx);
+    tr_close();
+    exit(0);
+    return NULL;
+}
 
 // === FS command handlers ===
-static int cmd_format(disk_t* disk, int cfd) {
-    // (Re-)compute layout then format
-    if (compute_layout(disk, &G.L) < 0) return -1;
-    pthread_mutex_lock(&G.meta_mtx);
-    fat_free(&G.fat); fat_init(&G.fat); // reset cache
-    int rv = format_fs(disk, &G.L, &G.fat);
-    if (rv == 0) { G.formatted = true; }
-    pthread_mutex_unlock(&G.meta_mtx);
+static int cmd_format(disk_t* disk, const fmt_opts_t* o, int cfd) {
+    // F excludes everything: all file stripes in order, then the metadata,
+    // after any group-commit flush in progress has finished
+    for (int i = 0; i < FILE_LOCK_STRIPES; i++) tr_rwlock(&G.file_locks[i], true, TR_WAIT_FILE);
+    pthread_mutex_lock(&G.commit_mtx);
+    G.commit_hold = true;
+    while (G.commit_busy) pthread_cond_wait(&G.commit_done, &G.commit_mtx); // no stale flush after the format
+    pthread_mutex_unlock(&G.commit_mtx);
+    tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+    // (Re-)compute layout then format; options that do not fit this disk leave it as it was
+    layout_t L;
+    int rv = compute_layout(disk, o, &L);
+    if (rv == 0) {
+        G.L = L;
+        fat_free(&G.fat); fat_init(&G.fat); // reset caches
+        dirs_free();
+        g_dirs.nzombies = 0;
+        jr_reset(&G.L, 1);
+        G.dir.write_back = G.group || G.L.journal_sectors > 0;
+        bidx_clear();
+        bc_clear(&g_bc);
+        rv = format_fs(disk, &G.L, &G.fat, &G.dir);
+        G.formatted = (rv == 0);
+        G.fs_gen++;
+    }
+    pthread_mutex_lock(&G.commit_mtx);
+    G.commit_hold = false;
+    G.durable_seq = G.meta_seq; // pending group-commit changes were superseded
+    pthread_cond_broadcast(&G.commit_done);
+    pthread_mutex_unlock(&G.commit_mtx);
+    pthread_rwlock_unlock(&G.meta_lock);
+    for (int i = FILE_LOCK_STRIPES; i-- > 0;) pthread_rwlock_unlock(&G.file_locks[i]);
     const char* ok = (rv == 0) ? "0\n" : "2\n";
     return (write_all(cfd, ok, strlen(ok)) < 0) ? -1 : 0;
 }
-static int cmd_create(disk_t* disk, const char* name, int cfd) {
-    if (strlen(name) == 0 || strlen(name) >= MAX_NAME) { write_all(cfd, "2\n", 2); return 0; }
-    pthread_mutex_lock(&G.meta_mtx);
-    if (!G.formatted) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "2\n", 2); return 0; }
-    if (fat_load(disk, &G.L, &G.fat) < 0) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "2\n", 2); return 0; }
-
-    dirent_fs e; uint32_t slot;
-    int fnd = dir_find_by_name(disk, &G.L, name, &slot, &e);
-    if (fnd == 0) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "1\n", 2); return 0; } // already exists
-
+// C f and MD d: add an entry to the directory holding path. A new file has no
+// readers yet, so only the metadata lock is needed. A new directory first gets an
+// empty table of one cluster.
+static int cmd_create(disk_t* disk, const char* path, uint8_t type, int cfd) {
+    if (meta_ready(disk) != 0) { write_all(cfd, "2\n", 2); return 0; }
+    tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+    const char* leaf; dirent_fs e; uint32_t slot;
+    dir_cache_t* dc = dir_walk(path, &leaf);
+    const char* err = NULL;
+    if (dc && !*leaf) err = "1\n"; // the root always exists
+    else if (!dc || strlen(leaf) >= MAX_NAME) err = "2\n";
+    else if (dir_find_by_name(dc, leaf, &slot, &e) == 0) err = "1\n"; // already exists
     uint32_t free_slot;
-    if (dir_find_free(disk, &G.L, &free_slot) != 0) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "2\n", 2); return 0; }
-    memset(&e, 0, sizeof(e)); strncpy(e.name, name, MAX_NAME - 1);
-    e.length = 0; e.first = FAT_EOF; e.used = 1;
-    int rv = dir_write_entry(disk, &G.L, free_slot, &e);
-    pthread_mutex_unlock(&G.meta_mtx);
-    write_all(cfd, (rv == 0) ? "0\n" : "2\n", 2);
+    if (!err && dir_take_free(disk, dc, &free_slot) != 0) err = "2\n";
+    dir_cache_t* sub = NULL;
+    if (!err && type == FT_DIR && !(sub = dir_create_table(disk))) err = "2\n";
+    uint64_t t = 0;
+    if (!err) {
+        memset(&e, 0, sizeof(e)); strncpy(e.name, leaf, MAX_NAME - 1);
+        e.length = 0; e.first = sub ? sub->id : FAT_EOF; e.used = 1; e.type = type;
+        bool linked = dir_write_entry(disk, dc, free_slot, &e) == 0;
+        if (!linked || meta_commit(disk, &t) < 0) err = "2\n";
+        if (err && sub) {
+            // take the new table back out: clear the entry again and free its cluster
+            dirent_fs blank; memset(&blank, 0, sizeof(blank));
+            if (linked) dir_write_entry(disk, dc, free_slot, &blank);
+            dir_unregister(sub); dir_free(sub); free(sub);
+            free_chain(disk, &G.L, &G.fat, e.first);
+        }
+    }
+    pthread_rwlock_unlock(&G.meta_lock);
+    if (!err && commit_wait(t) < 0) err = "2\n";
+    write_all(cfd, err ? err : "0\n", 2);
     return 0;
 }
-static int cmd_delete(disk_t* disk, const char* name, int cfd) {
-    pthread_mutex_lock(&G.meta_mtx);
-    if (!G.formatted) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "2\n", 2); return 0; }
-    if (fat_load(disk, &G.L, &G.fat) < 0) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "2\n", 2); return 0; }
-
-    dirent_fs e; uint32_t slot;
-    if (dir_find_by_name(disk, &G.L, name, &slot, &e) != 0) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "1\n", 2); return 0; }
+static int cmd_delete(disk_t* disk, const char* path, int cfd) {
+    if (meta_ready(disk) != 0) { write_all(cfd, "2\n", 2); return 0; }
+    dirent_fs e; uint32_t slot; dir_cache_t* dc;
+    // exclusive file lock: waits out readers still streaming the chain we free
+    int fnd = lock_file(path, true, true, &dc, &slot, &e);
+    if (fnd != 0) { write_all(cfd, fnd == 1 ? "1\n" : "2\n", 2); return 0; }
     // free chain
     if (e.first != FAT_EOF) free_chain(disk, &G.L, &G.fat, e.first);
-    if (fat_flush(disk, &G.L, &G.fat) < 0) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "2\n", 2); return 0; }
-    // clear dir slot
-    dirent_fs blank; memset(&blank, 0, sizeof(blank));
-    int rv = dir_write_entry(disk, &G.L, slot, &blank);
-    pthread_mutex_unlock(&G.meta_mtx);
+    uint64_t t;
+    dirent_fs blank; memset(&blank, 0, sizeof(blank)); // clear dir slot
+    int rv = meta_publish(disk, dc, slot, &blank, &t);
+    pthread_rwlock_unlock(&G.meta_lock); pthread_rwlock_unlock(file_lock(dc->id, slot));
+    if (rv == 0) rv = commit_wait(t);
     write_all(cfd, (rv == 0) ? "0\n" : "2\n", 2);
     return 0;
 }
-static int cmd_list(disk_t* disk, int brief, int cfd) {
-    if (!G.formatted) { write_all(cfd, "(unformatted)\n", 14); return 0; }
-    dirent_fs e;
-    char line[256];
-    for (uint32_t i = 0; i < G.L.dir_entries; i++) {
-        if (dir_read_entry(disk, &G.L, i, &e) < 0) return -1;
-        if (!e.used) continue;
-        if (!brief) snprintf(line, sizeof(line), "%s %u\n", e.name, e.length);
-        else       snprintf(line, sizeof(line), "%s\n", e.name);
-        if (write_all(cfd, line, strlen(line)) < 0) return -1;
+// RD d: remove an empty directory; 3 if it still has entries
+static int cmd_rmdir(disk_t* disk, const char* path, int cfd) {
+    if (meta_ready(disk) != 0) { write_all(cfd, "2\n", 2); return 0; }
+    tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+    const char* leaf; dirent_fs e; uint32_t slot;
+    dir_cache_t* dc = dir_walk(path, &leaf), *sub = NULL;
+    const char* err = NULL;
+    if (dc && !*leaf) err = "2\n"; // not the root
+    else if (!dc || dir_find_by_name(dc, leaf, &slot, &e) != 0) err = "1\n";
+    else if (e.type != FT_DIR || !(sub = dir_by_id(e.first))) err = "2\n";
+    else if (sub->nused > 0) err = "3\n";
+    bool zombie = g_jr.nsec == 0 && G.group;
+    if (!err && zombie && g_dirs.nzombies == g_dirs.zcap) {
+        // make room on the zombie list before anything changes
+        uint32_t cap = g_dirs.zcap ? g_dirs.zcap * 2 : 16;
+        uint32_t* z = (uint32_t*)realloc(g_dirs.zombies, (size_t)cap * sizeof(uint32_t));
+        if (!z) err = "2\n";
+        else { g_dirs.zombies = z; g_dirs.zcap = cap; }
+    }
+    uint64_t t = 0;
+    if (!err) {
+        dirent_fs blank; memset(&blank, 0, sizeof(blank));
+        if (dir_write_entry(disk, dc, slot, &blank) < 0) err = "2\n";
     }
+    if (!err) {
+        dir_unregister(sub); dir_free(sub); free(sub);
+        if (g_jr.nsec > 0) jr_quarantine(&G.fat, e.first);
+        else if (!zombie) free_chain(disk, &G.L, &G.fat, e.first);
+        else {
+            __atomic_store_n(&g_dirs.zombies[g_dirs.nzombies], e.first, __ATOMIC_RELAXED);
+            __atomic_store_n(&g_dirs.nzombies, g_dirs.nzombies + 1, __ATOMIC_RELAXED);
+        }
+        if (meta_commit(disk, &t) < 0) err = "2\n";
+    }
+    pthread_rwlock_unlock(&G.meta_lock);
+    if (!err && commit_wait(t) < 0) err = "2\n";
+    write_all(cfd, err ? err : "0\n", 2);
     return 0;
 }
+// S alone: the sector and block-index cache counters, framed like T
+static int cmd_counters(int cfd) {
+    char text[512], out[sizeof(text) + 32];
+    pthread_mutex_lock(&g_bc.mtx);
+    int n = snprintf(text, sizeof(text),
+                     "cache_blocks %u\ncache_hits %llu\ncache_misses %llu\ncache_inserts %llu\ncache_evictions %llu\n"
+                     "cache_refused %llu\ncache_dirty %u\ncache_writebacks %llu\nreadahead_blocks %llu\nreadahead_hits %llu\n",
+                     g_bc.cap, (unsigned long long)g_bc.hits, (unsigned long long)g_bc.misses, (unsigned long long)g_bc.inserts,
+                     (unsigned long long)g_bc.evictions, (unsigned long long)g_bc.refused, g_bc.ndirty,
+                     (unsigned long long)g_bc.writebacks, (unsigned long long)g_bc.ra_blocks, (unsigned long long)g_bc.ra_hits);
+    pthread_mutex_unlock(&g_bc.mtx);
+    pthread_mutex_lock(&g_bidx.mtx);
+    n += snprintf(text + n, sizeof(text) - (size_t)n, "bidx_hits %llu\nbidx_misses %llu\n",
+                  (unsigned long long)g_bidx.hits, (unsigned long long)g_bidx.misses);
+    pthread_mutex_unlock(&g_bidx.mtx);
+    int m = snprintf(out, sizeof(out), "0 %d %s\n", n, text);
+    return write_all(cfd, out, (size_t)m) < 0 ? -1 : 0;
+}
+// S f [f ...]: the directory entry of each name, one line per name in order: "0 length
+// first type" (first is -1 for an empty file, type f or d), "1" if missing or "2". All
+// names are looked up under one hold of the shared lock; no file data is read.
+static int cmd_stat(disk_t* disk, const char* names, const char* cwd, int cfd) {
+    int ready = disk ? meta_ready(disk) : -1; // no disk connection: 2 for every name
+    // count the names first to size the reply
+    size_t n = 0;
+    for (const char* p = names; *p; ) {
+        while (*p && strchr(" \t\r\n", *p)) p++;
+        if (!*p) break;
+        n++; while (*p && !strchr(" \t\r\n", *p)) p++;
+    }
+    if (n == 0) return cmd_counters(cfd);
+    size_t cap = n * 40, m = 0;
+    char* out = (char*)malloc(cap);
+    if (!out) return -1;
+    if (ready == 0) tr_rwlock(&G.meta_lock, false, TR_WAIT_META);
+    for (const char* p = names; *p; ) {
+        while (*p && strchr(" \t\r\n", *p)) p++;
+        if (!*p) break;
+        const char* q = p; while (*q && !strchr(" \t\r\n", *q)) q++;
+        char arg[MAX_LINE], path[MAX_LINE];
+        memcpy(arg, p, (size_t)(q - p)); arg[q - p] = '\0';
+        p = q;
+        const char* leaf; dirent_fs e; uint32_t slot;
+        dir_cache_t* dc = ready != 0 || path_canon(cwd, arg, path, sizeof(path)) < 0 ? NULL : dir_walk(path, &leaf);
+        if (ready != 0) m += (size_t)snprintf(out + m, cap - m, "2\n");
+        else if (dc && !*leaf) m += (size_t)snprintf(out + m, cap - m, "0 0 0 d\n"); // the root
+        else if (!dc || dir_find_by_name(dc, leaf, &slot, &e) != 0) m += (size_t)snprintf(out + m, cap - m, "1\n");
+        else m += (size_t)snprintf(out + m, cap - m, "0 %u %d %c\n", e.length,
+                                   e.first == FAT_EOF ? -1 : (int)e.first, e.type == FT_DIR ? 'd' : 'f');
+    }
+    if (ready == 0) pthread_rwlock_unlock(&G.meta_lock);
+    int rv = write_all(cfd, out, m) < 0 ? -1 : 0;
+    free(out);
+    return ready < 0 && disk ? -1 : rv;
+}
+// CD d: make d the connection's working directory; replies "0 <canonical path>"
+static int cmd_cd(disk_t* disk, const char* path, char* cwd, int cfd) {
+    if (meta_ready(disk) != 0) { write_all(cfd, "2\n", 2); return 0; }
+    tr_rwlock(&G.meta_lock, false, TR_WAIT_META);
+    bool ok = dir_lookup(path) != NULL;
+    pthread_rwlock_unlock(&G.meta_lock);
+    if (!ok) { write_all(cfd, "1\n", 2); return 0; }
+    if (cwd != path) strcpy(cwd, path);
+    char out[MAX_LINE + 4];
+    int m = snprintf(out, sizeof(out), "0 %s\n", cwd);
+    return write_all(cfd, out, (size_t)m) < 0 ? -1 : 0;
+}
+// L b [d]: the entries of directory d (default: the working directory), with
+// lengths unless b is 0; subdirectories end in '/'
+static int cmd_list(disk_t* disk, int brief, const char* path, int cfd) {
+    int ready = meta_ready(disk);
+    if (ready == 1) { write_all(cfd, "(unformatted)\n", 14); return 0; }
+    if (ready < 0) return -1;
+    // format the listing from the cache under the shared lock, send it after
+    tr_rwlock(&G.meta_lock, false, TR_WAIT_META);
+    dir_cache_t* dc = dir_lookup(path);
+    if (!dc) { pthread_rwlock_unlock(&G.meta_lock); return write_all(cfd, "(no such directory)\n", 20) < 0 ? -1 : 0; }
+    size_t cap = (size_t)dc->nused * (MAX_NAME + 12) + 1, n = 0;
+    char* out = (char*)malloc(cap);
+    if (!out) { pthread_rwlock_unlock(&G.meta_lock); return -1; }
+    for (uint32_t i = 0; i < dc->nents; i++) {
+        const dirent_fs* e = &dc->ents[i];
+        if (!e->used) continue;
+        const char* sfx = e->type == FT_DIR ? "/" : "";
+        if (!brief) n += (size_t)snprintf(out + n, cap - n, "%s%s %u\n", e->name, sfx, e->length);
+        else       n += (size_t)snprintf(out + n, cap - n, "%s%s\n", e->name, sfx);
+    }
+    pthread_rwlock_unlock(&G.meta_lock);
+    int rv = (n > 0 && write_all(cfd, out, n) < 0) ? -1 : 0;
+    free(out);
+    return rv;
+}
+// T: the tracing timers, framed like R ("0 len text\n")
+static int cmd_trace(int cfd) {
+    TR_SCOPE(TR_CMD_T);
+    char text[(TR_NKINDS + 1) * 64], out[sizeof(text) + 32];
+    size_t n = tr_report(text, sizeof(text));
+    int m = snprintf(out, sizeof(out), "0 %zu %s\n", n, text);
+    return write_all(cfd, out, (size_t)m) < 0 ? -1 : 0;
+}
 static int cmd_read(disk_t* disk, const char* name, int cfd) {
-    pthread_mutex_lock(&G.meta_mtx);
-    if (!G.formatted) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "1 0 \n", 5); return 0; }
-    if (fat_load(disk, &G.L, &G.fat) < 0) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "2 0 \n", 5); return 0; }
-    dirent_fs e; uint32_t slot;
-    if (dir_find_by_name(disk, &G.L, name, &slot, &e) != 0) { pthread_mutex_unlock(&G.meta_mtx); write_all(cfd, "1 0 \n", 5); return 0; }
-    unsigned char* buf = NULL; uint32_t len = 0;
-    int rv = read_whole_file(disk, &G.L, &G.fat, &e, &buf, &len);
-    pthread_mutex_unlock(&G.meta_mtx);
-    if (rv < 0) { write_all(cfd, "2 0 \n", 5); return 0; }
+    int ready = meta_ready(disk);
+    if (ready != 0) { write_all(cfd, ready == 1 ? "1 0 \n" : "2 0 \n", 5); return 0; }
+    dirent_fs e; uint32_t slot; dir_cache_t* dc;
+    int fnd = lock_file(name, false, false, &dc, &slot, &e);
+    if (fnd != 0) { write_all(cfd, fnd == 1 ? "1 0 \n" : "2 0 \n", 5); return 0; }
+    // the shared file lock keeps the chain from being freed or replaced; other
+    // files' metadata can change meanwhile, so meta_lock is dropped for the stream
+    pthread_rwlock_unlock(&G.meta_lock);
+    int rv = stream_file_out(disk, &G.fat, &e, cfd);
+    pthread_rwlock_unlock(file_lock(dc->id, slot));
+    if (rv == -1) { write_all(cfd, "2 0 \n", 5); return 0; }
+    return rv < 0 ? -1 : 0;
+}
+// W of a file small enough to live in its entry: the payload (already read) goes
+// into the entry and any old chain is freed, so no data block is written. Called
+// with the exclusive file lock and meta_lock held; releases both.
+static int write_inline(disk_t* disk, dir_cache_t* dc, uint32_t slot, dirent_fs* e, const unsigned char* data, uint32_t len, int cfd) {
+    const char* err = NULL;
+    uint64_t t = 0;
+    if (e->first != FAT_EOF) free_chain(disk, &G.L, &G.fat, e->first);
+    memset(e->data, 0, sizeof(e->data)); memcpy(e->data, data, len);
+    e->first = FAT_EOF; e->length = len;
+    if (meta_publish(disk, dc, slot, e, &t) < 0) err = "2\n";
+    pthread_rwlock_unlock(&G.meta_lock); pthread_rwlock_unlock(file_lock(dc->id, slot));
+    if (!err && commit_wait(t) < 0) err = "2\n";
+    write_all(cfd, err ? err : "0\n", 2);
+    return 0;
+}
+// W is a shadow write: new blocks are allocated under meta_lock but stay unlinked
+// while the payload streams in without any lock; the entry is then switched to
+// the new chain and the old one freed under the exclusive file lock. If the file
+// only fits by reusing its own blocks, it is truncated up front instead. Files of
+// up to inline_max bytes go to write_inline() instead. The disk connection is
+// leased for each step that needs one, never while waiting for the payload.
+static int cmd_write(disk_lease_t* ls, const char* name, uint32_t len, rbuf_t* cin) {
+    int cfd = cin->fd;
+    uint32_t blocks = (len + BLKSZ - 1) / BLKSZ, nclu = 0;
+    const char* err = NULL;
+    // a payload that may go inline is read before any lock is taken, so a client
+    // stalling in it holds up no other writer of the stripe, D or F
+    unsigned char small[DIRENT_INLINE_MAX];
+    const unsigned char* src = NULL;
+    if (len > 0 && len <= DIRENT_INLINE_MAX) {
+        if (read_exact(cin, small, len) != (ssize_t)len) return -1;
+        src = small;
+    }
 
-    char hdr[64]; int m = snprintf(hdr, sizeof(hdr), "0 %u ", len);
-    if (write_all(cfd, hdr, (size_t)m) < 0) { free(buf); return -1; }
-    if (len > 0 && write_all(cfd, buf, len) < 0) { free(buf); return -1; }
-    if (write_all(cfd, "\n", 1) < 0) { free(buf); return -1; }
-    free(buf);
+    disk_t* disk = lease_get(ls);
+    if (disk) adopt_super(disk);
+    int ready = disk ? meta_ready(disk) : -1, fnd = 0;
+    dirent_fs e; uint32_t slot; dir_cache_t* dc;
+    if (ready != 0) err = "2\n";
+    else if ((fnd = lock_file(name, true, true, &dc, &slot, &e)) != 0) err = fnd == 1 ? "1\n" : "2\n";
+    if (!err && len > 0 && len <= G.L.inline_max) return write_inline(disk, dc, slot, &e, small, len, cfd);
+    uint32_t *picked = NULL, *secs = NULL; // the new chain's clusters, and its sectors
+    uint64_t gen = 0;
+    if (!err) {
+        uint32_t cs = G.fat.csize;
+        nclu = (blocks + cs - 1) / cs;
+        uint32_t old_clu = e.first == FAT_EOF ? 0 : ((e.length + BLKSZ - 1) / BLKSZ + cs - 1) / cs;
+        if (nclu > G.fat.nfree + old_clu) err = "2\n"; // no space, old contents kept
+        if (!err && nclu > G.fat.nfree) {
+            // fits only in place: release the current chain first
+            free_chain(disk, &G.L, &G.fat, e.first);
+            e.first = FAT_EOF; e.length = 0;
+            if (dir_write_entry(disk, dc, slot, &e) < 0) err = "2\n";
+        }
+        if (!err && blocks > 0) {
+            picked = (uint32_t*)malloc((size_t)nclu * sizeof(uint32_t));
+            secs = (uint32_t*)malloc((size_t)blocks * sizeof(uint32_t));
+            if (!picked || !secs || alloc_blocks(&G.fat, nclu, picked) != 0) err = "2\n";
+            else {
+                fat_reserve(&G.fat, picked, nclu);
+                clusters_to_secs(&G.fat, picked, blocks, secs);
+            }
+        }
+        gen = G.fs_gen;
+        pthread_rwlock_unlock(&G.meta_lock); pthread_rwlock_unlock(file_lock(dc->id, slot));
+    }
+    lease_put(ls);
+    if (err) { free(picked); free(secs); if (!src && rbuf_skip(cin, len) < 0) return -1; write_all(cfd, err, 2); return 0; }
+
+    int srv = blocks > 0 ? stream_file_in(ls, cin, src, secs, len) : 0;
+
+    uint64_t t = 0;
+    dirent_fs cur; uint32_t cslot; dir_cache_t* cdc;
+    if (srv == 0 && !(disk = lease_get(ls))) srv = -1;
+    if (srv == 0 && (fnd = lock_file(name, true, true, &cdc, &cslot, &cur)) == 0) {
+        if (G.fs_gen != gen) err = "2\n"; // formatted underneath us; the blocks are gone already
+        else {
+            // publish: the last writer wins; whichever chain it replaces is freed
+            if (cur.first != FAT_EOF) free_chain(disk, &G.L, &G.fat, cur.first);
+            if (blocks > 0) fat_link_reserved(&G.fat, picked, nclu);
+            cur.first = blocks > 0 ? picked[0] : FAT_EOF; cur.length = len;
+            if (meta_publish(disk, cdc, cslot, &cur, &t) < 0) err = "2\n";
+        }
+        pthread_rwlock_unlock(&G.meta_lock); pthread_rwlock_unlock(file_lock(cdc->id, cslot));
+    } else {
+        // the stream failed or the file was deleted meanwhile: give the new blocks back
+        err = srv < 0 || fnd == 2 ? "2\n" : "1\n";
+        tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+        if (G.fs_gen == gen && blocks > 0) fat_unreserve(&G.fat, picked, nclu);
+        pthread_rwlock_unlock(&G.meta_lock);
+    }
+    free(picked); free(secs);
+    if (srv == -2) return -1;
+    if (!err && commit_wait(t) < 0) err = "2\n";
+    write_all(cfd, err ? err : "0\n", 2);
     return 0;
 }
-static int cmd_write(disk_t* disk, const char* name, uint32_t len, int cfd) {
-    // read len raw bytes from client, then write file
-    unsigned char* data = (unsigned char*)malloc(len ? len : 1); if (!data) { write_all(cfd, "2\n", 2); return 0; }
-    if (len > 0 && read_exact(cfd, data, len) != (ssize_t)len) { free(data); return -1; }
-
-    pthread_mutex_lock(&G.meta_mtx);
-    if (!G.formatted) { pthread_mutex_unlock(&G.meta_mtx); free(data); write_all(cfd, "2\n", 2); return 0; }
-    if (fat_load(disk, &G.L, &G.fat) < 0) { pthread_mutex_unlock(&G.meta_mtx); free(data); write_all(cfd, "2\n", 2); return 0; }
-    dirent_fs e; uint32_t slot;
-    if (dir_find_by_name(disk, &G.L, name, &slot, &e) != 0) { pthread_mutex_unlock(&G.meta_mtx); free(data); write_all(cfd, "1\n", 2); return 0; }
-
-    int rv = write_whole_file(disk, &G.L, &G.fat, &e, data, len);
-    if (rv == -2) { pthread_mutex_unlock(&G.meta_mtx); free(data); write_all(cfd, "2\n", 2); return 0; } // no space
-    if (rv < 0) { pthread_mutex_unlock(&G.meta_mtx); free(data); write_all(cfd, "2\n", 2); return 0; }
-    // persist updated FAT and dir entry
-    if (fat_flush(disk, &G.L, &G.fat) < 0) { pthread_mutex_unlock(&G.meta_mtx); free(data); write_all(cfd, "2\n", 2); return 0; }
-    if (dir_write_entry(disk, &G.L, slot, &e) < 0) { pthread_mutex_unlock(&G.meta_mtx); free(data); write_all(cfd, "2\n", 2); return 0; }
-    pthread_mutex_unlock(&G.meta_mtx);
-    free(data);
-    write_all(cfd, "0\n", 2);
+
+// RR f off len: like R but for bytes [off, off+len) clamped to the file length
+// per-connection read-ahead for RR: reads that continue where the previous one
+// ended double the window (RA_MIN..RA_MAX blocks), anything else closes it
+#define RA_MIN 8
+#define RA_MAX (STREAM_RING * STREAM_CHUNK)
+typedef struct { uint32_t head, next, window; } readahead_t;
+static uint32_t ra_update(readahead_t* ra, uint32_t head, uint32_t off, uint32_t n) {
+    bool seq = ra->next > 0 && head == ra->head && off == ra->next;
+    if (!seq) ra->window = 0;
+    else if (ra->window == 0) ra->window = RA_MIN;
+    else ra->window = ra->window * 2 < RA_MAX ? ra->window * 2 : RA_MAX;
+    ra->head = head; ra->next = off + n;
+    return ra->window;
+}
+static int cmd_read_range(disk_t* disk, const char* name, uint32_t off, uint32_t len, readahead_t* ra, int cfd) {
+    int ready = meta_ready(disk);
+    if (ready != 0) { write_all(cfd, ready == 1 ? "1 0 \n" : "2 0 \n", 5); return 0; }
+    dirent_fs e; uint32_t slot; dir_cache_t* dc;
+    int fnd = lock_file(name, false, false, &dc, &slot, &e);
+    if (fnd != 0) { write_all(cfd, fnd == 1 ? "1 0 \n" : "2 0 \n", 5); return 0; }
+    pthread_rwlock_unlock(&G.meta_lock);
+    uint32_t n = off >= e.length ? 0 : (len < e.length - off ? len : e.length - off);
+    int rv;
+    if (dirent_inline(&e)) rv = inline_out(&e, off, n, cfd); // nothing to read ahead either
+    else {
+        uint32_t window = ra_update(ra, e.first, off, n);
+        uint32_t end_blk = (off + n + BLKSZ - 1) / BLKSZ, file_blks = (e.length + BLKSZ - 1) / BLKSZ;
+        uint32_t ahead = n == 0 || end_blk >= file_blks ? 0 : (window < file_blks - end_blk ? window : file_blks - end_blk);
+        rv = stream_range_out(disk, &G.fat, e.first, off / BLKSZ, off % BLKSZ, n, ahead, cfd);
+    }
+    pthread_rwlock_unlock(file_lock(dc->id, slot));
+    if (rv == -1) { write_all(cfd, "2 0 \n", 5); return 0; }
+    return rv < 0 ? -1 : 0;
+}
+// WR f off len / A f len: overwrite bytes [off, off+len) in place, growing the file
+// if the range runs past its end (off may not exceed the length; append uses
+// off = length). Only the blocks covering the range are written; partial first and
+// last blocks are read back and merged, and new blocks are linked after the current
+// tail, preferably right behind it. An inline (or empty) file that still fits in its
+// entry is updated there; one that outgrows it moves to blocks. The exclusive file
+// lock is held throughout; meta_lock only while choosing blocks and when the new
+// length is published. The payload (src) was read before the lease's connection
+// was taken, so neither waits on the client.
+static int cmd_write_range(disk_lease_t* ls, const char* name, uint32_t off, bool append, const unsigned char* src, uint32_t len, int cfd) {
+    disk_t* disk = ls->d;
+    const char* err = NULL;
+    int ready = meta_ready(disk), fnd = 0;
+    dirent_fs e; uint32_t slot; dir_cache_t* dc;
+    if (ready != 0) err = "2\n";
+    else if ((fnd = lock_file(name, true, true, &dc, &slot, &e)) != 0) err = fnd == 1 ? "1\n" : "2\n";
+    if (err) { write_all(cfd, err, 2); return 0; }
+    if (append) off = e.length;
+
+    // old_blocks hold file data; old_cap blocks are allocated (whole clusters); extra clusters are added
+    uint32_t cs = G.fat.csize;
+    uint64_t end = (uint64_t)off + len;
+    uint32_t new_len = end > e.length ? (uint32_t)end : e.length;
+    bool keep_inline = e.first == FAT_EOF && new_len <= G.L.inline_max;
+    bool to_blocks = dirent_inline(&e) && !keep_inline; // its bytes become the head of block 0
+    uint32_t old_blocks = e.first == FAT_EOF ? 0 : (e.length + BLKSZ - 1) / BLKSZ, old_cap = (old_blocks + cs - 1) / cs * cs;
+    uint32_t new_blocks = (uint32_t)((new_len + (uint64_t)BLKSZ - 1) / BLKSZ);
+    uint32_t extra = !keep_inline && new_blocks > old_cap ? (new_blocks - old_cap + cs - 1) / cs : 0;
+    uint32_t first_b = off / BLKSZ, nblk = len && !keep_inline ? (uint32_t)((end - 1) / BLKSZ) - first_b + 1 : 0;
+    uint32_t *blk = NULL, *ext = NULL, tail = FAT_EOF;
+    if (off > e.length || end > UINT32_MAX) err = "2\n"; // no holes
+    else if (extra > G.fat.nfree) err = "2\n"; // no space
+    else if (nblk > 0) {
+        blk = (uint32_t*)malloc((size_t)nblk * sizeof(uint32_t));
+        ext = (uint32_t*)malloc((size_t)(extra ? extra : 1) * sizeof(uint32_t));
+        if (!blk || !ext) err = "2\n";
+    }
+    if (!err && nblk > 0) {
+        // existing blocks in the range, then the tail cluster for linking new ones
+        uint32_t k = first_b < old_cap ? bidx_get(&G.fat, e.first, first_b, nblk < old_cap - first_b ? nblk : old_cap - first_b, blk) : 0;
+        if (extra > 0) {
+            if (k > 0) tail = blk[k - 1] / cs; // the range runs past the end, so it covers the tail
+            else if (old_cap > 0 && bidx_get(&G.fat, e.first, old_cap - 1, 1, &tail) == 1) tail /= cs;
+            if (tail != FAT_EOF) G.fat.cursor = tail + 1; // next-fit right behind the tail
+            if (alloc_blocks(&G.fat, extra, ext) != 0) err = "2\n";
+            else {
+                fat_reserve(&G.fat, ext, extra); // linked behind the tail once the data is in
+                clusters_to_secs(&G.fat, ext, nblk - k, blk + k); // the range continues at the first new cluster
+            }
+        }
+    }
+    pthread_rwlock_unlock(&G.meta_lock);
+
+    int srv = 0;
+    if (!err && keep_inline) memcpy(e.data + off, src, len);
+    else if (!err && nblk > 0) {
+        // merge partial edge blocks that already hold file data
+        unsigned char hb[BLKSZ], tb[BLKSZ];
+        bool need_h = to_blocks || (first_b < old_blocks && (off % BLKSZ != 0 || (nblk == 1 && end % BLKSZ != 0)));
+        bool need_t = nblk > 1 && first_b + nblk - 1 < old_blocks && end % BLKSZ != 0;
+        if (to_blocks) { memset(hb, 0, BLKSZ); memcpy(hb, e.data, e.length); }
+        else if (need_h && bc_read_idx(disk, blk[0], hb) < 0) srv = -1;
+        if (need_t && srv == 0 && bc_read_idx(disk, blk[nblk - 1], tb) < 0) srv = -1;
+        if (srv == 0) srv = stream_range_in(ls, NULL, src, blk, off % BLKSZ, len, need_h ? hb : NULL, need_t ? tb : (nblk == 1 && need_h ? hb : NULL));
+    }
+
+    uint64_t t = 0;
+    tr_rwlock(&G.meta_lock, true, TR_WAIT_META);
+    if (!err && srv < 0 && extra > 0) {
+        fat_unreserve(&G.fat, ext, extra); // give back the blocks reserved for the growth
+        err = "2\n";
+    } else if (!err && srv < 0) err = "2\n";
+    else if (!err && (new_len != e.length || (keep_inline && len > 0))) {
+        if (extra > 0) {
+            fat_link_reserved(&G.fat, ext, extra);
+            if (tail != FAT_EOF) fat_set(&G.fat, tail, ext[0]); else e.first = ext[0];
+        }
+        e.length = new_len;
+        if (meta_publish(disk, dc, slot, &e, &t) < 0) err = "2\n";
+    }
+    pthread_rwlock_unlock(&G.meta_lock); pthread_rwlock_unlock(file_lock(dc->id, slot));
+    free(blk); free(ext);
+    if (!err && commit_wait(t) < 0) err = "2\n";
+    write_all(cfd, err ? err : "0\n", 2);
     return 0;
 }
 
 // === client handler ===
+// a W/WR/A header that does not parse: skip the payload it declares and reply 2,
+// or drop the connection if not even the length could be read (-1)
+static int bad_write_hdr(rbuf_t* cin, bool have_len, uint32_t len) {
+    if (!have_len || rbuf_skip(cin, len) < 0) return -1;
+    return write_all(cin->fd, "2\n", 2) < 0 ? -1 : 0;
+}
+// WR/A: the whole payload, read before the command takes a disk connection or its
+// file lock. NULL with *rc set if it could not be: 0 after replying 2 (no memory,
+// payload skipped), -1 if the client went away.
+static unsigned char* read_payload(rbuf_t* cin, uint32_t len, int* rc) {
+    unsigned char* p = (unsigned char*)malloc(len ? len : 1);
+    if (!p) { *rc = bad_write_hdr(cin, true, len); return NULL; }
+    if (read_exact(cin, p, len) != (ssize_t)len) { free(p); *rc = -1; return NULL; }
+    return p;
+}
+// the disk server is unreachable: reply 2 in the command's own format
+static int reply_no_disk(char cmd, int cfd) {
+    const char* r = cmd == 'R' || cmd == 'r' ? "2 0 \n" : "2\n";
+    return write_all(cfd, r, strlen(r)) < 0 ? -1 : 0;
+}
 static void* client_main(void* vp) {
     int cfd = ((client_arg_t*)vp)->cfd; free(vp);
-    // open a dedicated disk connection for this client
-    disk_t d = { .fd = -1 }; if (disk_connect(&d, G.disk_host, G.disk_port) < 0) { close(cfd); return NULL; }
-    // detect existing FS
-    layout_t tmpL;
-    if (try_load_super(&d, &tmpL) == 0) { G.L = tmpL; G.formatted = true; } // lazy adoption
-
-    char line[MAX_LINE];
+    tr_attach("client");
+    rbuf_t cin; rbuf_init(&cin, cfd);
+    readahead_t ra = { 0 };
+    char line[MAX_LINE], cwd[MAX_LINE] = "/", path[MAX_LINE], canon[MAX_LINE];
     while (1) {
-        ssize_t r = readline(cfd, line);
+        ssize_t r = readline(&cin, line);
         if (r <= 0) break;
-        char cmd = 0; char arg1[MAX_LINE] = { 0 }; char arg2[MAX_LINE] = { 0 };
-        uint32_t Lval = 0;
-        if (sscanf(line, " %c %s %u", &cmd, arg1, &Lval) < 1) break;
-
-        switch (cmd) {
-        case 'F': { cmd_format(&d, cfd); break; } // returns "0\n" or "2\n"
-        case 'C': { cmd_create(&d, arg1, cfd); break; } // "0\n" | "1\n" | "2\n"
-        case 'D': { cmd_delete(&d, arg1, cfd); break; } // "0\n" | "1\n" | "2\n"
-        case 'L': {
+        char op[8] = { 0 }; char arg1[MAX_LINE] = { 0 };
+        uint32_t n1 = 0, n2 = 0;
+        int got = sscanf(line, " %7s %s %u %u", op, arg1, &n1, &n2);
+        if (got < 1) break;
+        // one-letter commands plus RR (ranged read), WR (ranged write), MD/RD/CD (directories)
+        char cmd = op[1] == 0 ? op[0] : !strcmp(op, "RR") ? 'r' : !strcmp(op, "WR") ? 'w'
+                 : !strcmp(op, "MD") ? 'm' : !strcmp(op, "RD") ? 'd' : !strcmp(op, "CD") ? 'c' : 0;
+        if (!cmd || !strchr("FCDLRWArwmdcST", cmd)) break; // unknown
+        if (cmd == 'T') { if (cmd_trace(cfd) < 0) break; continue; } // no disk needed
+        // names are resolved against the connection's working directory
+        char* rel = cmd == 'L' ? path : arg1;
+        if (cmd == 'L') { path[0] = 0; sscanf(line, " %*s %*s %s", path); }
+        if (cmd != 'F' && path_canon(cwd, rel, canon, sizeof(canon)) < 0) canon[0] = 0;
+
+        // the command's span covers waiting for a disk connection too
+        static const char cmds[] = "FCDLRWArwmdcS";
+        uint64_t t0 = tr_now();
+        tr_cfd = cfd;
+
+        // borrow a pooled disk connection for the duration of the command, but only
+        // once its payload is in: W streams it and leases a connection per ring of
+        // blocks (cmd_write), WR and A read it whole first, since they keep their file
+        // locked until it is written. S gets by without one (it replies 2 per name).
+        disk_lease_t ls = { &G.pool, NULL };
+        unsigned char* payload = NULL;
+        int need = cmd == 'w' ? 4 : (cmd == 'W' || cmd == 'A') ? 3 : 0; // sscanf fields of a good header
+        int rc = 0;
+        bool run = false;
+        if (need && got != need) rc = bad_write_hdr(&cin, cmd != 'w' && got > need, n1);
+        else if (need && cmd != 'W' && !(payload = read_payload(&cin, cmd == 'w' ? n2 : n1, &rc))) {}
+        else if (cmd != 'W' && !lease_get(&ls) && cmd != 'S') rc = reply_no_disk(cmd, cfd);
+        else run = true;
+        disk_t* d = ls.d;
+        if (d) adopt_super(d);
+
+        switch (run ? cmd : 0) {
+        case 'F': { // "F [cluster_secs [dir_entries [journal_sectors [inline_max]]]]" -> "0\n" or "2\n"
+            fmt_opts_t fo = { FMT_CLUSTER_DEFAULT, FMT_DIR_DEFAULT, FMT_JOURNAL_AUTO, 0 };
+            uint32_t* field[] = { &fo.cluster_secs, &fo.dir_entries, &fo.journal_sectors, &fo.inline_max };
+            const char* p = strchr(line, 'F') + 1;
+            for (int k = 0;; k++) {
+                while (*p == ' ' || *p == '\t') p++;
+                if (!*p || *p == '\r' || *p == '\n') break;
+                char* end;
+                unsigned long v = strtoul(p, &end, 10);
+                // not a number, or too many: rejected by compute_layout
+                if (k == 4 || end == p || !strchr(" \t\r\n", *end)) { fo.cluster_secs = 0; break; }
+                *field[k] = v < FMT_JOURNAL_AUTO ? (uint32_t)v : FMT_JOURNAL_AUTO - 1;
+                p = end;
+            }
+            rc = cmd_format(d, &fo, cfd); break;
+        }
+        case 'C': { rc = cmd_create(d, canon, FT_FILE, cfd); break; } // "0\n" | "1\n" | "2\n"
+        case 'D': { rc = cmd_delete(d, canon, cfd); break; } // "0\n" | "1\n" | "2\n"
+        case 'L': { // "L b [d]"
             int brief = (arg1[0] == '0') ? 1 : 0; // '0' -> names only
-            cmd_list(&d, brief, cfd); break;
+            rc = cmd_list(d, brief, canon, cfd); break;
         }
-        case 'R': { cmd_read(&d, arg1, cfd); break; } // "code len data"
-        case 'W': {
-            // line was "W f l\n" then raw l bytes
-            uint32_t l = 0; char fname[MAX_LINE] = { 0 };
-            if (sscanf(line, " W %s %u", fname, &l) != 2) { write_all(cfd, "2\n", 2); break; }
-            cmd_write(&d, fname, l, cfd); break;
+        case 'm': { rc = cmd_create(d, canon, FT_DIR, cfd); break; } // "0\n" | "1\n" | "2\n"
+        case 'd': { rc = cmd_rmdir(d, canon, cfd); break; } // "0\n" | "1\n" | "2\n" | "3\n" (not empty)
+        case 'c': { rc = cmd_cd(d, canon, cwd, cfd); break; } // "0 /canonical/path\n" | "1\n"
+        case 'S': { // "S f [f ...]" -> one "0 len first type\n" | "1\n" | "2\n" per name; "S" -> counters
+            const char* names = line; while (*names == ' ' || *names == '\t') names++;
+            rc = cmd_stat(d, names + 1, cwd, cfd); break;
         }
-        default: { /*unknown*/ goto out; }
+        case 'R': { rc = cmd_read(d, canon, cfd); break; } // "code len data"
+        case 'r': { // "RR f off len" -> "code n data"
+            if (got != 4) { write_all(cfd, "2 0 \n", 5); break; }
+            rc = cmd_read_range(d, canon, n1, n2, &ra, cfd); break;
         }
+        case 'W': { rc = cmd_write(&ls, canon, n1, &cin); break; } // "W f l\n" then raw l bytes
+        case 'w': { rc = cmd_write_range(&ls, canon, n1, false, payload, n2, cfd); break; } // "WR f off len\n" then raw len bytes
+        case 'A': { rc = cmd_write_range(&ls, canon, 0, true, payload, n1, cfd); break; } // "A f len\n" then raw len bytes
+        }
+        lease_put(&ls);
+        free(payload);
+        tr_cfd = -1;
+        tr_end(TR_CMD_F + (int)(strchr(cmds, cmd) - cmds), t0);
+        if (rc < 0) break; // client gone or stream out of sync
     }
-out:
-    disk_close(&d); close(cfd); return NULL;
+    tr_detach();
+    close(cfd); return NULL;
 }
 
 // === main: listen for FS clients ===
 int main(int argc, char** argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <listen_port> <disk_host> <disk_port>\n", argv[0]);
+    // options: -a    talk the ASCII disk protocol instead of negotiating binary frames
+    //          -P n  keep n pooled disk connections (default 8)
+    //          -G ms[,n]  group-commit metadata every ms, or once n commands wait (default 8)
+    //          -c n[,lru|arc][,wb]  cache n data blocks (default 2048, lru, write-through)
+    //          -T file  write a Chrome trace of every timed span to file
+    int pool_size = 8;
+    long cache_blocks = 2048; bool cache_arc = false, cache_wb = false;
+    const char* trace_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "aP:G:c:T:R:")) != -1) {
+        switch (opt) {
+        case 'a': g_vol.binary = false; break;
+        case 'R': g_vol.copies = atoi(optarg); if (g_vol.copies < 1) goto usage; break;
+        case 'P': pool_size = atoi(optarg); if (pool_size < 1) goto usage; break;
+        case 'G':
+            G.group = true; G.group_max = 8;
+            if (sscanf(optarg, "%d,%d", &G.group_ms, &G.group_max) < 1 || G.group_ms < 1 || G.group_max < 1) goto usage;
+            break;
+        case 'c': {
+            char* rest = NULL;
+            cache_blocks = strtol(optarg, &rest, 10);
+            if (rest == optarg || cache_blocks < 0 || cache_blocks > (1L << 24)) goto usage;
+            for (char* tok = strtok(rest, ","); tok; tok = strtok(NULL, ",")) {
+                if (!strcmp(tok, "lru")) cache_arc = false;
+                else if (!strcmp(tok, "arc")) cache_arc = true;
+                else if (!strcmp(tok, "wb")) cache_wb = true;
+                else goto usage;
+            }
+            break;
+        }
+        case 'T': trace_path = optarg; break;
+        default: goto usage;
+        }
+    }
+    g_vol.n = (argc - optind - 1) / 2;
+    if (argc - optind < 3 || (argc - optind) % 2 == 0 || g_vol.n > DISK_NODES_MAX || g_vol.n % g_vol.copies != 0) {
+    usage:
+        fprintf(stderr, "Usage: %s [-a] [-P pool_size] [-G ms[,n]] [-c n[,lru|arc][,wb]] [-T trace.json] [-R copies] "
+                        "<listen_port> <disk_host> <disk_port> [<disk_host> <disk_port> ...]\n", argv[0]);
         return 2;
     }
-    int lport = atoi(argv[1]);
-    strncpy(G.disk_host, argv[2], sizeof(G.disk_host) - 1);
-    G.disk_port = atoi(argv[3]);
-    pthread_mutex_init(&G.meta_mtx, NULL);
+    int lport = atoi(argv[optind]);
+    if (trace_path && tr_open(trace_path) < 0) return 1;
+    tr_attach("main");
+    for (int i = 0; i < g_vol.n; i++) {
+        strncpy(g_vol.node[i].host, argv[optind + 1 + 2 * i], sizeof(g_vol.node[i].host) - 1);
+        g_vol.node[i].port = atoi(argv[optind + 2 + 2 * i]);
+    }
+    pthread_rwlock_init(&G.meta_lock, NULL);
+    for (int i = 0; i < FILE_LOCK_STRIPES; i++) pthread_rwlock_init(&G.file_locks[i], NULL);
+    pthread_mutex_init(&G.commit_mtx, NULL);
     fat_init(&G.fat);
+    dir_init(&G.dir);
     G.formatted = false;
+    G.dir.write_back = G.group;
+    pthread_cond_init(&G.commit_kick, NULL); pthread_cond_init(&G.commit_done, NULL);
+    // signals go to one thread, so a write-back cache is flushed before exiting
+    // (blocked before any thread starts, so all of them inherit the mask)
+    static sigset_t sigs;
+    sigemptyset(&sigs); sigaddset(&sigs, SIGINT); sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    if (G.group) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, committer_main, NULL) != 0) { perror("pthread_create"); return 1; }
+        pthread_detach(tid);
+    }
+    bc_init(&g_bc, (uint32_t)cache_blocks, cache_arc, cache_wb);
+    if (g_bc.write_back) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, flusher_main, NULL) != 0) { perror("pthread_create"); return 1; }
+        pthread_detach(tid);
+    }
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, shutdown_main, &sigs) != 0) { perror("pthread_create"); return 1; }
+        pthread_detach(tid);
+    }
+
+    // dial the pool up front so the first clients skip connect + handshake;
+    // slots that fail here are retried when checked out
+    pool_init(&G.pool, pool_size);
+    for (int i = 0; i < pool_size; i++) {
+        disk_t* d = &G.pool.conns[i];
+        if (disk_connect(d) < 0) break;
+    }
+    if (G.pool.conns[0].up) adopt_super(&G.pool.conns[0]);
 
     int srv = socket(AF_INET, SOCK_STREAM, 0); if (srv < 0) { perror("socket"); return 1; }
-    int opt = 1; setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    opt = 1; setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
     struct sockaddr_in a = { 0 }; a.sin_family = AF_INET; a.sin_port = htons((uint16_t)lport); a.sin_addr.s_addr = htonl(INADDR_ANY);
     if (bind(srv, (struct sockaddr*)&a, sizeof(a)) < 0) { perror("bind"); return 1; }
     if (listen(srv, 64) < 0) { perror("listen"); return 1; }
-    fprintf(stderr, "[fs_server] listening on %d; disk=%s:%d\n", lport, G.disk_host, G.disk_port);
+    char disks[DISK_NODES_MAX * 80]; size_t dl = 0;
+    for (int i = 0; i < g_vol.n; i++)
+        dl += (size_t)snprintf(disks + dl, sizeof(disks) - dl, "%s%s:%d", i ? "," : "", g_vol.node[i].host, g_vol.node[i].port);
+    fprintf(stderr, "[fs_server] listening on %d; disk=%s", lport, disks);
+    if (g_vol.n > 1 || g_vol.copies > 1) fprintf(stderr, " (%u-way stripe, %d copies)", vol_groups(), g_vol.copies);
+    fprintf(stderr, "\n");
 
     while (1) {
         struct sockaddr_in cli; socklen_t cl = sizeof(cli);
         int cfd = accept(srv, (struct sockaddr*)&cli, &cl);
         if (cfd < 0) { if (errno == EINTR) continue; perror("accept"); break; }
+        // replies often end in a small write (the tail of R, a listing); do not let Nagle hold it for an ACK
+        int one = 1; setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
         client_arg_t* arg = (client_arg_t*)malloc(sizeof(*arg)); if (!arg) { close(cfd); continue; }
         arg->cfd = cfd;
         pthread_t tid; if (pthread_create(&tid, NULL, client_main, arg) == 0) pthread_detach(tid);
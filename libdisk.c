@@ -0,0 +1,374 @@
+// Client library for the disk_server protocol; see libdisk.h.
+
+#include "libdisk.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// binary protocol framing (see disk_server.c)
+#define BIN_REQ_HDR 20
+#define BIN_RSP_HDR 12
+#define BIN_OP_I    1
+
+// largest encoded request: an ASCII WV line with n pairs of 10-digit
+// numbers, or a binary WV frame, plus the payload
+#define REQ_MAX (64 + DC_VEC_MAX * (2 * 11 + DC_BLKSZ))
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void put_le16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+// ------------- connection setup -------------
+
+// connect and query the geometry; returns 0 or -1
+static int open_ascii(dc_conn_t *d, const char *host, int port) {
+    int fd = net_dial(host, port);
+    if (fd < 0) {
+        return -1;
+    }
+    net_init(&d->net, fd);
+    d->binary = 0;
+    d->broken = 0;
+    d->next_id = d->ack_id = 0;
+    d->head = d->tail = NULL;
+    d->inflight = 0;
+
+    char line[128];
+    if (net_put(&d->net, "I\n", 2) < 0 || net_line(&d->net, line, sizeof(line)) <= 0) {
+        fprintf(stderr, "disk: no geometry from %s:%d\n", host, port);
+        net_close(&d->net);
+        return -1;
+    }
+    if (sscanf(line, "%ld %ld", &d->cyl, &d->sec) != 2) {
+        fprintf(stderr, "disk: bad geometry %s", line);
+        net_close(&d->net);
+        return -1;
+    }
+    return 0;
+}
+
+int dc_open(dc_conn_t *d, const char *host, int port, int binary) {
+    if (open_ascii(d, host, port) < 0) {
+        return -1;
+    }
+    if (!binary) {
+        return 0;
+    }
+    char code = 0;
+    if (net_put(&d->net, "B\n", 2) == 0 && net_read(&d->net, &code, 1) == 1 && code == '1') {
+        d->binary = 1;
+        return 0;
+    }
+    net_close(&d->net);
+    return open_ascii(d, host, port);
+}
+
+void dc_close(dc_conn_t *d) {
+    net_close(&d->net);
+    d->broken = 1;
+    // nothing in flight can complete any more
+    while (dc_next(d) != NULL) {
+    }
+}
+
+// ------------- submission -------------
+
+// append r to the in-flight list once its bytes are queued
+static int queue(dc_conn_t *d, dc_req_t *r, const unsigned char *req, size_t len) {
+    if (net_put(&d->net, req, len) < 0) {
+        d->broken = 1;
+        return -1;
+    }
+    r->done = 0;
+    r->status = -1;
+    r->next = NULL;
+    if (d->tail) {
+        d->tail->next = r;
+    } else {
+        d->head = r;
+    }
+    d->tail = r;
+    d->inflight++;
+    d->next_id++;
+    return 0;
+}
+
+// binary request header; cyl/sec are only meaningful for R and W
+static void bin_header(dc_conn_t *d, unsigned char *req, uint8_t op, uint32_t count,
+                       long c, long s, uint32_t plen) {
+    memset(req, 0, BIN_REQ_HDR);
+    req[0] = op;
+    put_le16(req + 2, (uint16_t)count);
+    put_le32(req + 4, d->next_id);
+    put_le32(req + 8, (uint32_t)c);
+    put_le32(req + 12, (uint32_t)s);
+    put_le32(req + 16, plen);
+}
+
+// encode an R/RV or WV request; data is the WV payload
+static int submit_vec(dc_conn_t *d, dc_req_t *r, uint8_t op, uint32_t n, const long *cs,
+                      const unsigned char *data) {
+    unsigned char req[REQ_MAX];
+    size_t m;
+
+    if (d->broken || n < 1 || n > DC_VEC_MAX) {
+        return -1;
+    }
+    if (op == DC_OP_RV && n == 1) {
+        op = DC_OP_R;
+    }
+    r->op = op;
+    r->n = n;
+
+    if (d->binary && op == DC_OP_R) {
+        bin_header(d, req, op, 1, cs[0], cs[1], 0);
+        m = BIN_REQ_HDR;
+    } else if (d->binary) {
+        size_t plen = (size_t)n * 8 + (op == DC_OP_WV ? (size_t)n * DC_BLKSZ : 0);
+        bin_header(d, req, op, n, 0, 0, (uint32_t)plen);
+        for (uint32_t i = 0; i < n; i++) {
+            put_le32(req + BIN_REQ_HDR + i * 8, (uint32_t)cs[2 * i]);
+            put_le32(req + BIN_REQ_HDR + i * 8 + 4, (uint32_t)cs[2 * i + 1]);
+        }
+        m = BIN_REQ_HDR + (size_t)n * 8;
+    } else if (op == DC_OP_R) {
+        m = (size_t)snprintf((char *)req, sizeof(req), "R %ld %ld\n", cs[0], cs[1]);
+    } else {
+        m = (size_t)snprintf((char *)req, sizeof(req), op == DC_OP_RV ? "RV %u" : "WV %u", n);
+        for (uint32_t i = 0; i < n; i++) {
+            m += (size_t)snprintf((char *)req + m, sizeof(req) - m, " %ld %ld",
+                                  cs[2 * i], cs[2 * i + 1]);
+        }
+        req[m++] = '\n';
+    }
+    if (op == DC_OP_WV) {
+        memcpy(req + m, data, (size_t)n * DC_BLKSZ);
+        m += (size_t)n * DC_BLKSZ;
+    }
+    return queue(d, r, req, m);
+}
+
+int dc_submit_read(dc_conn_t *d, dc_req_t *r, uint32_t n, const long *cs, unsigned char *out) {
+    r->out = out;
+    return submit_vec(d, r, DC_OP_RV, n, cs, NULL);
+}
+
+int dc_submit_write(dc_conn_t *d, dc_req_t *r, uint32_t n, const long *cs, const unsigned char *data) {
+    r->out = NULL;
+    return submit_vec(d, r, DC_OP_WV, n, cs, data);
+}
+
+int dc_submit_w(dc_conn_t *d, dc_req_t *r, long c, long s, uint32_t len, const unsigned char *data) {
+    unsigned char req[BIN_REQ_HDR + 64 + DC_BLKSZ];
+    size_t m;
+
+    if (d->broken || len > DC_BLKSZ) {
+        return -1;
+    }
+    r->op = DC_OP_W;
+    r->n = 1;
+    r->out = NULL;
+    if (d->binary) {
+        bin_header(d, req, DC_OP_W, 1, c, s, len);
+        m = BIN_REQ_HDR;
+    } else {
+        m = (size_t)snprintf((char *)req, sizeof(req), "W %ld %ld %u\n", c, s, len);
+    }
+    memcpy(req + m, data, len);
+    return queue(d, r, req, m + len);
+}
+
+int dc_submit_stats(dc_conn_t *d, dc_req_t *r, char *buf, size_t cap) {
+    unsigned char req[BIN_REQ_HDR];
+    size_t m = 2;
+
+    if (d->broken || cap == 0) {
+        return -1;
+    }
+    r->op = DC_OP_S;
+    r->n = 0;
+    r->out = (unsigned char *)buf;
+    r->cap = cap;
+    r->len = 0;
+    if (d->binary) {
+        bin_header(d, req, DC_OP_S, 1, 0, 0, 0);
+        m = BIN_REQ_HDR;
+    } else {
+        memcpy(req, "S\n", 2);
+    }
+    return queue(d, r, req, m);
+}
+
+int dc_flush(dc_conn_t *d) {
+    if (d->broken || net_flush(&d->net) < 0) {
+        d->broken = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// ------------- completion -------------
+
+// keep the first cap - 1 bytes of an S reply of len bytes in r->out
+static int take_text(dc_conn_t *d, dc_req_t *r, size_t len) {
+    size_t keep = len < r->cap - 1 ? len : r->cap - 1;
+    if (net_read(&d->net, r->out, keep) != (ssize_t)keep || net_skip(&d->net, len - keep) < 0) {
+        return -1;
+    }
+    r->out[keep] = '\0';
+    r->len = keep;
+    return 0;
+}
+
+// read the reply to r, the oldest request in flight
+// returns 1 or 0 (the disk's status), or -1 if the stream is lost
+static int recv_reply(dc_conn_t *d, dc_req_t *r) {
+    size_t want = (r->op == DC_OP_R || r->op == DC_OP_RV) ? (size_t)r->n * DC_BLKSZ : 0;
+
+    if (d->binary) {
+        unsigned char rsp[BIN_RSP_HDR];
+        if (net_read(&d->net, rsp, BIN_RSP_HDR) != BIN_RSP_HDR) {
+            return -1;
+        }
+        uint32_t rlen = get_le32(rsp + 8);
+        if (rsp[0] != r->op || get_le32(rsp + 4) != d->ack_id++) {
+            return -1; // out of sync
+        }
+        if (rsp[1] != 1) {
+            return (rlen == 0) ? 0 : -1;
+        }
+        if (r->op == DC_OP_S) {
+            return take_text(d, r, rlen) < 0 ? -1 : 1;
+        }
+        if (rlen != want || (want > 0 && net_read(&d->net, r->out, want) != (ssize_t)want)) {
+            return -1;
+        }
+        return 1;
+    }
+
+    if (r->op == DC_OP_S) {
+        // "name value" lines up to an empty line
+        char line[256];
+        r->len = 0;
+        r->out[0] = '\0';
+        for (;;) {
+            ssize_t k = net_line(&d->net, line, sizeof(line));
+            if (k <= 0) {
+                return -1;
+            }
+            if (line[0] == '\n') {
+                return 1;
+            }
+            if (r->len + (size_t)k < r->cap) {
+                memcpy(r->out + r->len, line, (size_t)k + 1);
+                r->len += (size_t)k;
+            }
+        }
+    }
+    char code;
+    if (net_read(&d->net, &code, 1) != 1) {
+        return -1;
+    }
+    if (code != '1') {
+        return (code == '0') ? 0 : -1;
+    }
+    if (want > 0 && net_read(&d->net, r->out, want) != (ssize_t)want) {
+        return -1;
+    }
+    return 1;
+}
+
+dc_req_t *dc_next(dc_conn_t *d) {
+    dc_req_t *r = d->head;
+    if (r == NULL) {
+        return NULL;
+    }
+    int status = d->broken ? -1 : recv_reply(d, r);
+    if (status < 0) {
+        d->broken = 1;
+    }
+    d->head = r->next;
+    if (d->head == NULL) {
+        d->tail = NULL;
+    }
+    d->inflight--;
+    r->next = NULL;
+    r->status = status;
+    r->done = 1;
+    if (r->cb) {
+        r->cb(r, r->arg);
+    }
+    return r;
+}
+
+int dc_wait(dc_conn_t *d, dc_req_t *r) {
+    if (!r->done) {
+        dc_flush(d);  // on failure everything in flight completes as failed
+    }
+    while (!r->done && dc_next(d) != NULL) {
+    }
+    return r->done ? r->status : -1;
+}
+
+int dc_drain(dc_conn_t *d) {
+    int worst = 1;
+    dc_flush(d);
+    for (dc_req_t *r; (r = dc_next(d)) != NULL; ) {
+        if (r->status < worst) {
+            worst = r->status;
+        }
+    }
+    return worst;
+}
+
+// ------------- synchronous forms -------------
+
+int dc_read(dc_conn_t *d, long c, long s, unsigned char *out) {
+    long cs[2] = { c, s };
+    return dc_read_vec(d, 1, cs, out);
+}
+
+int dc_write(dc_conn_t *d, long c, long s, uint32_t len, const unsigned char *data) {
+    dc_req_t r = { 0 };
+    if (dc_submit_w(d, &r, c, s, len, data) < 0) {
+        return -1;
+    }
+    return dc_wait(d, &r);
+}
+
+int dc_read_vec(dc_conn_t *d, uint32_t n, const long *cs, unsigned char *out) {
+    dc_req_t r = { 0 };
+    if (dc_submit_read(d, &r, n, cs, out) < 0) {
+        return -1;
+    }
+    return dc_wait(d, &r);
+}
+
+int dc_write_vec(dc_conn_t *d, uint32_t n, const long *cs, const unsigned char *data) {
+    dc_req_t r = { 0 };
+    if (dc_submit_write(d, &r, n, cs, data) < 0) {
+        return -1;
+    }
+    return dc_wait(d, &r);
+}
+
+ssize_t dc_stats(dc_conn_t *d, char *buf, size_t cap) {
+    dc_req_t r = { 0 };
+    if (dc_submit_stats(d, &r, buf, cap) < 0 || dc_wait(d, &r) != 1) {
+        return -1;
+    }
+    return (ssize_t)r.len;
+}
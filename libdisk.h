@@ -0,0 +1,106 @@
+// Client library for the disk_server protocol (Problem 3), ASCII or
+// binary framed, shared by disk_cli, disk_rand, fs_bench and fs_server.
+//
+// Requests are asynchronous.  dc_submit_*() encodes a request into the
+// connection's output buffer and returns at once; the dc_req_t is its
+// future.  dc_flush() sends everything queued in one write (a batched
+// submit), and dc_wait() collects replies until the given request has
+// completed, running each completed request's callback on the way.
+// disk_server answers the requests of a connection in order, so any
+// number of them may be in flight.  The synchronous calls (dc_read(),
+// dc_write(), ...) are a submit followed by a wait.
+//
+// Before submitting, set the request's cb and arg (a zeroed dc_req_t
+// has no callback).  The request and the buffers it names must stay
+// valid until it completes; a read's out may still be changed until
+// then.  A request completes with status 1 (done), 0 (refused by the
+// disk: an invalid sector or a failed transfer) or -1 (the connection
+// failed; every later request fails the same way).
+
+#ifndef LIBDISK_H
+#define LIBDISK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "net.h"
+
+#define DC_BLKSZ   128        // bytes per sector
+#define DC_VEC_MAX 64         // sectors per request (disk_server's MAX_VEC)
+
+// request types; the values are the binary protocol opcodes
+#define DC_OP_R  2
+#define DC_OP_W  3
+#define DC_OP_RV 4
+#define DC_OP_WV 5
+#define DC_OP_S  6
+
+typedef struct dc_req dc_req_t;
+typedef void (*dc_cb_t)(dc_req_t *r, void *arg);
+
+struct dc_req {
+    dc_cb_t cb;               // called once the request completes, or NULL
+    void   *arg;
+
+    // filled in by the library
+    uint8_t  op;              // DC_OP_*
+    uint32_t n;               // sectors
+    unsigned char *out;       // R/RV: n * DC_BLKSZ bytes; S: text buffer
+    size_t   cap;             // S: size of out
+    size_t   len;             // S: text length (out is NUL-terminated)
+    int      status;          // 1, 0 or -1 once done
+    int      done;
+    dc_req_t *next;           // in-flight list
+};
+
+typedef struct {
+    net_t net;
+    long  cyl, sec;           // geometry reported by I
+    int   binary;             // binary framed protocol negotiated with B
+    int   broken;             // the stream is out of sync or closed
+    uint32_t next_id;         // binary request id of the next request
+    uint32_t ack_id;          // id expected on the next binary reply
+    dc_req_t *head, *tail;    // in flight, oldest first
+    unsigned inflight;
+} dc_conn_t;
+
+// connect, read the geometry with I and, if binary is set, switch to the
+// binary protocol (a disk server without B drops the connection; then
+// this reconnects and stays with ASCII); returns 0 or -1
+int  dc_open(dc_conn_t *d, const char *host, int port, int binary);
+void dc_close(dc_conn_t *d);
+
+// queue a request of n sectors named by the (c,s) pairs in cs[]; a read
+// of one sector is sent as R, more as RV.  dc_submit_w() sends a W of
+// len <= DC_BLKSZ bytes (the disk zero-fills the rest of the sector),
+// dc_submit_stats() an S whose text is stored in buf.  All return 0, or
+// -1 if the request cannot be sent (it is not in flight then).
+int dc_submit_read(dc_conn_t *d, dc_req_t *r, uint32_t n, const long *cs, unsigned char *out);
+int dc_submit_write(dc_conn_t *d, dc_req_t *r, uint32_t n, const long *cs, const unsigned char *data);
+int dc_submit_w(dc_conn_t *d, dc_req_t *r, long c, long s, uint32_t len, const unsigned char *data);
+int dc_submit_stats(dc_conn_t *d, dc_req_t *r, char *buf, size_t cap);
+
+// send the queued requests now (dc_wait() also does)
+int dc_flush(dc_conn_t *d);
+
+// complete requests in order until r is done; returns r->status
+int dc_wait(dc_conn_t *d, dc_req_t *r);
+
+// complete the oldest request in flight and return it, or NULL if none
+dc_req_t *dc_next(dc_conn_t *d);
+
+// complete everything in flight; returns 1 if all succeeded, else the
+// lowest status seen
+int dc_drain(dc_conn_t *d);
+
+// synchronous forms; they return the request status
+int dc_read(dc_conn_t *d, long c, long s, unsigned char *out);
+int dc_write(dc_conn_t *d, long c, long s, uint32_t len, const unsigned char *data);
+int dc_read_vec(dc_conn_t *d, uint32_t n, const long *cs, unsigned char *out);
+int dc_write_vec(dc_conn_t *d, uint32_t n, const long *cs, const unsigned char *data);
+
+// the S statistics text ("name value" lines) into buf; returns its
+// length, or -1
+ssize_t dc_stats(dc_conn_t *d, char *buf, size_t cap);
+
+#endif
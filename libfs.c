@@ -0,0 +1,241 @@
+// Client library for the fs_server protocol; see libfs.h.
+
+#include "libfs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int fc_open(fc_conn_t *f, const char *host, int port) {
+    int fd = net_dial(host, port);
+    if (fd < 0) {
+        return -1;
+    }
+    net_init(&f->net, fd);
+    f->broken = 0;
+    f->head = f->tail = NULL;
+    return 0;
+}
+
+// complete the oldest request in flight; returns it, or NULL if none
+static fc_req_t *fc_next(fc_conn_t *f);
+
+void fc_close(fc_conn_t *f) {
+    net_close(&f->net);
+    f->broken = 1;
+    while (fc_next(f) != NULL) {
+    }
+}
+
+// ------------- submission -------------
+
+static int queue(fc_conn_t *f, fc_req_t *r, const char *cmd, const void *data, size_t len) {
+    if (f->broken) {
+        return -1;
+    }
+    if (net_put(&f->net, cmd, strlen(cmd)) < 0 || (len > 0 && net_put(&f->net, data, len) < 0)) {
+        f->broken = 1;
+        return -1;
+    }
+    r->done = 0;
+    r->status = -1;
+    r->code = -1;
+    r->len = 0;
+    r->text[0] = '\0';
+    r->next = NULL;
+    if (f->tail) {
+        f->tail->next = r;
+    } else {
+        f->head = r;
+    }
+    f->tail = r;
+    return 0;
+}
+
+int fc_submit(fc_conn_t *f, fc_req_t *r, const char *cmd, const void *data, size_t len) {
+    r->data = 0;
+    r->lines = 1;
+    r->buf = NULL;
+    r->cap = 0;
+    return queue(f, r, cmd, data, len);
+}
+
+int fc_submit_lines(fc_conn_t *f, fc_req_t *r, const char *cmd, int nlines) {
+    r->data = 0;
+    r->lines = nlines > 0 ? nlines : 1;
+    r->buf = NULL;
+    r->cap = 0;
+    return queue(f, r, cmd, NULL, 0);
+}
+
+int fc_submit_read(fc_conn_t *f, fc_req_t *r, const char *cmd, void *buf, size_t cap) {
+    r->data = 1;
+    r->lines = 0;
+    r->buf = buf;
+    r->cap = buf ? cap : 0;
+    return queue(f, r, cmd, NULL, 0);
+}
+
+int fc_flush(fc_conn_t *f) {
+    if (f->broken || net_flush(&f->net) < 0) {
+        f->broken = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// ------------- completion -------------
+
+// read the reply to r, the oldest request in flight; returns 0 or -1
+static int recv_reply(fc_conn_t *f, fc_req_t *r) {
+    if (r->data) {
+        long code = net_num(&f->net), len = net_num(&f->net);
+        if (code < 0 || len < 0) {
+            return -1;
+        }
+        size_t keep = (size_t)len < r->cap ? (size_t)len : r->cap;
+        if ((keep > 0 && net_read(&f->net, r->buf, keep) != (ssize_t)keep) ||
+            net_skip(&f->net, (size_t)len - keep) < 0 || net_getc(&f->net) != '\n') {
+            return -1;
+        }
+        r->code = code;
+        r->len = (size_t)len;
+        return 0;
+    }
+    size_t off = 0;
+    for (int i = 0; i < r->lines; i++) {
+        // a line that does not fit is cut short, the rest discarded
+        char line[FC_TEXT_MAX];
+        ssize_t n = net_line(&f->net, line, sizeof(line));
+        while (n > 0 && line[n - 1] != '\n') {
+            char rest[256];
+            n = net_line(&f->net, rest, sizeof(rest));
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        off += (size_t)snprintf(r->text + off, sizeof(r->text) - off, "%s", line);
+        if (off >= sizeof(r->text)) {
+            off = sizeof(r->text) - 1;
+        }
+    }
+    if (off > 0 && r->text[off - 1] == '\n') {
+        r->text[off - 1] = '\0';
+    }
+    char *end;
+    long code = strtol(r->text, &end, 10);
+    r->code = (end != r->text) ? code : -1;
+    return 0;
+}
+
+static fc_req_t *fc_next(fc_conn_t *f) {
+    fc_req_t *r = f->head;
+    if (r == NULL) {
+        return NULL;
+    }
+    int ok = !f->broken && recv_reply(f, r) == 0;
+    if (!ok) {
+        f->broken = 1;
+    }
+    f->head = r->next;
+    if (f->head == NULL) {
+        f->tail = NULL;
+    }
+    r->next = NULL;
+    r->status = ok ? 1 : -1;
+    r->done = 1;
+    if (r->cb) {
+        r->cb(r, r->arg);
+    }
+    return r;
+}
+
+int fc_wait(fc_conn_t *f, fc_req_t *r) {
+    if (!r->done) {
+        fc_flush(f);  // on failure everything in flight completes as failed
+    }
+    while (!r->done && fc_next(f) != NULL) {
+    }
+    return r->done ? r->status : -1;
+}
+
+// ------------- synchronous forms -------------
+
+int fc_cmd(fc_conn_t *f, const char *cmd, const void *data, size_t len, char *text, size_t cap) {
+    fc_req_t r = { 0 };
+    if (fc_submit(f, &r, cmd, data, len) < 0 || fc_wait(f, &r) < 0) {
+        return -1;
+    }
+    if (text && cap > 0) {
+        snprintf(text, cap, "%s", r.text);
+    }
+    return (r.code >= 0) ? (int)r.code : -2;
+}
+
+int fc_read(fc_conn_t *f, const char *cmd, void *buf, size_t cap, size_t *len) {
+    fc_req_t r = { 0 };
+    if (fc_submit_read(f, &r, cmd, buf, cap) < 0 || fc_wait(f, &r) < 0) {
+        return -1;
+    }
+    if (len) {
+        *len = r.len;
+    }
+    return (int)r.code;
+}
+
+// complete everything in flight; returns 0, or -1 if the stream broke
+static int settle(fc_conn_t *f) {
+    while (fc_next(f) != NULL) {
+    }
+    return f->broken ? -1 : 0;
+}
+
+ssize_t fc_line(fc_conn_t *f, char *out, size_t max) {
+    if (settle(f) < 0) {
+        return -1;
+    }
+    ssize_t n = net_line(&f->net, out, max);
+    if (n <= 0 || out[n - 1] != '\n') {
+        f->broken = 1;  // EOF, or a line longer than out
+        return -1;
+    }
+    out[--n] = '\0';
+    return n;
+}
+
+// R of this replies "1 0 " (or "2 0 " if the disk is down): the leaf is
+// longer than any name fs_server stores, and it is absolute so the
+// connection's working directory does not matter
+#define FC_LIST_END "R /.end-of-listing.no-such-file.libfs\n"
+
+int fc_list(fc_conn_t *f, const char *cmd, void (*fn)(const char *line, void *arg), void *arg) {
+    if (settle(f) < 0) {
+        return -1;
+    }
+    if (net_put(&f->net, cmd, strlen(cmd)) < 0 || net_put(&f->net, FC_LIST_END, strlen(FC_LIST_END)) < 0) {
+        f->broken = 1;
+        return -1;
+    }
+    // names hold no spaces, so no listing line ends in one; an R reply
+    // without data does ("code 0 ")
+    char line[FC_TEXT_MAX];
+    for (;;) {
+        ssize_t n = fc_line(f, line, sizeof(line));
+        if (n < 0) {
+            return -1;
+        }
+        if (n >= 4 && strcmp(line + n - 3, " 0 ") == 0 && line[0] >= '0' && line[0] <= '9') {
+            return 0;
+        }
+        if (fn) {
+            fn(line, arg);
+        }
+    }
+}
+
+ssize_t fc_some(fc_conn_t *f, void *buf, size_t max) {
+    if (settle(f) < 0) {
+        return -1;
+    }
+    return net_some(&f->net, buf, max);
+}
@@ -0,0 +1,101 @@
+// Client library for the fs_server protocol (Problem 4), shared by
+// fs_cli, fs_dirs and fs_bench.
+//
+// Like libdisk, requests are asynchronous: fc_submit() and
+// fc_submit_read() queue a command on the connection's output buffer
+// and return at once, fc_flush() sends everything queued in one write,
+// and fc_wait() collects replies in order until the given request has
+// completed, running callbacks on the way.  fs_server answers the
+// commands of a connection in order, so several may be in flight.
+// fc_cmd() and fc_read() are the synchronous forms.
+//
+// There are two reply shapes: lines ("0", "0 /a/b", or one line per
+// name for S), kept in the request's text with the leading number in
+// code, and the "code len data\n" of R, RR and T, whose data goes to a
+// caller's buffer.  L replies are not framed; fc_list() finds their
+// end.
+//
+// Before submitting, set cb and arg (a zeroed fc_req_t has no
+// callback).  A request completes with status 1, or -1 if the
+// connection failed (every later request then fails too); buffers must
+// stay valid until then.
+
+#ifndef LIBFS_H
+#define LIBFS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "net.h"
+
+#define FC_TEXT_MAX 1152      // a one-line reply (CD's path is the longest)
+
+typedef struct fc_req fc_req_t;
+typedef void (*fc_cb_t)(fc_req_t *r, void *arg);
+
+struct fc_req {
+    fc_cb_t cb;               // called once the request completes, or NULL
+    void   *arg;
+
+    // filled in by the library
+    int    data;              // reply is "code len data\n"
+    int    lines;             // line replies: how many lines
+    unsigned char *buf;       // data replies: where the data goes
+    size_t cap;               // ... and how much of it to keep
+    long   code;              // the reply's leading number, -1 if none
+    size_t len;               // data replies: the data length (may exceed cap)
+    char   text[FC_TEXT_MAX]; // line replies: the lines, less the last '\n'
+    int    status;            // 1 or -1 once done
+    int    done;
+    fc_req_t *next;           // in-flight list
+};
+
+typedef struct {
+    net_t net;
+    int   broken;             // the stream is out of sync or closed
+    fc_req_t *head, *tail;    // in flight, oldest first
+} fc_conn_t;
+
+// connect; returns 0 or -1
+int  fc_open(fc_conn_t *f, const char *host, int port);
+void fc_close(fc_conn_t *f);
+
+// queue the command line cmd (with its '\n'), then len bytes of data
+// (the payload of W, A or WR; NULL if none), whose reply is one line
+int fc_submit(fc_conn_t *f, fc_req_t *r, const char *cmd, const void *data, size_t len);
+
+// queue cmd, whose reply is nlines lines (S with nlines names)
+int fc_submit_lines(fc_conn_t *f, fc_req_t *r, const char *cmd, int nlines);
+
+// queue cmd, whose reply is "code len data\n"; up to cap bytes of the
+// data are stored in buf (which may be NULL), the rest is discarded
+int fc_submit_read(fc_conn_t *f, fc_req_t *r, const char *cmd, void *buf, size_t cap);
+
+// send the queued commands now (fc_wait() also does)
+int fc_flush(fc_conn_t *f);
+
+// complete requests in order until r is done; returns r->status
+int fc_wait(fc_conn_t *f, fc_req_t *r);
+
+// synchronous forms: they return the reply code, -1 if the connection
+// failed, or -2 if a line reply did not start with a number.  fc_cmd()
+// copies the reply line to text (if not NULL); fc_read() stores the
+// data length in *len
+int fc_cmd(fc_conn_t *f, const char *cmd, const void *data, size_t len, char *text, size_t cap);
+int fc_read(fc_conn_t *f, const char *cmd, void *buf, size_t cap, size_t *len);
+
+// L: send cmd ("L b [d]\n") once everything in flight has completed and
+// pass each line of the listing, less its '\n', to fn (if not NULL).
+// The listing has no end marker (an empty directory sends nothing), so
+// an R of a name too long to exist follows it, and that R's "1 0 "
+// reply ends it.  Returns 0, or -1 if the connection failed
+int fc_list(fc_conn_t *f, const char *cmd, void (*fn)(const char *line, void *arg), void *arg);
+
+// unframed input, once everything in flight has completed.  fc_line()
+// reads one line without its '\n' and returns its length, or -1 on EOF
+// or error; fc_some() returns whatever has arrived (or one recv() worth),
+// at most max bytes: the count, 0 on EOF, or -1
+ssize_t fc_line(fc_conn_t *f, char *out, size_t max);
+ssize_t fc_some(fc_conn_t *f, void *buf, size_t max);
+
+#endif
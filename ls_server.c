@@ -1,24 +1,55 @@
 /* This program extends the earlier server to provide directory listing service.
 It implements a TCP server that listens on a specified port for incoming connections.
-It accepts connections, forks a child process to handle each client,
-executes the "ls" command with arguments received from the client,
+It accepts connections, hands each one to a pool of worker threads,
+lists the files named by the "ls" arguments received from the client,
 and sends the output back to the client.
+
+Listings for the common flags -l, -a, -1 and -R (separately or clustered, in
+any combination) are produced in-process with opendir/readdir/lstat, formatted
+the way GNU ls writes to a pipe.  The sorted entries of each directory are
+cached, keyed by path and checked against the directory's device, inode and
+mtime, so listing an unchanged directory again costs one stat (plus one lstat
+per entry with -l).  Any other option falls back to forking and executing the
+real ls, as before.
+
+Usage: ./ls_server [-w workers] [-x] <port>
+  -w  number of worker threads (default 4)
+  -x  always fork and exec ls (for comparing against the in-process lister)
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <grp.h>
+#include <locale.h>
+#include <stdarg.h>
+#include <time.h>
 
 
 // defines the backlog size basically the maximum number of pending connections
 // buf is the temp buffer size for receiving data from clients
 #define BACKLOG 16
 #define BUF 8192
+#define QUEUE_LEN 64        // accepted connections waiting for a worker
+#define CACHE_MAX 1024      // directories kept in the listing cache
+#define CACHE_BUCKETS 256
+#define RACY_SECS 2         // directories modified this recently are not cached
+#define MAX_DEPTH 256       // -R nesting limit (also bounds the loop check)
+#define SIX_MONTHS 15778476 // seconds; older (or future) times show the year
+
+static int g_always_exec = 0; // -x
 
 // this functions prints out an error message and exists the program if a fatal error occurs
 static void fatal(const char *msg) {
@@ -26,34 +57,627 @@ static void fatal(const char *msg) {
     exit(EXIT_FAILURE);
 }
 
-// this function gets called when a SIGCHLD signal is received to reap terminated child processes
-// the while loop calls waitpid with WNOHANG to avoid blocking
-static void reap_children(int sig) {
-    (void)sig;
-    while (waitpid(-1, NULL, WNOHANG) > 0) {}
+// ------------- growable output buffer -------------
+
+typedef struct {
+    char *p;
+    size_t len, cap;
+} sbuf_t;
+
+static void sb_putn(sbuf_t *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (b->len + n + 1 > cap) cap *= 2;
+        char *np = realloc(b->p, cap);
+        if (!np) fatal("realloc");
+        b->p = np;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, s, n);
+    b->len += n;
+    b->p[b->len] = '\0';
+}
+
+static void sb_puts(sbuf_t *b, const char *s) { sb_putn(b, s, strlen(s)); }
+
+static void sb_printf(sbuf_t *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void sb_printf(sbuf_t *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n <= 0) return;
+    sb_putn(b, "", 0); // make sure p exists
+    if (b->len + (size_t)n + 1 > b->cap) {
+        size_t cap = b->cap;
+        while (b->len + (size_t)n + 1 > cap) cap *= 2;
+        char *np = realloc(b->p, cap);
+        if (!np) fatal("realloc");
+        b->p = np;
+        b->cap = cap;
+    }
+    va_start(ap, fmt);
+    vsnprintf(b->p + b->len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    b->len += (size_t)n;
+}
+
+// dir + "/" + name, without doubling a trailing slash
+static char *path_join(const char *dir, const char *name) {
+    size_t dl = strlen(dir);
+    int slash = dl > 0 && dir[dl - 1] != '/';
+    char *p = malloc(dl + (size_t)slash + strlen(name) + 1);
+    if (!p) fatal("malloc");
+    memcpy(p, dir, dl);
+    if (slash) p[dl++] = '/';
+    strcpy(p + dl, name);
+    return p;
+}
+
+// ------------- directory cache -------------
+
+// the sorted entries of one directory, shared read-only by every request that
+// lists it; freed when the last user lets go of an entry that has left the cache
+typedef struct dir_ent {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    size_t n;
+    char **names;            // sorted with strcoll, including . and ..
+    unsigned char *is_dir;   // per name, not following symlinks (for -R)
+    int refs;                // the cache holds one while the entry is in it
+    int cached;
+    struct dir_ent *hnext;   // hash chain
+    struct dir_ent *prev, *next; // LRU list, most recent first
+} dir_ent_t;
+
+static struct {
+    pthread_mutex_t mtx;
+    dir_ent_t *buckets[CACHE_BUCKETS];
+    dir_ent_t *mru, *lru;
+    size_t n;
+} g_cache = { .mtx = PTHREAD_MUTEX_INITIALIZER };
+
+static unsigned path_hash(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h % CACHE_BUCKETS;
+}
+
+static void dir_ent_free(dir_ent_t *e) {
+    for (size_t i = 0; i < e->n; i++) free(e->names[i]);
+    free(e->names);
+    free(e->is_dir);
+    free(e->path);
+    free(e);
+}
+
+static void dir_release(dir_ent_t *e) {
+    pthread_mutex_lock(&g_cache.mtx);
+    int last = --e->refs == 0;
+    pthread_mutex_unlock(&g_cache.mtx);
+    if (last) dir_ent_free(e);
+}
+
+// take e out of the hash chain and LRU list and drop the cache's reference
+// g_cache.mtx held; returns 1 if nobody else uses e and the caller must free it
+static int cache_unlink(dir_ent_t *e) {
+    dir_ent_t **pp = &g_cache.buckets[path_hash(e->path)];
+    while (*pp != e) pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    if (e->prev) e->prev->next = e->next; else g_cache.mru = e->next;
+    if (e->next) e->next->prev = e->prev; else g_cache.lru = e->prev;
+    g_cache.n--;
+    e->cached = 0;
+    return --e->refs == 0;
+}
+
+static void lru_push_front(dir_ent_t *e) {
+    e->prev = NULL;
+    e->next = g_cache.mru;
+    if (g_cache.mru) g_cache.mru->prev = e; else g_cache.lru = e;
+    g_cache.mru = e;
+}
+
+typedef struct {
+    char *name;
+    unsigned char is_dir;
+} scan_item_t;
+
+static int scan_cmp(const void *a, const void *b) {
+    return strcoll(((const scan_item_t *)a)->name, ((const scan_item_t *)b)->name);
+}
+
+// read and sort the directory at path, already stat'ed as st
+// returns NULL with errno set if it cannot be opened
+static dir_ent_t *dir_scan(const char *path, const struct stat *st) {
+    DIR *d = opendir(path);
+    if (!d) return NULL;
+    scan_item_t *items = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            items = realloc(items, cap * sizeof(*items));
+            if (!items) fatal("realloc");
+        }
+        items[n].name = strdup(de->d_name);
+        if (!items[n].name) fatal("strdup");
+        if (de->d_type == DT_UNKNOWN) {
+            // some file systems do not report the type; ask for it
+            struct stat sub;
+            char *p = path_join(path, de->d_name);
+            items[n].is_dir = lstat(p, &sub) == 0 && S_ISDIR(sub.st_mode);
+            free(p);
+        } else {
+            items[n].is_dir = de->d_type == DT_DIR;
+        }
+        n++;
+    }
+    closedir(d);
+    qsort(items, n, sizeof(*items), scan_cmp);
+
+    dir_ent_t *e = calloc(1, sizeof(*e));
+    if (!e) fatal("calloc");
+    e->names = malloc((n ? n : 1) * sizeof(char *));
+    e->is_dir = malloc(n ? n : 1);
+    e->path = strdup(path);
+    if (!e->names || !e->is_dir || !e->path) fatal("malloc");
+    for (size_t i = 0; i < n; i++) {
+        e->names[i] = items[i].name;
+        e->is_dir[i] = items[i].is_dir;
+    }
+    free(items);
+    e->n = n;
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->mtime = st->st_mtim;
+    e->refs = 1;
+    return e;
+}
+
+// the entries of directory path (stat'ed as st), from the cache if it still
+// matches; the caller owns one reference.  NULL with errno set on failure.
+//
+// File systems stamp mtime from a coarse clock, so a directory changed again
+// within the same tick right after it was scanned keeps its old mtime.  Such
+// recently modified directories are therefore listed fresh and not cached.
+static dir_ent_t *dir_get(const char *path, const struct stat *st) {
+    dir_ent_t *stale = NULL;
+    pthread_mutex_lock(&g_cache.mtx);
+    dir_ent_t *e = g_cache.buckets[path_hash(path)];
+    while (e && strcmp(e->path, path) != 0) e = e->hnext;
+    if (e && e->dev == st->st_dev && e->ino == st->st_ino &&
+        e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec) {
+        // hit: move to the front of the LRU list
+        if (e->prev) e->prev->next = e->next; else g_cache.mru = e->next;
+        if (e->next) e->next->prev = e->prev; else g_cache.lru = e->prev;
+        lru_push_front(e);
+        e->refs++;
+        pthread_mutex_unlock(&g_cache.mtx);
+        return e;
+    }
+    if (e && cache_unlink(e)) stale = e;
+    pthread_mutex_unlock(&g_cache.mtx);
+    if (stale) dir_ent_free(stale);
+
+    // scan without the lock; requests for other directories keep going
+    e = dir_scan(path, st);
+    if (!e || time(NULL) - st->st_mtim.tv_sec < RACY_SECS) return e;
+
+    dir_ent_t *drop[2] = { NULL, NULL };
+    int ndrop = 0;
+    pthread_mutex_lock(&g_cache.mtx);
+    // another request may have cached this path meanwhile; ours is as new
+    dir_ent_t *old = g_cache.buckets[path_hash(path)];
+    while (old && strcmp(old->path, path) != 0) old = old->hnext;
+    if (old && cache_unlink(old)) drop[ndrop++] = old;
+    unsigned h = path_hash(path);
+    e->hnext = g_cache.buckets[h];
+    g_cache.buckets[h] = e;
+    lru_push_front(e);
+    e->refs++;
+    e->cached = 1;
+    g_cache.n++;
+    dir_ent_t *victim = g_cache.lru;
+    if (g_cache.n > CACHE_MAX && cache_unlink(victim)) drop[ndrop++] = victim;
+    pthread_mutex_unlock(&g_cache.mtx);
+    for (int i = 0; i < ndrop; i++) dir_ent_free(drop[i]);
+    return e;
+}
+
+// ------------- in-process listing engine -------------
+
+typedef struct {
+    int l, a, R;             // -l, -a, -R (-1 is what a pipe gets anyway)
+    time_t now;
+    sbuf_t out, err;         // listing, and ls-style error messages
+    int any_output;          // something was printed: separate with a blank line
+    dev_t seen_dev[MAX_DEPTH]; // directories on the current -R path
+    ino_t seen_ino[MAX_DEPTH];
+    int depth;
+} ls_req_t;
+
+// parse the client's arguments into flags and operands
+// returns 0 if every option is one the in-process lister supports
+static int parse_ls_args(char **args, int nargs, ls_req_t *q, char **paths, int *npaths) {
+    *npaths = 0;
+    for (int i = 0; i < nargs; i++) {
+        const char *a = args[i];
+        if (a[0] != '-' || a[1] == '\0') {
+            paths[(*npaths)++] = args[i];
+            continue;
+        }
+        if (a[1] == '-') return -1; // long options and "--"
+        for (const char *c = a + 1; *c; c++) {
+            if (*c == 'l') q->l = 1;
+            else if (*c == 'a') q->a = 1;
+            else if (*c == 'R') q->R = 1;
+            else if (*c == '1') continue;
+            else return -1;
+        }
+    }
+    return 0;
+}
+
+static void mode_string(mode_t m, char out[11]) {
+    out[0] = S_ISDIR(m) ? 'd' : S_ISLNK(m) ? 'l' : S_ISCHR(m) ? 'c' : S_ISBLK(m) ? 'b' :
+             S_ISFIFO(m) ? 'p' : S_ISSOCK(m) ? 's' : '-';
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++) out[1 + i] = (m & (0400 >> i)) ? rwx[i] : '-';
+    if (m & S_ISUID) out[3] = (m & S_IXUSR) ? 's' : 'S';
+    if (m & S_ISGID) out[6] = (m & S_IXGRP) ? 's' : 'S';
+    if (m & S_ISVTX) out[9] = (m & S_IXOTH) ? 't' : 'T';
+    out[10] = '\0';
+}
+
+// one line of a -l listing, before column widths are known
+typedef struct {
+    const char *name;
+    char mode[11];
+    char nlink[24], owner[64], group[64], size[48], date[32];
+    char *link;              // symlink target, or NULL
+    blkcnt_t blocks;
+} long_row_t;
+
+static void fill_row(ls_req_t *q, long_row_t *r, const char *name, const char *path, const struct stat *st) {
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    mode_string(st->st_mode, r->mode);
+    snprintf(r->nlink, sizeof(r->nlink), "%lu", (unsigned long)st->st_nlink);
+
+    char buf[4096];
+    struct passwd pw, *pwp = NULL;
+    if (getpwuid_r(st->st_uid, &pw, buf, sizeof(buf), &pwp) == 0 && pwp) snprintf(r->owner, sizeof(r->owner), "%s", pw.pw_name);
+    else snprintf(r->owner, sizeof(r->owner), "%u", (unsigned)st->st_uid);
+    struct group gr, *grp = NULL;
+    if (getgrgid_r(st->st_gid, &gr, buf, sizeof(buf), &grp) == 0 && grp) snprintf(r->group, sizeof(r->group), "%s", gr.gr_name);
+    else snprintf(r->group, sizeof(r->group), "%u", (unsigned)st->st_gid);
+
+    if (S_ISCHR(st->st_mode) || S_ISBLK(st->st_mode)) {
+        snprintf(r->size, sizeof(r->size), "%u, %u", major(st->st_rdev), minor(st->st_rdev));
+    } else {
+        snprintf(r->size, sizeof(r->size), "%lld", (long long)st->st_size);
+    }
+
+    // recent files show the time of day, others (and future ones) the year
+    time_t when = st->st_mtim.tv_sec;
+    if (when > q->now) q->now = time(NULL);
+    struct tm tm;
+    localtime_r(&when, &tm);
+    int recent = when > q->now - SIX_MONTHS && when <= q->now;
+    strftime(r->date, sizeof(r->date), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+
+    if (S_ISLNK(st->st_mode)) {
+        ssize_t n = readlink(path, buf, sizeof(buf) - 1);
+        if (n >= 0) {
+            buf[n] = '\0';
+            r->link = strdup(buf);
+        }
+    }
+    r->blocks = st->st_blocks;
+}
+
+// print rows[0, n) with columns aligned over rows[0, nw), preceded by "total" for a directory
+// (ls sizes the columns for file operands over the directory operands too)
+static void print_rows(ls_req_t *q, long_row_t *rows, size_t n, size_t nw, int with_total) {
+    int wl = 0, wo = 0, wg = 0, ws = 0;
+    long long blocks = 0;
+    for (size_t i = 0; i < nw; i++) {
+        int k;
+        if ((k = (int)strlen(rows[i].nlink)) > wl) wl = k;
+        if ((k = (int)strlen(rows[i].owner)) > wo) wo = k;
+        if ((k = (int)strlen(rows[i].group)) > wg) wg = k;
+        if ((k = (int)strlen(rows[i].size)) > ws) ws = k;
+        blocks += rows[i].blocks;
+    }
+    // st_blocks counts 512-byte units; ls reports 1K blocks, rounded up
+    if (with_total) sb_printf(&q->out, "total %lld\n", (blocks + 1) / 2);
+    for (size_t i = 0; i < n; i++) {
+        long_row_t *r = &rows[i];
+        sb_printf(&q->out, "%s %*s %-*s %-*s %*s %s %s", r->mode, wl, r->nlink, wo, r->owner,
+                  wg, r->group, ws, r->size, r->date, r->name);
+        if (r->link) sb_printf(&q->out, " -> %s", r->link);
+        sb_puts(&q->out, "\n");
+        free(r->link);
+    }
+}
+
+static void list_dir(ls_req_t *q, const char *path, const struct stat *st, int header);
+
+// list the directory named path; header prints "path:" above it
+static void list_dir(ls_req_t *q, const char *path, const struct stat *st, int header) {
+    for (int i = 0; i < q->depth; i++) {
+        if (q->seen_dev[i] == st->st_dev && q->seen_ino[i] == st->st_ino) {
+            sb_printf(&q->err, "ls: %s: not listing already-listed directory\n", path);
+            return;
+        }
+    }
+    dir_ent_t *e = dir_get(path, st);
+    if (!e) {
+        sb_printf(&q->err, "ls: cannot open directory '%s': %s\n", path, strerror(errno));
+        return;
+    }
+
+    if (q->any_output) sb_puts(&q->out, "\n");
+    if (header) sb_printf(&q->out, "%s:\n", path);
+    q->any_output = 1;
+
+    if (q->l) {
+        long_row_t *rows = malloc((e->n ? e->n : 1) * sizeof(*rows));
+        if (!rows) fatal("malloc");
+        size_t n = 0;
+        for (size_t i = 0; i < e->n; i++) {
+            if (!q->a && e->names[i][0] == '.') continue;
+            char *p = path_join(path, e->names[i]);
+            struct stat sub;
+            if (lstat(p, &sub) == 0) fill_row(q, &rows[n++], e->names[i], p, &sub);
+            else sb_printf(&q->err, "ls: cannot access '%s': %s\n", p, strerror(errno));
+            free(p);
+        }
+        print_rows(q, rows, n, n, 1);
+        free(rows);
+    } else {
+        for (size_t i = 0; i < e->n; i++) {
+            if (!q->a && e->names[i][0] == '.') continue;
+            sb_puts(&q->out, e->names[i]);
+            sb_puts(&q->out, "\n");
+        }
+    }
+
+    // -R: then each subdirectory, depth first in sorted order
+    if (q->R && q->depth < MAX_DEPTH) {
+        q->seen_dev[q->depth] = st->st_dev;
+        q->seen_ino[q->depth] = st->st_ino;
+        q->depth++;
+        for (size_t i = 0; i < e->n; i++) {
+            const char *nm = e->names[i];
+            if (!e->is_dir[i] || (!q->a && nm[0] == '.')) continue;
+            if (!strcmp(nm, ".") || !strcmp(nm, "..")) continue;
+            char *p = path_join(path, nm);
+            struct stat sub;
+            if (lstat(p, &sub) == 0 && S_ISDIR(sub.st_mode)) list_dir(q, p, &sub, 1);
+            free(p);
+        }
+        q->depth--;
+    }
+    dir_release(e);
+}
+
+typedef struct {
+    char *name;
+    struct stat st;
+} operand_t;
+
+static int operand_cmp(const void *a, const void *b) {
+    return strcoll(((const operand_t *)a)->name, ((const operand_t *)b)->name);
+}
+
+// list the operands like ls: errors first, then plain files, then directories
+static void ls_inprocess(ls_req_t *q, char **paths, int npaths) {
+    char *dot = ".";
+    if (npaths == 0) {
+        paths = &dot;
+        npaths = 1;
+    }
+    operand_t *files = malloc(sizeof(*files) * (size_t)npaths);
+    operand_t *dirs = malloc(sizeof(*dirs) * (size_t)npaths);
+    if (!files || !dirs) fatal("malloc");
+    int nf = 0, nd = 0;
+    for (int i = 0; i < npaths; i++) {
+        struct stat st;
+        // operand symlinks are followed, except for -l (which shows the link)
+        int rc = q->l ? lstat(paths[i], &st) : stat(paths[i], &st);
+        if (rc != 0 && !q->l) rc = lstat(paths[i], &st); // dangling link
+        if (rc != 0) {
+            sb_printf(&q->err, "ls: cannot access '%s': %s\n", paths[i], strerror(errno));
+            continue;
+        }
+        operand_t *o = S_ISDIR(st.st_mode) ? &dirs[nd++] : &files[nf++];
+        o->name = paths[i];
+        o->st = st;
+    }
+    qsort(files, (size_t)nf, sizeof(*files), operand_cmp);
+    qsort(dirs, (size_t)nd, sizeof(*dirs), operand_cmp);
+
+    if (nf > 0) {
+        if (q->l) {
+            long_row_t *rows = malloc(sizeof(*rows) * (size_t)(nf + nd));
+            if (!rows) fatal("malloc");
+            for (int i = 0; i < nf; i++) fill_row(q, &rows[i], files[i].name, files[i].name, &files[i].st);
+            for (int i = 0; i < nd; i++) fill_row(q, &rows[nf + i], dirs[i].name, dirs[i].name, &dirs[i].st);
+            print_rows(q, rows, (size_t)nf, (size_t)(nf + nd), 0);
+            free(rows);
+        } else {
+            for (int i = 0; i < nf; i++) sb_printf(&q->out, "%s\n", files[i].name);
+        }
+        q->any_output = 1;
+    }
+    // a lone directory operand gets no "dir:" header unless -R
+    int header = npaths > 1 || q->R;
+    for (int i = 0; i < nd; i++) list_dir(q, dirs[i].name, &dirs[i].st, header);
+    free(files);
+    free(dirs);
+}
+
+// ------------- connection handling -------------
+
+// send all n bytes of buf, handling partial sends; returns 0 or -1
+static int send_all(int fd, const char *buf, size_t n) {
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t s = send(fd, buf + sent, n - sent, MSG_NOSIGNAL);
+        if (s < 0 && errno == EINTR) continue;
+        if (s <= 0) return -1;
+        sent += (size_t)s;
+    }
+    return 0;
+}
+
+// fork and exec the real ls with stdout and stderr on the client socket
+static void ls_exec(int fd, char **args, int nargs) {
+    char *argv_exec[128];
+    int ai = 0;
+    argv_exec[ai++] = "ls";
+    for (int i = 0; i < nargs && ai < 127; i++) argv_exec[ai++] = args[i];
+    argv_exec[ai] = NULL;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        // if statements to redirect stdout and stderr to the client socket
+        if (dup2(fd, STDOUT_FILENO) < 0) { perror("dup2 stdout"); _exit(1); }
+        if (dup2(fd, STDERR_FILENO) < 0) { perror("dup2 stderr"); _exit(1); }
+        execvp("ls", argv_exec);
+        perror("execvp");
+        _exit(1);
+    }
+    // the listing is complete once our copy of the socket and the child's are closed
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {}
+}
+
+// read the request, list, and reply on one client connection
+static void serve_client(int fd) {
+    char buf[BUF];
+    size_t len = 0;
+    // the client sends one line of arguments; stop at its newline or EOF
+    while (len < sizeof(buf) - 1) {
+        ssize_t r = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) {
+            perror("recv");
+            return;
+        }
+        if (r == 0) break;
+        len += (size_t)r;
+        if (memchr(buf, '\n', len)) break;
+    }
+    buf[len] = '\0';
+
+    char *args[127];
+    int nargs = 0;
+    char *save = NULL;
+    char *tok = strtok_r(buf, " \t\r\n", &save);
+    while (tok && nargs < 126) {
+        args[nargs++] = tok;
+        tok = strtok_r(NULL, " \t\r\n", &save);
+    }
+
+    ls_req_t *q = calloc(1, sizeof(*q));
+    if (!q) fatal("calloc");
+    char *paths[127];
+    int npaths = 0;
+    if (g_always_exec || parse_ls_args(args, nargs, q, paths, &npaths) != 0) {
+        ls_exec(fd, args, nargs);
+    } else {
+        q->now = time(NULL);
+        ls_inprocess(q, paths, npaths);
+        // ls writes errors unbuffered and the listing buffered, so errors come first
+        if (q->err.len == 0 || send_all(fd, q->err.p, q->err.len) == 0) {
+            if (q->out.len > 0) send_all(fd, q->out.p, q->out.len);
+        }
+    }
+    free(q->out.p);
+    free(q->err.p);
+    free(q);
+}
+
+// bounded FIFO of accepted client fds shared by the accept loop (producer)
+// and the workers (consumers), as in server.c
+static struct {
+    int fds[QUEUE_LEN];
+    int head, len;
+    pthread_mutex_t mtx;
+    pthread_cond_t not_empty, not_full;
+} g_queue = { .mtx = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER,
+              .not_full = PTHREAD_COND_INITIALIZER };
+
+// add fd, waiting while the queue is full (this is the backpressure)
+static void queue_push(int fd) {
+    pthread_mutex_lock(&g_queue.mtx);
+    while (g_queue.len == QUEUE_LEN) pthread_cond_wait(&g_queue.not_full, &g_queue.mtx);
+    g_queue.fds[(g_queue.head + g_queue.len) % QUEUE_LEN] = fd;
+    g_queue.len++;
+    pthread_cond_signal(&g_queue.not_empty);
+    pthread_mutex_unlock(&g_queue.mtx);
+}
+
+// take the oldest fd, waiting while the queue is empty
+static int queue_pop(void) {
+    pthread_mutex_lock(&g_queue.mtx);
+    while (g_queue.len == 0) pthread_cond_wait(&g_queue.not_empty, &g_queue.mtx);
+    int fd = g_queue.fds[g_queue.head];
+    g_queue.head = (g_queue.head + 1) % QUEUE_LEN;
+    g_queue.len--;
+    pthread_cond_signal(&g_queue.not_full);
+    pthread_mutex_unlock(&g_queue.mtx);
+    return fd;
+}
+
+// worker thread: serve queued connections one after another
+static void *worker_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        int fd = queue_pop();
+        serve_client(fd);
+        close(fd);
+    }
+    return NULL;
 }
 
 // main function that sets up the server and handles incoming connections
-// it takes the port number as a command line argument and listens for incoming connections using if statements to handle errors 
-// it uses while loop to accept connections and forks a child process to handle each client
+// it takes the port number as a command line argument and listens for incoming connections using if statements to handle errors
+// it uses while loop to accept connections and queues each one for the worker threads
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    int workers = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:x")) != -1) {
+        if (opt == 'w' && (workers = atoi(optarg)) > 0) continue;
+        if (opt == 'x') { g_always_exec = 1; continue; }
+        argc = 0; // force the usage message
+        break;
+    }
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-w workers] [-x] <port>\n", argv[0]);
         return 1;
     }
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
     if (port <= 0) { fprintf(stderr, "Invalid port\n"); return 1; }
 
-    struct sigaction sa;
-    sa.sa_handler = reap_children;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGCHLD, &sa, NULL);
+    // sort and format dates like an ls started from the same environment
+    setlocale(LC_ALL, "");
+    signal(SIGPIPE, SIG_IGN);
 
     // this section of our code creates a TCP socket and sets socket options
-    int srv = socket(AF_INET, SOCK_STREAM, 0);
+    // (close-on-exec, so a forked ls does not hold other clients' sockets open)
+    int srv = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (srv < 0) fatal("socket");
-    int opt = 1;
+    opt = 1;
     if (setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) fatal("setsockopt");
 
     struct sockaddr_in saddr;
@@ -64,64 +688,26 @@ int main(int argc, char **argv) {
     if (bind(srv, (struct sockaddr*)&saddr, sizeof(saddr)) < 0) fatal("bind");
     if (listen(srv, BACKLOG) < 0) fatal("listen");
 
+    for (int i = 0; i < workers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_main, NULL) != 0) fatal("pthread_create");
+        pthread_detach(tid);
+    }
+
     printf("ls_server: listening on port %d\n", port);
 
     // main server loop that accepts incoming connections
     while (1) {
         struct sockaddr_in ca;
         socklen_t len = sizeof(ca);
-        int fd = accept(srv, (struct sockaddr*)&ca, &len);
+        int fd = accept4(srv, (struct sockaddr*)&ca, &len, SOCK_CLOEXEC);
         if (fd < 0) {
-            perror("accept");
-            continue;
-        }
-
-        pid_t pid = fork();
-        if (pid < 0) {
-            perror("fork");
-            close(fd);
+            if (errno != EINTR) perror("accept");
             continue;
         }
-        if (pid == 0) {
-            
-            close(srv);
-
-            
-            char buf[BUF];
-            ssize_t r = recv(fd, buf, sizeof(buf)-1, 0);
-            if (r < 0) {
-                perror("recv");
-                close(fd);
-                exit(1);
-            }
-            buf[r] = '\0';
-            
-            char *argv_exec[128];
-            int ai = 0;
-            argv_exec[ai++] = "ls";
-            char *tok = strtok(buf, " \t\r\n");
-            while (tok && ai < 127) {
-                argv_exec[ai++] = tok;
-                tok = strtok(NULL, " \t\r\n");
-            }
-            argv_exec[ai] = NULL;
-
-            // if statements to redirect stdout and stderr to the client socket
-            if (dup2(fd, STDOUT_FILENO) < 0) { perror("dup2 stdout"); close(fd); exit(1); }
-            if (dup2(fd, STDERR_FILENO) < 0) { perror("dup2 stderr"); close(fd); exit(1); }
-            close(fd);
-
-            execvp("ls", argv_exec);
-            
-            perror("execvp");
-            exit(1);
-        } else {
-            
-            close(fd);
-            
-        }
+        queue_push(fd);
     }
 
     close(srv);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,252 @@
+// Buffered TCP connections for the protocol client libraries; see net.h.
+
+#include "net.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int net_dial(const char *host, int port) {
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port   = htons((uint16_t)port);
+
+    if (inet_pton(AF_INET, host, &sa.sin_addr) <= 0) {
+        perror("inet_pton");
+        close(s);
+        return -1;
+    }
+
+    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        perror("connect");
+        close(s);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return s;
+}
+
+void net_init(net_t *n, int fd) {
+    n->fd = fd;
+    n->in_pos = n->in_len = 0;
+    n->out_len = 0;
+}
+
+void net_close(net_t *n) {
+    if (n->fd >= 0) {
+        close(n->fd);
+    }
+    n->fd = -1;
+    n->in_pos = n->in_len = 0;
+    n->out_len = 0;
+}
+
+// write exactly len bytes from buf to the socket
+static int send_all(int fd, const void *buf, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = send(fd, (const char *)buf + off, len - off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue; // interrupted by signal, retry
+            }
+            return -1;
+        }
+        off += (size_t)w;
+    }
+    return 0;
+}
+
+int net_flush(net_t *n) {
+    if (n->out_len == 0) {
+        return 0;
+    }
+    size_t len = n->out_len;
+    n->out_len = 0;
+    return send_all(n->fd, n->out, len);
+}
+
+int net_put(net_t *n, const void *buf, size_t len) {
+    if (n->out_len + len > NET_BUFSZ && net_flush(n) < 0) {
+        return -1;
+    }
+    if (len > NET_BUFSZ) {
+        // too big to buffer: straight out, behind what was queued
+        return send_all(n->fd, buf, len);
+    }
+    memcpy(n->out + n->out_len, buf, len);
+    n->out_len += len;
+    return 0;
+}
+
+int net_putf(net_t *n, const char *fmt, ...) {
+    char buf[NET_BUFSZ];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0 || (size_t)len >= sizeof(buf)) {
+        return -1;
+    }
+    return net_put(n, buf, (size_t)len);
+}
+
+// refill the input buffer with one recv(), sending queued output first
+// since the peer may be waiting for it; returns bytes buffered, 0, or -1
+static ssize_t fill(net_t *n) {
+    if (net_flush(n) < 0) {
+        return -1;
+    }
+    for (;;) {
+        ssize_t r = recv(n->fd, n->in, NET_BUFSZ, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r > 0) {
+            n->in_pos = 0;
+            n->in_len = (size_t)r;
+        }
+        return r;
+    }
+}
+
+ssize_t net_read(net_t *n, void *buf, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        size_t avail = n->in_len - n->in_pos;
+        if (avail > 0) {
+            size_t take = (len - off < avail) ? len - off : avail;
+            memcpy((char *)buf + off, n->in + n->in_pos, take);
+            n->in_pos += take;
+            off += take;
+            continue;
+        }
+        ssize_t r;
+        if (len - off >= NET_BUFSZ) {
+            // big payload: receive straight into the destination
+            if (net_flush(n) < 0) {
+                return -1;
+            }
+            r = recv(n->fd, (char *)buf + off, len - off, 0);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r > 0) {
+                off += (size_t)r;
+                continue;
+            }
+        } else {
+            r = fill(n);
+            if (r > 0) {
+                continue;
+            }
+        }
+        return r; // 0 on EOF, -1 on error
+    }
+    return (ssize_t)len;
+}
+
+ssize_t net_line(net_t *n, char *out, size_t max) {
+    size_t off = 0;
+    while (off + 1 < max) {
+        if (n->in_pos == n->in_len) {
+            ssize_t r = fill(n);
+            if (r == 0) {
+                break;        // EOF: return what there is
+            }
+            if (r < 0) {
+                return -1;
+            }
+        }
+        unsigned char *start = n->in + n->in_pos;
+        size_t take = n->in_len - n->in_pos;
+        if (take > max - 1 - off) {
+            take = max - 1 - off;
+        }
+        unsigned char *nl = memchr(start, '\n', take);
+        if (nl) {
+            take = (size_t)(nl - start) + 1;
+        }
+        memcpy(out + off, start, take);
+        n->in_pos += take;
+        off += take;
+        if (nl) {
+            break;
+        }
+    }
+    out[off] = '\0';
+    return (ssize_t)off;
+}
+
+int net_getc(net_t *n) {
+    if (n->in_pos == n->in_len && fill(n) <= 0) {
+        return -1;
+    }
+    return n->in[n->in_pos++];
+}
+
+long net_num(net_t *n) {
+    long v = 0;
+    int digits = 0;
+    for (;;) {
+        int c = net_getc(n);
+        if (c < 0) {
+            return -1;
+        }
+        if (c == ' ') {
+            break;
+        }
+        if (c < '0' || c > '9') {
+            return -1;
+        }
+        v = v * 10 + (c - '0');
+        digits++;
+    }
+    return digits ? v : -1;
+}
+
+int net_skip(net_t *n, size_t len) {
+    while (len > 0) {
+        if (n->in_pos == n->in_len && fill(n) <= 0) {
+            return -1;
+        }
+        size_t take = n->in_len - n->in_pos;
+        if (take > len) {
+            take = len;
+        }
+        n->in_pos += take;
+        len -= take;
+    }
+    return 0;
+}
+
+ssize_t net_some(net_t *n, void *buf, size_t max) {
+    if (n->in_pos == n->in_len) {
+        ssize_t r = fill(n);
+        if (r <= 0) {
+            return r;
+        }
+    }
+    size_t take = n->in_len - n->in_pos;
+    if (take > max) {
+        take = max;
+    }
+    memcpy(buf, n->in + n->in_pos, take);
+    n->in_pos += take;
+    return (ssize_t)take;
+}
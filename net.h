@@ -0,0 +1,65 @@
+// Buffered TCP connections for the disk and filesystem protocol clients
+// (libdisk and libfs; see libdisk.h and libfs.h).
+//
+// Output is collected in a per-connection buffer and sent with a single
+// send() when the caller flushes, when the buffer fills up, or when the
+// caller next waits for input, so a client that issues several requests
+// before reading a reply sends them together.  Input is read with large
+// recv() calls and parsed out of a buffer instead of a byte at a time.
+//
+// Every call returns -1 on a connection error; reads return 0 on EOF.
+
+#ifndef NET_H
+#define NET_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define NET_BUFSZ 16384       // size of each of the input and output buffers
+
+typedef struct {
+    int    fd;
+    size_t in_pos, in_len;    // unread input is in[in_pos .. in_len)
+    size_t out_len;           // queued output is out[0 .. out_len)
+    unsigned char in[NET_BUFSZ];
+    unsigned char out[NET_BUFSZ];
+} net_t;
+
+// connect to host:port (dotted IPv4) with TCP_NODELAY set, since output
+// is coalesced here; returns the socket, or -1 after printing the error
+int net_dial(const char *host, int port);
+
+// wrap an open socket / close it (a closed net_t has fd -1)
+void net_init(net_t *n, int fd);
+void net_close(net_t *n);
+
+// queue len bytes, or printf-style text, for sending
+int net_put(net_t *n, const void *buf, size_t len);
+int net_putf(net_t *n, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// send everything queued
+int net_flush(net_t *n);
+
+// read exactly len bytes; returns len, 0 on EOF, or -1
+ssize_t net_read(net_t *n, void *buf, size_t len);
+
+// read one line including its '\n' (at most max - 1 bytes, always
+// NUL-terminated); returns its length, 0 on EOF, or -1
+ssize_t net_line(net_t *n, char *out, size_t max);
+
+// read one byte; returns it, or -1 on EOF or error
+int net_getc(net_t *n);
+
+// read a decimal number ended by a single space (the "code len " of an
+// FS reply); returns it, or -1 on EOF, error or a malformed number
+long net_num(net_t *n);
+
+// discard len bytes; returns 0 or -1
+int net_skip(net_t *n, size_t len);
+
+// for replies without framing: whatever input is buffered, or else the
+// bytes one recv() delivers (at most max); returns the count, 0 on EOF,
+// or -1
+ssize_t net_some(net_t *n, void *buf, size_t max);
+
+#endif
@@ -1,6 +1,19 @@
 /* This program implements a TCP server that listens on a specified port for incoming connections.
-It accepts the connection and makes a new thread to handle the client server.
+It accepts the connection and hands it to a fixed pool of worker threads.
 The string it gets from tthe client the server reveres and returns to the client.
+
+A connection is kept open after the first reply: every newline-terminated line
+the client sends is reversed and echoed until the client closes it (or stays
+idle for IDLE_TIMEOUT_S seconds).  Accepted connections wait in a bounded queue;
+when it is full the accept loop stops accepting, so excess clients wait in the
+kernel listen backlog instead of piling up as threads.
+
+Usage: ./server [-w workers] [-b queue_len] [-d delay_ms] [-q] <port>
+  -w  number of worker threads (default 8)
+  -b  accepted connections that may wait for a worker (default 64)
+  -d  simulated work per connection before it is served (default 2000 ms,
+      which demonstrates DoS effects; use -d 0 to measure the server itself)
+  -q  do not log each connection
 */
 
 #include <stdio.h>
@@ -11,9 +24,15 @@ The string it gets from tthe client the server reveres and returns to the client
 #include <pthread.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 #define BACKLOG 16      // max pending connections in listen queue
 #define BUF_SIZE 4096   // buffer size for each client request
+#define IDLE_TIMEOUT_S 30 // close a keep-alive connection idle this long
+
+static int g_delay_ms = 2000; // -d
+static int g_quiet = 0;       // -q
 
 // helper: print an error message and exit on fatal errors in main thread
 static void fatal(const char *msg) {
@@ -21,11 +40,54 @@ static void fatal(const char *msg) {
     exit(EXIT_FAILURE);
 }
 
-// struct passed to each worker thread containing the client fd and address
+// bounded FIFO of accepted client fds shared by the accept loop (producer)
+// and the workers (consumers)
 typedef struct {
-    int client_fd;
-    struct sockaddr_in addr;
-} client_arg_t;
+    int *fds;
+    int cap, head, len;
+    pthread_mutex_t mtx;
+    pthread_cond_t not_empty, not_full;
+} conn_queue_t;
+
+static conn_queue_t g_queue;
+
+static void queue_init(conn_queue_t *q, int cap) {
+    q->fds = malloc(sizeof(int) * (size_t)cap);
+    if (!q->fds) {
+        fatal("malloc");
+    }
+    q->cap = cap;
+    q->head = q->len = 0;
+    pthread_mutex_init(&q->mtx, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+// add fd, waiting while the queue is full (this is the backpressure)
+static void queue_push(conn_queue_t *q, int fd) {
+    pthread_mutex_lock(&q->mtx);
+    while (q->len == q->cap) {
+        pthread_cond_wait(&q->not_full, &q->mtx);
+    }
+    q->fds[(q->head + q->len) % q->cap] = fd;
+    q->len++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mtx);
+}
+
+// take the oldest fd, waiting while the queue is empty
+static int queue_pop(conn_queue_t *q) {
+    pthread_mutex_lock(&q->mtx);
+    while (q->len == 0) {
+        pthread_cond_wait(&q->not_empty, &q->mtx);
+    }
+    int fd = q->fds[q->head];
+    q->head = (q->head + 1) % q->cap;
+    q->len--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mtx);
+    return fd;
+}
 
 // reverse a string in place, using indices [0, n)
 static void reverse_inplace(char *s, ssize_t n) {
@@ -39,74 +101,144 @@ static void reverse_inplace(char *s, ssize_t n) {
     }
 }
 
-// thread entry point for each client connection
-static void *thread_main(void *arg) {
-    client_arg_t *ca = (client_arg_t *)arg;
-    int fd = ca->client_fd;
-    free(ca); // we no longer need the struct; only the fd is required
+// send all n bytes of buf, handling partial sends; returns 0 or -1
+static int send_all(int fd, const char *buf, size_t n) {
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t s = send(fd, buf + sent, n - sent, MSG_NOSIGNAL);
+        if (s <= 0) {
+            // if send fails, log the error (if any) and give up on the client
+            if (s < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("send");
+            }
+            return -1;
+        }
+        sent += (size_t)s;
+    }
+    return 0;
+}
 
+// reverse the line in buf[0, n) (without its newline, if any) and send it
+// back followed by a newline
+static int reply_line(int fd, char *buf, size_t n) {
+    if (n > 0 && buf[n - 1] == '\n') {
+        --n;
+    }
+    reverse_inplace(buf, (ssize_t)n);
+    buf[n] = '\n';
+    return send_all(fd, buf, n + 1);
+}
+
+// serve one client connection until it closes: reverse every line it sends
+static void serve_client(int fd) {
     // this printf is just for debugging/visualization:
     // every new connection will print the thread id and client fd
     // the sleep simulates extra work / slowdown to demonstrate DoS effects
-    printf("Thread %lu started for client fd=%d\n", pthread_self(), fd);
-    sleep(2);
-
-    // receives data from the client, reverses the string, and sends it back
-    char buf[BUF_SIZE];
-    ssize_t r = recv(fd, buf, sizeof(buf) - 1, 0);
-    if (r <= 0) {
-        // If r == 0 the client closed the connection; if r < 0 an error occurred
-        if (r < 0) {
-            perror("recv");
-        }
-        close(fd);
-        return NULL;
+    if (!g_quiet) {
+        printf("Thread %lu serving client fd=%d\n", pthread_self(), fd);
     }
-
-    // if statement checks if the last character received is a newline
-    // and removes it before reversing
-    // buf[r] makes sure the string is null-terminated before reversing
-    if (buf[r - 1] == '\n') {
-        --r;
+    if (g_delay_ms > 0) {
+        usleep((useconds_t)g_delay_ms * 1000);
     }
-    buf[r] = '\0';
-
-    // reverse the string in place
-    reverse_inplace(buf, r);
 
-    // add a newline back to the reversed string
-    strncat(buf, "\n", sizeof(buf) - strlen(buf) - 1);
+    // a keep-alive client that goes quiet must not hold a worker forever
+    struct timeval tv = { IDLE_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-    // send the reversed string back to the client, handling partial sends
-    ssize_t tosend = strlen(buf);
-    ssize_t sent = 0;
-    while (sent < tosend) {
-        ssize_t s = send(fd, buf + sent, tosend - sent, 0);
-        if (s <= 0) {
-            // if send fails, log the error (if any) and break out of the loop
-            if (s < 0) {
-                perror("send");
+    // buf[0, len) holds received bytes not answered yet; one byte is kept
+    // free so a line can always be followed by its newline
+    char buf[BUF_SIZE];
+    size_t len = 0;
+    for (;;) {
+        ssize_t r = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            // If r == 0 the client closed the connection; if r < 0 an error
+            // occurred or it was idle too long
+            if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("recv");
             }
+            // a last line without a newline is still answered
+            if (r == 0 && len > 0) {
+                reply_line(fd, buf, len);
+            }
+            break;
+        }
+        len += (size_t)r;
+
+        // answer every complete line, then keep the partial tail
+        size_t start = 0;
+        char *nl;
+        int ok = 1;
+        while (ok && (nl = memchr(buf + start, '\n', len - start)) != NULL) {
+            size_t n = (size_t)(nl - (buf + start)) + 1;
+            ok = reply_line(fd, buf + start, n) == 0;
+            start += n;
+        }
+        if (!ok) {
             break;
         }
-        sent += s;
+        memmove(buf, buf + start, len - start);
+        len -= start;
+
+        // a line longer than the buffer is answered in buffer-sized pieces
+        if (len == sizeof(buf) - 1) {
+            if (reply_line(fd, buf, len) < 0) {
+                break;
+            }
+            len = 0;
+        }
     }
 
     close(fd);
+}
+
+// worker thread: serve queued connections one after another
+static void *worker_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        serve_client(queue_pop(&g_queue));
+    }
     return NULL;
 }
 
 // main function that sets up the server, listens for incoming connections,
-// and creates threads to handle each client
+// starts the worker pool and queues each client for it
 // it uses if and while statements to handle errors during socket creation,
 // binding, listening, and accepting connections
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    int workers = 8;
+    int queue_len = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:b:d:q")) != -1) {
+        if (opt == 'w' && (workers = atoi(optarg)) > 0) {
+            continue;
+        }
+        if (opt == 'b' && (queue_len = atoi(optarg)) > 0) {
+            continue;
+        }
+        if (opt == 'd' && (g_delay_ms = atoi(optarg)) >= 0) {
+            continue;
+        }
+        if (opt == 'q') {
+            g_quiet = 1;
+            continue;
+        }
+        argc = 0; // force the usage message
+        break;
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-w workers] [-b queue_len] [-d delay_ms] [-q] <port>\n", argv[0]);
         return 1;
     }
 
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
     if (port <= 0) {
         fprintf(stderr, "Invalid port\n");
         return 1;
@@ -140,43 +272,42 @@ int main(int argc, char **argv) {
         fatal("listen");
     }
 
-    printf("Server listening on port %d\n", port);
-
-    // main accept loop: each accepted client gets its own thread
-    while (1) {
-        client_arg_t *ca = malloc(sizeof(*ca));
-        if (!ca) {
-            // if malloc fails, close and bail out
-            fatal("malloc");
+    // the workers are created once; connections never start a thread
+    queue_init(&g_queue, queue_len);
+    for (int i = 0; i < workers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_main, NULL) != 0) {
+            fatal("pthread_create");
         }
+        // detach the thread so we don't have to pthread_join() it later
+        pthread_detach(tid);
+    }
 
-        socklen_t len = sizeof(ca->addr);
-        ca->client_fd = accept(srv, (struct sockaddr *)&ca->addr, &len);
-        if (ca->client_fd < 0) {
+    printf("Server listening on port %d (%d workers, queue %d)\n", port, workers, queue_len);
+
+    // main accept loop: each accepted client is queued for the next free worker
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept(srv, (struct sockaddr *)&addr, &len);
+        if (fd < 0) {
             // accept failed; log and retry
-            perror("accept");
-            free(ca);
+            if (errno != EINTR) {
+                perror("accept");
+            }
             continue;
         }
 
         // display which client connected (for debugging)
-        char addr_str[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &ca->addr.sin_addr, addr_str, sizeof(addr_str));
-        printf("Accepted connection from %s:%d (fd=%d)\n",
-               addr_str, ntohs(ca->addr.sin_port), ca->client_fd);
-
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, thread_main, ca) != 0) {
-            // if fails to create a thread for this client,
-            // close its socket and free the argument struct
-            perror("pthread_create");
-            close(ca->client_fd);
-            free(ca);
-            continue;
+        if (!g_quiet) {
+            char addr_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr.sin_addr, addr_str, sizeof(addr_str));
+            printf("Accepted connection from %s:%d (fd=%d)\n",
+                   addr_str, ntohs(addr.sin_port), fd);
         }
 
-        // detach the thread so we don't have to pthread_join() it later
-        pthread_detach(tid);
+        // blocks while every queue slot is taken
+        queue_push(&g_queue, fd);
     }
 
     close(srv);
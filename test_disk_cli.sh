@@ -12,7 +12,7 @@ BACKING_FILE="disk_cli.img"
 
 echo "Compiling disk_server and disk_cli..."
 $CC $CFLAGS -o disk_server disk_server.c
-$CC $CFLAGS -o disk_cli    disk_cli.c
+$CC $CFLAGS -o disk_cli    disk_cli.c net.c
 
 echo
 echo "=========== DISK CLI NEGATIVE TESTS ==========="
@@ -12,7 +12,7 @@ BACKING_FILE="disk_rand.img"
 
 echo "Compiling disk_server and disk_rand..."
 $CC $CFLAGS -o disk_server disk_server.c
-$CC $CFLAGS -o disk_rand   disk_rand.c
+$CC $CFLAGS -pthread -o disk_rand   disk_rand.c bench.c libdisk.c net.c -lm
 
 echo
 echo "=========== DISK RAND NEGATIVE TESTS ==========="
@@ -58,6 +58,14 @@ echo
 echo "6) Larger random workload (N=256, seed=5678):"
 ./disk_rand 127.0.0.1 "$PORT" 256 5678
 
+echo
+echo "7) Benchmark mode (4 threads, 30% writes, zipfian sectors, CSV report):"
+./disk_rand -t 4 -w 30 -p zipf -o csv 127.0.0.1 "$PORT" 400 42
+
+echo
+echo "8) Open loop at 200 ops/s on a hot cylinder band for 1 s, after a 0.5 s warmup:"
+./disk_rand -t 2 -r 200 -p hot:10,90 -W 0.5 -d 1 127.0.0.1 "$PORT" 0 7
+
 echo
 echo "Stopping disk_server (SIGTERM)..."
 kill "$SERVER_PID" 2>/dev/null || true
@@ -12,8 +12,8 @@ BACKING_FILE="disk.img"
 
 echo "Compiling disk_server, disk_cli, and disk_rand..."
 $CC $CFLAGS -o disk_server disk_server.c
-$CC $CFLAGS -o disk_cli    disk_cli.c
-$CC $CFLAGS -o disk_rand   disk_rand.c
+$CC $CFLAGS -o disk_cli    disk_cli.c net.c
+$CC $CFLAGS -pthread -o disk_rand disk_rand.c bench.c libdisk.c net.c -lm
 
 echo
 echo "=========== DISK SERVER NEGATIVE TESTS ==========="
@@ -75,11 +75,52 @@ echo
 echo "8) Exercise concurrent access using disk_rand (short run):"
 ./disk_rand 127.0.0.1 "$PORT" 64 12345
 
+echo
+echo "9) Runtime statistics (S command) after the traffic above:"
+./disk_cli 127.0.0.1 "$PORT" <<EOF
+S
+EOF
+
 echo
 echo "Stopping disk_server (SIGTERM)..."
 kill "$SERVER_PID" 2>/dev/null || true
 wait "$SERVER_PID" 2>/dev/null || true
 
+echo
+echo "10) Same image on the other storage backends: read back block 0 0 from step 6,"
+echo "    then write and read through each (pio and direct sync every write):"
+for BACKEND in "pio -s always" "direct -s always" "uring"; do
+  echo "-- backend $BACKEND"
+  ./disk_server -b $BACKEND "$PORT" "$CYL" "$SEC" "$TRACK_US" "$BACKING_FILE" &
+  SERVER_PID=$!
+  sleep 1
+  ./disk_cli 127.0.0.1 "$PORT" <<EOF
+R 0 0
+W 9 19 3
+xyz
+R 9 19
+EOF
+  kill "$SERVER_PID" 2>/dev/null || true
+  wait "$SERVER_PID" 2>/dev/null || true
+done
+
+echo
+echo "11) Two independent arms (-k 2), one per half of the cylinders: block 0 0"
+echo "    and 9 19 lie in different zones; each arm reports its own zone and seeks:"
+./disk_server -k 2 -p look "$PORT" "$CYL" "$SEC" "$TRACK_US" "$BACKING_FILE" &
+SERVER_PID=$!
+sleep 1
+./disk_cli 127.0.0.1 "$PORT" <<EOF
+R 0 0
+R 9 19
+EOF
+./disk_rand -t 4 127.0.0.1 "$PORT" 64 777
+./disk_cli 127.0.0.1 "$PORT" <<EOF | grep '^arm[0-9s]'
+S
+EOF
+kill "$SERVER_PID" 2>/dev/null || true
+wait "$SERVER_PID" 2>/dev/null || true
+
 echo
 echo "=========== DISK SERVER TESTS COMPLETE ==========="
 
@@ -0,0 +1,78 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+CC=gcc
+CFLAGS="-Wall -Wextra -g"
+
+# Ports and files
+DISK_PORT=5610
+FS_PORT=5611
+DISK_IMG="fs_bench.img"
+
+echo "Compiling disk_server, fs_server, and fs_bench..."
+$CC $CFLAGS -pthread -o disk_server disk_server.c
+$CC $CFLAGS -pthread -o fs_server fs_server.c libdisk.c net.c
+$CC $CFLAGS -pthread -o fs_bench  fs_bench.c bench.c libfs.c libdisk.c net.c -lm
+
+echo
+echo "=========== FS BENCH NEGATIVE TESTS ==========="
+
+echo
+echo "1) Missing arguments (should print usage and exit non-zero):"
+if ./fs_bench ; then
+  echo "!! ERROR: fs_bench returned success but should have failed"
+else
+  echo "-- OK: fs_bench failed as expected (missing args)"
+fi
+
+echo
+echo "2) Bad op mix (should print usage and exit non-zero):"
+if ./fs_bench -m X=5 127.0.0.1 "$FS_PORT" ; then
+  echo "!! ERROR: fs_bench accepted an unknown op"
+else
+  echo "-- OK: fs_bench rejected the mix"
+fi
+
+echo
+echo "3) Connection failure (no server listening):"
+if ./fs_bench -d 1 127.0.0.1 "$FS_PORT" ; then
+  echo "!! ERROR: fs_bench reported success when connect should fail"
+else
+  echo "-- OK: fs_bench handled connect() failure"
+fi
+
+echo
+echo "=========== STARTING DISK + FS SERVER =========="
+
+./disk_server "$DISK_PORT" 128 128 10 "$DISK_IMG" &
+DISK_PID=$!
+sleep 1
+./fs_server "$FS_PORT" 127.0.0.1 "$DISK_PORT" &
+FS_PID=$!
+sleep 1
+
+echo
+echo "=========== FS BENCH FUNCTIONAL TESTS ========="
+
+echo
+echo "4) Format, then the default mix on 8 connections for 2 s, with the disk probe:"
+./fs_bench -F -d 2 -s 128-8192 -D 127.0.0.1:"$DISK_PORT" 127.0.0.1 "$FS_PORT"
+
+echo
+echo "5) Every op type, small files, 4 connections, 1 s warmup + 2 s, CSV report:"
+./fs_bench -c 4 -m C=5,W=20,R=40,D=5,L=5,RR=15,A=10 -s 0,100,5000 -W 1 -d 2 -o csv 127.0.0.1 "$FS_PORT"
+
+echo
+echo "6) Read-heavy JSON report:"
+./fs_bench -c 2 -m W=10,R=90 -s 1000 -d 1 -o json 127.0.0.1 "$FS_PORT"
+
+echo
+echo "=========== STOPPING SERVERS ==========="
+
+kill "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+kill "$DISK_PID" 2>/dev/null || true
+wait "$DISK_PID" 2>/dev/null || true
+
+echo
+echo "=========== FS BENCH TESTS COMPLETE =========="
@@ -99,5 +99,106 @@ exit
 EOF
 echo
 
+echo "9) Files inside directories, listings and relative paths (expect rmdir 'not empty', then success):"
+./fs_dirs 127.0.0.1 "$FS_PORT" <<EOF
+mkdir a
+mkdir a/b
+cd a/b
+pwd
+cd ../..
+pwd
+exit
+EOF
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+C a/b/notes
+L 1 a/b
+L 0 a
+EOF
+./fs_dirs 127.0.0.1 "$FS_PORT" <<EOF
+ls a
+stat a/b/notes
+stat a/x/notes
+rmdir a/b
+rmdir a/b/notes
+exit
+EOF
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+D a/b/notes
+RD a/b
+RD a
+C done
+L 1
+D done
+EOF
+echo
+
+echo "10) Grow a subdirectory past its first cluster (two entries per sector, one-sector"
+echo "    clusters): 20 files in big/, then restart fs_server and read them all back:"
+{
+    echo "MD big"
+    for i in $(seq 1 20); do echo "C big/f$i"; done
+    for i in $(seq 1 20); do printf 'W big/f%d 6\nfile%02d' "$i" "$i"; done
+} | ./fs_cli 127.0.0.1 "$FS_PORT" > /dev/null
+kill "$FS_SERVER_PID" 2>/dev/null || true
+wait "$FS_SERVER_PID" 2>/dev/null || true
+./fs_server "$FS_PORT" 127.0.0.1 "$DISK_PORT" &
+FS_SERVER_PID=$!
+sleep 1
+listed=$(./fs_cli 127.0.0.1 "$FS_PORT" <<< "L 0 big" | grep -c '^f[0-9]*$' || true)
+got=$(for i in $(seq 1 20); do echo "R big/f$i"; done | ./fs_cli 127.0.0.1 "$FS_PORT" | tr -d '\n')
+want=$(for i in $(seq 1 20); do printf '0 6 file%02d' "$i"; done)
+if [[ "$listed" == 20 && "$got" == "$want" ]]; then
+    echo "-- OK: all 20 entries listed and read back after the restart"
+else
+    echo "!! ERROR: listed $listed entries; read back: $got"
+fi
+./fs_cli 127.0.0.1 "$FS_PORT" <<< "S big"
+echo
+
+echo "11) ls of an empty directory, by name and as the current directory (expect no"
+echo "    entries, and mkdir/pwd still answered behind them):"
+out=$(timeout 10 ./fs_dirs 127.0.0.1 "$FS_PORT" <<EOF
+mkdir e
+ls e
+cd e
+ls
+mkdir sub
+pwd
+ls
+exit
+EOF
+)
+rc=$?
+echo "$out"
+if [[ $rc == 0 && "$out" == *"/e"* && "$out" == *"sub/"* ]]; then
+    echo "-- OK: empty listings ended and the next commands got their own replies"
+else
+    echo "!! ERROR: fs_dirs exited with $rc"
+fi
+echo
+
+echo "12) ls of a listing larger than one read (400 entries with long names, over 8 KB),"
+echo "    then mkdir on the same connection (expect no 'unexpected response'):"
+{
+    echo "MD many"
+    for i in $(seq -w 1 400); do echo "C many/a_long_name_to_fill_the_$i"; done
+} | ./fs_cli 127.0.0.1 "$FS_PORT" > /dev/null
+out=$(timeout 20 ./fs_dirs 127.0.0.1 "$FS_PORT" 2>&1 <<EOF
+ls many
+mkdir zz
+ls zz
+exit
+EOF
+)
+rc=$?
+listed=$(grep -c 'a_long_name_to_fill_the_[0-9]*$' <<< "$out")
+if [[ $rc == 0 && "$listed" == 400 && "$out" != *unexpected* ]]; then
+    echo "-- OK: all 400 entries listed, mkdir zz answered cleanly"
+else
+    echo "!! ERROR: fs_dirs exited with $rc, listed $listed entries:"
+    grep -v 'a_long_name' <<< "$out"
+fi
+echo
+
 echo "=========== FS_DIRS TESTS COMPLETE =========="
 
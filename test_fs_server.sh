@@ -11,8 +11,8 @@ DISK_IMG="fs_disk.img"
 
 echo "Compiling disk_server, fs_server, and fs_cli..."
 $CC $CFLAGS -pthread -o disk_server disk_server.c
-$CC $CFLAGS -o fs_server fs_server.c
-$CC $CFLAGS -o fs_cli    fs_cli.c
+$CC $CFLAGS -o fs_server fs_server.c libdisk.c net.c
+$CC $CFLAGS -o fs_cli    fs_cli.c libfs.c net.c
 
 echo
 echo "=========== FS SERVER NEGATIVE TESTS ==========="
@@ -100,6 +100,205 @@ W qux 3
 abc
 EOF
 
+echo
+echo "12) Append, ranged write and ranged read (A foo, WR foo, RR foo):"
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+A foo 6
+ Bye!
+WR foo 19 5
+bye!
+RR foo 7 10
+R foo
+EOF
+
+echo
+echo "13) Tracing timers for the commands above (T):"
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+T
+EOF
+
+echo
+echo "14) Reformat with 4-sector clusters and a 200-entry directory (F 4 200), reuse it;"
+echo "    a layout that leaves no room for data (F 1 999999) is refused with 2:"
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+F 4 200
+C big
+W big 24
+spans the first cluster
+A big 5
+ end
+R big
+F 1 999999
+L 1
+EOF
+echo "    Then a file over 3 clusters of 4 sectors: W 1500 bytes, WR across a cluster"
+echo "    boundary, A 700 more (into a 5th cluster), and R / RR it back byte for byte:"
+data=$(printf 'clu%04d ' $(seq 1 188) | head -c 1500)
+more=$(printf 'app%04d ' $(seq 1 88) | head -c 700)
+want="${data:0:500}ZZZZZZZZZZZZZZZZZZZZ${data:520}$more"
+out=$(printf 'C multi\nW multi %d\n%sWR multi 500 20\nZZZZZZZZZZZZZZZZZZZZA multi %d\n%sR multi\nRR multi 1000 1000\nS multi\n' \
+      "${#data}" "$data" "${#more}" "$more" | ./fs_cli 127.0.0.1 "$FS_PORT" 2>/dev/null)
+echo "$out" | tail -n 1
+if [[ $(echo "$out" | grep -cxF "0 ${#want} $want") == 1 && $(echo "$out" | grep -cxF "0 1000 ${want:1000:1000}") == 1 ]]; then
+  echo "-- OK: the multi-cluster file reads back byte for byte"
+else
+  echo "!! ERROR: the multi-cluster file came back different"
+fi
+
+echo
+echo "15) Journaled format (F 1 64 32): kill fs_server with SIGKILL after a write,"
+echo "    restart it and read the file back (the journal is replayed at mount):"
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+F 1 64 32
+C kept
+W kept 15
+survives a kill
+EOF
+kill -9 "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+./fs_server "$FS_PORT" 127.0.0.1 "$DISK_PORT" &
+FS_PID=$!
+sleep 1
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+R kept
+L 1
+EOF
+
+echo
+echo "16) Inline data (F 1 64 32 40): files of up to 40 bytes live in their directory"
+echo "    entry (S shows first -1), survive a restart, and move to blocks when they grow:"
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+F 1 64 32 40
+C tiny
+C grows
+W tiny 12
+inline data
+W grows 11
+0123456789
+A grows 45
+ takes this file past the inline limit of 40
+S tiny grows
+EOF
+kill -9 "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+./fs_server "$FS_PORT" 127.0.0.1 "$DISK_PORT" &
+FS_PID=$!
+sleep 1
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+R tiny
+RR tiny 7 4
+R grows
+F 1 64 32 85
+EOF
+
+echo
+echo "17) Stripe over three disk servers: the one-server filesystem is not mounted"
+echo "    (unformatted until F), then a file spanning all three is written and read back:"
+./disk_server "$((DISK_PORT + 10))" 16 32 1000 "$DISK_IMG.1" &
+NODE1_PID=$!
+./disk_server "$((DISK_PORT + 11))" 16 32 1000 "$DISK_IMG.2" &
+NODE2_PID=$!
+sleep 1
+kill "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+./fs_server "$FS_PORT" 127.0.0.1 "$DISK_PORT" 127.0.0.1 "$((DISK_PORT + 10))" 127.0.0.1 "$((DISK_PORT + 11))" &
+FS_PID=$!
+sleep 1
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+L 0
+F
+C wide
+W wide 400
+$(printf 'striped%.0s' $(seq 1 57))
+RR wide 385 14
+L 1
+EOF
+
+echo
+echo "18) Mirror the two extra servers (-R 2), write, and read back:"
+kill "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+./fs_server -R 2 "$FS_PORT" 127.0.0.1 "$((DISK_PORT + 10))" 127.0.0.1 "$((DISK_PORT + 11))" &
+FS_PID=$!
+sleep 1
+./fs_cli 127.0.0.1 "$FS_PORT" <<EOF
+F
+C twin
+W twin 12
+on both too
+R twin
+EOF
+kill "$NODE1_PID" "$NODE2_PID" 2>/dev/null || true
+wait "$NODE1_PID" "$NODE2_PID" 2>/dev/null || true
+rm -f "$DISK_IMG.1" "$DISK_IMG.2"
+
+echo
+echo "19) ARC sector cache (-c 64,arc): W, WR and A of a 38-block file, then R twice;"
+echo "    R must see every change and the second R is served from the cache:"
+kill "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+./fs_server -c 64,arc "$FS_PORT" 127.0.0.1 "$DISK_PORT" &
+FS_PID=$!
+sleep 1
+data=$(printf 'arc%04d ' $(seq 1 600))
+want="${data:0:100}XXXXX${data:105}tail"
+out=$({ printf 'F\nC c\nW c %d\n%sWR c 100 5\nXXXXXA c 4\ntailR c\nR c\nS\n' "${#data}" "$data"; } | ./fs_cli 127.0.0.1 "$FS_PORT" 2>/dev/null)
+echo "$out" | grep '^cache_'
+if [[ $(echo "$out" | grep -cxF "0 ${#want} $want") == 2 && $(echo "$out" | sed -n 's/^cache_hits //p') -ge 38 ]]; then
+  echo "-- OK: R matches W+WR+A byte for byte and hit the cache"
+else
+  echo "!! ERROR: R after W/WR/A under -c 64,arc returned something else"
+fi
+
+echo
+echo "20) Write-back cache (-c 64,wb): W, WR and A stay dirty in the cache, SIGTERM writes"
+echo "    them back, and an uncached fs_server reads them from the disk:"
+kill "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+./fs_server -c 64,wb "$FS_PORT" 127.0.0.1 "$DISK_PORT" &
+FS_PID=$!
+sleep 1
+data=$(printf 'wb%05d ' $(seq 1 600))
+want="${data:0:200}YYYYY${data:205}more"
+out=$({ printf 'F\nC w\nW w %d\n%sWR w 200 5\nYYYYYA w 4\nmoreR w\nS\n' "${#data}" "$data"; } | ./fs_cli 127.0.0.1 "$FS_PORT" 2>/dev/null)
+echo "$out" | grep '^cache_'
+if [[ $(echo "$out" | grep -cxF "0 ${#want} $want") == 1 ]]; then
+  echo "-- OK: R sees the write-back data"
+else
+  echo "!! ERROR: R under -c 64,wb returned something else"
+fi
+kill -TERM "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+./fs_server -c 0 "$FS_PORT" 127.0.0.1 "$DISK_PORT" &
+FS_PID=$!
+sleep 1
+out=$(printf 'R w\nS\n' | ./fs_cli 127.0.0.1 "$FS_PORT" 2>/dev/null)
+echo "$out" | grep '^cache_hits'
+if [[ $(echo "$out" | grep -cxF "0 ${#want} $want") == 1 ]]; then
+  echo "-- OK: the file survived the SIGTERM flush"
+else
+  echo "!! ERROR: the write-back data did not reach the disk"
+fi
+
+echo
+echo "21) Read-ahead: restart with a cold cache and read a 64-block file with sequential"
+echo "    512-byte RRs; the data must match and readahead_hits in S must go up:"
+data=$(printf 'ra%05d ' $(seq 1 1024))
+printf 'C seq\nW seq %d\n%s' "${#data}" "$data" | ./fs_cli 127.0.0.1 "$FS_PORT" > /dev/null 2>&1
+kill "$FS_PID" 2>/dev/null || true
+wait "$FS_PID" 2>/dev/null || true
+./fs_server "$FS_PORT" 127.0.0.1 "$DISK_PORT" &
+FS_PID=$!
+sleep 1
+out=$({ for off in $(seq 0 512 $(( ${#data} - 1 ))); do echo "RR seq $off 512"; done; echo S; } | ./fs_cli 127.0.0.1 "$FS_PORT" 2>/dev/null)
+echo "$out" | grep '^readahead_'
+got=$(echo "$out" | sed -n 's/^0 512 //p' | tr -d '\n')
+if [[ "$got" == "$data" && $(echo "$out" | sed -n 's/^readahead_hits //p') -gt 0 ]]; then
+  echo "-- OK: sequential RRs returned the file and were served by read-ahead"
+else
+  echo "!! ERROR: sequential RR data or read-ahead counters are wrong"
+fi
+
 echo
 echo "=========== STOPPING SERVERS ==========="
 
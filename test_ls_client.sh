@@ -4,7 +4,7 @@ set -euo pipefail
 PORT=5561
 
 echo "Compiling ls_server and ls_client..."
-gcc -Wall -Wextra -o ls_server ls_server.c
+gcc -Wall -Wextra -pthread -o ls_server ls_server.c
 gcc -Wall -Wextra -o ls_client ls_client.c
 
 echo
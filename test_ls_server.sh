@@ -4,7 +4,7 @@ set -euo pipefail
 PORT=5560
 
 echo "Compiling ls_server and ls_client..."
-gcc -Wall -Wextra -o ls_server ls_server.c
+gcc -Wall -Wextra -pthread -o ls_server ls_server.c
 gcc -Wall -Wextra -o ls_client ls_client.c
 
 echo
@@ -60,11 +60,30 @@ echo "7) Invalid ls option (should show error text coming from server):"
 ./ls_client 127.0.0.1 "${PORT}" --this-option-does-not-exist
 
 echo
-echo "8) Concurrent clients (fork handling and robustness):"
+echo "8) Concurrent clients (worker pool and robustness):"
+CLIENT_PIDS=()
 for i in {1..5}; do
     ./ls_client 127.0.0.1 "${PORT}" -l . &
+    CLIENT_PIDS+=($!)
 done
-wait
+# wait for the clients only; a bare wait would also wait for the server
+wait "${CLIENT_PIDS[@]}"
+
+echo
+echo "9) In-process listing matches forked ls (-x server on port $((PORT + 1))):"
+./ls_server -x "$((PORT + 1))" &
+EXEC_PID=$!
+sleep 1
+for args in "." "-la ." "-lR ." ". .. /nonexistent"; do
+    if cmp -s <(./ls_client 127.0.0.1 "${PORT}" ${args} 2>&1) \
+              <(./ls_client 127.0.0.1 "$((PORT + 1))" ${args} 2>&1); then
+        echo "  same: ls ${args}"
+    else
+        echo "  DIFFERENT: ls ${args}"
+    fi
+done
+kill "${EXEC_PID}" 2>/dev/null || true
+wait "${EXEC_PID}" 2>/dev/null || true
 
 echo
 echo "Stopping ls_server (SIGTERM)..."
@@ -55,10 +55,20 @@ LONG_STR=$(printf 'x%.0s' {1..3000})
 
 echo
 echo "6) Multiple concurrent clients (demonstrate multi-threading & DoS behavior):"
+CLIENT_PIDS=()
 for i in {1..8}; do
     ./client 127.0.0.1 "${PORT}" "message $i from concurrent client" &
+    CLIENT_PIDS+=($!)
 done
-wait
+# wait for the clients only; a bare wait would also wait for the server
+wait "${CLIENT_PIDS[@]}"
+
+echo
+echo "7) Keep-alive: three lines over one connection, one reply per line:"
+exec 3<>"/dev/tcp/127.0.0.1/${PORT}"
+printf 'first line\nsecond line\nthird line\n' >&3
+head -n 3 <&3
+exec 3<&-
 
 echo
 echo "Stopping server (SIGTERM)..."